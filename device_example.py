@@ -1,14 +1,56 @@
+import argparse
 import asyncio
+import ctypes
+import ctypes.util
+import hashlib
+import os
+import socket
+import struct
 import threading
+import time
 import pygame
 from bleak import BleakClient, BleakScanner, BleakError
+import wire  # Generated from main/wire.json by tools/wire_gen.py
 
+SERVICE_UUID = "000000ff-0000-1000-8000-00805f9b34fb"
 CHAR_UUID = "ff01"
 FULL_CHAR_UUID = "0000ff01-0000-1000-8000-00805f9b34fb"
 CALIBRATION_CHAR_UUID = "ff02"
 FULL_CALIBRATION_CHAR_UUID = "0000ff02-0000-1000-8000-00805f9b34fb"
+STATS_CHAR_UUID = "0000ff03-0000-1000-8000-00805f9b34fb"
+OTA_CONTROL_CHAR_UUID = "0000ff04-0000-1000-8000-00805f9b34fb"
+OTA_DATA_CHAR_UUID = "0000ff05-0000-1000-8000-00805f9b34fb"
+CONFIG_CHAR_UUID = "0000ff06-0000-1000-8000-00805f9b34fb"
+RULES_CHAR_UUID = "0000ff07-0000-1000-8000-00805f9b34fb"
+ZONE_STATS_CHAR_UUID = "0000ff08-0000-1000-8000-00805f9b34fb"
+
+# OTA flow control, see main/ota.h; the messages are in wire.py
+OTA_WINDOW_BYTES = 8192
+
+# Notification throughput benchmark, see main/ble.h
+BENCH_PHYS = {"1m": 1, "2m": 2, "coded": 3}
+BENCH_TRANSPORTS = {t.name.lower(): t for t in wire.BenchTransport}
+PHY_NAMES = {0: "none", 1: "1M", 2: "2M", 3: "Coded"}
+
+# LE L2CAP stream channel and capture frames, see main/ble.h and main/capture.h
+L2CAP_PSM = 0x0080
+L2CAP_MTU = 512
+# BlueZ socket options, not all exported by the socket module
+SOL_BLUETOOTH, BT_SECURITY, BT_SECURITY_LOW, BT_SECURITY_MEDIUM, BT_RCVMTU = 274, 4, 1, 2, 13
+BDADDR_LE_PUBLIC, BDADDR_LE_RANDOM = 1, 2
+
+# Raw ATT on the LE fixed channel for --bond-test, which needs to pick the link security itself
+ATT_CID = 4
+ATT_ERROR_RSP, ATT_MTU_REQ, ATT_MTU_RSP = 0x01, 0x02, 0x03
+ATT_READ_BY_TYPE_REQ, ATT_READ_BY_TYPE_RSP, ATT_WRITE_REQ, ATT_WRITE_RSP = 0x08, 0x09, 0x12, 0x13
+ATT_NOTIFICATION, ATT_INDICATION, ATT_CONFIRMATION = 0x1B, 0x1D, 0x1E
+ATT_ERR_AUTHENTICATION, ATT_ERR_ENCRYPTION = 0x05, 0x0F
+ATT_DEFAULT_MTU = 23
+GATT_CHARACTERISTIC_UUID = 0x2803
+CALIBRATION_UUID16 = 0xFF02
 
 DEVICE_NAME = "BLE_Encoder"
+device_id = None  # Short ID to connect to, see --id
 
 # Shared state
 alert_flag = False
@@ -16,6 +58,7 @@ connected_flag = False
 current_zone = "NONE"
 running = True 
 calibration_mode_active = False
+signal_degraded = False
 ble_loop = None 
 ble_client_global = None
 
@@ -56,6 +99,10 @@ def draw_ui(screen, font):
     screen.blit(alert_surface, (20, 100))
     screen.blit(calibration_surface, (20, 150)) 
 
+    if signal_degraded:
+        signal_surface = font.render("ENCODER SIGNAL DEGRADED", True, (255, 120, 0))
+        screen.blit(signal_surface, (20, 200))
+
     # Draw Calibration button
     pygame.draw.rect(screen, (50, 50, 50), (290, 140, 130, 40))
     button_text_color = (255, 255, 255)
@@ -66,25 +113,66 @@ def draw_ui(screen, font):
     pygame.display.flip()
 
 def notification_handler(sender, data):
-    global current_zone
+    global current_zone, signal_degraded
     if not data:
         return
-    if data[0] == 0x01:
+    if data[0] == wire.Frame.ZONE_RED:
         current_zone = "RED"
-    elif data[0] == 0x02:
+    elif data[0] == wire.Frame.ZONE_GREEN:
         current_zone = "GREEN"
-    elif data[0] == 0x03:
+    elif data[0] == wire.Frame.ZONE_YELLOW:
         current_zone = "YELLOW"
-    elif data[0] == 0x04:
+    elif data[0] == wire.Frame.ZERO_SET:
         asyncio.run_coroutine_threadsafe(toggle_calibration_mode(), ble_loop)
+    elif data[0] == wire.Frame.SIGNAL_DEGRADED:
+        signal_degraded = True
+        print("Encoder signal degraded, readings may be unreliable")
+    elif data[0] == wire.Frame.SIGNAL_RECOVERED:
+        signal_degraded = False
+        print("Encoder signal recovered")
+    elif data[0] == wire.Frame.RULE_ALERT:
+        alert = wire.decode_rule_alert(data)
+        print(f"Rule {alert.rule} alert {alert.code}")
     # print(f"Received notification: {data[0]:02x}, current_zone: {current_zone}") # Debugging
     
+def decode_stats(data):
+    """Decode the statistics characteristic into a dict of counters and histograms."""
+    frame = wire.decode_stats(data)
+    if frame.version != wire.STATS_VERSION:
+        raise ValueError(f"Unsupported statistics version {frame.version}")
+
+    stats = {"uptime_s": frame.uptime_s}
+    for counter in wire.StatsCounter:
+        value = frame.counters[counter]
+        signed = counter in wire.STATS_COUNTER_SIGNED and value >= 1 << 31
+        stats[counter.name.lower()] = value - (1 << 32) if signed else value
+    stats["disconnect_reasons"] = {
+        reason.name.lower(): frame.disconnect_reasons[reason] for reason in wire.StatsDisconnect
+    }
+    for name in ("notify_latency_us", "loop_time_us", "encrypt_latency_us"):
+        bounds = getattr(wire, f"STATS_{name.upper()}_BOUNDS")
+        labels = [f"<={b}" for b in bounds] + [f">{bounds[-1]}"]
+        stats[name] = dict(zip(labels, getattr(frame, name)))
+    return stats
+
+async def read_stats():
+    if ble_client_global and ble_client_global.is_connected:
+        try:
+            data = await ble_client_global.read_gatt_char(STATS_CHAR_UUID)
+            for key, value in decode_stats(bytes(data)).items():
+                print(f"  {key}: {value}")
+        except (BleakError, ValueError, struct.error) as e:
+            print(f"Failed to read statistics: {e}")
+    else:
+        print("Not connected to device, cannot read statistics.")
+
 def on_disconnect(client):
-    global connected_flag, current_zone, calibration_mode_active
+    global connected_flag, current_zone, calibration_mode_active, signal_degraded
     print("Device disconnected callback triggered.")
     connected_flag = False
     current_zone = "NONE"
     calibration_mode_active = False 
+    signal_degraded = False
     
 
 async def toggle_calibration_mode():
@@ -110,12 +198,44 @@ async def toggle_calibration_mode():
     else:
         print("Not connected to device, cannot toggle calibration mode.")
 
+async def secure_link(client):
+    """Pair, or re-encrypt from an existing bond, and confirm the protected calibration characteristic is readable."""
+    start = time.monotonic()
+    try:
+        await client.pair()
+    except NotImplementedError:
+        pass  # CoreBluetooth pairs on the first access to an encrypted characteristic
+    value = await client.read_gatt_char(FULL_CALIBRATION_CHAR_UUID)
+    print(f"Link secured in {(time.monotonic() - start) * 1000:.0f} ms")
+    return bool(value and value[0])
+
+def encoder_client(device, **kwargs):
+    """Client limited to the encoder service. Handles come from the OS cache when the Database Hash is unchanged,
+    so a reconnect skips discovery."""
+    return BleakClient(device, services=[SERVICE_UUID], winrt={"use_cached_services": True}, **kwargs)
+
+async def find_encoder():
+    """Scan for an encoder by its advertised service UUID, and by its short ID if one was given."""
+    def match(device, adv):
+        if SERVICE_UUID not in adv.service_uuids:
+            return False
+        short_id = adv.service_data.get(SERVICE_UUID, b"")[:2].hex().upper()
+        return device_id is None or short_id == device_id
+
+    # Passing the UUID lets the OS filter in the controller where it can
+    device = await BleakScanner.find_device_by_filter(match, service_uuids=[SERVICE_UUID])
+    if device:
+        print(f"Found {device.name or DEVICE_NAME} at {device.address}")
+    return device
+
 async def ble_task():
     global connected_flag, running, current_zone, ble_client_global, calibration_mode_active
 
+    device = None
     while running:
-        print("Scanning for BLE_Encoder...")
-        device = await BleakScanner.find_device_by_name(DEVICE_NAME)
+        if not device:
+            print(f"Scanning for {DEVICE_NAME}...")
+            device = await find_encoder()
 
         if not device:
             print("Device not found. Retrying in 5s...")
@@ -123,32 +243,484 @@ async def ble_task():
             continue
 
         try:
-            async with BleakClient(device, disconnected_callback=on_disconnect) as client:
+            start = time.monotonic()
+            async with encoder_client(device, disconnected_callback=on_disconnect) as client:
                 ble_client_global = client # Store client instance
                 connected_flag = True
-                print("Connected to device")
-
-                # Set initial calibration mode state from device (optional, but good practice)
-                calibration_mode_active = False # Reset on new connection, assuming C program defaults to OFF
 
+                # The zone subscription needs no encryption, so it goes first
                 try:
                     await client.start_notify(CHAR_UUID, notification_handler)
                 except Exception:
                     await client.start_notify(FULL_CHAR_UUID, notification_handler)
+                print(f"Connected and subscribed in {(time.monotonic() - start) * 1000:.0f} ms")
+
+                # Calibration is encrypted-only, so reading it also proves the bond works
+                try:
+                    calibration_mode_active = await secure_link(client)
+                except BleakError as e:
+                    print(f"Pairing failed, calibration is unavailable: {e}")
+                    calibration_mode_active = False
 
                 while running and client.is_connected:
                     await asyncio.sleep(0.1)
 
-        except BleakError as e:
+        except (BleakError, asyncio.TimeoutError) as e:
             print(f"BLE connection error: {e}")
+            device = None  # Scan again, the device may have moved to another address
 
         # If we reach here, we are disconnected or errored
         connected_flag = False
         current_zone = "NONE"
         calibration_mode_active = False 
         ble_client_global = None 
-        print("Disconnected. Reconnecting in 3s...")
-        await asyncio.sleep(3)
+        if device:
+            print("Disconnected. Reconnecting in 1s...")
+            await asyncio.sleep(1)
+        else:
+            print("Disconnected. Reconnecting in 3s...")
+            await asyncio.sleep(3)
+
+async def ota_upload(path):
+    """Stream a firmware image to the device and switch it over once the hash checks out."""
+    with open(path, "rb") as f:
+        image = f.read()
+    digest = hashlib.sha256(image).digest()
+
+    print(f"Scanning for {DEVICE_NAME}...")
+    device = await find_encoder()
+    if not device:
+        print("Device not found.")
+        return False
+
+    async with encoder_client(device) as client:
+        await secure_link(client)
+
+        replies = asyncio.Queue()
+        ack_event = asyncio.Event()
+        acked = 0
+
+        def on_reply(sender, data):
+            nonlocal acked
+            if data[0] == wire.OtaMessage.MSG_ACK:
+                acked = wire.decode_ota_ack(data).written
+                ack_event.set()
+            else:
+                replies.put_nowait(wire.decode_ota_reply(data))
+                ack_event.set()  # Wakes a sender waiting for the window, an abort ends it
+
+        def status_name(status):
+            return {s.value: s.name.lower() for s in wire.OtaStatus}.get(status, status)
+
+        async def expect(cmd, timeout):
+            reply, status = await asyncio.wait_for(replies.get(), timeout)
+            if reply != cmd or status != wire.OtaStatus.OK:
+                raise BleakError(f"OTA command 0x{cmd:02x} failed: reply 0x{reply:02x}, {status_name(status)}")
+
+        def check_stopped():
+            """The device only replies during the transfer when it aborts it."""
+            try:
+                reply, status = replies.get_nowait()
+            except asyncio.QueueEmpty:
+                return
+            raise BleakError(f"OTA transfer stopped: reply 0x{reply:02x}, {status_name(status)}")
+
+        await client.start_notify(OTA_CONTROL_CHAR_UUID, on_reply)
+        await client.write_gatt_char(
+            OTA_CONTROL_CHAR_UUID, wire.pack_ota_begin(len(image), digest), response=True)
+        await expect(wire.OtaMessage.CMD_BEGIN, 30)  # The device erases the partition first
+
+        data_char = client.services.get_characteristic(OTA_DATA_CHAR_UUID)
+        chunk_size = data_char.max_write_without_response_size
+        print(f"Sending {len(image)} bytes in chunks of {chunk_size}")
+
+        start = time.monotonic()
+        sent = 0
+        while sent < len(image):
+            chunk = image[sent:sent + chunk_size]
+            # Keep at most one window unacknowledged so the device buffer never overflows
+            while sent + len(chunk) - acked > OTA_WINDOW_BYTES:
+                check_stopped()
+                ack_event.clear()
+                await asyncio.wait_for(ack_event.wait(), 10)
+            await client.write_gatt_char(data_char, chunk, response=False)
+            sent += len(chunk)
+            print(f"\r{sent * 100 // len(image)}%", end="", flush=True)
+
+        while acked < len(image):
+            check_stopped()
+            ack_event.clear()
+            await asyncio.wait_for(ack_event.wait(), 10)
+        elapsed = time.monotonic() - start
+        print(f"\nTransferred in {elapsed:.1f} s ({len(image) / elapsed / 1024:.1f} KiB/s)")
+
+        await client.write_gatt_char(OTA_CONTROL_CHAR_UUID, bytes([wire.OtaMessage.CMD_END]), response=True)
+        await expect(wire.OtaMessage.CMD_END, 10)
+        print("Update verified, device is restarting")
+    return True
+
+class SockaddrL2(ctypes.Structure):
+    _fields_ = [("l2_family", ctypes.c_ushort), ("l2_psm", ctypes.c_ushort), ("l2_bdaddr", ctypes.c_uint8 * 6),
+                ("l2_cid", ctypes.c_ushort), ("l2_bdaddr_type", ctypes.c_uint8)]
+
+def l2cap_connect(address, security, psm=0, cid=0, addr_type=BDADDR_LE_PUBLIC, mtu=None):
+    """Connect an LE L2CAP socket, to a PSM or a fixed channel. BlueZ only: Python's L2CAP addresses carry no
+    LE address type, so connect() goes through libc."""
+    sock = socket.socket(socket.AF_BLUETOOTH, socket.SOCK_SEQPACKET, socket.BTPROTO_L2CAP)
+    try:
+        sock.setsockopt(SOL_BLUETOOTH, BT_SECURITY, struct.pack("BB", security, 0))
+        if mtu:
+            sock.setsockopt(SOL_BLUETOOTH, BT_RCVMTU, struct.pack("H", mtu))
+        bdaddr = bytes.fromhex(address.replace(":", ""))[::-1]
+        addr = SockaddrL2(socket.AF_BLUETOOTH, psm, (ctypes.c_uint8 * 6)(*bdaddr), cid, addr_type)
+        libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+        if libc.connect(sock.fileno(), ctypes.byref(addr), ctypes.sizeof(addr)) != 0:
+            err = ctypes.get_errno()
+            raise OSError(err, os.strerror(err))
+    except BaseException:
+        sock.close()
+        raise
+    return sock
+
+def open_stream(address):
+    """Open the L2CAP stream channel over an existing link."""
+    # The device refuses the channel on an unencrypted link
+    sock = l2cap_connect(address, BT_SECURITY_MEDIUM, psm=L2CAP_PSM, mtu=L2CAP_MTU)
+    sock.setblocking(False)
+    return sock
+
+async def receive_sdus(sock, on_sdu, seconds):
+    """Hand every SDU to on_sdu until it returns True or the time is up."""
+    loop = asyncio.get_running_loop()
+    deadline = time.monotonic() + seconds
+    while (remaining := deadline - time.monotonic()) > 0:
+        try:
+            data = await asyncio.wait_for(loop.sock_recv(sock, L2CAP_MTU), remaining)
+        except asyncio.TimeoutError:
+            break
+        if not data or on_sdu(data):
+            break
+
+def decode_capture_frame(data):
+    """Split a capture frame into its header and samples; with NumPy the samples are a view of data."""
+    header = wire.decode_capture_header(data)
+    return header, wire.decode_capture_sample_batch(data, header.count, wire.CAPTURE_HEADER.size)
+
+async def connect_stream(client, device):
+    """Open the stream channel next to a connected GATT client, or explain why not."""
+    try:
+        return await asyncio.get_running_loop().run_in_executor(None, open_stream, device.address)
+    except (OSError, ValueError, AttributeError) as e:
+        print(f"L2CAP channel to {device.address} failed ({e}); it needs BlueZ and a NimBLE build of the firmware")
+        return None
+
+async def run_benchmark(client, device, count, phy, transport):
+    """One benchmark run; returns (received, lost, bytes per second) or None if nothing arrived."""
+    received = 0
+    payload_bytes = 0
+    seen = set()
+    first = last = None
+    done = asyncio.Event()
+
+    def on_packet(data):
+        nonlocal received, payload_bytes, first, last
+        if not data or data[0] != wire.Frame.BENCH:
+            return False
+        last = time.monotonic()
+        first = first or last
+        received += 1
+        payload_bytes += len(data)
+        seen.add(wire.decode_bench_packet(data).sequence)
+        if received >= count:
+            done.set()
+        return done.is_set()
+
+    request = wire.pack_bench_request(count, BENCH_PHYS[phy] if phy else 0, BENCH_TRANSPORTS[transport])
+    if transport == "l2cap":
+        sock = await connect_stream(client, device)
+        if not sock:
+            return None
+        try:
+            await client.write_gatt_char(FULL_CHAR_UUID, request, response=True)
+            await receive_sdus(sock, on_packet, 30)
+        finally:
+            sock.close()
+    else:
+        await client.start_notify(FULL_CHAR_UUID, lambda sender, data: on_packet(data))
+        await client.write_gatt_char(FULL_CHAR_UUID, request, response=True)
+        try:
+            await asyncio.wait_for(done.wait(), 30)
+        except asyncio.TimeoutError:
+            pass
+        await client.stop_notify(FULL_CHAR_UUID)
+
+    if received < 2:
+        print(f"{transport}: received {received} packets, nothing to measure")
+        return None
+    elapsed = last - first
+    lost = count - len(seen)
+    print(f"{transport}: received {received}/{count} packets ({lost} lost) in {elapsed:.2f} s: "
+          f"{received / elapsed:.0f} packets/s, {payload_bytes / elapsed / 1024:.1f} KiB/s")
+    return received, lost, payload_bytes / elapsed
+
+async def benchmark(count, phy=None, transport="gatt"):
+    """Have the device flood notifications or L2CAP SDUs and measure what arrives, then print its footprint statistics."""
+    print(f"Scanning for {DEVICE_NAME}...")
+    device = await find_encoder()
+    if not device:
+        print("Device not found.")
+        return False
+
+    async with encoder_client(device) as client:
+        await secure_link(client)
+
+        transports = ["gatt", "l2cap"] if transport == "both" else [transport]
+        results = {}
+        for t in transports:
+            results[t] = await run_benchmark(client, device, count, phy, t)
+            # Let the device log its figure and drop its PHY before the next run
+            await asyncio.sleep(1)
+        if not any(results.values()):
+            return False
+        if results.get("gatt") and results.get("l2cap"):
+            print(f"L2CAP / GATT throughput: {results['l2cap'][2] / results['gatt'][2]:.2f}x")
+
+        stats = decode_stats(bytes(await client.read_gatt_char(STATS_CHAR_UUID)))
+        for key in ("ble_heap_bytes", "boot_to_adv_ms", "bench_bytes_per_s", "phy_updates"):
+            print(f"  {key}: {stats.get(key, 'n/a')}")
+        # The device drops back to its base PHY after the run, so this is the link PHY now
+        print(f"  phy: {PHY_NAMES.get(stats.get('phy'), 'n/a')}")
+    return True
+
+async def capture(seconds, out_path=None):
+    """Record encoder samples streamed over the L2CAP channel, optionally to a CSV file."""
+    print(f"Scanning for {DEVICE_NAME}...")
+    device = await find_encoder()
+    if not device:
+        print("Device not found.")
+        return False
+
+    async with encoder_client(device) as client:
+        await secure_link(client)
+        sock = await connect_stream(client, device)
+        if not sock:
+            return False
+
+        batches = []
+        frames = 0
+        lost = 0
+        expected = None
+        timestamp_hz = 0
+
+        def on_frame(data):
+            nonlocal frames, lost, expected, timestamp_hz
+            if not data or data[0] != wire.Frame.CAPTURE_SAMPLES:
+                return False
+            header, batch = decode_capture_frame(data)
+            if expected is not None:
+                lost += (header.sequence - expected) & 0xFFFF
+            expected = (header.sequence + 1) & 0xFFFF
+            timestamp_hz = header.timestamp_hz
+            frames += 1
+            batches.append(batch)
+            return False
+
+        print(f"Capturing for {seconds} s, turn the encoder...")
+        try:
+            await receive_sdus(sock, on_frame, seconds)
+        finally:
+            sock.close()
+
+        samples = [sample for batch in batches for sample in batch]
+        print(f"{frames} frames ({lost} lost), {len(samples)} samples")
+        if samples:
+            print(f"Position {samples[0][1]} -> {samples[-1][1]}, timestamps at {timestamp_hz} Hz")
+        if out_path:
+            with open(out_path, "w") as f:
+                f.write(f"timestamp,position,interval  # timestamps at {timestamp_hz} Hz\n")
+                for timestamp, position, interval in samples:
+                    f.write(f"{timestamp},{position},{interval}\n")
+            print(f"Samples written to {out_path}")
+
+        stats = decode_stats(bytes(await client.read_gatt_char(STATS_CHAR_UUID)))
+        for key in ("capture_frames", "capture_dropped"):
+            print(f"  {key}: {stats.get(key, 'n/a')}")
+    return True
+
+async def measure_resolution(resolution, seconds):
+    """Switch the encoder resolution, then report the edge rate its decode path sustained while the user spun the knob."""
+    print(f"Scanning for {DEVICE_NAME}...")
+    device = await find_encoder()
+    if not device:
+        print("Device not found.")
+        return False
+
+    async with encoder_client(device) as client:
+        await secure_link(client)
+        await client.write_gatt_char(CONFIG_CHAR_UUID, bytes([resolution]), response=True)
+        applied = bytes(await client.read_gatt_char(CONFIG_CHAR_UUID))[0]
+        print(f"Resolution x{applied}. Spin the encoder as fast as it will go for {seconds} s...")
+
+        # The device restarts its maximum on the switch, so this covers the spin only
+        await asyncio.sleep(seconds)
+        stats = decode_stats(bytes(await client.read_gatt_char(STATS_CHAR_UUID)))
+        for key in ("encoder_resolution", "encoder_isr_raw", "encoder_isr_max_cycles",
+                    "encoder_max_edge_rate", "signal_illegal"):
+            print(f"  {key}: {stats.get(key, 'n/a')}")
+    return True
+
+async def upload_rules(path):
+    """Write a program from tools/rules_compile.py to the rules characteristic, an empty file clears the rules."""
+    with open(path, "rb") as f:
+        program = f.read()
+    print(f"Scanning for {DEVICE_NAME}...")
+    device = await find_encoder()
+    if not device:
+        print("Device not found.")
+        return False
+
+    async with encoder_client(device) as client:
+        await secure_link(client)
+        try:
+            await client.write_gatt_char(RULES_CHAR_UUID, program, response=True)
+        except BleakError as e:
+            print(f"Rules program rejected: {e}")
+            return False
+        stored = bytes(await client.read_gatt_char(RULES_CHAR_UUID))
+        if stored != program:
+            print(f"Read back {len(stored)} bytes that differ from the {len(program)} written")
+            return False
+        if program:
+            header = wire.decode_rules_header(program)
+            print(f"Installed {header.rules} rules, {len(program)} bytes")
+        else:
+            print("Rules cleared")
+    return True
+
+async def read_zone_stats(clear=False):
+    """Print the zone dwell times, entries and position range the device kept, optionally clearing them."""
+    print(f"Scanning for {DEVICE_NAME}...")
+    device = await find_encoder()
+    if not device:
+        print("Device not found.")
+        return False
+
+    async with encoder_client(device) as client:
+        stats = wire.decode_zone_stats(bytes(await client.read_gatt_char(ZONE_STATS_CHAR_UUID)))
+        zone = wire.Frame(stats.zone).name[len("ZONE_"):] if stats.zone else "none"
+        print(f"Over {stats.covered_s} s, now in {zone}, position {stats.min_position} to {stats.max_position}")
+        for name in ("red", "yellow", "green"):
+            dwell = getattr(stats, f"{name}_dwell_s")
+            share = 100 * dwell / stats.covered_s if stats.covered_s else 0
+            print(f"  {name.upper():6s} {dwell:8d} s  {share:5.1f} %  {getattr(stats, f'{name}_entries')} entries")
+        if clear:
+            # Clearing takes an encrypted link, reading does not
+            await secure_link(client)
+            await client.write_gatt_char(ZONE_STATS_CHAR_UUID, b"\x00", response=True)
+            print("Cleared")
+    return True
+
+def att_request(sock, pdu):
+    """Send an ATT request and return its response, answering whatever the server sends in between."""
+    sock.send(pdu)
+    while True:
+        rsp = sock.recv(L2CAP_MTU)
+        if rsp[0] == ATT_INDICATION:
+            sock.send(bytes([ATT_CONFIRMATION]))
+        elif rsp[0] == ATT_MTU_REQ:
+            sock.send(struct.pack("<BH", ATT_MTU_RSP, ATT_DEFAULT_MTU))
+        elif rsp[0] != ATT_NOTIFICATION:
+            return rsp
+
+def att_find_value_handle(sock, uuid16):
+    """Walk the characteristic declarations, which read without security, for a value handle."""
+    start = 0x0001
+    while True:
+        rsp = att_request(sock, struct.pack("<BHHH", ATT_READ_BY_TYPE_REQ, start, 0xFFFF, GATT_CHARACTERISTIC_UUID))
+        if rsp[0] != ATT_READ_BY_TYPE_RSP:
+            return None
+        length = rsp[1]
+        for i in range(2, len(rsp) - length + 1, length):
+            handle, _, value_handle = struct.unpack_from("<HBH", rsp, i)
+            if rsp[i + 5:i + length] == struct.pack("<H", uuid16):
+                return value_handle
+            start = handle + 1
+
+def att_write(sock, handle, value):
+    """Write request; returns 0 on success or the ATT error code."""
+    rsp = att_request(sock, struct.pack("<BH", ATT_WRITE_REQ, handle) + value)
+    if rsp[0] == ATT_WRITE_RSP:
+        return 0
+    if rsp[0] == ATT_ERROR_RSP:
+        return rsp[4]
+    raise OSError(f"unexpected ATT response 0x{rsp[0]:02x}")
+
+def link_security(sock):
+    """Security level the kernel reports for the link."""
+    return sock.getsockopt(SOL_BLUETOOTH, BT_SECURITY, 2)[0]
+
+def bond_steps(address, addr_type, reconnect):
+    """Calibration writes on one ATT link: refused while unencrypted, accepted once encrypted. A first link pairs
+    and bonds; on a reconnect the kernel encrypts from the stored keys instead. Returns the failed step or None."""
+    with l2cap_connect(address, BT_SECURITY_LOW, cid=ATT_CID, addr_type=addr_type) as sock:
+        sock.settimeout(30)
+        handle = att_find_value_handle(sock, CALIBRATION_UUID16)
+        if handle is None:
+            return "calibration characteristic not found"
+        if not reconnect:
+            # A bonded device asks to re-encrypt as soon as it connects, so this only holds on the first link
+            err = att_write(sock, handle, b"\x00")
+            if err not in (ATT_ERR_AUTHENTICATION, ATT_ERR_ENCRYPTION):
+                return f"unencrypted write answered 0x{err:02x}, expected a security error"
+            print("Unencrypted write rejected")
+        start = time.monotonic()
+        # The next send waits until the kernel has paired, or encrypted from the bond
+        sock.setsockopt(SOL_BLUETOOTH, BT_SECURITY, struct.pack("BB", BT_SECURITY_MEDIUM, 0))
+        err = att_write(sock, handle, b"\x00")
+        if link_security(sock) < BT_SECURITY_MEDIUM:
+            return "link did not encrypt"
+        if err == ATT_ERR_AUTHENTICATION:
+            return "encrypted write refused as unbonded; is the adapter bondable?"
+        if err:
+            return f"encrypted write answered 0x{err:02x}"
+        print(f"Encrypted write accepted, {'re-encrypted' if reconnect else 'paired'} in "
+              f"{(time.monotonic() - start) * 1000:.0f} ms")
+    return None
+
+async def bond_test():
+    """Pair, disconnect, reconnect from the bond, and check the calibration characteristic only takes writes
+    over the bonded link. BlueZ only; the device must not hold a bond for this host."""
+    print(f"Scanning for {DEVICE_NAME}...")
+    device = await find_encoder()
+    if not device:
+        print("Device not found.")
+        return False
+    try:
+        # Start from a link without keys on this side
+        await BleakClient(device).unpair()
+    except BleakError:
+        pass
+
+    loop = asyncio.get_running_loop()
+    for reconnect in (False, True):
+        if reconnect:
+            # Let the link drop, then find the device again; it is reported by its identity address once bonded
+            await asyncio.sleep(2)
+            device = await find_encoder()
+            if not device:
+                print("FAIL: device did not come back after the disconnect")
+                return False
+        props = device.details.get("props", {}) if isinstance(device.details, dict) else {}
+        addr_type = BDADDR_LE_RANDOM if props.get("AddressType") == "random" else BDADDR_LE_PUBLIC
+        try:
+            failure = await loop.run_in_executor(None, bond_steps, device.address, addr_type, reconnect)
+        except OSError as e:
+            failure = f"ATT link to {device.address} failed ({e})"
+        if failure:
+            print(f"FAIL: {failure}")
+            return False
+    print("Bond test passed")
+    return True
 
 def start_ble_loop():
     global ble_loop 
@@ -157,7 +729,55 @@ def start_ble_loop():
     ble_loop.run_until_complete(ble_task()) 
 
 def main():
-    global running
+    global running, device_id
+
+    parser = argparse.ArgumentParser(description="BLE encoder monitor")
+    parser.add_argument("--id", metavar="XXXX",
+                        help="connect only to the encoder with this short ID, the last 4 hex digits of its address")
+    parser.add_argument("--ota", metavar="FIRMWARE_BIN", help="upload a firmware image and exit")
+    parser.add_argument("--bench", metavar="COUNT", type=int,
+                        help="measure notification throughput over COUNT notifications and exit")
+    parser.add_argument("--phy", choices=sorted(BENCH_PHYS),
+                        help="PHY for --bench, defaults to the device's streaming PHY")
+    parser.add_argument("--transport", choices=sorted(BENCH_TRANSPORTS) + ["both"], default="gatt",
+                        help="what --bench floods: GATT notifications, the L2CAP channel (BlueZ, NimBLE firmware) or both")
+    parser.add_argument("--capture", metavar="SECONDS", type=int,
+                        help="record encoder samples streamed over the L2CAP channel and exit")
+    parser.add_argument("--out", metavar="CSV", help="file for the samples recorded by --capture")
+    parser.add_argument("--resolution", type=int, choices=[1, 2, 4],
+                        help="set the steps per detent cycle, measure the decode edge rate while you spin, and exit")
+    parser.add_argument("--spin", metavar="SECONDS", type=int, default=10,
+                        help="how long --resolution measures for")
+    parser.add_argument("--rules", metavar="PROGRAM_BIN",
+                        help="install alert rules compiled by tools/rules_compile.py and exit, an empty file clears them")
+    parser.add_argument("--zone-stats", action="store_true",
+                        help="print the zone dwell times and entries kept by the device and exit")
+    parser.add_argument("--clear", action="store_true", help="clear the totals after --zone-stats prints them")
+    parser.add_argument("--bond-test", action="store_true",
+                        help="check that calibration writes need a bonded link across pairing and a reconnect, and exit")
+    args = parser.parse_args()
+    device_id = args.id.upper() if args.id else None
+    if args.ota:
+        ok = asyncio.run(ota_upload(args.ota))
+        raise SystemExit(0 if ok else 1)
+    if args.bench:
+        ok = asyncio.run(benchmark(args.bench, args.phy, args.transport))
+        raise SystemExit(0 if ok else 1)
+    if args.capture:
+        ok = asyncio.run(capture(args.capture, args.out))
+        raise SystemExit(0 if ok else 1)
+    if args.resolution:
+        ok = asyncio.run(measure_resolution(args.resolution, args.spin))
+        raise SystemExit(0 if ok else 1)
+    if args.rules is not None:
+        ok = asyncio.run(upload_rules(args.rules))
+        raise SystemExit(0 if ok else 1)
+    if args.zone_stats:
+        ok = asyncio.run(read_zone_stats(args.clear))
+        raise SystemExit(0 if ok else 1)
+    if args.bond_test:
+        ok = asyncio.run(bond_test())
+        raise SystemExit(0 if ok else 1)
 
     # Start BLE in background thread
     ble_thread = threading.Thread(target=start_ble_loop)
@@ -175,6 +795,10 @@ def main():
         for event in pygame.event.get():
             if event.type == pygame.QUIT:
                 running = False
+            elif event.type == pygame.KEYDOWN and event.key == pygame.K_s:
+                # Dump device statistics to the console
+                if ble_loop and ble_loop.is_running():
+                    asyncio.run_coroutine_threadsafe(read_stats(), ble_loop)
             elif event.type == pygame.MOUSEBUTTONDOWN:
                 # Check if calibration button was clicked
                 mouse_pos = event.pos
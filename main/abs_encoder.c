@@ -0,0 +1,312 @@
+/*
+ *
+ * Magnetic absolute angle sensor on I2C as a position source
+ *
+ */
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "abs_encoder.h"
+
+#define TAG "ABS_ENCODER"
+
+#define STOP_TIMEOUT_MS  200
+#define STOP_POLL_MS     10
+
+static int i2c_read(void *ctx, uint8_t reg, uint8_t *data, size_t len)
+{
+    abs_encoder_t *enc = (abs_encoder_t *)ctx;
+    return i2c_master_transmit_receive(enc->dev, &reg, 1, data, len, ABS_ENCODER_I2C_TIMEOUT_MS) == ESP_OK ? 0 : -1;
+}
+
+static int32_t angle_to_steps(const abs_encoder_t *enc, int32_t angle)
+{
+    return abs_sensor_to_steps(angle - enc->zero_angle, enc->detents_per_turn * enc->resolution);
+}
+
+/**
+ * @brief Publish a state change that is not a step, call with the lock held
+ * @param enc Backend instance
+ */
+static void publish_state(abs_encoder_t *enc)
+{
+    encoder_event_t event = {
+        .state = enc->state,
+        .timestamp = enc->last_step_us,
+    };
+    position_snapshot_publish(&enc->snapshot, &event);
+}
+
+/**
+ * @brief Take one sample and deliver an event if the position changed
+ * @param enc Backend instance
+ */
+static void sample(abs_encoder_t *enc)
+{
+    int32_t angle;
+    if (abs_sensor_sample(&enc->sensor, &angle) != ABS_SENSOR_OK) {
+        return;
+    }
+    if (enc->flip) {
+        angle = -angle;
+    }
+
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    encoder_event_t event;
+    bool send = false;
+
+    portENTER_CRITICAL(&enc->lock);
+    enc->angle = angle;
+    if (!enc->zeroed) {
+        // Centers the resting angle in its step, whatever the magnet's orientation
+        enc->zero_angle = angle;
+        enc->offset = enc->state.position;
+        enc->zeroed = true;
+    }
+    int32_t position = enc->offset + angle_to_steps(enc, angle);
+    if (position != enc->state.position) {
+        int step = position > enc->state.position ? 1 : -1;
+        if (enc->last_step && step != enc->last_step) {
+            enc->reversals++;
+        }
+        enc->last_step = step;
+        enc->state.position = position;
+        enc->state.direction = step > 0 ? ENCODER_DIRECTION_CLOCKWISE : ENCODER_DIRECTION_COUNTER_CLOCKWISE;
+        event.state = enc->state;
+        event.timestamp = now;
+        event.interval = enc->stepped ? now - enc->last_step_us : 0;
+        enc->last_step_us = now;
+        enc->stepped = true;
+        position_snapshot_publish(&enc->snapshot, &event);
+        send = enc->queue != NULL;
+    }
+    portEXIT_CRITICAL(&enc->lock);
+
+    if (send) {
+        xQueueOverwrite(enc->queue, &event);
+    }
+}
+
+static void sample_task(void *arg)
+{
+    abs_encoder_t *enc = (abs_encoder_t *)arg;
+    TickType_t wake = xTaskGetTickCount();
+    TickType_t period = pdMS_TO_TICKS(enc->sample_period_ms);
+
+    while (enc->running) {
+        sample(enc);
+        vTaskDelayUntil(&wake, period ? period : 1);
+    }
+
+    // Its stack and TCB are static, so it is deleted by uninit rather than left for the idle task to reap
+    enc->stopped = true;
+    vTaskSuspend(NULL);
+}
+
+esp_err_t abs_encoder_init(abs_encoder_t *enc, const abs_encoder_config_t *config)
+{
+    if (!enc || !config || !config->detents_per_turn) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(enc, 0, sizeof(*enc));
+    portMUX_INITIALIZE(&enc->lock);
+    enc->sample_period_ms = config->sample_period_ms;
+    enc->detents_per_turn = config->detents_per_turn;
+    enc->resolution = config->resolution;
+    enc->flip = config->flip;
+    position_quality_init(&enc->quality);
+    abs_sensor_init(&enc->sensor, i2c_read, enc);
+
+    i2c_master_bus_config_t bus_conf = {
+        .i2c_port = -1,
+        .sda_io_num = config->sda,
+        .scl_io_num = config->scl,
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .glitch_ignore_cnt = 7,
+        .flags.enable_internal_pullup = true,
+    };
+    i2c_device_config_t dev_conf = {
+        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+        .device_address = ABS_SENSOR_I2C_ADDR,
+        .scl_speed_hz = config->scl_hz,
+    };
+    esp_err_t ret = i2c_new_master_bus(&bus_conf, &enc->bus);
+    if (ret == ESP_OK) {
+        ret = i2c_master_bus_add_device(enc->bus, &dev_conf, &enc->dev);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "I2C setup failed: %s", esp_err_to_name(ret));
+        abs_encoder_uninit(enc);
+        return ret;
+    }
+
+    enc->running = true;
+    enc->task = xTaskCreateStatic(sample_task, "abs_encoder", ABS_ENCODER_TASK_STACK_SIZE, enc,
+                                  ABS_ENCODER_TASK_PRIORITY, enc->task_stack, &enc->task_buffer);
+    if (!enc->task) {
+        enc->running = false;
+        abs_encoder_uninit(enc);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t abs_encoder_uninit(abs_encoder_t *enc)
+{
+    if (!enc) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // The task may be inside a bus transaction, let it finish and park itself
+    esp_err_t ret = ESP_OK;
+    if (enc->task) {
+        enc->running = false;
+        uint32_t waited_ms = 0;
+        while (!enc->stopped || eTaskGetState(enc->task) != eSuspended) {
+            if (waited_ms >= STOP_TIMEOUT_MS) {
+                // Still running, possibly on the bus; keep the bus and the task for another attempt
+                ESP_LOGE(TAG, "Sampling task did not stop");
+                return ESP_ERR_TIMEOUT;
+            }
+            vTaskDelay(pdMS_TO_TICKS(STOP_POLL_MS));
+            waited_ms += STOP_POLL_MS;
+        }
+        vTaskDelete(enc->task);
+        enc->task = NULL;
+    }
+    if (enc->dev) {
+        i2c_master_bus_rm_device(enc->dev);
+        enc->dev = NULL;
+    }
+    if (enc->bus) {
+        ret = i2c_del_master_bus(enc->bus);
+        enc->bus = NULL;
+    }
+    return ret;
+}
+
+static esp_err_t source_set_queue(void *ctx, QueueHandle_t queue)
+{
+    abs_encoder_t *enc = (abs_encoder_t *)ctx;
+    portENTER_CRITICAL(&enc->lock);
+    enc->queue = queue;
+    portEXIT_CRITICAL(&enc->lock);
+    return ESP_OK;
+}
+
+static esp_err_t source_get_timestamp_hz(void *ctx, uint32_t *hz)
+{
+    if (!hz) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *hz = 1000000;
+    return ESP_OK;
+}
+
+static esp_err_t source_get_state(void *ctx, encoder_state_t *state)
+{
+    abs_encoder_t *enc = (abs_encoder_t *)ctx;
+    if (!state) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    encoder_event_t event;
+    position_snapshot_read(&enc->snapshot, &event);
+    *state = event.state;
+    return ESP_OK;
+}
+
+static esp_err_t source_set_position(void *ctx, encoder_position_t position)
+{
+    abs_encoder_t *enc = (abs_encoder_t *)ctx;
+    portENTER_CRITICAL(&enc->lock);
+    // Before the first good sample the offset is fixed from this position then
+    enc->offset = position - angle_to_steps(enc, enc->angle);
+    enc->state.position = position;
+    publish_state(enc);
+    portEXIT_CRITICAL(&enc->lock);
+    return ESP_OK;
+}
+
+static esp_err_t source_reset(void *ctx)
+{
+    abs_encoder_t *enc = (abs_encoder_t *)ctx;
+    source_set_position(ctx, 0);
+    portENTER_CRITICAL(&enc->lock);
+    enc->state.direction = ENCODER_DIRECTION_NOT_SET;
+    enc->last_step = 0;
+    publish_state(enc);
+    portEXIT_CRITICAL(&enc->lock);
+    return ESP_OK;
+}
+
+static esp_err_t source_set_resolution(void *ctx, quadrature_resolution_t resolution)
+{
+    abs_encoder_t *enc = (abs_encoder_t *)ctx;
+    if (resolution != QUADRATURE_X1 && resolution != QUADRATURE_X2 && resolution != QUADRATURE_X4) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&enc->lock);
+    enc->state.position = enc->state.position * resolution / enc->resolution;
+    enc->resolution = resolution;
+    enc->offset = enc->state.position - angle_to_steps(enc, enc->angle);
+    enc->stepped = false;
+    publish_state(enc);
+    portEXIT_CRITICAL(&enc->lock);
+    return ESP_OK;
+}
+
+static bool source_check_quality(void *ctx, const encoder_quality_limits_t *limits, encoder_quality_t *quality)
+{
+    abs_encoder_t *enc = (abs_encoder_t *)ctx;
+    bool changed = false;
+
+    if (position_quality_due(&enc->quality)) {
+        // Sensor counters are only written by the sampling task, a stale read is harmless
+        uint32_t rejected = enc->sensor.bus_errors + enc->sensor.magnet_errors;
+        uint32_t jumps = enc->sensor.jumps;
+        portENTER_CRITICAL(&enc->lock);
+        uint32_t reversals = enc->reversals;
+        portEXIT_CRITICAL(&enc->lock);
+
+        changed = position_quality_roll(&enc->quality, rejected, jumps, reversals, limits);
+    }
+
+    if (quality) {
+        *quality = enc->quality.quality;
+    }
+    return changed;
+}
+
+static esp_err_t source_uninit(void *ctx)
+{
+    return abs_encoder_uninit(ctx);
+}
+
+static const position_source_ops_t source_ops = {
+    .set_queue = source_set_queue,
+    .get_timestamp_hz = source_get_timestamp_hz,
+    .get_state = source_get_state,
+    .set_position = source_set_position,
+    .reset = source_reset,
+    .set_resolution = source_set_resolution,
+    .check_quality = source_check_quality,
+    .uninit = source_uninit,
+};
+
+esp_err_t abs_encoder_get_position_source(abs_encoder_t *enc, position_source_t *source)
+{
+    if (!enc || !source) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *source = (position_source_t){
+        .name = "absolute",
+        .ops = &source_ops,
+        .ctx = enc,
+        .snapshot = &enc->snapshot,
+    };
+    return ESP_OK;
+}
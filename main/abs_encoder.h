@@ -0,0 +1,116 @@
+/*
+ *
+ * Magnetic absolute angle sensor on I2C as a position source
+ *
+ * A sampling task reads the sensor at a fixed period; each read is an
+ * interrupt-driven I2C transaction, so the task sleeps while the bus works.
+ * The angle is unwrapped over any number of turns (abs_sensor.h) and mapped
+ * onto detents, so the zone thresholds mean the same as with an incremental
+ * encoder. An event is delivered whenever the position changes.
+ *
+ * Signal quality: samples rejected for a bus error or a missing magnet are
+ * counted as illegal, moves over a quarter turn between samples as glitches.
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "driver/i2c_master.h"
+#include "esp_err.h"
+#include "abs_sensor.h"
+#include "position_source.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ABS_ENCODER_TASK_STACK_SIZE  3072  // Bytes
+#define ABS_ENCODER_TASK_PRIORITY    5     // Above the encoder loop, sampling must keep its period
+#define ABS_ENCODER_I2C_TIMEOUT_MS   10    // One register burst at 400 kHz takes well under 1 ms
+
+/**
+ * @brief Bus and mapping options
+ */
+typedef struct {
+    gpio_num_t sda;
+    gpio_num_t scl;
+    uint32_t scl_hz;                     ///< I2C clock, the sensor supports up to 1 MHz
+    uint32_t sample_period_ms;           ///< Must stay under half a turn at the fastest expected speed
+    uint32_t detents_per_turn;           ///< Detent equivalents in one turn, at x1
+    quadrature_resolution_t resolution;  ///< Steps per detent
+    bool flip;                           ///< Reverse the clockwise/counterclockwise sense
+} abs_encoder_config_t;
+
+/**
+ * @brief Backend instance, treat as opaque
+ */
+typedef struct {
+    i2c_master_bus_handle_t bus;
+    i2c_master_dev_handle_t dev;
+    abs_sensor_t sensor;
+    QueueHandle_t queue;
+    portMUX_TYPE lock;
+    seqlock_t snapshot;         ///< Last step, readable without the lock
+
+    uint32_t sample_period_ms;
+    uint32_t detents_per_turn;
+    quadrature_resolution_t resolution;
+    bool flip;
+    bool zeroed;                ///< The first good sample has fixed the zero angle
+    int32_t angle;              ///< Last multi-turn angle, in the configured direction
+    int32_t zero_angle;         ///< Angle of the first good sample, the middle of a step
+    int32_t offset;             ///< Position at the zero angle
+    encoder_state_t state;
+    int last_step;
+    uint32_t reversals;
+    uint32_t last_step_us;
+    bool stepped;
+    position_quality_window_t quality;
+
+    volatile bool running;
+    volatile bool stopped;      ///< Set by the sampling task right before it suspends itself
+    TaskHandle_t task;
+    StaticTask_t task_buffer;
+    StackType_t task_stack[ABS_ENCODER_TASK_STACK_SIZE];
+} abs_encoder_t;
+
+/**
+ * @brief Open the I2C bus to the sensor and start sampling
+ *
+ * The angle of the first good sample is taken as the middle of position zero.
+ *
+ * @param enc Backend instance
+ * @param config Bus and mapping options
+ * @return ESP_OK on success
+ */
+esp_err_t abs_encoder_init(abs_encoder_t *enc, const abs_encoder_config_t *config);
+
+/**
+ * @brief Stop sampling and release the bus
+ *
+ * The sampling task finishes its bus transaction and suspends itself, then
+ * it is deleted here. If it does not get there in time the bus is left
+ * alone and the instance must not be initialized again; calling this again
+ * keeps waiting for the task.
+ *
+ * @param enc Backend instance
+ * @return ESP_OK on success, ESP_ERR_TIMEOUT if the sampling task did not stop
+ */
+esp_err_t abs_encoder_uninit(abs_encoder_t *enc);
+
+/**
+ * @brief Expose an initialized backend through the position source interface
+ * @param enc Backend instance, must outlive the source
+ * @param source Receives the position source
+ * @return ESP_OK on success
+ */
+esp_err_t abs_encoder_get_position_source(abs_encoder_t *enc, position_source_t *source);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,142 @@
+/*
+ *
+ * Magnetic absolute angle sensor: register access and multi-turn unwrapping
+ *
+ * Kept free of ESP-IDF so it can be exercised on a host against a simulated
+ * register file, see tools/abs_sensor_model.c. Registers are read through a
+ * bus hook; abs_encoder.c supplies one for I2C.
+ *
+ * The register map is the AS5600 one: a status byte followed by the 12-bit
+ * raw angle, read in one burst so they belong to the same conversion.
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ABS_SENSOR_I2C_ADDR         0x36
+#define ABS_SENSOR_REG_STATUS       0x0B    // Followed by RAW ANGLE high (0x0C) and low (0x0D)
+#define ABS_SENSOR_STATUS_MH        0x08    // Magnet too strong
+#define ABS_SENSOR_STATUS_ML        0x10    // Magnet too weak
+#define ABS_SENSOR_STATUS_MD        0x20    // Magnet detected
+#define ABS_SENSOR_COUNTS_PER_TURN  4096
+#define ABS_SENSOR_MAX_STEP         (ABS_SENSOR_COUNTS_PER_TURN / 4)  // Larger moves between samples are counted as jumps
+
+/**
+ * @brief Read consecutive registers
+ * @param ctx Bus context
+ * @param reg First register
+ * @param data Receives the values
+ * @param len Number of registers
+ * @return 0 on success
+ */
+typedef int (*abs_sensor_read_t)(void *ctx, uint8_t reg, uint8_t *data, size_t len);
+
+/**
+ * @brief Result of one sample
+ */
+typedef enum {
+    ABS_SENSOR_OK = 0,
+    ABS_SENSOR_BUS_ERROR,       ///< The read failed, the angle is unchanged
+    ABS_SENSOR_NO_MAGNET,       ///< Magnet missing, too weak or too strong, the angle is unchanged
+} abs_sensor_result_t;
+
+/**
+ * @brief Sensor and unwrapping state
+ */
+typedef struct {
+    abs_sensor_read_t read;
+    void *ctx;
+    bool started;
+    uint16_t raw;               ///< Last accepted raw angle
+    int32_t turns;              ///< Full turns since the first sample
+    uint32_t bus_errors;
+    uint32_t magnet_errors;
+    uint32_t jumps;             ///< Moves over ABS_SENSOR_MAX_STEP between samples
+} abs_sensor_t;
+
+/**
+ * @brief Attach the sensor state to a bus
+ * @param s Sensor
+ * @param read Register read hook
+ * @param ctx Argument for read
+ */
+static inline void abs_sensor_init(abs_sensor_t *s, abs_sensor_read_t read, void *ctx)
+{
+    *s = (abs_sensor_t){
+        .read = read,
+        .ctx = ctx,
+    };
+}
+
+/**
+ * @brief Read the sensor and unwrap the angle across turns
+ *
+ * A move of more than half a turn between samples is taken as a wrap the
+ * other way, so samples must come faster than half a turn.
+ *
+ * @param s Sensor
+ * @param angle Receives the multi-turn angle in counts from turn zero, also on errors
+ * @return ABS_SENSOR_OK if a new angle was taken
+ */
+static inline abs_sensor_result_t abs_sensor_sample(abs_sensor_t *s, int32_t *angle)
+{
+    uint8_t regs[3];
+    abs_sensor_result_t result = ABS_SENSOR_OK;
+
+    if (s->read(s->ctx, ABS_SENSOR_REG_STATUS, regs, sizeof(regs)) != 0) {
+        s->bus_errors++;
+        result = ABS_SENSOR_BUS_ERROR;
+    } else if (!(regs[0] & ABS_SENSOR_STATUS_MD) || (regs[0] & (ABS_SENSOR_STATUS_ML | ABS_SENSOR_STATUS_MH))) {
+        s->magnet_errors++;
+        result = ABS_SENSOR_NO_MAGNET;
+    } else {
+        uint16_t raw = ((regs[1] & 0x0F) << 8) | regs[2];
+        if (s->started) {
+            int32_t delta = (int32_t)raw - s->raw;
+            if (delta > ABS_SENSOR_COUNTS_PER_TURN / 2) {
+                s->turns--;
+                delta -= ABS_SENSOR_COUNTS_PER_TURN;
+            } else if (delta < -ABS_SENSOR_COUNTS_PER_TURN / 2) {
+                s->turns++;
+                delta += ABS_SENSOR_COUNTS_PER_TURN;
+            }
+            if (delta > ABS_SENSOR_MAX_STEP || delta < -ABS_SENSOR_MAX_STEP) {
+                s->jumps++;
+            }
+        }
+        s->raw = raw;
+        s->started = true;
+    }
+
+    *angle = s->turns * ABS_SENSOR_COUNTS_PER_TURN + s->raw;
+    return result;
+}
+
+/**
+ * @brief Convert a multi-turn angle into steps, rounding to the nearest step
+ *
+ * Angle zero sits in the middle of step zero, so jitter around it has to
+ * cover half a step before the position moves.
+ *
+ * @param angle Counts from the zero angle
+ * @param steps_per_turn Steps in one full turn
+ * @return Steps from the zero angle
+ */
+static inline int32_t abs_sensor_to_steps(int32_t angle, uint32_t steps_per_turn)
+{
+    int64_t scaled = (int64_t)angle * steps_per_turn + ABS_SENSOR_COUNTS_PER_TURN / 2;
+    int64_t steps = scaled >= 0 ? scaled / ABS_SENSOR_COUNTS_PER_TURN
+                                : -((ABS_SENSOR_COUNTS_PER_TURN - 1 - scaled) / ABS_SENSOR_COUNTS_PER_TURN);
+    return (int32_t)steps;
+}
+
+#ifdef __cplusplus
+}
+#endif
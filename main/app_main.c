@@ -13,20 +13,30 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "esp_timer.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "nvs.h"
 #include "nvs_flash.h"
-#include "esp_bt.h"
-#include "esp_gap_ble_api.h"
-#include "esp_gatts_api.h"
-#include "esp_bt_defs.h"
-#include "esp_bt_main.h"
-#include "esp_bt_device.h"
-#include "esp_gatt_common_api.h"
-#include "rotary_encoder.h"
+#include "sdkconfig.h"
+#include "abs_encoder.h"
+#include "ble.h"
+#include "capture.h"
+#include "deep_sleep.h"
+#include "encoder.h"
+#include "input_filter.h"
+#include "led.h"
+#include "stats.h"
+#include "health.h"
+#include "ota.h"
+#include "pcnt_encoder.h"
+#include "position_source.h"
+#include "rules.h"
+#include "wire.h"
+#include "zone_stats.h"
 
 #define TAG "BLE_ENCODER"
-#define APP_ID_PLACEHOLDER 0
 
 // GPIO Pin Definitions
 #define ROT_ENC_A_GPIO      GPIO_NUM_8
@@ -36,129 +46,87 @@
 #define GREEN_LED_GPIO      GPIO_NUM_1
 #define BLUE_LED_GPIO       GPIO_NUM_0
 
+// Position Source
+#define POSITION_SOURCE_QUADRATURE  0  // A/B on GPIO interrupts through the in-tree decoder
+#define POSITION_SOURCE_PCNT        1  // A/B counted by the PCNT peripheral, on chips that have one
+#define POSITION_SOURCE_ABSOLUTE    2  // AS5600 magnetic angle sensor on I2C
+#define POSITION_SOURCE             POSITION_SOURCE_QUADRATURE
+#define ABS_SDA_GPIO        GPIO_NUM_4
+#define ABS_SCL_GPIO        GPIO_NUM_5
+#define ABS_I2C_HZ          400000
+#define ABS_SAMPLE_PERIOD_MS 2     // Follows up to 250 turns per second
+#define ABS_DETENTS_PER_TURN 20    // One sensor turn spans this many detents of the zone thresholds
+
 // Configuration Constants
-#define ENABLE_HALF_STEPS   false  // Set to true to enable tracking of rotary encoder at half step resolution
-#define RESET_AT            0      // Set to a positive non-zero number to reset the position if this value is exceeded
+#define ENCODER_RESOLUTION  QUADRATURE_X1  // Steps per detent cycle until a central writes the config characteristic
+#define RESET_AT            0      // Set to a positive non-zero number to reset the position if this many detents are exceeded
 #define FLIP_DIRECTION      false  // Set to true to reverse the clockwise/counterclockwise sense
 #define TASK_DELAY_MS       50     // Task delay in milliseconds
-
-// Position Thresholds for LED Colors
+#define HEALTH_WDT_TIMEOUT_MS 3000 // Task watchdog timeout for the main loop
+#define SETTINGS_NVS_NAMESPACE "settings" // Settings written by the central, kept across resets
+
+// Encoder Signal Quality
+#define SIGNAL_GLITCH_WIDTH_US      200   // Edges on one pin closer than this are counted as glitches
+#define SIGNAL_MAX_ILLEGAL_PER_S    2     // Illegal A/B transitions (missed edges) tolerated per second
+#define SIGNAL_MAX_GLITCHES_PER_S   20    // Glitch pulses tolerated per second
+#define SIGNAL_MAX_REVERSALS_PER_S  6     // Direction reversals tolerated per second
+
+// Input Filtering
+#define ENCODER_GLITCH_FILTER_NS    500   // Hardware glitch filter on A/B, 0 disables
+#define ENCODER_MIN_EDGE_INTERVAL_US 0    // ISR queues step events no closer than this, every edge is still decoded, 0 disables
+#define BUTTON_GLITCH_FILTER_NS     500   // Hardware glitch filter on the button, 0 disables
+#define ENCODER_EDGE_CAPTURE        true  // Timestamp A/B edges with MCPWM capture where the chip has it
+
+// Static memory plan, see tools/memory_report.py for the per-subsystem totals
+#define ENCODER_QUEUE_LENGTH     1     // The encoder driver overwrites a single pending event
+#define ENCODER_TASK_STACK_SIZE  4096  // Bytes, covers ESP_LOG formatting in the loop
+#define ENCODER_TASK_PRIORITY    1     // Same priority as the app_main task it replaces
+#define OTA_CONFIRM_LOOPS        100   // Healthy loop iterations after the first advertisement before a new image is kept
+
+// LED Behaviour
+#define LED_BRIGHTNESS          255    // Global LED brightness, 0-255
+#define LED_FADE_MS             150    // Fade time between zone colors
+#define LED_YELLOW_BLINK_MS     1000   // Blink period in the YELLOW zone
+#define LED_RED_BLINK_MS        400    // Blink period in the RED zone
+#define LED_CALIBRATION_PULSE_MS 1500  // Pulse period while calibrating
+#define LED_DISCONNECT_FLASHES  3      // Number of flashes when a central disconnects
+#define LED_DISCONNECT_FLASH_MS 200    // Flash period when a central disconnects
+
+// Position Thresholds for LED Colors, in detents at any resolution
 #define GREEN_ZONE_MIN      -5
 #define GREEN_ZONE_MAX      5
 #define YELLOW_ZONE_MIN     -10
 #define YELLOW_ZONE_MAX     10
 
-// BLE characteristic value constraints
-#define GATTS_SERVICE_UUID   0x00FF
-#define GATTS_CHAR_UUID      0xFF01
-#define GATTS_CALIBRATION_CHAR_UUID  0xFF02
-#define GATTS_NUM_HANDLE     6
-#define DEVICE_NAME          "BLE_Encoder"
-#define CHAR_VALUE_MAX_LEN   20
-#define ADV_DATA_MAX_LEN     31
-
 // State variables
-static bool connection_established = false;
-static bool notifications_enabled = false;
-static bool ble_service_started = false;
 static bool calibration_mode = false;
-
-// GATT communication variables
-static uint16_t gatt_handle_table[GATTS_NUM_HANDLE];
-static esp_gatt_char_prop_t property = 0;
-static uint8_t char_value_buffer[CHAR_VALUE_MAX_LEN] = {0x00};
-static esp_attr_value_t gatts_char_val = {
-    .attr_max_len = CHAR_VALUE_MAX_LEN,
-    .attr_len = 1,
-    .attr_value = char_value_buffer,
-};
-
-static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
-static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
-static uint16_t notify_conn_id = 0;
-static esp_gatt_if_t notify_gatts_if = 0;
-
-// Device Vars
-static const char *CONN_TAG = DEVICE_NAME;
-static const char device_name[] = DEVICE_NAME;
-
-// UUIDs
-static uint16_t primary_service_uuid         = ESP_GATT_UUID_PRI_SERVICE;
-static uint16_t character_declaration_uuid   = ESP_GATT_UUID_CHAR_DECLARE;
-static uint16_t character_client_config_uuid = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
-
-// Characteristic Properties
-static uint8_t char_prop_read_notify = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
-static uint8_t char_prop_read_write = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE;
-
-// CCCD (Client Characteristic Configuration Descriptor) default value
-static uint8_t cccd[2] = {0x00, 0x00};
-static uint8_t calibration_cccd[2] = {0x00, 0x00};
-
-static esp_ble_adv_params_t adv_params = {
-    .adv_int_min = 0x20,  // 20ms
-    .adv_int_max = 0x20,  // 20ms
-    .adv_type = ADV_TYPE_IND,
-    .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
-    .channel_map = ADV_CHNL_ALL,
-    .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
-};
-
-static uint8_t adv_raw_data[] = {
-    0x02, ESP_BLE_AD_TYPE_FLAG, 0x06,
-    0x0C, ESP_BLE_AD_TYPE_NAME_CMPL, 'B', 'L', 'E', '_', 'E', 'n', 'c', 'o', 'd', 'e', 'r',
-    0x02, ESP_BLE_AD_TYPE_TX_PWR, 0x09,
-};
-
-// LED Color Control
-typedef struct {
-    bool red;
-    bool green;
-    bool blue;
-} led_color_t;
-
-static const led_color_t LED_GREEN = {false, true, false};
-static const led_color_t LED_YELLOW = {true, true, false};
-static const led_color_t LED_RED = {true, false, false};
-static const led_color_t LED_BLUE = {false, false, true};
-
-/**
- * @brief Set RGB LED color
- * @param color LED color structure containing RGB values
- */
-static void set_led_color(led_color_t color)
-{
-    gpio_set_level(RED_LED_GPIO, color.red);
-    gpio_set_level(GREEN_LED_GPIO, color.green);
-    gpio_set_level(BLUE_LED_GPIO, color.blue);
-}
-
-/**
- * @brief Get LED color based on encoder position
- * @param position Current encoder position
- * @return LED color structure
- */
-static led_color_t get_led_color_for_position(int position)
-{
-    if (position >= GREEN_ZONE_MIN && position <= GREEN_ZONE_MAX) {
-        return LED_GREEN;
-    } else if ((position > GREEN_ZONE_MAX && position <= YELLOW_ZONE_MAX) || 
-               (position < GREEN_ZONE_MIN && position >= YELLOW_ZONE_MIN)) {
-        return LED_YELLOW;
-    } else {
-        return LED_RED;
-    }
-}
-
-/**
- * @brief Update LED based on encoder position
- * @param position Current encoder position
- */
-static void update_led_for_position(int position)
-{
-    led_color_t color = get_led_color_for_position(position);
-    set_led_color(color);
-}
+static bool zone_resend = false;      // Notify the zone once a central is back, after a wake from deep sleep
+static int64_t last_activity_us = 0;  // Last connection, step or button press, for the deep sleep idle time
+static quadrature_resolution_t resolution = ENCODER_RESOLUTION;
+static volatile uint8_t requested_resolution = 0;  // Written by the BLE host task, applied by the encoder loop
+static bool zero_set = false;         // A zero point was set since boot
+static int64_t zero_set_us = 0;
+
+// Alert rules: the BLE host task stores a verified program, the encoder loop installs and runs it
+static rules_t rules;
+static portMUX_TYPE rules_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t rules_program[RULES_PROGRAM_MAX];  // Under rules_lock
+static size_t rules_program_len = 0;
+static bool rules_pending = false;
+_Static_assert(RULES_PROGRAM_MAX == BLE_RULES_MAX_LEN, "Rules program must fit the rules characteristic");
+
+// Statically allocated runtime buffers; only one position backend runs at a time
+static union {
+    encoder_info_t quadrature;
+    pcnt_encoder_t pcnt;
+    abs_encoder_t absolute;
+} position_backend;
+static position_source_t position_source;
+static StaticQueue_t encoder_queue_buffer;
+static uint8_t encoder_queue_storage[ENCODER_QUEUE_LENGTH * sizeof(encoder_event_t)];
+static StaticTask_t encoder_task_buffer;
+static StackType_t encoder_task_stack[ENCODER_TASK_STACK_SIZE];
+static gpio_glitch_filter_handle_t button_filter = NULL;
 
 /**
  * @brief Configure GPIO pins for button input
@@ -173,73 +141,129 @@ static void configure_button_gpio(void)
         .intr_type = GPIO_INTR_DISABLE
     };
     ESP_ERROR_CHECK(gpio_config(&io_conf));
+
+    if (BUTTON_GLITCH_FILTER_NS) {
+        esp_err_t ret = input_filter_enable(BUTTON_GPIO, BUTTON_GLITCH_FILTER_NS, &button_filter);
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Button glitch filter unavailable: %s", esp_err_to_name(ret));
+        }
+    }
 }
 
 /**
- * @brief Configure GPIO pins for LED outputs
+ * @brief Initialize rotary encoder
+ * @param info Pointer to rotary encoder info structure
+ * @return ESP_OK on success
  */
-static void configure_led_gpio(void)
+static esp_err_t initialize_rotary_encoder(encoder_info_t *info)
 {
-    gpio_config_t led_conf = {
-        .pin_bit_mask = (1ULL << RED_LED_GPIO) | (1ULL << GREEN_LED_GPIO) | (1ULL << BLUE_LED_GPIO),
-        .mode = GPIO_MODE_OUTPUT,
-        .pull_up_en = GPIO_PULLUP_DISABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE
-    };
-    ESP_ERROR_CHECK(gpio_config(&led_conf));
+    // Initialize the rotary encoder device with the GPIOs for A and B signals
+    esp_err_t ret = encoder_init(info, ROT_ENC_A_GPIO, ROT_ENC_B_GPIO);
+    if (ret == ESP_OK) {
+        ret = encoder_set_resolution(info, resolution);
+    }
+    if (ret == ESP_OK && FLIP_DIRECTION) {
+        ret = encoder_flip_direction(info);
+    }
+    if (ret == ESP_OK) {
+        ret = encoder_set_glitch_width(info, SIGNAL_GLITCH_WIDTH_US);
+    }
+    if (ret == ESP_OK && ENCODER_GLITCH_FILTER_NS) {
+        // Optional, decoding still works unfiltered on chips without a glitch filter
+        esp_err_t filter_ret = encoder_set_input_filter(info, ENCODER_GLITCH_FILTER_NS);
+        if (filter_ret != ESP_OK) {
+            ESP_LOGW(TAG, "Encoder glitch filter unavailable: %s", esp_err_to_name(filter_ret));
+        }
+    }
+    if (ret == ESP_OK) {
+        ret = encoder_set_min_edge_interval(info, ENCODER_MIN_EDGE_INTERVAL_US);
+    }
+    if (ret == ESP_OK && ENCODER_EDGE_CAPTURE) {
+        // Optional, without it event timestamps come from the CPU cycle counter in the GPIO ISR
+        esp_err_t capture_ret = encoder_enable_capture(info);
+        if (capture_ret != ESP_OK) {
+            ESP_LOGW(TAG, "Encoder edge capture unavailable: %s", esp_err_to_name(capture_ret));
+        }
+    }
+    return ret;
 }
 
 /**
- * @brief Initialize rotary encoder
- * @param info Pointer to rotary encoder info structure
- * @return Queue handle for encoder events
+ * @brief Start the configured position backend
+ * @param source Receives the position source
+ * @param event_queue Queue to receive encoder events
+ * @return ESP_OK on success
  */
-static QueueHandle_t initialize_rotary_encoder(rotary_encoder_info_t *info)
+static esp_err_t initialize_position_source(position_source_t *source, QueueHandle_t event_queue)
 {
-    // Initialize the rotary encoder device with the GPIOs for A and B signals
-    ESP_ERROR_CHECK(rotary_encoder_init(info, ROT_ENC_A_GPIO, ROT_ENC_B_GPIO));
-    ESP_ERROR_CHECK(rotary_encoder_enable_half_steps(info, ENABLE_HALF_STEPS));
-    
-    if (FLIP_DIRECTION) {
-        ESP_ERROR_CHECK(rotary_encoder_flip_direction(info));
+    esp_err_t ret;
+
+    switch (POSITION_SOURCE) {
+        case POSITION_SOURCE_PCNT: {
+            const pcnt_encoder_config_t config = {
+                .pin_a = ROT_ENC_A_GPIO,
+                .pin_b = ROT_ENC_B_GPIO,
+                .resolution = resolution,
+                .glitch_ns = ENCODER_GLITCH_FILTER_NS,
+                .flip = FLIP_DIRECTION,
+            };
+            ret = pcnt_encoder_init(&position_backend.pcnt, &config);
+            if (ret == ESP_OK) {
+                ret = pcnt_encoder_get_position_source(&position_backend.pcnt, source);
+            }
+            break;
+        }
+        case POSITION_SOURCE_ABSOLUTE: {
+            const abs_encoder_config_t config = {
+                .sda = ABS_SDA_GPIO,
+                .scl = ABS_SCL_GPIO,
+                .scl_hz = ABS_I2C_HZ,
+                .sample_period_ms = ABS_SAMPLE_PERIOD_MS,
+                .detents_per_turn = ABS_DETENTS_PER_TURN,
+                .resolution = resolution,
+                .flip = FLIP_DIRECTION,
+            };
+            ret = abs_encoder_init(&position_backend.absolute, &config);
+            if (ret == ESP_OK) {
+                ret = abs_encoder_get_position_source(&position_backend.absolute, source);
+            }
+            break;
+        }
+        default:
+            ret = initialize_rotary_encoder(&position_backend.quadrature);
+            if (ret == ESP_OK) {
+                ret = encoder_get_position_source(&position_backend.quadrature, source);
+            }
+            break;
     }
 
-    // Create a queue for events from the rotary encoder driver
-    QueueHandle_t event_queue = rotary_encoder_create_queue();
-    ESP_ERROR_CHECK(rotary_encoder_set_queue(info, event_queue));
-    
-    return event_queue;
+    if (ret == ESP_OK) {
+        ret = position_source_set_queue(source, event_queue);
+    }
+    return ret;
 }
 
 /**
- * @brief Send BLE notification with bounds checking
- * @param value Value to send
- * @param len Length of value
+ * @brief Restart the position backend in place, keeping the position
+ * @param source Position source
+ * @param event_queue Queue to receive encoder events
+ * @param position Position to carry over into the restarted backend
  * @return ESP_OK on success
  */
-static esp_err_t send_ble_notification(uint8_t *value, size_t len)
+static esp_err_t restart_position_source(position_source_t *source, QueueHandle_t event_queue, int32_t position)
 {
-    // Validate inputs
-    if (!value || len == 0 || len > CHAR_VALUE_MAX_LEN) {
-        ESP_LOGE(TAG, "Invalid notification parameters: len=%zu, max=%d", len, CHAR_VALUE_MAX_LEN);
-        return ESP_ERR_INVALID_ARG;
-    }
-    
-    // Check if BLE is ready and notifications are enabled
-    if (!notifications_enabled || !connection_established) {
-        ESP_LOGW(TAG, "BLE not ready for notifications or notifications disabled");
-        return ESP_ERR_INVALID_STATE;
+    // A backend that did not stop must not be started over itself, the caller retries later
+    esp_err_t ret = position_source_uninit(source);
+    if (ret != ESP_OK) {
+        return ret;
     }
-    
-    // Check if handles are valid
-    if (notify_gatts_if == 0 || gatt_handle_table[2] == 0) {
-        ESP_LOGW(TAG, "BLE handles not ready for notifications");
-        return ESP_ERR_INVALID_STATE;
+    xQueueReset(event_queue);
+
+    ret = initialize_position_source(source, event_queue);
+    if (ret == ESP_OK) {
+        ret = position_source_set_position(source, position);
     }
-    
-    return esp_ble_gatts_send_indicate(notify_gatts_if, notify_conn_id, 
-                                     gatt_handle_table[2], len, value, false);
+    return ret;
 }
 
 // Encoder Zone Control
@@ -251,6 +275,60 @@ typedef enum {
 
 static encoder_zone_t previous_zone = -1;
 
+// Last position seen through either the event queue or polling
+static int32_t encoder_position = 0;
+
+// Event bookkeeping for statistics
+static int last_event_position = 0;
+static int64_t pending_event_time_us = 0;  // Oldest event not yet reflected in a notification
+
+/**
+ * @brief Convert a position at the current resolution to whole detents, rounding toward zero
+ * @param position Encoder position
+ * @return Detents from zero
+ */
+static int32_t position_to_detents(int32_t position)
+{
+    return position / (int32_t)resolution;
+}
+
+/**
+ * @brief Get the positions that stay in the zone of a position
+ * @param position Current encoder position
+ * @param min Receives the lowest position in the zone
+ * @param max Receives the highest position in the zone
+ */
+static void get_zone_bounds(int32_t position, int32_t *min, int32_t *max)
+{
+    int32_t detents = position_to_detents(position);
+    int32_t partial = resolution - 1;
+
+    if (detents >= GREEN_ZONE_MIN && detents <= GREEN_ZONE_MAX) {
+        *min = GREEN_ZONE_MIN;
+        *max = GREEN_ZONE_MAX;
+    } else if (detents > GREEN_ZONE_MAX && detents <= YELLOW_ZONE_MAX) {
+        *min = GREEN_ZONE_MAX + 1;
+        *max = YELLOW_ZONE_MAX;
+    } else if (detents < GREEN_ZONE_MIN && detents >= YELLOW_ZONE_MIN) {
+        *min = YELLOW_ZONE_MIN;
+        *max = GREEN_ZONE_MIN - 1;
+    } else if (detents > YELLOW_ZONE_MAX) {
+        *min = YELLOW_ZONE_MAX + 1;
+        *max = INT32_MAX;
+    } else {
+        *min = INT32_MIN;
+        *max = YELLOW_ZONE_MIN - 1;
+    }
+
+    // Back to positions, including the partial detents that round toward zero into the zone
+    if (*min != INT32_MIN) {
+        *min = *min * (int32_t)resolution - (*min <= 0 ? partial : 0);
+    }
+    if (*max != INT32_MAX) {
+        *max = *max * (int32_t)resolution + (*max >= 0 ? partial : 0);
+    }
+}
+
 /**
  * @brief Get zone based on encoder position
  * @param position Current encoder position
@@ -258,6 +336,7 @@ static encoder_zone_t previous_zone = -1;
  */
 static encoder_zone_t get_zone_for_position(int position)
 {
+    position = position_to_detents(position);
     if (position >= GREEN_ZONE_MIN && position <= GREEN_ZONE_MAX) {
         return ZONE_GREEN;
     } else if ((position > GREEN_ZONE_MAX && position <= YELLOW_ZONE_MAX) ||
@@ -268,87 +347,202 @@ static encoder_zone_t get_zone_for_position(int position)
     }
 }
 
+/**
+ * @brief Frame code of a zone, which is also how rules and zone statistics name it
+ * @param zone Zone
+ * @return WIRE_FRAME_ZONE_*
+ */
+static uint8_t zone_frame(encoder_zone_t zone)
+{
+    static const uint8_t frames[] = {
+        [ZONE_GREEN] = WIRE_FRAME_ZONE_GREEN,
+        [ZONE_YELLOW] = WIRE_FRAME_ZONE_YELLOW,
+        [ZONE_RED] = WIRE_FRAME_ZONE_RED,
+    };
+    return frames[zone];
+}
+
+// LED Colors
+static const led_rgb_t LED_GREEN  = {0, 255, 0};
+static const led_rgb_t LED_YELLOW = {255, 160, 0};
+static const led_rgb_t LED_RED    = {255, 0, 0};
+static const led_rgb_t LED_BLUE   = {0, 0, 255};
+static const led_rgb_t LED_WHITE  = {255, 255, 255};
+
+/**
+ * @brief Show the LED pattern for a zone, or the calibration pattern
+ *
+ * Only calls into the LED module when the zone or calibration state changes;
+ * blinking and pulsing are then stepped by the LED module's own timer.
+ *
+ * @param zone Current encoder zone
+ */
+static void update_led_for_zone(encoder_zone_t zone)
+{
+    static encoder_zone_t shown_zone = -1;
+    static bool shown_calibration = false;
+
+    if (zone == shown_zone && calibration_mode == shown_calibration) {
+        return;
+    }
+    shown_zone = zone;
+    shown_calibration = calibration_mode;
+
+    if (calibration_mode) {
+        led_set_pattern(LED_PATTERN_PULSE, LED_BLUE, LED_CALIBRATION_PULSE_MS);
+        return;
+    }
+
+    switch (zone) {
+        case ZONE_GREEN:
+            led_set_color(LED_GREEN, LED_FADE_MS);
+            break;
+        case ZONE_YELLOW:
+            led_set_pattern(LED_PATTERN_BLINK, LED_YELLOW, LED_YELLOW_BLINK_MS);
+            break;
+        case ZONE_RED:
+            led_set_pattern(LED_PATTERN_BLINK, LED_RED, LED_RED_BLINK_MS);
+            break;
+    }
+}
+
 /**
  * @brief Process rotary encoder event
  * @param event Rotary encoder event structure
  */
-static void process_encoder_event(rotary_encoder_event_t event)
+static void process_encoder_event(encoder_event_t event)
 {
-    ESP_LOGI(TAG, "Event: position %d, direction %s", 
+    // Steps per second from the edge timestamps, free of loop and interrupt latency
+    uint32_t timestamp_hz = 0;
+    uint32_t speed_milli = 0;
+    if (event.interval && position_source_get_timestamp_hz(&position_source, &timestamp_hz) == ESP_OK) {
+        speed_milli = (uint32_t)((uint64_t)timestamp_hz * 1000 / event.interval);
+    }
+    ESP_LOGI(TAG, "Event: position %d, direction %s, %" PRIu32 ".%03" PRIu32 " steps/s",
              event.state.position,
-             event.state.direction ? (event.state.direction == ROTARY_ENCODER_DIRECTION_CLOCKWISE ? "CW" : "CCW") : "NOT_SET");
-    
-    if (!calibration_mode)
-        update_led_for_position(event.state.position);
+             event.state.direction ? (event.state.direction == ENCODER_DIRECTION_CLOCKWISE ? "CW" : "CCW") : "NOT_SET",
+             speed_milli / 1000, speed_milli % 1000);
+
+    encoder_position = event.state.position;
+    last_activity_us = esp_timer_get_time();
+    health_note_encoder_event(event.state.position);
+    stats_inc(STATS_ENCODER_EVENTS);
+    // The driver queue only holds the latest state, so a jump of more than one step means events were dropped
+    if (abs(event.state.position - last_event_position) > 1) {
+        stats_inc(STATS_QUEUE_OVERFLOWS);
+    }
+    last_event_position = event.state.position;
+    if (!pending_event_time_us) {
+        pending_event_time_us = esp_timer_get_time();
+    }
+
+    update_led_for_zone(get_zone_for_position(event.state.position));
 }
 
 /**
  * @brief Poll rotary encoder state and update related values
- * @param info Pointer to rotary encoder info structure
+ * @param source Position source
  */
-static void poll_encoder_state(rotary_encoder_info_t *info)
+static void poll_encoder_state(position_source_t *source)
 {
-    rotary_encoder_state_t state = { 0 };
-    ESP_ERROR_CHECK(rotary_encoder_get_state(info, &state));
-
-    if (!calibration_mode)
-        update_led_for_position(state.position);
+    // Lock-free read of what the decode path last published, it never holds up an edge
+    encoder_event_t snapshot = { 0 };
+    esp_err_t err = position_source_read_snapshot(source, &snapshot);
+    if (err != ESP_OK) {
+        health_report_encoder_error(err);
+        return;
+    }
+    encoder_state_t state = snapshot.state;
+    encoder_position = state.position;
+    health_note_encoder_poll(state.position);
 
     encoder_zone_t current_zone = get_zone_for_position(state.position);
+    update_led_for_zone(current_zone);
 
-    if (current_zone != previous_zone && ble_service_started && !calibration_mode) {
+    bool resend = zone_resend && ble_is_connected();
+    if ((current_zone != previous_zone || resend) && ble_is_ready() && !calibration_mode) {
+        if (current_zone != previous_zone) {
+            stats_inc(STATS_ZONE_TRANSITIONS);
+        }
         previous_zone = current_zone;
 
         uint8_t notification_val = 0x00;
         switch (current_zone) {
             case ZONE_GREEN:
-                notification_val = 0x02;
+                notification_val = WIRE_FRAME_ZONE_GREEN;
                 ESP_LOGI(TAG, "Zone changed to GREEN");
                 break;
             case ZONE_YELLOW:
-                notification_val = 0x03;
+                notification_val = WIRE_FRAME_ZONE_YELLOW;
                 ESP_LOGI(TAG, "Zone changed to YELLOW");
                 break;
             case ZONE_RED:
-                notification_val = 0x01;
+                notification_val = WIRE_FRAME_ZONE_RED;
                 ESP_LOGI(TAG, "Zone changed to RED");
                 break;
         }
 
-        esp_err_t ret = send_ble_notification(&notification_val, sizeof(notification_val));
+        esp_err_t ret = ble_notify(&notification_val, sizeof(notification_val));
         if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
             ESP_LOGE(TAG, "Failed to send notification: %s", esp_err_to_name(ret));
         }
+        if (ret == ESP_OK && pending_event_time_us) {
+            stats_record(STATS_HIST_NOTIFY_LATENCY, (uint32_t)(esp_timer_get_time() - pending_event_time_us));
+        }
+        if (ret == ESP_OK) {
+            zone_resend = false;
+        }
     }
+    pending_event_time_us = 0;
 
     // Reset if position exceeds threshold
-    if (RESET_AT && (state.position >= RESET_AT || state.position <= -RESET_AT)) {
+    int32_t detents = position_to_detents(state.position);
+    if (RESET_AT && (detents >= RESET_AT || detents <= -RESET_AT)) {
         ESP_LOGI(TAG, "Reset due to position limit");
-        ESP_ERROR_CHECK(rotary_encoder_reset(info));
+        err = position_source_reset(source);
+        if (err != ESP_OK) {
+            health_report_encoder_error(err);
+            return;
+        }
+        encoder_position = 0;
+        last_event_position = 0;
+        health_note_encoder_event(0);
     }
 }
 
 
 /**
  * @brief Handle button press/release events
- * @param info Pointer to rotary encoder info structure
+ * @param source Position source
  * @param prev_button_pressed Pointer to previous button state
  */
-static void handle_button_events(rotary_encoder_info_t *info, bool *prev_button_pressed)
+static void handle_button_events(position_source_t *source, bool *prev_button_pressed)
 {
     bool button_pressed = (gpio_get_level(BUTTON_GPIO) == 0);  // Active low
 
     if (button_pressed && !(*prev_button_pressed)) {
         // Button was just pressed
         ESP_LOGI(TAG, "Button Pressed!");
+        last_activity_us = esp_timer_get_time();
         if(calibration_mode){
             ESP_LOGI(TAG, "Setting zero point");
-            ESP_ERROR_CHECK(rotary_encoder_reset(info));
-            uint8_t notification_val = 0x04;
-            esp_err_t ret = send_ble_notification(&notification_val, sizeof(notification_val));
+            esp_err_t err = position_source_reset(source);
+            if (err != ESP_OK) {
+                health_report_encoder_error(err);
+                return;
+            }
+            encoder_position = 0;
+            last_event_position = 0;
+            health_note_encoder_event(0);
+            zero_set = true;
+            zero_set_us = esp_timer_get_time();
+            uint8_t notification_val = WIRE_FRAME_ZERO_SET;
+            esp_err_t ret = ble_notify(&notification_val, sizeof(notification_val));
             if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
                 ESP_LOGE(TAG, "Failed to send notification: %s", esp_err_to_name(ret));
             }
+        } else if (!ble_is_connected()) {
+            ble_open_pairing_window();
         }
     } else if (!button_pressed && (*prev_button_pressed)) {
         // Button was just released
@@ -358,321 +552,616 @@ static void handle_button_events(rotary_encoder_info_t *info, bool *prev_button_
     *prev_button_pressed = button_pressed;
 }
 
-void app_main(void)
+/**
+ * @brief Evaluate the encoder signal quality and tell the central when it degrades or recovers
+ * @param source Position source
+ */
+static void check_signal_quality(position_source_t *source)
 {
-    esp_err_t ret;
-
-    // Compile-time check for advertising data size
-    _Static_assert(sizeof(adv_raw_data) <= ADV_DATA_MAX_LEN, "Advertising data too large");
+    static const encoder_quality_limits_t limits = {
+        .illegal_per_s = SIGNAL_MAX_ILLEGAL_PER_S,
+        .glitches_per_s = SIGNAL_MAX_GLITCHES_PER_S,
+        .reversals_per_s = SIGNAL_MAX_REVERSALS_PER_S,
+    };
+    encoder_quality_t quality;
+    uint32_t isr_raw, isr_accepted;
 
-    //initialize NVS
-    ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
+    if (POSITION_SOURCE == POSITION_SOURCE_QUADRATURE &&
+        encoder_get_isr_counts(&position_backend.quadrature, &isr_raw, &isr_accepted) == ESP_OK) {
+        stats_set(STATS_ENCODER_ISR_RAW, isr_raw);
+        stats_set(STATS_ENCODER_ISR_ACCEPTED, isr_accepted);
     }
-    ESP_ERROR_CHECK( ret );
 
-    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
-    esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
-    ret = esp_bt_controller_init(&bt_cfg);
-    if (ret) {
-        ESP_LOGE(CONN_TAG, "%s initialize controller failed: %s", __func__, esp_err_to_name(ret));
+    bool changed = position_source_check_quality(source, &limits, &quality);
+    stats_set(STATS_SIGNAL_ILLEGAL, quality.illegal);
+    stats_set(STATS_SIGNAL_GLITCHES, quality.glitches);
+    stats_set(STATS_SIGNAL_REVERSALS, quality.reversals);
+    stats_set(STATS_SIGNAL_DEGRADED, quality.degraded);
+    if (!changed) {
         return;
     }
 
-    ret = esp_bt_controller_enable(ESP_BT_MODE_BLE);
-    if (ret) {
-        ESP_LOGE(CONN_TAG, "%s enable controller failed: %s", __func__, esp_err_to_name(ret));
+    uint8_t notification_val;
+    if (quality.degraded) {
+        ESP_LOGW(TAG, "Encoder signal degraded: %" PRIu32 " illegal, %" PRIu32 " glitches, %" PRIu32 " reversals per second",
+                 quality.illegal_per_s, quality.glitches_per_s, quality.reversals_per_s);
+        notification_val = WIRE_FRAME_SIGNAL_DEGRADED;
+    } else {
+        ESP_LOGI(TAG, "Encoder signal recovered");
+        notification_val = WIRE_FRAME_SIGNAL_RECOVERED;
+    }
+
+    esp_err_t ret = ble_notify(&notification_val, sizeof(notification_val));
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to send notification: %s", esp_err_to_name(ret));
+    }
+}
+
+/**
+ * @brief Load the resolution last written by a central
+ */
+static void load_resolution(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
         return;
     }
 
-    ret = esp_bluedroid_init();
-    if (ret) {
-        ESP_LOGE(CONN_TAG, "%s init bluetooth failed: %s", __func__, esp_err_to_name(ret));
+    uint8_t stored = 0;
+    if (nvs_get_u8(handle, "resolution", &stored) == ESP_OK &&
+        (stored == QUADRATURE_X1 || stored == QUADRATURE_X2 || stored == QUADRATURE_X4)) {
+        resolution = stored;
+    }
+    nvs_close(handle);
+}
+
+/**
+ * @brief Store the resolution so it survives a reset
+ */
+static void save_resolution(void)
+{
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret == ESP_OK) {
+        ret = nvs_set_u8(handle, "resolution", resolution);
+        if (ret == ESP_OK) {
+            ret = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to store resolution: %s", esp_err_to_name(ret));
+    }
+}
+
+/**
+ * @brief Switch to a resolution requested by the central
+ *
+ * The driver rescales the position, so the zone thresholds, which are in
+ * detents, keep pointing at the same shaft angles.
+ *
+ * @param source Position source
+ */
+static void apply_requested_resolution(position_source_t *source)
+{
+    quadrature_resolution_t requested = requested_resolution;
+    if (!requested) {
+        return;
+    }
+    requested_resolution = 0;
+    if (requested == resolution) {
         return;
     }
 
-    ret = esp_bluedroid_enable();
-    if (ret) {
-        ESP_LOGE(CONN_TAG, "%s enable bluetooth failed: %s", __func__, esp_err_to_name(ret));
+    esp_err_t err = position_source_set_resolution(source, requested);
+    encoder_state_t state = { 0 };
+    if (err == ESP_OK) {
+        err = position_source_get_state(source, &state);
+    }
+    if (err != ESP_OK) {
+        health_report_encoder_error(err);
         return;
     }
 
-    ret = esp_ble_gap_register_callback(esp_gap_cb);
-    if (ret) {
-        ESP_LOGE(CONN_TAG, "%s gap register failed, error code = %x", __func__, ret);
+    ESP_LOGI(TAG, "Resolution x%d, position %" PRId32 " -> %" PRId32, requested, encoder_position, state.position);
+    resolution = requested;
+    encoder_position = state.position;
+    last_event_position = state.position;
+    health_note_encoder_event(state.position);
+    save_resolution();
+}
+
+/**
+ * @brief Publish the resolution and the edge rate the decode path can sustain at it
+ */
+static void update_resolution_stats(void)
+{
+    uint32_t cycles = 0;
+    stats_set(STATS_ENCODER_RESOLUTION, resolution);
+    if (POSITION_SOURCE == POSITION_SOURCE_QUADRATURE &&
+        encoder_get_isr_max_cycles(&position_backend.quadrature, &cycles) == ESP_OK && cycles) {
+        stats_set(STATS_ENCODER_ISR_MAX_CYCLES, cycles);
+        stats_set(STATS_ENCODER_MAX_EDGE_RATE, esp_rom_get_cpu_ticks_per_us() * 1000000 / cycles);
+    }
+}
+
+/**
+ * @brief Load the rules program last written by a central and install it
+ */
+static void load_rules(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
         return;
     }
 
-    ret = esp_ble_gatts_register_callback(gatts_event_handler);
-    if (ret) {
-        ESP_LOGE(CONN_TAG, "%s gatts register failed, error code = %x", __func__, ret);
+    static uint8_t program[RULES_PROGRAM_MAX];
+    size_t len = sizeof(program);
+    esp_err_t ret = nvs_get_blob(handle, "rules", program, &len);
+    nvs_close(handle);
+    if (ret != ESP_OK) {
+        return;
+    }
+    if (!rules_load(&rules, program, len)) {
+        ESP_LOGW(TAG, "Stored rules program rejected, %d bytes", (int)len);
         return;
     }
+    ESP_LOGI(TAG, "Rules program loaded, %d bytes", (int)len);
+
+    // The BLE stack is already up, a central may read the program from here on
+    portENTER_CRITICAL(&rules_lock);
+    if (!rules_pending) {
+        memcpy(rules_program, program, len);
+        rules_program_len = len;
+    }
+    portEXIT_CRITICAL(&rules_lock);
+}
+
+/**
+ * @brief Store the rules program so it survives a reset, an empty one erases it
+ * @param program Program bytes
+ * @param len Program length
+ */
+static void save_rules(const uint8_t *program, size_t len)
+{
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret == ESP_OK) {
+        ret = len ? nvs_set_blob(handle, "rules", program, len) : nvs_erase_key(handle, "rules");
+        if (ret == ESP_ERR_NVS_NOT_FOUND) {
+            ret = ESP_OK;
+        }
+        if (ret == ESP_OK) {
+            ret = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to store rules program: %s", esp_err_to_name(ret));
+    }
+}
 
-    ret = esp_ble_gatts_app_register(APP_ID_PLACEHOLDER);
-    if (ret) {
-        ESP_LOGE(CONN_TAG, "%s gatts app register failed, error code = %x", __func__, ret);
+/**
+ * @brief Install a rules program written by the central
+ */
+static void apply_pending_rules(void)
+{
+    static uint8_t program[RULES_PROGRAM_MAX];
+    size_t len = 0;
+
+    portENTER_CRITICAL(&rules_lock);
+    bool pending = rules_pending;
+    if (pending) {
+        len = rules_program_len;
+        memcpy(program, rules_program, len);
+        rules_pending = false;
+    }
+    portEXIT_CRITICAL(&rules_lock);
+    if (!pending) {
         return;
     }
 
-    ret = esp_ble_gatt_set_local_mtu(500);
-    if (ret) {
-        ESP_LOGE(CONN_TAG, "set local  MTU failed, error code = %x", ret);
+    // Verified by on_rules_written, so this cannot fail
+    rules_load(&rules, program, len);
+    ESP_LOGI(TAG, "Rules program installed, %d bytes", (int)len);
+    save_rules(program, len);
+}
+
+/**
+ * @brief Send a rule alert to the central
+ * @param rule Index of the rule in the program
+ * @param code Alert code given by the program
+ * @param ctx Unused
+ */
+static void send_rule_alert(uint8_t rule, uint8_t code, void *ctx)
+{
+    ESP_LOGI(TAG, "Rule %u alert %u", rule, code);
+    stats_inc(STATS_RULE_ALERTS);
+
+    uint8_t frame[WIRE_RULE_ALERT_LEN];
+    wire_pack_rule_alert(frame, &(wire_rule_alert_t){ .rule = rule, .code = code });
+    esp_err_t ret = ble_notify(frame, sizeof(frame));
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to send notification: %s", esp_err_to_name(ret));
+    }
+}
+
+/**
+ * @brief Run the rules program against the current position and zone
+ * @param zone Zone as its frame code
+ * @param detents Position in detents
+ */
+static void evaluate_rules(uint8_t zone, int32_t detents)
+{
+    int64_t now = esp_timer_get_time();
+    const rules_input_t in = {
+        .now_ms = (uint32_t)(now / 1000),
+        .position = detents,
+        .zone = zone,
+        .calibrating = calibration_mode,
+        .calibrated = zero_set,
+        .calibrated_ms = (uint32_t)(zero_set_us / 1000),
+    };
+    rules_evaluate(&rules, &in, send_rule_alert, NULL);
+}
+
+/**
+ * @brief Process a step event and run the rules against its position
+ *
+ * The queue keeps only the latest event, so the rules have to see each one
+ * when it is taken; a zone entered and left between two loop passes would
+ * otherwise never reach them.
+ *
+ * @param event Rotary encoder event structure
+ */
+static void handle_step_event(encoder_event_t event)
+{
+    process_encoder_event(event);
+    evaluate_rules(zone_frame(get_zone_for_position(event.state.position)), position_to_detents(event.state.position));
+}
+
+/**
+ * @brief Restart whichever subsystem the health monitor reports as stalled
+ * @param source Position source
+ * @param event_queue Queue receiving encoder events
+ * @return true if nothing needed a recovery
+ */
+static bool run_health_checks(position_source_t *source, QueueHandle_t event_queue)
+{
+    health_recovery_t recovery = health_check();
+
+    switch (recovery) {
+        case HEALTH_RECOVERY_ENCODER_ERROR:
+        case HEALTH_RECOVERY_EVENT_STALL: {
+            ESP_LOGW(TAG, "Restarting encoder driver, reason %d", recovery);
+            esp_err_t ret = restart_position_source(source, event_queue, encoder_position);
+            if (ret != ESP_OK) {
+                // Raises the same recovery at the next check, which tries again
+                ESP_LOGE(TAG, "Encoder restart failed: %s", esp_err_to_name(ret));
+                health_report_encoder_error(ret);
+                return false;
+            }
+            break;
+        }
+        case HEALTH_RECOVERY_ADVERTISING:
+            ESP_LOGW(TAG, "Advertising did not resume, restarting it");
+            ble_restart_advertising();
+            break;
+        default:
+            return true;
+    }
+
+    health_record_recovery(recovery, encoder_position);
+    return false;
+}
+
+/**
+ * @brief Keep a freshly updated image once it has advertised and run the loop without recoveries
+ *
+ * Until then the image stays pending, and a reset from a crash or the
+ * watchdog rolls the bootloader back to the previous one.
+ *
+ * @param healthy This iteration needed no recovery
+ */
+static void confirm_image_when_healthy(bool healthy)
+{
+    static uint32_t healthy_loops = 0;
+    static bool confirmed = false;
+
+    if (confirmed) {
         return;
     }
+    if (!healthy || !ble_has_advertised()) {
+        healthy_loops = 0;
+        return;
+    }
+    if (++healthy_loops < OTA_CONFIRM_LOOPS) {
+        return;
+    }
+    confirmed = true;
+    esp_err_t ret = ota_confirm_running_image();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to confirm running image: %s", esp_err_to_name(ret));
+    }
+}
 
-    ret = esp_ble_gap_set_device_name(device_name);
-    if (ret) {
-        ESP_LOGE(CONN_TAG, "set device name failed, error code = %x", ret);
+/**
+ * @brief Hand the encoder to the coprocessor and enter deep sleep once disconnected and idle
+ *
+ * Only returns if the sleep could not be entered, with the driver restarted.
+ * The coprocessor decodes A/B, so an absolute sensor keeps the device awake.
+ *
+ * @param source Position source
+ * @param event_queue Queue receiving encoder events
+ */
+static void enter_deep_sleep_when_idle(position_source_t *source, QueueHandle_t event_queue)
+{
+#if CONFIG_ENCODER_DEEP_SLEEP
+    int64_t now = esp_timer_get_time();
+    if (POSITION_SOURCE == POSITION_SOURCE_ABSOLUTE || ble_is_connected() || calibration_mode || ota_in_progress()) {
+        last_activity_us = now;
+        return;
+    }
+    if (now - last_activity_us < (int64_t)CONFIG_ENCODER_DEEP_SLEEP_IDLE_S * 1000000) {
         return;
     }
 
-    ret = esp_ble_gap_config_adv_data_raw(adv_raw_data, sizeof(adv_raw_data));
-    if (ret) {
-        ESP_LOGE(CONN_TAG, "config adv data failed, error code = %x", ret);
+    deep_sleep_config_t config = {
+        .pin_a = ROT_ENC_A_GPIO,
+        .pin_b = ROT_ENC_B_GPIO,
+        .position = encoder_position,
+        .resolution = resolution,
+        .flip = FLIP_DIRECTION,
+    };
+    get_zone_bounds(encoder_position, &config.wake_min, &config.wake_max);
+    esp_err_t ret = position_source_uninit(source);
+    if (ret != ESP_OK) {
+        // The driver still owns the pins, leave them to the health monitor's restart
+        last_activity_us = now;
+        health_report_encoder_error(ret);
+        return;
     }
-    
-    // Install GPIO ISR service (required for rotary encoder)
-    ESP_ERROR_CHECK(gpio_install_isr_service(0));
+    ret = deep_sleep_enter(&config);
+
+    // Still awake, keep counting on the main core and try again after another idle period
+    ESP_LOGE(TAG, "Deep sleep failed: %s", esp_err_to_name(ret));
+    last_activity_us = now;
+    ret = restart_position_source(source, event_queue, encoder_position);
+    if (ret != ESP_OK) {
+        health_report_encoder_error(ret);
+    }
+#endif
+}
 
-    // Configure GPIO pins
-    configure_button_gpio();
-    configure_led_gpio();
+/**
+ * @brief Encoder main loop: drains encoder events, polls state, handles the button and health checks
+ * @param arg Unused
+ */
+static void encoder_loop_task(void *arg)
+{
+    // Subscribe the main loop to the task watchdog
+    ESP_ERROR_CHECK(health_init(HEALTH_WDT_TIMEOUT_MS));
+
+    // Take the pins and the position back from the coprocessor after a wake from deep sleep
+    int32_t slept_position = 0;
+    bool woke_from_sleep = deep_sleep_resume(&slept_position);
+
+    // Initialize the position backend
+    load_resolution();
+    load_rules();
+    position_source_t *source = &position_source;
+    QueueHandle_t event_queue = xQueueCreateStatic(ENCODER_QUEUE_LENGTH, sizeof(encoder_event_t),
+                                                   encoder_queue_storage, &encoder_queue_buffer);
+    ESP_ERROR_CHECK(initialize_position_source(source, event_queue));
+    ESP_LOGI(TAG, "Position source: %s", source->name);
+
+    // Streams samples whenever a central opens the L2CAP channel
+    esp_err_t ret = capture_init(source);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Capture init failed: %s", esp_err_to_name(ret));
+    }
 
-    // Initialize rotary encoder
-    rotary_encoder_info_t info = { 0 };
-    QueueHandle_t event_queue = initialize_rotary_encoder(&info);
+    // Carry the position over deep sleep, or over a watchdog or panic reset
+    int32_t preserved_position = 0;
+    if (woke_from_sleep) {
+        ESP_ERROR_CHECK(position_source_set_position(source, slept_position));
+        encoder_position = slept_position;
+        last_event_position = slept_position;
+        zone_resend = true;
+    } else if (health_get_preserved_position(&preserved_position)) {
+        ESP_ERROR_CHECK(position_source_set_position(source, preserved_position));
+        encoder_position = preserved_position;
+        health_record_recovery(HEALTH_RECOVERY_WATCHDOG, preserved_position);
+    }
     
     bool prev_button_pressed = false;
 
     // Main event loop
     while (1) {
+        int64_t loop_start_us = esp_timer_get_time();
+
         // Check for rotary encoder events
-        rotary_encoder_event_t event = { 0 };
+        encoder_event_t event = { 0 };
         if (xQueueReceive(event_queue, &event, 0) == pdTRUE) {
-            process_encoder_event(event);
+            handle_step_event(event);
         } else {
             // No event received, poll current position
-            poll_encoder_state(&info);
+            poll_encoder_state(source);
         }
 
         // Handle button events
-        handle_button_events(&info, &prev_button_pressed);
-
-        // Task delay
-        vTaskDelay(TASK_DELAY_MS / portTICK_PERIOD_MS);
+        handle_button_events(source, &prev_button_pressed);
+
+        // Raise or clear the degraded-signal flag
+        check_signal_quality(source);
+
+        // Take up a resolution written by the central
+        apply_requested_resolution(source);
+        update_resolution_stats();
+
+        // Zone statistics see the position and zone once per loop; the rules also
+        // run here for the conditions that only change with time, held zones and zone time
+        uint8_t zone = zone_frame(get_zone_for_position(encoder_position));
+        int32_t detents = position_to_detents(encoder_position);
+        zone_stats_update(zone, detents);
+        apply_pending_rules();
+        evaluate_rules(zone, detents);
+
+        // Feed the watchdog and restart anything that stalled
+        health_feed(encoder_position);
+        confirm_image_when_healthy(run_health_checks(source, event_queue));
+
+        // Does not return when the device goes to sleep
+        enter_deep_sleep_when_idle(source, event_queue);
+
+        stats_record(STATS_HIST_LOOP_TIME, (uint32_t)(esp_timer_get_time() - loop_start_us));
+
+        // Task delay, spent waiting on the queue so each step is handled as it arrives
+        TickType_t wait_start = xTaskGetTickCount();
+        TickType_t wait = TASK_DELAY_MS / portTICK_PERIOD_MS;
+        TickType_t waited;
+        while ((waited = xTaskGetTickCount() - wait_start) < wait &&
+               xQueueReceive(event_queue, &event, wait - waited) == pdTRUE) {
+            handle_step_event(event);
+        }
     }
 
     // Cleanup (this code is never reached in the current implementation)
     ESP_LOGE(TAG, "Unexpected exit from main loop");
-    ESP_ERROR_CHECK(rotary_encoder_uninit(&info));
+    ESP_ERROR_CHECK(position_source_uninit(source));
+    vTaskDelete(NULL);
 }
 
-static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+/**
+ * @brief Leave calibration mode and flash the LED when the central disconnects
+ * @param reason HCI disconnect reason
+ */
+static void on_ble_disconnected(uint8_t reason)
 {
-    switch (event) {
-    case ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT:
-        ESP_LOGI(CONN_TAG, "Advertising data set, status %d", param->adv_data_raw_cmpl.status);
-        esp_ble_gap_start_advertising(&adv_params);
-        break;
-    case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
-        if (param->adv_start_cmpl.status != ESP_BT_STATUS_SUCCESS) {
-            ESP_LOGE(CONN_TAG, "Advertising start failed, status %d", param->adv_start_cmpl.status);
-            break;
-        }
-        ESP_LOGI(CONN_TAG, "Advertising start successfully");
-        break;
-    case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
-        if (param->adv_stop_cmpl.status != ESP_BT_STATUS_SUCCESS) {
-            ESP_LOGE(CONN_TAG, "Advertising stop failed, status %d", param->adv_stop_cmpl.status);
-        }
-        ESP_LOGI(CONN_TAG, "Advertising stop successfully");
-        break;
-    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
-        ESP_LOGI(CONN_TAG, "Connection params update, status %d, conn_int %d, latency %d, timeout %d",
-                    param->update_conn_params.status,
-                    param->update_conn_params.conn_int,
-                    param->update_conn_params.latency,
-                    param->update_conn_params.timeout);
-        break;
-    default:
-        break;
-    }
-}
-
-static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
-{
-    static uint16_t gatt_service_uuid = GATTS_SERVICE_UUID;
-    static uint16_t gatt_char_uuid    = GATTS_CHAR_UUID;
-    static uint16_t gatt_calibration_char_uuid = GATTS_CALIBRATION_CHAR_UUID;
-
-    switch (event) {
-    case ESP_GATTS_REG_EVT:
-        ESP_LOGI(CONN_TAG, "GATT server register, status %d, app_id %d", param->reg.status, param->reg.app_id);
-        
-        // Create attribute table
-                esp_gatts_attr_db_t gatt_db[GATTS_NUM_HANDLE] = {
-            // Service Declaration
-            [0] = {
-                {ESP_GATT_AUTO_RSP},
-                {ESP_UUID_LEN_16, (uint8_t*)&primary_service_uuid, ESP_GATT_PERM_READ,
-                sizeof(uint16_t), sizeof(gatt_service_uuid), (uint8_t*)&gatt_service_uuid}
-            },
-            // Characteristic Declaration 
-            [1] = {
-                {ESP_GATT_AUTO_RSP},
-                {ESP_UUID_LEN_16, (uint8_t*)&character_declaration_uuid, ESP_GATT_PERM_READ,
-                sizeof(uint8_t), sizeof(uint8_t), (uint8_t*)&char_prop_read_notify}
-            },
-            // Characteristic Value
-            [2] = {
-                {ESP_GATT_RSP_BY_APP},
-                {ESP_UUID_LEN_16, (uint8_t*)&gatt_char_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, // Perm_write added for flexibility, though not used in original plan
-                CHAR_VALUE_MAX_LEN, sizeof(char_value_buffer), char_value_buffer}
-            },
-            // Client Characteristic Configuration Descriptor (CCCD)
-            [3] = {
-                {ESP_GATT_AUTO_RSP},
-                {ESP_UUID_LEN_16, (uint8_t*)&character_client_config_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-                sizeof(uint16_t), sizeof(cccd), (uint8_t*)cccd}
-            },
-            // Calibration Characteristic Declaration
-            [4] = {
-                {ESP_GATT_AUTO_RSP},
-                {ESP_UUID_LEN_16, (uint8_t*)&character_declaration_uuid, ESP_GATT_PERM_READ,
-                sizeof(uint8_t), sizeof(uint8_t), (uint8_t*)&char_prop_read_write}
-            },
-            // Calibration Characteristic Value
-            [5] = {
-                {ESP_GATT_RSP_BY_APP},
-                {ESP_UUID_LEN_16, (uint8_t*)&gatt_calibration_char_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-                sizeof(uint8_t), sizeof(uint8_t), (uint8_t*)&calibration_mode} // Store calibration_mode state directly
-            }
-        };
-        
-        // Create the attribute table
-        esp_err_t create_attr_ret = esp_ble_gatts_create_attr_tab(gatt_db, gatts_if, GATTS_NUM_HANDLE, 0);
-        if (create_attr_ret) {
-            ESP_LOGE(CONN_TAG, "create attr table failed, error code = %x", create_attr_ret);
-        }
-        break;
+    calibration_mode = false;
+    led_flash(LED_WHITE, LED_DISCONNECT_FLASHES, LED_DISCONNECT_FLASH_MS);
+}
 
-    case ESP_GATTS_CREAT_ATTR_TAB_EVT:
-        if (param->add_attr_tab.status != ESP_GATT_OK) {
-            ESP_LOGE(CONN_TAG, "create attribute table failed, error code=0x%x", param->add_attr_tab.status);
-            break;
-        }
-        
-        if (param->add_attr_tab.num_handle != GATTS_NUM_HANDLE) {
-            ESP_LOGE(CONN_TAG, "create attribute table abnormally, num_handle (%d) doesn't equal to GATTS_NUM_HANDLE(%d)", 
-                    param->add_attr_tab.num_handle, GATTS_NUM_HANDLE);
-            break;
-        }
-        
-        ESP_LOGI(CONN_TAG, "create attribute table successfully, the number handle = %d", param->add_attr_tab.num_handle);
-        memcpy(gatt_handle_table, param->add_attr_tab.handles, sizeof(gatt_handle_table));
-        
-        // Start the service
-        esp_ble_gatts_start_service(gatt_handle_table[0]);
-        break;
-
-    case ESP_GATTS_READ_EVT:
-        ESP_LOGI(CONN_TAG, "GATT read request, handle = %d", param->read.handle);
-        esp_gatt_rsp_t rsp;
-        memset(&rsp, 0, sizeof(esp_gatt_rsp_t));
-        rsp.attr_value.handle = param->read.handle;
-
-        // Handle read for calibration characteristic
-        if (param->read.handle == gatt_handle_table[5]) { // Handle for calibration_mode value
-            rsp.attr_value.len = 1;
-            rsp.attr_value.value[0] = calibration_mode ? 0x01 : 0x00;
-            ESP_LOGI(CONN_TAG, "Reading calibration mode: %s", calibration_mode ? "ON" : "OFF");
-        } else {
-            rsp.attr_value.len = 1;
-            rsp.attr_value.value[0] = 0x00;  // Default value for other reads
-        }
-        esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id, ESP_GATT_OK, &rsp);
-        break;
-
-    case ESP_GATTS_START_EVT:
-        ESP_LOGI(CONN_TAG, "Service start successfully, status %d, service_handle %d", 
-                param->start.status, param->start.service_handle);
-        ble_service_started = true;  // ADD THIS LINE
-        break;
-        
-    case ESP_GATTS_CONNECT_EVT:
-        esp_ble_conn_update_params_t conn_params = {0};
-        memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
-        conn_params.latency = 0;
-        conn_params.max_int = 0x20;
-        conn_params.min_int = 0x10;
-        conn_params.timeout = 400;
-        ESP_LOGI(CONN_TAG, "Connected, conn_id %u, remote "ESP_BD_ADDR_STR"",
-                param->connect.conn_id, ESP_BD_ADDR_HEX(param->connect.remote_bda));
-        esp_ble_gap_update_conn_params(&conn_params);
-        notify_conn_id = param->connect.conn_id;
-        notify_gatts_if = gatts_if;
-        connection_established = true;
-        break;
-        
-    case ESP_GATTS_WRITE_EVT:
-        ESP_LOGI(CONN_TAG, "GATT write request, handle = %d, value len = %d", 
-                param->write.handle, param->write.len);
-        
-        // Add bounds checking for write operations
-        if (param->write.len > CHAR_VALUE_MAX_LEN) {
-            ESP_LOGE(CONN_TAG, "Write length %d exceeds maximum %d", param->write.len, CHAR_VALUE_MAX_LEN);
-            if (param->write.need_rsp) {
-                esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, ESP_GATT_INVALID_ATTR_LEN, NULL);
-            }
-            break;
-        }
-        
-        // Check if this is a CCCD write (handle 3 is our CCCD)
-        if (param->write.handle == gatt_handle_table[3] && param->write.len == 2) {
-            uint16_t descr_value = param->write.value[1]<<8 | param->write.value[0];
-            if (descr_value == 0x0001) {
-                ESP_LOGI(CONN_TAG, "Notifications enabled");
-                notifications_enabled = true;
-            } else if (descr_value == 0x0000) {
-                ESP_LOGI(CONN_TAG, "Notifications disabled");
-                notifications_enabled = false;
-            }
-        }
-        // Handle write for Calibration Mode characteristic (handle 5)
-        else if (param->write.handle == gatt_handle_table[5] && param->write.len == 1) {
-            if (param->write.value[0] == 0x01) {
-                calibration_mode = true;
-                set_led_color(LED_BLUE);
-                ESP_LOGI(CONN_TAG, "Calibration mode ENABLED. Notifications DISABLED.");
-            } else if (param->write.value[0] == 0x00) {
-                calibration_mode = false;
-                // notifications_enabled remains as per CCCD setting
-                ESP_LOGI(CONN_TAG, "Calibration mode DISABLED.");
-            } else {
-                ESP_LOGW(CONN_TAG, "Invalid value for calibration characteristic: 0x%02x", param->write.value[0]);
-            }
-        }
-    
-        if (param->write.need_rsp) {
-            esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, ESP_GATT_OK, NULL);
-        }
-        break;
-        
-    case ESP_GATTS_DISCONNECT_EVT:
-        ESP_LOGI(CONN_TAG, "Disconnected, remote "ESP_BD_ADDR_STR", reason 0x%02x",
-                ESP_BD_ADDR_HEX(param->disconnect.remote_bda), param->disconnect.reason);
-        connection_established = false;
-        notifications_enabled = false;
-        calibration_mode = false;
-        notify_conn_id = 0;
-        notify_gatts_if = 0;
-        esp_ble_gap_start_advertising(&adv_params);
-        break;
-        
-    default:
-        break;
-    }
-}
\ No newline at end of file
+/**
+ * @brief Enter or leave calibration mode on request of the central
+ * @param enabled New calibration mode
+ */
+static void on_calibration_written(bool enabled)
+{
+    calibration_mode = enabled;
+    if (enabled) {
+        led_set_pattern(LED_PATTERN_PULSE, LED_BLUE, LED_CALIBRATION_PULSE_MS);
+    }
+}
+
+static bool on_calibration_read(void)
+{
+    return calibration_mode;
+}
+
+/**
+ * @brief Request a new configuration from the central; byte 0 is the resolution
+ * @param value Written value
+ * @param len Length of value
+ */
+static void on_config_written(const uint8_t *value, size_t len)
+{
+    if (len < 1 || (value[0] != QUADRATURE_X1 && value[0] != QUADRATURE_X2 && value[0] != QUADRATURE_X4)) {
+        ESP_LOGW(TAG, "Ignoring invalid config write of %d bytes", (int)len);
+        return;
+    }
+    requested_resolution = value[0];
+}
+
+static size_t on_config_read(uint8_t *value, size_t max_len)
+{
+    if (max_len < 1) {
+        return 0;
+    }
+    // A pending request reads back as applied, the loop takes it up within one period
+    value[0] = requested_resolution ? requested_resolution : resolution;
+    return 1;
+}
+
+/**
+ * @brief Accept a rules program from the central, the loop installs it within one period
+ * @param program Written program, empty clears the rules
+ * @param len Length of program
+ * @return false if the program fails verification
+ */
+static bool on_rules_written(const uint8_t *program, size_t len)
+{
+    if (len > RULES_PROGRAM_MAX || !rules_verify(program, len)) {
+        return false;
+    }
+    portENTER_CRITICAL(&rules_lock);
+    memcpy(rules_program, program, len);
+    rules_program_len = len;
+    rules_pending = true;
+    portEXIT_CRITICAL(&rules_lock);
+    return true;
+}
+
+static size_t on_rules_read(uint8_t *program, size_t max_len)
+{
+    portENTER_CRITICAL(&rules_lock);
+    size_t len = rules_program_len <= max_len ? rules_program_len : 0;
+    memcpy(program, rules_program, len);
+    portEXIT_CRITICAL(&rules_lock);
+    return len;
+}
+
+static const ble_callbacks_t ble_callbacks = {
+    .disconnected = on_ble_disconnected,
+    .calibration_written = on_calibration_written,
+    .calibration_read = on_calibration_read,
+    .config_written = on_config_written,
+    .config_read = on_config_read,
+    .rules_written = on_rules_written,
+    .rules_read = on_rules_read,
+};
+
+void app_main(void)
+{
+    esp_err_t ret;
+
+    //initialize NVS
+    ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK( ret );
+
+    // Before the stack, a central may read the totals as soon as it connects
+    zone_stats_init();
+
+    // Before the stack, a central may write the OTA characteristics as soon as it connects
+    ret = ota_init(ble_notify_ota);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "OTA init failed: %s", esp_err_to_name(ret));
+    }
+
+    ret = ble_init(&ble_callbacks);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "BLE init failed: %s", esp_err_to_name(ret));
+        return;
+    }
+
+    // Install GPIO ISR service (required for rotary encoder). IRAM so edges are
+    // still decoded while NVS or an OTA image is being written to flash
+    ESP_ERROR_CHECK(gpio_install_isr_service(ESP_INTR_FLAG_IRAM));
+
+    // Configure GPIO pins
+    configure_button_gpio();
+    ESP_ERROR_CHECK(led_init(RED_LED_GPIO, GREEN_LED_GPIO, BLUE_LED_GPIO));
+    ESP_ERROR_CHECK(led_set_brightness(LED_BRIGHTNESS));
+
+    // Hand over to the statically allocated encoder loop, app_main's own stack is freed on return
+    TaskHandle_t loop_task = xTaskCreateStatic(encoder_loop_task, "encoder_loop", ENCODER_TASK_STACK_SIZE, NULL,
+                                               ENCODER_TASK_PRIORITY, encoder_task_stack, &encoder_task_buffer);
+    if (!loop_task) {
+        ESP_LOGE(TAG, "Failed to start encoder loop task");
+        return;
+    }
+}
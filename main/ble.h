@@ -0,0 +1,134 @@
+/*
+ *
+ * BLE peripheral: the encoder GATT service, pairing and advertising
+ *
+ * The host stack is chosen in menuconfig and only one implementation is
+ * built: ble_bluedroid.c (CONFIG_BT_BLUEDROID_ENABLED) or ble_nimble.c
+ * (CONFIG_BT_NIMBLE_ENABLED). Both expose the same GATT contract:
+ *
+ *   0x00FF  service
+ *   0xFF01  zone notifications         read, notify, encrypted write
+ *   0xFF02  calibration mode           bonded read/write
+ *   0xFF03  statistics                 read
+ *   0xFF04  OTA control                encrypted write, notify
+ *   0xFF05  OTA data                   encrypted write without response
+ *   0xFF06  device configuration       encrypted read/write
+ *   0xFF07  rules program              encrypted read/write
+ *   0xFF08  zone statistics            read, encrypted write
+ *
+ * Writing a bench_request frame to 0xFF01 starts a throughput benchmark;
+ * see ble_common.c. Every frame and code on 0xFF01, 0xFF04, 0xFF07 and
+ * the L2CAP channel is defined in main/wire.json and packed through
+ * wire.h. Byte 0 of 0xFF06 is the encoder resolution in steps per detent
+ * cycle: 1, 2 or 4. 0xFF07 holds the alert rules program (see rules.h); a
+ * write the application rejects fails with an ATT error and changes
+ * nothing. 0xFF08 reads as a zone_stats frame (see zone_stats.h), and any
+ * write clears it. The stacks only check encryption on 0xFF02; the backend
+ * also requires the link keys to be bonded and answers Insufficient
+ * Authentication otherwise.
+ *
+ * For bulk data a central can open an LE credit based L2CAP channel on
+ * PSM 0x0080 over an encrypted link (NimBLE builds only, Bluedroid has no
+ * LE channel API). SDUs skip the ATT header and the notification queue and
+ * are paced by the central's credits. GATT stays the control path.
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BLE_RULES_MAX_LEN  244    // Largest rules program, one ATT write at a 247 byte MTU
+
+/**
+ * @brief Application hooks, called from the BLE host task
+ */
+typedef struct {
+    void (*disconnected)(uint8_t reason);       ///< Link dropped, reason is the HCI code
+    void (*calibration_written)(bool enabled);  ///< Central wrote the calibration characteristic
+    bool (*calibration_read)(void);             ///< Current calibration mode for a read
+    void (*config_written)(const uint8_t *value, size_t len);  ///< Central wrote the configuration characteristic
+    size_t (*config_read)(uint8_t *value, size_t max_len);     ///< Current configuration for a read, returns its length
+    bool (*rules_written)(const uint8_t *program, size_t len); ///< Central wrote a rules program, false rejects it
+    size_t (*rules_read)(uint8_t *program, size_t max_len);    ///< Current rules program for a read, returns its length
+} ble_callbacks_t;
+
+/**
+ * @brief Bring up the host stack, register the service and start advertising
+ *
+ * NVS must already be initialized. Records the heap taken by the stack and
+ * the time from boot to the first advertisement in the statistics.
+ *
+ * @param callbacks Application hooks, must stay valid
+ * @return ESP_OK on success
+ */
+esp_err_t ble_init(const ble_callbacks_t *callbacks);
+
+/**
+ * @brief Notify the zone characteristic
+ * @param value Value to send
+ * @param len Length of value, at most CHAR_VALUE_MAX_LEN
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if nobody is subscribed
+ */
+esp_err_t ble_notify(const uint8_t *value, size_t len);
+
+/**
+ * @brief Notify the OTA control characteristic, matches ota_notify_cb_t
+ * @param msg Reply bytes
+ * @param len Reply length
+ */
+void ble_notify_ota(const uint8_t *msg, size_t len);
+
+/**
+ * @brief Send one SDU on the L2CAP stream channel
+ * @param data SDU bytes
+ * @param len SDU length, at most ble_stream_mtu()
+ * @return ESP_OK if queued, ESP_ERR_INVALID_STATE if no channel is open,
+ *         ESP_ERR_NO_MEM while the central has no credits left, ESP_ERR_NOT_SUPPORTED on Bluedroid
+ */
+esp_err_t ble_stream_send(const uint8_t *data, size_t len);
+
+/**
+ * @brief Largest SDU the stream channel takes
+ * @return SDU size in bytes, 0 while no channel is open
+ */
+size_t ble_stream_mtu(void);
+
+/**
+ * @brief Check whether a central is connected
+ * @return true while connected
+ */
+bool ble_is_connected(void);
+
+/**
+ * @brief Check whether the GATT service has been started
+ * @return true once the service accepts requests
+ */
+bool ble_is_ready(void);
+
+/**
+ * @brief Check whether the device has advertised since boot
+ * @return true once the first advertisement went out
+ */
+bool ble_has_advertised(void);
+
+/**
+ * @brief Accept any central for PAIRING_WINDOW_MS so a new one can pair
+ */
+void ble_open_pairing_window(void);
+
+/**
+ * @brief Restart allow-list advertising, used by the health monitor
+ * @return ESP_OK if the restart was queued
+ */
+esp_err_t ble_restart_advertising(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,1012 @@
+/*
+ *
+ * BLE peripheral on the Bluedroid host stack
+ *
+ */
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_bt.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gatts_api.h"
+#include "esp_bt_defs.h"
+#include "esp_bt_main.h"
+#include "esp_bt_device.h"
+#include "esp_gatt_common_api.h"
+#include "stats.h"
+#include "ota.h"
+#include "wire.h"
+#include "zone_stats.h"
+#include "ble_priv.h"
+
+#define TAG "BLE"
+#define APP_ID_PLACEHOLDER 0
+#define GATTS_NUM_HANDLE     19
+
+// BLE Security
+#define SECURITY_AUTH_REQ    ESP_LE_AUTH_REQ_SC_BOND  // LE Secure Connections with bonding
+#define SECURITY_IO_CAP      ESP_IO_CAP_NONE          // No display or keyboard, pairs with Just Works
+
+// State variables
+static bool connection_established = false;
+static bool notifications_enabled = false;
+static bool ota_notifications_enabled = false;
+static atomic_bool congested = false;
+static uint16_t local_mtu = 23;
+
+// Advertising mode for the next start; strangers are filtered out once a central is bonded
+typedef enum {
+    ADV_MODE_ALLOW_LIST,   ///< Undirected, only bonded centrals may connect
+    ADV_MODE_OPEN,         ///< Undirected, any central may connect and pair
+    ADV_MODE_DIRECTED,     ///< High duty directed toward the last bonded central
+} adv_mode_t;
+
+// The mode and restart flag are shared by the BT host task, adv_mode_timer and the encoder task
+static portMUX_TYPE adv_lock = portMUX_INITIALIZER_UNLOCKED;
+static adv_mode_t adv_mode = ADV_MODE_ALLOW_LIST;
+static bool adv_restart_pending = false;
+static esp_timer_handle_t adv_mode_timer = NULL;
+static esp_ble_bond_dev_t bond_list[CONFIG_BT_SMP_MAX_BONDS];
+static int bonded_count = 0;
+static esp_bd_addr_t last_central_bda;
+static esp_bd_addr_t last_central_id_bda;       // Identity address, stable across address rotation
+static esp_ble_addr_type_t last_central_id_type = BLE_ADDR_TYPE_PUBLIC;
+static bool last_central_bonded = false;
+
+// GATT communication variables
+static uint16_t gatt_handle_table[GATTS_NUM_HANDLE];
+static uint8_t char_value_buffer[CHAR_VALUE_MAX_LEN] = {0x00};
+static uint8_t calibration_value = 0x00;
+static uint16_t notify_conn_id = 0;
+static uint16_t hci_conn_handle = BLE_PORT_CONN_HANDLE_NONE;   // Controller handle, unlike the GATT conn_id
+static esp_gatt_if_t notify_gatts_if = 0;
+
+static const char device_name[] = DEVICE_NAME;
+
+// UUIDs
+static uint16_t primary_service_uuid         = ESP_GATT_UUID_PRI_SERVICE;
+static uint16_t character_declaration_uuid   = ESP_GATT_UUID_CHAR_DECLARE;
+static uint16_t character_client_config_uuid = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
+
+// Characteristic Properties
+static uint8_t char_prop_read_write_notify = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static uint8_t char_prop_read_write = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE;
+static uint8_t char_prop_read = ESP_GATT_CHAR_PROP_BIT_READ;
+static uint8_t char_prop_write_notify = ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static uint8_t char_prop_write_nr = ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
+
+// CCCD (Client Characteristic Configuration Descriptor) default value
+static uint8_t cccd[2] = {0x00, 0x00};
+static uint8_t ota_cccd[2] = {0x00, 0x00};
+
+static esp_ble_adv_params_t adv_params = {
+    .adv_int_min = ADV_INTERVAL,
+    .adv_int_max = ADV_INTERVAL,
+    .adv_type = ADV_TYPE_IND,
+    .own_addr_type = BLE_ADDR_TYPE_RPA_PUBLIC,     // Falls back to public if local privacy cannot be enabled
+    .channel_map = ADV_CHNL_ALL,
+    .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
+};
+
+// Service UUID first so centrals can filter on it in the controller; the name goes in the scan response
+static uint8_t adv_raw_data[] = {
+    0x02, ESP_BLE_AD_TYPE_FLAG, 0x06,
+    0x03, ESP_BLE_AD_TYPE_16SRV_CMPL, GATTS_SERVICE_UUID & 0xFF, GATTS_SERVICE_UUID >> 8,
+    0x03 + SHORT_ID_LEN, ESP_BLE_AD_TYPE_SERVICE_DATA, GATTS_SERVICE_UUID & 0xFF, GATTS_SERVICE_UUID >> 8, 0x00, 0x00,
+    0x02, ESP_BLE_AD_TYPE_TX_PWR, TX_POWER_ADV_DBM,
+};
+#define ADV_SHORT_ID_OFFSET  11
+
+static uint8_t scan_rsp_raw_data[] = {
+    0x0C, ESP_BLE_AD_TYPE_NAME_CMPL, 'B', 'L', 'E', '_', 'E', 'n', 'c', 'o', 'd', 'e', 'r',
+};
+
+// Advertising starts once both are configured
+#define ADV_CONFIG_FLAG      (1 << 0)
+#define SCAN_RSP_CONFIG_FLAG (1 << 1)
+static uint8_t adv_config_pending = 0;
+
+_Static_assert(sizeof(adv_raw_data) <= ADV_DATA_MAX_LEN, "Advertising data too large");
+_Static_assert(sizeof(scan_rsp_raw_data) <= ADV_DATA_MAX_LEN, "Scan response data too large");
+
+static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
+
+/**
+ * @brief Configure LE Secure Connections pairing; Bluedroid keeps the bond keys in NVS
+ * @return ESP_OK on success
+ */
+static esp_err_t configure_security(void)
+{
+    esp_ble_auth_req_t auth_req = SECURITY_AUTH_REQ;
+    esp_ble_io_cap_t iocap = SECURITY_IO_CAP;
+    uint8_t key_size = SECURITY_KEY_SIZE;
+    uint8_t init_key = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
+    uint8_t rsp_key = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
+    uint8_t auth_option = ESP_BLE_ONLY_ACCEPT_SPECIFIED_AUTH_ENABLE;
+
+    esp_err_t ret = esp_ble_gap_set_security_param(ESP_BLE_SM_AUTHEN_REQ_MODE, &auth_req, sizeof(auth_req));
+    if (ret == ESP_OK) {
+        ret = esp_ble_gap_set_security_param(ESP_BLE_SM_IOCAP_MODE, &iocap, sizeof(iocap));
+    }
+    if (ret == ESP_OK) {
+        ret = esp_ble_gap_set_security_param(ESP_BLE_SM_MAX_KEY_SIZE, &key_size, sizeof(key_size));
+    }
+    if (ret == ESP_OK) {
+        ret = esp_ble_gap_set_security_param(ESP_BLE_SM_SET_INIT_KEY, &init_key, sizeof(init_key));
+    }
+    if (ret == ESP_OK) {
+        ret = esp_ble_gap_set_security_param(ESP_BLE_SM_SET_RSP_KEY, &rsp_key, sizeof(rsp_key));
+    }
+    if (ret == ESP_OK) {
+        // Refuse legacy pairing rather than silently downgrading
+        ret = esp_ble_gap_set_security_param(ESP_BLE_SM_ONLY_ACCEPT_SPECIFIED_SEC_AUTH, &auth_option, sizeof(auth_option));
+    }
+    return ret;
+}
+
+/**
+ * @brief Look up the stored bond of a central
+ * @param bda Remote address as reported by the stack
+ * @param id_bda Receives the identity address if bonded
+ * @param id_type Receives the identity address type if bonded
+ * @return true if bond keys exist for the address
+ */
+static bool find_bond(const esp_bd_addr_t bda, esp_bd_addr_t id_bda, esp_ble_addr_type_t *id_type)
+{
+    int count = CONFIG_BT_SMP_MAX_BONDS;
+
+    if (esp_ble_get_bond_device_list(&count, bond_list) != ESP_OK) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        if (memcmp(bond_list[i].bd_addr, bda, sizeof(esp_bd_addr_t)) == 0) {
+            // A central that rotates its address handed over its identity with the IRK
+            if (bond_list[i].bond_key.key_mask & ESP_LE_KEY_PID) {
+                memcpy(id_bda, bond_list[i].bond_key.pid_key.static_addr, sizeof(esp_bd_addr_t));
+                *id_type = bond_list[i].bond_key.pid_key.addr_type;
+            } else {
+                memcpy(id_bda, bond_list[i].bd_addr, sizeof(esp_bd_addr_t));
+                *id_type = bond_list[i].bd_addr_type;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Rebuild the controller's filter accept list from the bonded centrals
+ *
+ * Must not run while advertising with the allow list, the controller
+ * rejects changes to a list in use.
+ */
+static void update_accept_list(void)
+{
+    int count = CONFIG_BT_SMP_MAX_BONDS;
+
+    if (esp_ble_get_bond_device_list(&count, bond_list) != ESP_OK) {
+        count = 0;
+    }
+    esp_ble_gap_clear_whitelist();
+    for (int i = 0; i < count; i++) {
+        esp_ble_wl_addr_type_t type = bond_list[i].bd_addr_type == BLE_ADDR_TYPE_PUBLIC ?
+                                      BLE_WL_ADDR_TYPE_PUBLIC : BLE_WL_ADDR_TYPE_RANDOM;
+        esp_ble_gap_update_whitelist(true, bond_list[i].bd_addr, type);
+    }
+    bonded_count = count;
+    ESP_LOGI(TAG, "Accept list holds %d bonded central(s)", count);
+}
+
+/**
+ * @brief Start advertising in the current mode
+ *
+ * The directed burst and the pairing window are bounded by adv_mode_timer,
+ * which falls back to allow-list advertising when it expires.
+ *
+ * @return ESP_OK if the start was queued
+ */
+static esp_err_t start_advertising(void)
+{
+    esp_ble_adv_params_t params = adv_params;
+    uint32_t mode_ms = 0;
+
+    portENTER_CRITICAL(&adv_lock);
+    adv_mode_t mode = adv_mode;
+    portEXIT_CRITICAL(&adv_lock);
+
+    switch (mode) {
+        case ADV_MODE_DIRECTED:
+            // Aimed at the identity, the controller resolves the central's current address against it
+            params.adv_type = ADV_TYPE_DIRECT_IND_HIGH;
+            memcpy(params.peer_addr, last_central_id_bda, sizeof(esp_bd_addr_t));
+            params.peer_addr_type = last_central_id_type;
+            mode_ms = DIRECTED_ADV_BURST_MS;
+            break;
+        case ADV_MODE_OPEN:
+            mode_ms = PAIRING_WINDOW_MS;
+            break;
+        case ADV_MODE_ALLOW_LIST:
+        default:
+            // With nothing bonded yet the device has to stay reachable for the first pairing
+            if (bonded_count > 0) {
+                params.adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_WLST;
+            }
+            break;
+    }
+
+    esp_err_t ret = esp_ble_gap_start_advertising(&params);
+    if (ret == ESP_OK && mode_ms) {
+        esp_timer_stop(adv_mode_timer);
+        esp_timer_start_once(adv_mode_timer, (uint64_t)mode_ms * 1000);
+    }
+    return ret;
+}
+
+/**
+ * @brief Switch advertising mode; the restart happens once the controller confirms the stop
+ * @param mode Mode to advertise in next
+ */
+static void switch_advertising(adv_mode_t mode)
+{
+    portENTER_CRITICAL(&adv_lock);
+    adv_mode = mode;
+    bool restart = !connection_established;
+    if (restart) {
+        adv_restart_pending = true;
+    }
+    portEXIT_CRITICAL(&adv_lock);
+
+    if (restart) {
+        esp_ble_gap_stop_advertising();
+    }
+}
+
+static void adv_mode_timer_cb(void *arg)
+{
+    portENTER_CRITICAL(&adv_lock);
+    adv_mode_t mode = adv_mode;
+    portEXIT_CRITICAL(&adv_lock);
+
+    ESP_LOGI(TAG, "%s ended, advertising to bonded centrals", mode == ADV_MODE_DIRECTED ? "Directed burst" : "Pairing window");
+    switch_advertising(ADV_MODE_ALLOW_LIST);
+}
+
+/**
+ * @brief Push the advertising and scan response data; advertising starts once both complete
+ * @return ESP_OK if both were queued
+ */
+static esp_err_t config_adv_data(void)
+{
+    adv_config_pending = ADV_CONFIG_FLAG | SCAN_RSP_CONFIG_FLAG;
+    esp_err_t ret = esp_ble_gap_config_adv_data_raw(adv_raw_data, sizeof(adv_raw_data));
+    if (ret == ESP_OK) {
+        ret = esp_ble_gap_config_scan_rsp_data_raw(scan_rsp_raw_data, sizeof(scan_rsp_raw_data));
+    }
+    return ret;
+}
+
+esp_err_t ble_port_init(void)
+{
+    esp_err_t ret;
+
+    ret = esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
+    if (ret) {
+        ESP_LOGE(TAG, "%s release classic BT memory failed: %s", __func__, esp_err_to_name(ret));
+        return ret;
+    }
+
+    esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
+    ret = esp_bt_controller_init(&bt_cfg);
+    if (ret) {
+        ESP_LOGE(TAG, "%s initialize controller failed: %s", __func__, esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = esp_bt_controller_enable(ESP_BT_MODE_BLE);
+    if (ret) {
+        ESP_LOGE(TAG, "%s enable controller failed: %s", __func__, esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = esp_bluedroid_init();
+    if (ret) {
+        ESP_LOGE(TAG, "%s init bluetooth failed: %s", __func__, esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = esp_bluedroid_enable();
+    if (ret) {
+        ESP_LOGE(TAG, "%s enable bluetooth failed: %s", __func__, esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = esp_ble_gap_register_callback(esp_gap_cb);
+    if (ret) {
+        ESP_LOGE(TAG, "%s gap register failed, error code = %x", __func__, ret);
+        return ret;
+    }
+
+    ret = configure_security();
+    if (ret) {
+        ESP_LOGE(TAG, "%s security config failed: %s", __func__, esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = esp_ble_gatts_register_callback(gatts_event_handler);
+    if (ret) {
+        ESP_LOGE(TAG, "%s gatts register failed, error code = %x", __func__, ret);
+        return ret;
+    }
+
+    ret = esp_ble_gatts_app_register(APP_ID_PLACEHOLDER);
+    if (ret) {
+        ESP_LOGE(TAG, "%s gatts app register failed, error code = %x", __func__, ret);
+        return ret;
+    }
+
+    ret = esp_ble_gatt_set_local_mtu(LOCAL_MTU);
+    if (ret) {
+        ESP_LOGE(TAG, "set local  MTU failed, error code = %x", ret);
+        return ret;
+    }
+
+    ret = esp_ble_gap_set_device_name(device_name);
+    if (ret) {
+        ESP_LOGE(TAG, "set device name failed, error code = %x", ret);
+        return ret;
+    }
+
+    const esp_timer_create_args_t adv_timer_args = {
+        .callback = adv_mode_timer_cb,
+        .name = "adv_mode"
+    };
+    ret = esp_timer_create(&adv_timer_args, &adv_mode_timer);
+    if (ret) {
+        return ret;
+    }
+    update_accept_list();
+
+    ble_common_short_id(&adv_raw_data[ADV_SHORT_ID_OFFSET]);
+
+    // Advertise from a resolvable private address; the controller resolves bonded centrals from their IRKs.
+    // Advertising starts from the completion events
+    ret = esp_ble_gap_config_local_privacy(true);
+    if (ret) {
+        ESP_LOGW(TAG, "config local privacy failed, advertising the public address, error code = %x", ret);
+        adv_params.own_addr_type = BLE_ADDR_TYPE_PUBLIC;
+        ret = config_adv_data();
+    }
+    if (ret) {
+        ESP_LOGE(TAG, "config adv data failed, error code = %x", ret);
+    }
+    return ESP_OK;
+}
+
+esp_err_t ble_port_notify(ble_attr_t attr, const uint8_t *value, size_t len)
+{
+    uint16_t handle = attr == BLE_ATTR_ZONE ? gatt_handle_table[2] : gatt_handle_table[9];
+    bool subscribed = attr == BLE_ATTR_ZONE ? notifications_enabled : ota_notifications_enabled;
+
+    if (!connection_established || !subscribed || notify_gatts_if == 0 || handle == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (atomic_load(&congested)) {
+        return ESP_ERR_NO_MEM;
+    }
+    return esp_ble_gatts_send_indicate(notify_gatts_if, notify_conn_id, handle, len, (uint8_t *)value, false);
+}
+
+size_t ble_port_payload_max(void)
+{
+    return local_mtu - 3;
+}
+
+esp_err_t ble_port_stream_send(const uint8_t *data, size_t len)
+{
+    // Bluedroid only exposes L2CAP channels for BR/EDR, not LE credit based ones
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+size_t ble_port_stream_mtu(void)
+{
+    return 0;
+}
+
+esp_err_t ble_port_service_changed(void)
+{
+    // Bonded centrals that reconnect in a later boot are caught by the Database Hash instead,
+    // see CONFIG_BT_GATTS_ROBUST_CACHING_ENABLED
+    if (!connection_established || notify_gatts_if == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return esp_ble_gatts_send_service_change_indication(notify_gatts_if, last_central_bda);
+}
+
+void ble_port_set_conn_interval(uint16_t min_int, uint16_t max_int)
+{
+    esp_ble_conn_update_params_t conn_params = {0};
+    memcpy(conn_params.bda, last_central_bda, sizeof(esp_bd_addr_t));
+    conn_params.latency = 0;
+    conn_params.max_int = max_int;
+    conn_params.min_int = min_int;
+    conn_params.timeout = CONN_SUPERVISION_TIMEOUT;
+    esp_ble_gap_update_conn_params(&conn_params);
+}
+
+esp_err_t ble_port_set_phy(ble_phy_t phy)
+{
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    esp_ble_gap_phy_mask_t mask;
+    switch (phy) {
+        case BLE_PHY_2M:    mask = ESP_BLE_GAP_PHY_2M_PREF_MASK; break;
+        case BLE_PHY_CODED: mask = ESP_BLE_GAP_PHY_CODED_PREF_MASK; break;
+        default:            mask = ESP_BLE_GAP_PHY_1M_PREF_MASK; break;
+    }
+    if (!connection_established) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return esp_ble_gap_set_preferred_phy(last_central_bda, 0, mask, mask,
+                                         phy == BLE_PHY_CODED ? ESP_BLE_GAP_PHY_OPTIONS_PREF_S8_CODING : ESP_BLE_GAP_PHY_OPTIONS_NO_PREF);
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t ble_port_read_rssi(void)
+{
+    if (!connection_established) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return esp_ble_gap_read_rssi(last_central_bda);
+}
+
+uint16_t ble_port_conn_handle(void)
+{
+    return hci_conn_handle;
+}
+
+bool ble_is_connected(void)
+{
+    return connection_established;
+}
+
+void ble_open_pairing_window(void)
+{
+    if (connection_established) {
+        return;
+    }
+    ESP_LOGI(TAG, "Pairing window open for %d s", PAIRING_WINDOW_MS / 1000);
+    switch_advertising(ADV_MODE_OPEN);
+}
+
+esp_err_t ble_restart_advertising(void)
+{
+    portENTER_CRITICAL(&adv_lock);
+    adv_mode = ADV_MODE_ALLOW_LIST;
+    adv_restart_pending = false;
+    portEXIT_CRITICAL(&adv_lock);
+
+    esp_ble_gap_stop_advertising();
+    esp_err_t ret = start_advertising();
+    if (ret != ESP_OK) {
+        // Re-push the advertising data, its completion events start advertising
+        ret = config_adv_data();
+    }
+    return ret;
+}
+
+static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+    switch (event) {
+    case ESP_GAP_BLE_SET_LOCAL_PRIVACY_COMPLETE_EVT:
+        if (param->local_privacy_cmpl.status != ESP_BT_STATUS_SUCCESS) {
+            ESP_LOGW(TAG, "Local privacy failed, status %d, advertising the public address", param->local_privacy_cmpl.status);
+            adv_params.own_addr_type = BLE_ADDR_TYPE_PUBLIC;
+        }
+        if (config_adv_data() != ESP_OK) {
+            ESP_LOGE(TAG, "config adv data failed");
+        }
+        break;
+    case ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT:
+        ESP_LOGI(TAG, "Advertising data set, status %d", param->adv_data_raw_cmpl.status);
+        adv_config_pending &= ~ADV_CONFIG_FLAG;
+        if (adv_config_pending == 0) {
+            start_advertising();
+        }
+        break;
+    case ESP_GAP_BLE_SCAN_RSP_DATA_RAW_SET_COMPLETE_EVT:
+        ESP_LOGI(TAG, "Scan response data set, status %d", param->scan_rsp_data_raw_cmpl.status);
+        adv_config_pending &= ~SCAN_RSP_CONFIG_FLAG;
+        if (adv_config_pending == 0) {
+            start_advertising();
+        }
+        break;
+    case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
+        if (param->adv_start_cmpl.status != ESP_BT_STATUS_SUCCESS) {
+            ESP_LOGE(TAG, "Advertising start failed, status %d", param->adv_start_cmpl.status);
+            break;
+        }
+        ESP_LOGI(TAG, "Advertising start successfully");
+        ble_common_advertising_started();
+        break;
+    case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
+        if (param->adv_stop_cmpl.status != ESP_BT_STATUS_SUCCESS) {
+            ESP_LOGE(TAG, "Advertising stop failed, status %d", param->adv_stop_cmpl.status);
+        }
+        ESP_LOGI(TAG, "Advertising stop successfully");
+        portENTER_CRITICAL(&adv_lock);
+        bool restart = adv_restart_pending && !connection_established;
+        adv_restart_pending = false;
+        portEXIT_CRITICAL(&adv_lock);
+        if (restart) {
+            start_advertising();
+        }
+        break;
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+        ESP_LOGI(TAG, "Connection params update, status %d, conn_int %d, latency %d, timeout %d",
+                    param->update_conn_params.status,
+                    param->update_conn_params.conn_int,
+                    param->update_conn_params.latency,
+                    param->update_conn_params.timeout);
+        break;
+    case ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT:
+        if (param->read_rssi_cmpl.status == ESP_BT_STATUS_SUCCESS && connection_established) {
+            ble_common_rssi(param->read_rssi_cmpl.rssi);
+        }
+        break;
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT:
+        if (param->phy_update.status != ESP_BT_STATUS_SUCCESS) {
+            ESP_LOGW(TAG, "PHY update failed, status %d", param->phy_update.status);
+            break;
+        }
+        ble_common_phy_updated(param->phy_update.tx_phy, param->phy_update.rx_phy);
+        break;
+#endif
+    case ESP_GAP_BLE_SEC_REQ_EVT:
+        // Central asked for security, accept; with no IO capability this pairs with Just Works
+        esp_ble_gap_security_rsp(param->ble_security.ble_req.bd_addr, true);
+        break;
+    case ESP_GAP_BLE_KEY_EVT:
+        ESP_LOGI(TAG, "Bond key exchanged, type 0x%02x", param->ble_security.ble_key.key_type);
+        break;
+    case ESP_GAP_BLE_AUTH_CMPL_EVT:
+        if (!param->ble_security.auth_cmpl.success) {
+            ESP_LOGW(TAG, "Authentication failed, reason 0x%02x", param->ble_security.auth_cmpl.fail_reason);
+            ble_common_encrypted(false);
+            break;
+        }
+        ESP_LOGI(TAG, "Link encrypted with "ESP_BD_ADDR_STR", auth mode 0x%02x",
+                 ESP_BD_ADDR_HEX(param->ble_security.auth_cmpl.bd_addr), param->ble_security.auth_cmpl.auth_mode);
+        if (!last_central_bonded) {
+            // New bond, let it through the allow list from now on and remember its identity for directed advertising
+            last_central_bonded = find_bond(param->ble_security.auth_cmpl.bd_addr, last_central_id_bda, &last_central_id_type);
+            update_accept_list();
+        }
+        ble_common_encrypted(true);
+        break;
+    default:
+        break;
+    }
+}
+
+static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
+{
+    static uint16_t gatt_service_uuid = GATTS_SERVICE_UUID;
+    static uint16_t gatt_char_uuid    = GATTS_CHAR_UUID;
+    static uint16_t gatt_calibration_char_uuid = GATTS_CALIBRATION_CHAR_UUID;
+    static uint16_t gatt_stats_char_uuid = GATTS_STATS_CHAR_UUID;
+    static uint16_t gatt_ota_control_char_uuid = GATTS_OTA_CONTROL_CHAR_UUID;
+    static uint16_t gatt_ota_data_char_uuid = GATTS_OTA_DATA_CHAR_UUID;
+    static uint16_t gatt_config_char_uuid = GATTS_CONFIG_CHAR_UUID;
+    static uint16_t gatt_rules_char_uuid = GATTS_RULES_CHAR_UUID;
+    static uint16_t gatt_zone_stats_char_uuid = GATTS_ZONE_STATS_CHAR_UUID;
+    static uint8_t stats_blob[STATS_BLOB_LEN];
+    static uint8_t rules_blob[BLE_RULES_MAX_LEN];
+    static size_t rules_blob_len;
+    static uint8_t rules_prep[BLE_RULES_MAX_LEN];   // Prepare writes to the rules, applied on execute
+    static size_t rules_prep_len;
+    static bool rules_prep_pending;
+    static uint8_t zone_stats_blob[WIRE_ZONE_STATS_LEN];
+    // Over 600 bytes, kept off the BT task stack; only used from this callback
+    static esp_gatt_rsp_t rsp;
+
+    switch (event) {
+    case ESP_GATTS_REG_EVT:
+        ESP_LOGI(TAG, "GATT server register, status %d, app_id %d", param->reg.status, param->reg.app_id);
+
+        // Create attribute table
+                esp_gatts_attr_db_t gatt_db[GATTS_NUM_HANDLE] = {
+            // Service Declaration
+            [0] = {
+                {ESP_GATT_AUTO_RSP},
+                {ESP_UUID_LEN_16, (uint8_t*)&primary_service_uuid, ESP_GATT_PERM_READ,
+                sizeof(uint16_t), sizeof(gatt_service_uuid), (uint8_t*)&gatt_service_uuid}
+            },
+            // Characteristic Declaration
+            [1] = {
+                {ESP_GATT_AUTO_RSP},
+                {ESP_UUID_LEN_16, (uint8_t*)&character_declaration_uuid, ESP_GATT_PERM_READ,
+                sizeof(uint8_t), sizeof(uint8_t), (uint8_t*)&char_prop_read_write_notify}
+            },
+            // Characteristic Value
+            [2] = {
+                {ESP_GATT_RSP_BY_APP},
+                {ESP_UUID_LEN_16, (uint8_t*)&gatt_char_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE_ENCRYPTED, // Written to start the throughput benchmark
+                CHAR_VALUE_MAX_LEN, sizeof(char_value_buffer), char_value_buffer}
+            },
+            // Client Characteristic Configuration Descriptor (CCCD)
+            [3] = {
+                {ESP_GATT_AUTO_RSP},
+                {ESP_UUID_LEN_16, (uint8_t*)&character_client_config_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
+                sizeof(uint16_t), sizeof(cccd), (uint8_t*)cccd}
+            },
+            // Calibration Characteristic Declaration
+            [4] = {
+                {ESP_GATT_AUTO_RSP},
+                {ESP_UUID_LEN_16, (uint8_t*)&character_declaration_uuid, ESP_GATT_PERM_READ,
+                sizeof(uint8_t), sizeof(uint8_t), (uint8_t*)&char_prop_read_write}
+            },
+            // Calibration Characteristic Value, encrypted link here, bond checked on access
+            [5] = {
+                {ESP_GATT_RSP_BY_APP},
+                {ESP_UUID_LEN_16, (uint8_t*)&gatt_calibration_char_uuid, ESP_GATT_PERM_READ_ENCRYPTED | ESP_GATT_PERM_WRITE_ENCRYPTED,
+                sizeof(uint8_t), sizeof(uint8_t), &calibration_value}
+            },
+            // Statistics Characteristic Declaration
+            [6] = {
+                {ESP_GATT_AUTO_RSP},
+                {ESP_UUID_LEN_16, (uint8_t*)&character_declaration_uuid, ESP_GATT_PERM_READ,
+                sizeof(uint8_t), sizeof(uint8_t), (uint8_t*)&char_prop_read}
+            },
+            // Statistics Characteristic Value, serialized on each read
+            [7] = {
+                {ESP_GATT_RSP_BY_APP},
+                {ESP_UUID_LEN_16, (uint8_t*)&gatt_stats_char_uuid, ESP_GATT_PERM_READ,
+                STATS_BLOB_LEN, sizeof(stats_blob), stats_blob}
+            },
+            // OTA Control Characteristic Declaration
+            [8] = {
+                {ESP_GATT_AUTO_RSP},
+                {ESP_UUID_LEN_16, (uint8_t*)&character_declaration_uuid, ESP_GATT_PERM_READ,
+                sizeof(uint8_t), sizeof(uint8_t), (uint8_t*)&char_prop_write_notify}
+            },
+            // OTA Control Characteristic Value, see ota.h for the messages
+            [9] = {
+                {ESP_GATT_RSP_BY_APP},
+                {ESP_UUID_LEN_16, (uint8_t*)&gatt_ota_control_char_uuid, ESP_GATT_PERM_WRITE_ENCRYPTED,
+                OTA_DATA_MAX_LEN, 0, NULL}
+            },
+            // OTA Control CCCD
+            [10] = {
+                {ESP_GATT_AUTO_RSP},
+                {ESP_UUID_LEN_16, (uint8_t*)&character_client_config_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE_ENCRYPTED,
+                sizeof(uint16_t), sizeof(ota_cccd), (uint8_t*)ota_cccd}
+            },
+            // OTA Data Characteristic Declaration
+            [11] = {
+                {ESP_GATT_AUTO_RSP},
+                {ESP_UUID_LEN_16, (uint8_t*)&character_declaration_uuid, ESP_GATT_PERM_READ,
+                sizeof(uint8_t), sizeof(uint8_t), (uint8_t*)&char_prop_write_nr}
+            },
+            // OTA Data Characteristic Value, image chunks written without response
+            [12] = {
+                {ESP_GATT_RSP_BY_APP},
+                {ESP_UUID_LEN_16, (uint8_t*)&gatt_ota_data_char_uuid, ESP_GATT_PERM_WRITE_ENCRYPTED,
+                OTA_DATA_MAX_LEN, 0, NULL}
+            },
+            // Configuration Characteristic Declaration
+            [13] = {
+                {ESP_GATT_AUTO_RSP},
+                {ESP_UUID_LEN_16, (uint8_t*)&character_declaration_uuid, ESP_GATT_PERM_READ,
+                sizeof(uint8_t), sizeof(uint8_t), (uint8_t*)&char_prop_read_write}
+            },
+            // Configuration Characteristic Value, byte 0 is the encoder resolution
+            [14] = {
+                {ESP_GATT_RSP_BY_APP},
+                {ESP_UUID_LEN_16, (uint8_t*)&gatt_config_char_uuid, ESP_GATT_PERM_READ_ENCRYPTED | ESP_GATT_PERM_WRITE_ENCRYPTED,
+                CHAR_VALUE_MAX_LEN, 0, NULL}
+            },
+            // Rules Characteristic Declaration
+            [15] = {
+                {ESP_GATT_AUTO_RSP},
+                {ESP_UUID_LEN_16, (uint8_t*)&character_declaration_uuid, ESP_GATT_PERM_READ,
+                sizeof(uint8_t), sizeof(uint8_t), (uint8_t*)&char_prop_read_write}
+            },
+            // Rules Characteristic Value, the alert rules program
+            [16] = {
+                {ESP_GATT_RSP_BY_APP},
+                {ESP_UUID_LEN_16, (uint8_t*)&gatt_rules_char_uuid, ESP_GATT_PERM_READ_ENCRYPTED | ESP_GATT_PERM_WRITE_ENCRYPTED,
+                BLE_RULES_MAX_LEN, 0, NULL}
+            },
+            // Zone Statistics Characteristic Declaration
+            [17] = {
+                {ESP_GATT_AUTO_RSP},
+                {ESP_UUID_LEN_16, (uint8_t*)&character_declaration_uuid, ESP_GATT_PERM_READ,
+                sizeof(uint8_t), sizeof(uint8_t), (uint8_t*)&char_prop_read_write}
+            },
+            // Zone Statistics Characteristic Value, a zone_stats frame, cleared by any write
+            [18] = {
+                {ESP_GATT_RSP_BY_APP},
+                {ESP_UUID_LEN_16, (uint8_t*)&gatt_zone_stats_char_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE_ENCRYPTED,
+                WIRE_ZONE_STATS_LEN, 0, NULL}
+            }
+        };
+
+        // Create the attribute table
+        esp_err_t create_attr_ret = esp_ble_gatts_create_attr_tab(gatt_db, gatts_if, GATTS_NUM_HANDLE, 0);
+        if (create_attr_ret) {
+            ESP_LOGE(TAG, "create attr table failed, error code = %x", create_attr_ret);
+        }
+        break;
+
+    case ESP_GATTS_CREAT_ATTR_TAB_EVT:
+        if (param->add_attr_tab.status != ESP_GATT_OK) {
+            ESP_LOGE(TAG, "create attribute table failed, error code=0x%x", param->add_attr_tab.status);
+            break;
+        }
+
+        if (param->add_attr_tab.num_handle != GATTS_NUM_HANDLE) {
+            ESP_LOGE(TAG, "create attribute table abnormally, num_handle (%d) doesn't equal to GATTS_NUM_HANDLE(%d)",
+                    param->add_attr_tab.num_handle, GATTS_NUM_HANDLE);
+            break;
+        }
+
+        ESP_LOGI(TAG, "create attribute table successfully, the number handle = %d", param->add_attr_tab.num_handle);
+        memcpy(gatt_handle_table, param->add_attr_tab.handles, sizeof(gatt_handle_table));
+
+        // Start the service
+        esp_ble_gatts_start_service(gatt_handle_table[0]);
+        break;
+
+    case ESP_GATTS_READ_EVT:
+        ESP_LOGI(TAG, "GATT read request, handle = %d, offset = %d", param->read.handle, param->read.offset);
+        stats_inc(STATS_GATT_READS);
+        memset(&rsp, 0, sizeof(esp_gatt_rsp_t));
+        rsp.attr_value.handle = param->read.handle;
+
+        // Handle read for calibration characteristic
+        if (param->read.handle == gatt_handle_table[5]) { // Handle for calibration_mode value
+            // The stack only checks encryption; a central that paired without bonding is turned away here
+            if (!last_central_bonded) {
+                esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id, ESP_GATT_INSUF_AUTHENTICATION, NULL);
+                break;
+            }
+            rsp.attr_value.len = 1;
+            rsp.attr_value.value[0] = ble_common_calibration_read();
+        } else if (param->read.handle == gatt_handle_table[7]) {
+            // Snapshot on the first chunk so a long read returns one consistent blob
+            if (param->read.offset == 0) {
+                stats_serialize(stats_blob, sizeof(stats_blob));
+            }
+            if (param->read.offset > sizeof(stats_blob)) {
+                esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id, ESP_GATT_INVALID_OFFSET, NULL);
+                break;
+            }
+            rsp.attr_value.offset = param->read.offset;
+            rsp.attr_value.len = sizeof(stats_blob) - param->read.offset;
+            memcpy(rsp.attr_value.value, stats_blob + param->read.offset, rsp.attr_value.len);
+        } else if (param->read.handle == gatt_handle_table[14]) {
+            rsp.attr_value.len = ble_common_config_read(rsp.attr_value.value, CHAR_VALUE_MAX_LEN);
+        } else if (param->read.handle == gatt_handle_table[16]) {
+            // Same snapshot rule as the statistics for a long read
+            if (param->read.offset == 0) {
+                rules_blob_len = ble_common_rules_read(rules_blob, sizeof(rules_blob));
+            }
+            if (param->read.offset > rules_blob_len) {
+                esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id, ESP_GATT_INVALID_OFFSET, NULL);
+                break;
+            }
+            rsp.attr_value.offset = param->read.offset;
+            rsp.attr_value.len = rules_blob_len - param->read.offset;
+            memcpy(rsp.attr_value.value, rules_blob + param->read.offset, rsp.attr_value.len);
+        } else if (param->read.handle == gatt_handle_table[18]) {
+            if (param->read.offset == 0) {
+                zone_stats_serialize(zone_stats_blob, sizeof(zone_stats_blob));
+            }
+            if (param->read.offset > sizeof(zone_stats_blob)) {
+                esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id, ESP_GATT_INVALID_OFFSET, NULL);
+                break;
+            }
+            rsp.attr_value.offset = param->read.offset;
+            rsp.attr_value.len = sizeof(zone_stats_blob) - param->read.offset;
+            memcpy(rsp.attr_value.value, zone_stats_blob + param->read.offset, rsp.attr_value.len);
+        } else {
+            rsp.attr_value.len = 1;
+            rsp.attr_value.value[0] = 0x00;  // Default value for other reads
+        }
+        esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id, ESP_GATT_OK, &rsp);
+        break;
+
+    case ESP_GATTS_START_EVT:
+        ESP_LOGI(TAG, "Service start successfully, status %d, service_handle %d",
+                param->start.status, param->start.service_handle);
+        ble_common_service_started();
+        break;
+
+    case ESP_GATTS_CONNECT_EVT:
+        ESP_LOGI(TAG, "Connected, conn_id %u, remote "ESP_BD_ADDR_STR"",
+                param->connect.conn_id, ESP_BD_ADDR_HEX(param->connect.remote_bda));
+        esp_timer_stop(adv_mode_timer);
+        portENTER_CRITICAL(&adv_lock);
+        adv_mode = ADV_MODE_ALLOW_LIST;
+        adv_restart_pending = false;
+        portEXIT_CRITICAL(&adv_lock);
+        memcpy(last_central_bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+        last_central_bonded = find_bond(param->connect.remote_bda, last_central_id_bda, &last_central_id_type);
+        if (last_central_bonded) {
+            // Re-encrypt from the stored keys right away instead of waiting for the first protected access
+            esp_ble_set_encryption(param->connect.remote_bda, ESP_BLE_SEC_ENCRYPT);
+        }
+        notify_conn_id = param->connect.conn_id;
+        hci_conn_handle = param->connect.conn_handle;
+        notify_gatts_if = gatts_if;
+        local_mtu = 23;
+        atomic_store(&congested, false);
+        connection_established = true;
+        ble_common_connected();
+        break;
+
+    case ESP_GATTS_MTU_EVT:
+        ESP_LOGI(TAG, "MTU %d", param->mtu.mtu);
+        local_mtu = param->mtu.mtu;
+        break;
+
+    case ESP_GATTS_CONGEST_EVT:
+        atomic_store(&congested, param->congest.congested);
+        break;
+
+    case ESP_GATTS_WRITE_EVT:
+        stats_inc(STATS_GATT_WRITES);
+
+        // Image chunks arrive back to back, keep this path free of logging
+        if (param->write.handle == gatt_handle_table[12]) {
+            ota_data(param->write.value, param->write.len);
+            if (param->write.need_rsp) {
+                esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, ESP_GATT_OK, NULL);
+            }
+            break;
+        }
+
+        ESP_LOGI(TAG, "GATT write request, handle = %d, value len = %d",
+                param->write.handle, param->write.len);
+
+        if (param->write.handle == gatt_handle_table[9]) {
+            ble_common_ota_control(param->write.value, param->write.len);
+            if (param->write.need_rsp) {
+                esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, ESP_GATT_OK, NULL);
+            }
+            break;
+        }
+
+        if (param->write.handle == gatt_handle_table[16] && param->write.is_prep) {
+            // A long write arrives as prepare writes; queue them in order and apply the whole program on execute
+            esp_gatt_status_t status = ESP_GATT_OK;
+            if (!rules_prep_pending) {
+                rules_prep_pending = true;
+                rules_prep_len = 0;
+            }
+            if (param->write.offset > rules_prep_len) {
+                status = ESP_GATT_INVALID_OFFSET;
+            } else if (param->write.offset + param->write.len > sizeof(rules_prep)) {
+                status = ESP_GATT_INVALID_ATTR_LEN;
+            } else {
+                memcpy(rules_prep + param->write.offset, param->write.value, param->write.len);
+                if (param->write.offset + param->write.len > rules_prep_len) {
+                    rules_prep_len = param->write.offset + param->write.len;
+                }
+            }
+            if (status != ESP_GATT_OK) {
+                rules_prep_pending = false;
+            }
+            if (param->write.need_rsp) {
+                // The central checks the echoed part against what it sent
+                memset(&rsp, 0, sizeof(rsp));
+                rsp.attr_value.handle = param->write.handle;
+                rsp.attr_value.offset = param->write.offset;
+                rsp.attr_value.len = param->write.len;
+                rsp.attr_value.auth_req = ESP_GATT_AUTH_REQ_NONE;
+                memcpy(rsp.attr_value.value, param->write.value, param->write.len);
+                esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, status,
+                                            status == ESP_GATT_OK ? &rsp : NULL);
+            }
+            break;
+        }
+
+        if (param->write.handle == gatt_handle_table[16]) {
+            esp_gatt_status_t status = ESP_GATT_INVALID_ATTR_LEN;
+            if (param->write.len <= BLE_RULES_MAX_LEN) {
+                status = ble_common_rules_write(param->write.value, param->write.len) ? ESP_GATT_OK : ESP_GATT_OUT_OF_RANGE;
+            }
+            if (param->write.need_rsp) {
+                esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, status, NULL);
+            }
+            break;
+        }
+
+        // Add bounds checking for write operations
+        if (param->write.len > CHAR_VALUE_MAX_LEN) {
+            ESP_LOGE(TAG, "Write length %d exceeds maximum %d", param->write.len, CHAR_VALUE_MAX_LEN);
+            if (param->write.need_rsp) {
+                esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, ESP_GATT_INVALID_ATTR_LEN, NULL);
+            }
+            break;
+        }
+
+        if (param->write.handle == gatt_handle_table[5]) {
+            // Same bond rule as the read
+            esp_gatt_status_t status = ESP_GATT_INSUF_AUTHENTICATION;
+            if (last_central_bonded) {
+                ble_common_calibration_write(param->write.value, param->write.len);
+                status = ESP_GATT_OK;
+            }
+            if (param->write.need_rsp) {
+                esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, status, NULL);
+            }
+            break;
+        }
+
+        // Check if this is a CCCD write (handle 3 is our CCCD)
+        if ((param->write.handle == gatt_handle_table[3] || param->write.handle == gatt_handle_table[10]) && param->write.len == 2) {
+            uint16_t descr_value = param->write.value[1]<<8 | param->write.value[0];
+            bool enabled = descr_value == 0x0001;
+            if (param->write.handle == gatt_handle_table[3]) {
+                ESP_LOGI(TAG, "Notifications %s", enabled ? "enabled" : "disabled");
+                notifications_enabled = enabled;
+            } else {
+                ota_notifications_enabled = enabled;
+            }
+        }
+        else if (param->write.handle == gatt_handle_table[2]) {
+            ble_common_zone_write(param->write.value, param->write.len);
+        }
+        else if (param->write.handle == gatt_handle_table[14]) {
+            ble_common_config_write(param->write.value, param->write.len);
+        }
+        else if (param->write.handle == gatt_handle_table[18]) {
+            ble_common_zone_stats_write(param->write.value, param->write.len);
+        }
+
+        if (param->write.need_rsp) {
+            esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, ESP_GATT_OK, NULL);
+        }
+        break;
+
+    case ESP_GATTS_EXEC_WRITE_EVT: {
+        esp_gatt_status_t status = ESP_GATT_OK;
+        if (rules_prep_pending && param->exec_write.exec_write_flag == ESP_GATT_PREP_WRITE_EXEC) {
+            status = ble_common_rules_write(rules_prep, rules_prep_len) ? ESP_GATT_OK : ESP_GATT_OUT_OF_RANGE;
+        }
+        rules_prep_pending = false;
+        esp_ble_gatts_send_response(gatts_if, param->exec_write.conn_id, param->exec_write.trans_id, status, NULL);
+        break;
+    }
+
+    case ESP_GATTS_DISCONNECT_EVT:
+        ESP_LOGI(TAG, "Disconnected, remote "ESP_BD_ADDR_STR", reason 0x%02x",
+                ESP_BD_ADDR_HEX(param->disconnect.remote_bda), param->disconnect.reason);
+        connection_established = false;
+        notifications_enabled = false;
+        ota_notifications_enabled = false;
+        rules_prep_pending = false;
+        notify_conn_id = 0;
+        hci_conn_handle = BLE_PORT_CONN_HANDLE_NONE;
+        notify_gatts_if = 0;
+        ble_common_disconnected(param->disconnect.reason);
+        portENTER_CRITICAL(&adv_lock);
+        adv_mode = (DIRECTED_ADV_ENABLE && last_central_bonded) ? ADV_MODE_DIRECTED : ADV_MODE_ALLOW_LIST;
+        portEXIT_CRITICAL(&adv_lock);
+        esp_err_t adv_ret = start_advertising();
+        if (adv_ret != ESP_OK) {
+            // The health monitor retries once its advertising timeout expires
+            ESP_LOGE(TAG, "Restart advertising failed: %s", esp_err_to_name(adv_ret));
+        }
+        break;
+
+    default:
+        break;
+    }
+}
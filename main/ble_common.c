@@ -0,0 +1,594 @@
+/*
+ *
+ * Stack independent part of the BLE peripheral: notifications, statistics,
+ * PHY, connection interval and TX power policy, the L2CAP stream channel,
+ * the throughput benchmark and attribute table change tracking
+ *
+ * TX power control: the controller only reports the RSSI of the central as
+ * heard by this device. With a symmetric path and a central transmitting at
+ * about TX_POWER_ADV_DBM, the central hears this device at roughly that RSSI
+ * minus the power given up, which is the margin the loop steers on. Failed
+ * notifications count as loss and step the power back up at once.
+ *
+ */
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_bt.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "health.h"
+#include "ota.h"
+#include "stats.h"
+#include "wire.h"
+#include "zone_stats.h"
+#include "ble_priv.h"
+
+#define TAG "BLE"
+
+#define BENCH_TASK_STACK_SIZE  3072
+#define BENCH_TASK_PRIORITY    1      // Same as the encoder loop, shares the CPU with it while running
+#define BENCH_MAX_COUNT        10000
+#define PHY_SWITCH_TIMEOUT_MS  1000   // The benchmark runs on whatever PHY is up by then
+#define GATT_NVS_NAMESPACE     "ble"  // Attribute table version bonded centrals last saw
+
+static const ble_callbacks_t *app_callbacks = NULL;
+static atomic_bool service_started = false;
+static bool ota_fast_link = false;
+static atomic_bool stream_open = false;
+static bool gatt_db_checked = false;
+static atomic_bool gatt_db_changed = false;   // Table differs from the last boot, tell every central this session
+static atomic_bool gatt_db_stored = false;    // New version written to NVS, only after a Service Changed was queued
+static int64_t connect_time_us = 0;
+static atomic_int current_phy = BLE_PHY_NONE;
+static atomic_bool advertised = false;
+
+typedef struct {
+    esp_power_level_t level;
+    int8_t dbm;
+} tx_power_step_t;
+
+// Lowest to highest, the last step is the advertising power
+static const tx_power_step_t tx_power_steps[] = {
+    {ESP_PWR_LVL_N12, -12}, {ESP_PWR_LVL_N9, -9}, {ESP_PWR_LVL_N6, -6}, {ESP_PWR_LVL_N3, -3},
+    {ESP_PWR_LVL_N0, 0}, {ESP_PWR_LVL_P3, 3}, {ESP_PWR_LVL_P6, 6}, {ESP_PWR_LVL_P9, 9},
+};
+#define TX_POWER_STEP_MAX  (sizeof(tx_power_steps) / sizeof(tx_power_steps[0]) - 1)
+
+static esp_timer_handle_t rssi_timer = NULL;
+static atomic_uint notify_losses = 0;
+static int tx_power_step = TX_POWER_STEP_MAX;
+static int rssi_avg = 0;
+static bool rssi_valid = false;
+static int hold_polls = 0;
+
+static StaticTask_t bench_task_buffer;
+static StackType_t bench_task_stack[BENCH_TASK_STACK_SIZE];
+static TaskHandle_t bench_task_handle = NULL;
+static uint8_t bench_payload[OTA_DATA_MAX_LEN];
+
+static const char *phy_name(ble_phy_t phy)
+{
+    switch (phy) {
+        case BLE_PHY_1M:    return "1M";
+        case BLE_PHY_2M:    return "2M";
+        case BLE_PHY_CODED: return "Coded";
+        default:            return "none";
+    }
+}
+
+/**
+ * @brief PHY a link idles on: 1M, or Coded for long range installations
+ */
+static ble_phy_t base_phy(void)
+{
+    return PHY_LONG_RANGE ? BLE_PHY_CODED : BLE_PHY_1M;
+}
+
+/**
+ * @brief PHY for streaming and bulk transfers; long range links stay on Coded, 2M would not reach
+ */
+static ble_phy_t fast_phy(void)
+{
+    return PHY_LONG_RANGE ? BLE_PHY_CODED : BLE_PHY_2M;
+}
+
+/**
+ * @brief Apply a TX power step to the connection
+ * @param step Index into tx_power_steps
+ */
+static void set_tx_power_step(int step)
+{
+    // The controller keeps a power setting per connection handle, the link's handle need not be 0
+    uint16_t handle = ble_port_conn_handle();
+    if (handle > ESP_BLE_PWR_TYPE_CONN_HDL8 - ESP_BLE_PWR_TYPE_CONN_HDL0) {
+        ESP_LOGW(TAG, "TX power not set, no power setting for connection handle 0x%04x", handle);
+        return;
+    }
+    esp_err_t ret = esp_ble_tx_power_set((esp_ble_power_type_t)(ESP_BLE_PWR_TYPE_CONN_HDL0 + handle), tx_power_steps[step].level);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "TX power %d dBm failed: %s", tx_power_steps[step].dbm, esp_err_to_name(ret));
+        return;
+    }
+    tx_power_step = step;
+    stats_set(STATS_TX_POWER_DBM, (uint32_t)(int32_t)tx_power_steps[step].dbm);
+}
+
+static void rssi_timer_cb(void *arg)
+{
+    if (ble_is_connected()) {
+        ble_port_read_rssi();
+    }
+}
+
+static void request_phy(ble_phy_t phy)
+{
+    if (atomic_load(&current_phy) == phy) {
+        return;
+    }
+    esp_err_t ret = ble_port_set_phy(phy);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "PHY %s request failed: %s", phy_name(phy), esp_err_to_name(ret));
+    }
+}
+
+/**
+ * @brief Notification payload for streaming on the current link
+ * @return MTU limited payload, capped per PHY so one notification stays cheap to retransmit
+ */
+static size_t stream_payload_max(void)
+{
+    size_t cap;
+    switch (atomic_load(&current_phy)) {
+        case BLE_PHY_2M:    cap = STREAM_PAYLOAD_2M; break;
+        case BLE_PHY_CODED: cap = STREAM_PAYLOAD_CODED; break;
+        default:            cap = STREAM_PAYLOAD_1M; break;
+    }
+    size_t len = ble_port_payload_max();
+    return len < cap ? len : cap;
+}
+
+/**
+ * @brief Back to the idle interval and PHY unless a transfer still wants the fast link
+ */
+static void release_fast_link(void)
+{
+    if (ble_is_connected() && !ota_in_progress() && !atomic_load(&stream_open)) {
+        ble_port_set_conn_interval(CONN_INT_MIN, CONN_INT_MAX);
+        request_phy(base_phy());
+    }
+}
+
+/**
+ * @brief Flood the zone characteristic or the L2CAP channel and log the rate
+ *
+ * The requested PHY (the streaming PHY by default) is set up first and the
+ * payload is sized for it: a notification up to the per-PHY cap, or a full
+ * channel SDU. Each payload starts with a bench_packet header (see
+ * wire.h) carrying the sequence number, so the client can count losses and
+ * tell the run apart from zone codes and capture frames.
+ *
+ * @param arg Unused
+ */
+static void bench_task(void *arg)
+{
+    for (;;) {
+        uint32_t request = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        uint32_t count = request & 0xFFFF;
+        ble_phy_t phy = ((request >> 16) & 0xFF) ? (ble_phy_t)((request >> 16) & 0xFF) : fast_phy();
+        bool l2cap = (request >> 24) == WIRE_BENCH_TRANSPORT_L2CAP;
+
+        request_phy(phy);
+        for (int waited = 0; atomic_load(&current_phy) != phy && waited < PHY_SWITCH_TIMEOUT_MS; waited += 10) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+
+        size_t len = l2cap ? ble_port_stream_mtu() : stream_payload_max();
+        if (len > sizeof(bench_payload)) {
+            len = sizeof(bench_payload);
+        }
+        if (len < WIRE_BENCH_PACKET_LEN) {
+            continue;
+        }
+
+        uint32_t sent = 0;
+        uint32_t congested = 0;
+        int64_t start_us = esp_timer_get_time();
+        while (sent < count && ble_is_connected()) {
+            const wire_bench_packet_t packet = { .sequence = sent };
+            wire_pack_bench_packet(bench_payload, &packet);
+            esp_err_t ret = l2cap ? ble_port_stream_send(bench_payload, len) : ble_port_notify(BLE_ATTR_ZONE, bench_payload, len);
+            if (ret == ESP_OK) {
+                sent++;
+            } else if (ret == ESP_ERR_NO_MEM) {
+                // Let the stack drain its buffers, or the central hand out credits
+                congested++;
+                vTaskDelay(1);
+            } else {
+                break;
+            }
+        }
+
+        int64_t elapsed_us = esp_timer_get_time() - start_us;
+        ble_phy_t used = atomic_load(&current_phy);
+        if (ble_is_connected() && !ota_in_progress() && !atomic_load(&stream_open)) {
+            request_phy(base_phy());
+        }
+        if (elapsed_us <= 0 || sent == 0) {
+            ESP_LOGW(TAG, "Benchmark sent nothing");
+            continue;
+        }
+        uint32_t bytes_per_s = (uint32_t)((uint64_t)sent * len * 1000000 / elapsed_us);
+        stats_set(STATS_BENCH_BYTES_PER_S, bytes_per_s);
+        ESP_LOGI(TAG, "Benchmark over %s on %s PHY: %" PRIu32 " x %u bytes in %" PRId64 " ms, %" PRIu32 " packets/s, %" PRIu32 " bytes/s, %" PRIu32 " congestion waits",
+                 l2cap ? "L2CAP" : "GATT", phy_name(used), sent, (unsigned)len, elapsed_us / 1000, (uint32_t)((uint64_t)sent * 1000000 / elapsed_us),
+                 bytes_per_s, congested);
+    }
+}
+
+esp_err_t ble_init(const ble_callbacks_t *callbacks)
+{
+    if (!callbacks || !callbacks->disconnected || !callbacks->calibration_written || !callbacks->calibration_read ||
+        !callbacks->config_written || !callbacks->config_read || !callbacks->rules_written || !callbacks->rules_read) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    app_callbacks = callbacks;
+
+    const esp_timer_create_args_t rssi_timer_args = {
+        .callback = rssi_timer_cb,
+        .name = "ble_rssi"
+    };
+    esp_err_t ret = esp_timer_create(&rssi_timer_args, &rssi_timer);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    bench_task_handle = xTaskCreateStatic(bench_task, "ble_bench", BENCH_TASK_STACK_SIZE, NULL, BENCH_TASK_PRIORITY,
+                                          bench_task_stack, &bench_task_buffer);
+    if (!bench_task_handle) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Covers the controller, the host and their tasks, which is what differs between the stacks
+    size_t free_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    health_expect_advertising();
+    ret = ble_port_init();
+    size_t free_after = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    uint32_t heap_used = free_before > free_after ? free_before - free_after : 0;
+    stats_set(STATS_BLE_HEAP_BYTES, heap_used);
+    ESP_LOGI(TAG, "Host stack up, %" PRIu32 " bytes of heap in use", heap_used);
+
+    // Keep the advertised TX power level true
+    ret = esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_ADV, tx_power_steps[TX_POWER_STEP_MAX].level);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Advertising TX power failed: %s", esp_err_to_name(ret));
+    }
+    stats_set(STATS_TX_POWER_DBM, (uint32_t)(int32_t)TX_POWER_ADV_DBM);
+    return ESP_OK;
+}
+
+esp_err_t ble_notify(const uint8_t *value, size_t len)
+{
+    // Validate inputs
+    if (!value || len == 0 || len > CHAR_VALUE_MAX_LEN) {
+        ESP_LOGE(TAG, "Invalid notification parameters: len=%zu, max=%d", len, CHAR_VALUE_MAX_LEN);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ble_port_notify(BLE_ATTR_ZONE, value, len);
+    if (ret == ESP_ERR_INVALID_STATE) {
+        ESP_LOGW(TAG, "BLE not ready for notifications or notifications disabled");
+        stats_inc(STATS_NOTIFY_SUPPRESSED);
+        return ret;
+    }
+    if (ret != ESP_OK) {
+        atomic_fetch_add(&notify_losses, 1);
+    }
+    stats_inc(ret == ESP_OK ? STATS_NOTIFY_SENT : STATS_NOTIFY_FAILED);
+    return ret;
+}
+
+void ble_notify_ota(const uint8_t *msg, size_t len)
+{
+    ble_port_notify(BLE_ATTR_OTA_CONTROL, msg, len);
+    // Back to the normal interval and PHY once the transfer is over
+    if (ota_fast_link && !ota_in_progress()) {
+        ota_fast_link = false;
+        release_fast_link();
+    }
+}
+
+esp_err_t ble_stream_send(const uint8_t *data, size_t len)
+{
+    if (!data || len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ble_port_stream_send(data, len);
+}
+
+size_t ble_stream_mtu(void)
+{
+    return ble_port_stream_mtu();
+}
+
+void ble_common_short_id(uint8_t *id)
+{
+    uint8_t mac[6] = {0};
+
+    esp_read_mac(mac, ESP_MAC_BT);
+    memcpy(id, mac + sizeof(mac) - SHORT_ID_LEN, SHORT_ID_LEN);
+}
+
+bool ble_is_ready(void)
+{
+    return atomic_load(&service_started);
+}
+
+/**
+ * @brief Queue Service Changed, and record the table version once the first one is queued
+ *
+ * Until then the old version stays in NVS, so a reset before any central
+ * was told compares unequal again at the next boot.
+ */
+static void send_service_changed(void)
+{
+    if (ble_port_service_changed() != ESP_OK || atomic_exchange(&gatt_db_stored, true)) {
+        return;
+    }
+    nvs_handle_t handle;
+    if (nvs_open(GATT_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    nvs_set_u16(handle, "gatt_db", GATT_DB_VERSION);
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+/**
+ * @brief Compare the attribute table with the version kept in NVS
+ *
+ * Centrals that cache handles, through the Database Hash or a bond, skip
+ * discovery on reconnect, so they have to be told when the table changes.
+ */
+static void check_gatt_db_version(void)
+{
+    // A namespace that does not exist yet reads as version 0
+    uint16_t stored = 0;
+    nvs_handle_t handle;
+    if (nvs_open(GATT_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u16(handle, "gatt_db", &stored);
+        nvs_close(handle);
+    }
+    if (stored == GATT_DB_VERSION) {
+        return;
+    }
+    ESP_LOGI(TAG, "Attribute table version %u, was %u, sending Service Changed", GATT_DB_VERSION, stored);
+    atomic_store(&gatt_db_changed, true);
+    // Stacks that track bonds queue it for every bonded central right away, the others on encryption
+    send_service_changed();
+}
+
+void ble_common_service_started(void)
+{
+    // NimBLE registers the table again after a host reset
+    if (!gatt_db_checked) {
+        gatt_db_checked = true;
+        check_gatt_db_version();
+    }
+    atomic_store(&service_started, true);
+}
+
+void ble_common_advertising_started(void)
+{
+    health_note_advertising_started();
+    if (!atomic_exchange(&advertised, true)) {
+        uint32_t boot_to_adv_ms = (uint32_t)(esp_timer_get_time() / 1000);
+        stats_set(STATS_BOOT_TO_ADV_MS, boot_to_adv_ms);
+        ESP_LOGI(TAG, "First advertisement %" PRIu32 " ms after boot", boot_to_adv_ms);
+    }
+}
+
+bool ble_has_advertised(void)
+{
+    return atomic_load(&advertised);
+}
+
+void ble_common_connected(void)
+{
+    stats_inc(STATS_CONNECTIONS);
+    health_note_connected();
+    connect_time_us = esp_timer_get_time();
+    atomic_store(&current_phy, BLE_PHY_1M);
+    stats_set(STATS_PHY, BLE_PHY_1M);
+    ble_port_set_conn_interval(CONN_INT_MIN, CONN_INT_MAX);
+    // Connections always start on 1M
+    request_phy(base_phy());
+
+    // Start at full power, the loop works down from there
+    rssi_valid = false;
+    hold_polls = 0;
+    atomic_store(&notify_losses, 0);
+    set_tx_power_step(TX_POWER_STEP_MAX);
+    // RSSI is sampled for the statistics even with the loop turned off
+    esp_timer_start_periodic(rssi_timer, (uint64_t)TX_POWER_POLL_MS * 1000);
+}
+
+void ble_common_rssi(int8_t rssi)
+{
+    // 127 means the controller has no measurement yet
+    if (rssi == 127) {
+        return;
+    }
+    rssi_avg = rssi_valid ? (3 * rssi_avg + rssi) / 4 : rssi;
+    rssi_valid = true;
+    stats_set(STATS_RSSI, (uint32_t)(int32_t)rssi_avg);
+    if (!TX_POWER_ADAPTIVE) {
+        return;
+    }
+
+    int step = tx_power_step;
+    int margin = rssi_avg - (TX_POWER_ADV_DBM - tx_power_steps[step].dbm);
+    unsigned int losses = atomic_exchange(&notify_losses, 0);
+    if (losses > 0 || margin < TX_POWER_MARGIN_LOW) {
+        if (step < (int)TX_POWER_STEP_MAX) {
+            // Loss means the margin estimate was wrong, recover faster than a weak signal would ask for
+            step = losses > 0 ? step + 2 : step + 1;
+            step = step > (int)TX_POWER_STEP_MAX ? (int)TX_POWER_STEP_MAX : step;
+            ESP_LOGI(TAG, "TX power up to %d dBm: RSSI %d dBm, margin %d dBm, %u lost",
+                     tx_power_steps[step].dbm, rssi_avg, margin, losses);
+            set_tx_power_step(step);
+            stats_inc(STATS_TX_POWER_STEPS_UP);
+        }
+        hold_polls = 0;
+    } else if (margin > TX_POWER_MARGIN_HIGH && step > 0 && ++hold_polls >= TX_POWER_HOLD_POLLS) {
+        step--;
+        ESP_LOGI(TAG, "TX power down to %d dBm: RSSI %d dBm, margin %d dBm",
+                 tx_power_steps[step].dbm, rssi_avg, margin);
+        set_tx_power_step(step);
+        stats_inc(STATS_TX_POWER_STEPS_DOWN);
+        hold_polls = 0;
+    }
+}
+
+void ble_common_phy_updated(ble_phy_t tx_phy, ble_phy_t rx_phy)
+{
+    ESP_LOGI(TAG, "PHY tx %s, rx %s", phy_name(tx_phy), phy_name(rx_phy));
+    atomic_store(&current_phy, tx_phy);
+    stats_set(STATS_PHY, tx_phy);
+    stats_inc(STATS_PHY_UPDATES);
+}
+
+void ble_common_encrypted(bool success)
+{
+    if (!success) {
+        stats_inc(STATS_AUTH_FAILED);
+        return;
+    }
+    stats_inc(STATS_AUTH_COMPLETE);
+    if (connect_time_us) {
+        stats_record(STATS_HIST_ENCRYPT_LATENCY, (uint32_t)(esp_timer_get_time() - connect_time_us));
+        connect_time_us = 0;
+    }
+    if (atomic_load(&gatt_db_changed)) {
+        send_service_changed();
+    }
+}
+
+void ble_common_stream_changed(bool open, size_t mtu)
+{
+    atomic_store(&stream_open, open);
+    if (open) {
+        // Capture sessions want the same short interval and fast PHY as a firmware transfer
+        ESP_LOGI(TAG, "L2CAP stream channel open, SDUs up to %u bytes", (unsigned)mtu);
+        ble_port_set_conn_interval(OTA_CONN_INT_MIN, OTA_CONN_INT_MAX);
+        request_phy(fast_phy());
+    } else {
+        ESP_LOGI(TAG, "L2CAP stream channel closed");
+        if (!ota_fast_link) {
+            release_fast_link();
+        }
+    }
+}
+
+void ble_common_disconnected(uint8_t reason)
+{
+    stats_record_disconnect(reason);
+    connect_time_us = 0;
+    esp_timer_stop(rssi_timer);
+    stats_set(STATS_RSSI, 0);
+    stats_set(STATS_TX_POWER_DBM, (uint32_t)(int32_t)TX_POWER_ADV_DBM);
+    atomic_store(&current_phy, BLE_PHY_NONE);
+    stats_set(STATS_PHY, BLE_PHY_NONE);
+    atomic_store(&stream_open, false);
+    ota_abort();
+    ota_fast_link = false;
+    health_expect_advertising();
+    app_callbacks->disconnected(reason);
+}
+
+void ble_common_zone_write(const uint8_t *data, size_t len)
+{
+    wire_bench_request_t req;
+    if (!wire_unpack_bench_request(data, len, &req)) {
+        return;
+    }
+    uint32_t count = req.count;
+    uint32_t phy = req.phy;
+    uint32_t transport = req.transport;
+    if (count == 0 || count > BENCH_MAX_COUNT || phy > BLE_PHY_CODED || transport > WIRE_BENCH_TRANSPORT_L2CAP) {
+        ESP_LOGW(TAG, "Benchmark of %" PRIu32 " packets on PHY %" PRIu32 ", transport %" PRIu32 " out of range",
+                 count, phy, transport);
+        return;
+    }
+    if (transport == WIRE_BENCH_TRANSPORT_L2CAP && !ble_port_stream_mtu()) {
+        ESP_LOGW(TAG, "L2CAP benchmark needs the stream channel open");
+        return;
+    }
+    ESP_LOGI(TAG, "Benchmark of %" PRIu32 " %s requested", count, transport ? "SDUs" : "notifications");
+    xTaskNotify(bench_task_handle, count | (phy << 16) | (transport << 24), eSetValueWithOverwrite);
+}
+
+void ble_common_calibration_write(const uint8_t *data, size_t len)
+{
+    if (len != 1 || data[0] > 0x01) {
+        ESP_LOGW(TAG, "Invalid value for calibration characteristic: 0x%02x", len ? data[0] : 0);
+        return;
+    }
+    ESP_LOGI(TAG, "Calibration mode %s", data[0] ? "ENABLED. Notifications DISABLED." : "DISABLED.");
+    app_callbacks->calibration_written(data[0] == 0x01);
+}
+
+uint8_t ble_common_calibration_read(void)
+{
+    bool enabled = app_callbacks->calibration_read();
+    ESP_LOGI(TAG, "Reading calibration mode: %s", enabled ? "ON" : "OFF");
+    return enabled ? 0x01 : 0x00;
+}
+
+void ble_common_config_write(const uint8_t *data, size_t len)
+{
+    ESP_LOGI(TAG, "Configuration written, %d bytes", (int)len);
+    app_callbacks->config_written(data, len);
+}
+
+size_t ble_common_config_read(uint8_t *value, size_t max_len)
+{
+    return app_callbacks->config_read(value, max_len);
+}
+
+bool ble_common_rules_write(const uint8_t *data, size_t len)
+{
+    bool accepted = app_callbacks->rules_written(data, len);
+    ESP_LOGI(TAG, "Rules program written, %d bytes, %s", (int)len, accepted ? "accepted" : "rejected");
+    return accepted;
+}
+
+size_t ble_common_rules_read(uint8_t *value, size_t max_len)
+{
+    return app_callbacks->rules_read(value, max_len);
+}
+
+void ble_common_zone_stats_write(const uint8_t *data, size_t len)
+{
+    ESP_LOGI(TAG, "Zone statistics cleared by the central");
+    zone_stats_clear();
+}
+
+void ble_common_ota_control(const uint8_t *data, size_t len)
+{
+    if (len > 0 && data[0] == OTA_CMD_BEGIN && !ota_fast_link) {
+        ota_fast_link = true;
+        ble_port_set_conn_interval(OTA_CONN_INT_MIN, OTA_CONN_INT_MAX);
+        request_phy(fast_phy());
+    }
+    ota_control(data, len);
+}
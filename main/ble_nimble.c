@@ -0,0 +1,848 @@
+/*
+ *
+ * BLE peripheral on the NimBLE host stack
+ *
+ */
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "host/ble_hs.h"
+#include "host/util/util.h"
+#include "services/gap/ble_svc_gap.h"
+#include "services/gatt/ble_svc_gatt.h"
+#include "stats.h"
+#include "ota.h"
+#include "wire.h"
+#include "zone_stats.h"
+#include "ble_priv.h"
+
+#define TAG "BLE"
+
+#define STATS_SNAPSHOT_MS    500    // Reads closer together than this are chunks of one long read
+
+// Advertising mode for the next start; strangers are filtered out once a central is bonded
+typedef enum {
+    ADV_MODE_ALLOW_LIST,   ///< Undirected, only bonded centrals may connect
+    ADV_MODE_OPEN,         ///< Undirected, any central may connect and pair
+    ADV_MODE_DIRECTED,     ///< High duty directed toward the last bonded central
+} adv_mode_t;
+
+// State variables
+static atomic_bool connection_established = false;
+static bool notifications_enabled = false;
+static bool ota_notifications_enabled = false;
+static uint16_t conn_handle = BLE_HS_CONN_HANDLE_NONE;
+static uint8_t own_addr_type;
+
+// Only the host task touches the mode, other tasks post these events to it
+static adv_mode_t adv_mode = ADV_MODE_ALLOW_LIST;
+static struct ble_npl_event pairing_window_event;
+static struct ble_npl_event restart_adv_event;
+static ble_addr_t bond_list[CONFIG_BT_NIMBLE_MAX_BONDS];
+static int bonded_count = 0;
+static ble_addr_t last_central_addr;           // Identity address, stable across address rotation
+static bool last_central_bonded = false;
+
+// Attribute handles, filled in when the service is registered
+static uint16_t zone_handle;
+static uint16_t calibration_handle;
+static uint16_t stats_handle;
+static uint16_t ota_control_handle;
+static uint16_t ota_data_handle;
+static uint16_t config_handle;
+static uint16_t rules_handle;
+static uint16_t zone_stats_handle;
+
+// L2CAP stream channel; stream_lock keeps a send off a channel that is being torn down
+static struct ble_l2cap_chan *stream_chan = NULL;
+static size_t stream_sdu_max = 0;
+static SemaphoreHandle_t stream_lock = NULL;
+static StaticSemaphore_t stream_lock_buffer;
+#if CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM
+static bool stream_stalled = false;
+static os_membuf_t stream_mem[OS_MEMPOOL_SIZE(L2CAP_COC_BUF_COUNT, L2CAP_COC_MTU)];
+static struct os_mempool stream_mempool;
+static struct os_mbuf_pool stream_mbuf_pool;
+#endif
+
+// Service UUID first so centrals can filter on it in the controller; the name goes in the scan response
+static uint8_t adv_raw_data[] = {
+    0x02, BLE_HS_ADV_TYPE_FLAGS, 0x06,
+    0x03, BLE_HS_ADV_TYPE_COMP_UUIDS16, GATTS_SERVICE_UUID & 0xFF, GATTS_SERVICE_UUID >> 8,
+    0x03 + SHORT_ID_LEN, BLE_HS_ADV_TYPE_SVC_DATA_UUID16, GATTS_SERVICE_UUID & 0xFF, GATTS_SERVICE_UUID >> 8, 0x00, 0x00,
+    0x02, BLE_HS_ADV_TYPE_TX_PWR_LVL, TX_POWER_ADV_DBM,
+};
+#define ADV_SHORT_ID_OFFSET  11
+
+static uint8_t scan_rsp_raw_data[] = {
+    0x0C, BLE_HS_ADV_TYPE_COMP_NAME, 'B', 'L', 'E', '_', 'E', 'n', 'c', 'o', 'd', 'e', 'r',
+};
+
+_Static_assert(sizeof(adv_raw_data) <= ADV_DATA_MAX_LEN, "Advertising data too large");
+_Static_assert(sizeof(scan_rsp_raw_data) <= ADV_DATA_MAX_LEN, "Scan response data too large");
+
+// Not exported by any NimBLE header
+void ble_store_config_init(void);
+
+static int gap_event_cb(struct ble_gap_event *event, void *arg);
+static int gatt_access_cb(uint16_t conn, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+// Same contract as the Bluedroid attribute table; the stack adds the CCCDs for notifying characteristics
+static const struct ble_gatt_svc_def gatt_services[] = {
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = BLE_UUID16_DECLARE(GATTS_SERVICE_UUID),
+        .characteristics = (struct ble_gatt_chr_def[]) {
+            {
+                // Zone value, written to start the throughput benchmark
+                .uuid = BLE_UUID16_DECLARE(GATTS_CHAR_UUID),
+                .access_cb = gatt_access_cb,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC,
+                .val_handle = &zone_handle,
+            },
+            {
+                // Calibration mode, encrypted link here, bond checked on access
+                .uuid = BLE_UUID16_DECLARE(GATTS_CALIBRATION_CHAR_UUID),
+                .access_cb = gatt_access_cb,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC,
+                .val_handle = &calibration_handle,
+            },
+            {
+                // Statistics, serialized on read
+                .uuid = BLE_UUID16_DECLARE(GATTS_STATS_CHAR_UUID),
+                .access_cb = gatt_access_cb,
+                .flags = BLE_GATT_CHR_F_READ,
+                .val_handle = &stats_handle,
+            },
+            {
+                // OTA control, see ota.h for the messages
+                .uuid = BLE_UUID16_DECLARE(GATTS_OTA_CONTROL_CHAR_UUID),
+                .access_cb = gatt_access_cb,
+                .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC | BLE_GATT_CHR_F_NOTIFY,
+                .val_handle = &ota_control_handle,
+            },
+            {
+                // OTA data, image chunks written without response
+                .uuid = BLE_UUID16_DECLARE(GATTS_OTA_DATA_CHAR_UUID),
+                .access_cb = gatt_access_cb,
+                .flags = BLE_GATT_CHR_F_WRITE_NO_RSP | BLE_GATT_CHR_F_WRITE_ENC,
+                .val_handle = &ota_data_handle,
+            },
+            {
+                // Device configuration, byte 0 is the encoder resolution
+                .uuid = BLE_UUID16_DECLARE(GATTS_CONFIG_CHAR_UUID),
+                .access_cb = gatt_access_cb,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC,
+                .val_handle = &config_handle,
+            },
+            {
+                // Alert rules program
+                .uuid = BLE_UUID16_DECLARE(GATTS_RULES_CHAR_UUID),
+                .access_cb = gatt_access_cb,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC,
+                .val_handle = &rules_handle,
+            },
+            {
+                // Zone statistics, a zone_stats frame, cleared by any write
+                .uuid = BLE_UUID16_DECLARE(GATTS_ZONE_STATS_CHAR_UUID),
+                .access_cb = gatt_access_cb,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC,
+                .val_handle = &zone_stats_handle,
+            },
+            { 0 }
+        },
+    },
+    { 0 },
+};
+
+/**
+ * @brief Reload the bonded centrals from the store and rebuild the controller's filter accept list
+ *
+ * Must not run while advertising, the controller rejects changes to a list in use.
+ */
+static void update_accept_list(void)
+{
+    int count = 0;
+
+    if (ble_store_util_bonded_peers(bond_list, &count, CONFIG_BT_NIMBLE_MAX_BONDS) != 0) {
+        count = 0;
+    }
+    if (count > 0) {
+        ble_gap_wl_set(bond_list, count);
+    }
+    bonded_count = count;
+    ESP_LOGI(TAG, "Accept list holds %d bonded central(s)", count);
+}
+
+static bool is_bonded(const ble_addr_t *addr)
+{
+    for (int i = 0; i < bonded_count; i++) {
+        if (ble_addr_cmp(&bond_list[i], addr) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Start advertising in the current mode
+ *
+ * The directed burst and the pairing window are bounded by the advertising
+ * duration; BLE_GAP_EVENT_ADV_COMPLETE falls back to allow-list advertising.
+ *
+ * @return 0 on success, a NimBLE error code otherwise
+ */
+static int start_advertising(void)
+{
+    struct ble_gap_adv_params params = {
+        .conn_mode = BLE_GAP_CONN_MODE_UND,
+        .disc_mode = BLE_GAP_DISC_MODE_GEN,
+        .itvl_min = ADV_INTERVAL,
+        .itvl_max = ADV_INTERVAL,
+    };
+    const ble_addr_t *direct_addr = NULL;
+    int32_t duration_ms = BLE_HS_FOREVER;
+
+    switch (adv_mode) {
+        case ADV_MODE_DIRECTED:
+            params.conn_mode = BLE_GAP_CONN_MODE_DIR;
+            params.disc_mode = BLE_GAP_DISC_MODE_NON;
+            params.high_duty_cycle = 1;
+            direct_addr = &last_central_addr;
+            duration_ms = DIRECTED_ADV_BURST_MS;
+            break;
+        case ADV_MODE_OPEN:
+            duration_ms = PAIRING_WINDOW_MS;
+            break;
+        case ADV_MODE_ALLOW_LIST:
+        default:
+            // With nothing bonded yet the device has to stay reachable for the first pairing
+            if (bonded_count > 0) {
+                params.filter_policy = BLE_HCI_ADV_FILT_CONN;
+            }
+            break;
+    }
+
+    int rc = ble_gap_adv_start(own_addr_type, direct_addr, duration_ms, &params, gap_event_cb, NULL);
+    if (rc == 0) {
+        ESP_LOGI(TAG, "Advertising start successfully");
+        ble_common_advertising_started();
+    } else {
+        ESP_LOGE(TAG, "Advertising start failed, rc %d", rc);
+    }
+    return rc;
+}
+
+/**
+ * @brief Switch advertising mode, restarting advertising if it is running; host task only
+ * @param mode Mode to advertise in next
+ */
+static void switch_advertising(adv_mode_t mode)
+{
+    adv_mode = mode;
+    if (atomic_load(&connection_established)) {
+        return;
+    }
+    ble_gap_adv_stop();
+    start_advertising();
+}
+
+static void pairing_window_event_cb(struct ble_npl_event *ev)
+{
+    if (atomic_load(&connection_established)) {
+        return;
+    }
+    ESP_LOGI(TAG, "Pairing window open for %d s", PAIRING_WINDOW_MS / 1000);
+    switch_advertising(ADV_MODE_OPEN);
+}
+
+static void restart_adv_event_cb(struct ble_npl_event *ev)
+{
+    ble_gap_adv_stop();
+    adv_mode = ADV_MODE_ALLOW_LIST;
+    if (start_advertising() != 0) {
+        // Re-push the advertising data before giving up; the health monitor retries after its timeout
+        ble_gap_adv_set_data(adv_raw_data, sizeof(adv_raw_data));
+        ble_gap_adv_rsp_set_data(scan_rsp_raw_data, sizeof(scan_rsp_raw_data));
+        start_advertising();
+    }
+}
+
+static void on_sync(void)
+{
+    int rc = ble_hs_util_ensure_addr(0);
+    if (rc == 0) {
+        // Advertise from a resolvable private address; the controller resolves bonded centrals from their IRKs
+        rc = ble_hs_id_infer_auto(1, &own_addr_type);
+        if (rc != 0) {
+            ESP_LOGW(TAG, "Privacy unavailable, advertising the identity address, rc %d", rc);
+            rc = ble_hs_id_infer_auto(0, &own_addr_type);
+        }
+    }
+    if (rc != 0) {
+        ESP_LOGE(TAG, "No usable identity address, rc %d", rc);
+        return;
+    }
+
+    ble_common_short_id(&adv_raw_data[ADV_SHORT_ID_OFFSET]);
+    rc = ble_gap_adv_set_data(adv_raw_data, sizeof(adv_raw_data));
+    if (rc == 0) {
+        rc = ble_gap_adv_rsp_set_data(scan_rsp_raw_data, sizeof(scan_rsp_raw_data));
+    }
+    if (rc != 0) {
+        ESP_LOGE(TAG, "config adv data failed, rc %d", rc);
+        return;
+    }
+    update_accept_list();
+    start_advertising();
+}
+
+static void on_reset(int reason)
+{
+    ESP_LOGW(TAG, "Host reset, reason %d", reason);
+}
+
+static void host_task(void *arg)
+{
+    // Returns only after nimble_port_stop()
+    nimble_port_run();
+    nimble_port_freertos_deinit();
+}
+
+#if CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM
+/**
+ * @brief Give the channel a buffer for the next SDU from the central
+ * @param chan Stream channel
+ */
+static void stream_recv_ready(struct ble_l2cap_chan *chan)
+{
+    struct os_mbuf *sdu = os_mbuf_get_pkthdr(&stream_mbuf_pool, 0);
+    if (!sdu || ble_l2cap_recv_ready(chan, sdu) != 0) {
+        ESP_LOGW(TAG, "No receive buffer for the L2CAP channel");
+        if (sdu) {
+            os_mbuf_free_chain(sdu);
+        }
+    }
+}
+
+static int stream_event_cb(struct ble_l2cap_event *event, void *arg)
+{
+    struct ble_gap_conn_desc desc;
+    struct ble_l2cap_chan_info info;
+
+    switch (event->type) {
+    case BLE_L2CAP_EVENT_COC_ACCEPT:
+        // Same protection as the encrypted characteristics
+        if (ble_gap_conn_find(event->accept.conn_handle, &desc) != 0 || !desc.sec_state.encrypted) {
+            ESP_LOGW(TAG, "L2CAP channel refused, link not encrypted");
+            return BLE_HS_EAUTHEN;
+        }
+        stream_recv_ready(event->accept.chan);
+        return 0;
+
+    case BLE_L2CAP_EVENT_COC_CONNECTED:
+        if (event->connect.status != 0 || ble_l2cap_get_chan_info(event->connect.chan, &info) != 0) {
+            ESP_LOGW(TAG, "L2CAP channel failed, status %d", event->connect.status);
+            break;
+        }
+        xSemaphoreTake(stream_lock, portMAX_DELAY);
+        stream_chan = event->connect.chan;
+        stream_sdu_max = info.peer_coc_mtu < L2CAP_COC_MTU ? info.peer_coc_mtu : L2CAP_COC_MTU;
+        stream_stalled = false;
+        xSemaphoreGive(stream_lock);
+        ble_common_stream_changed(true, stream_sdu_max);
+        break;
+
+    case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+        xSemaphoreTake(stream_lock, portMAX_DELAY);
+        stream_chan = NULL;
+        stream_sdu_max = 0;
+        xSemaphoreGive(stream_lock);
+        ble_common_stream_changed(false, 0);
+        break;
+
+    case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+        // Control stays on GATT, whatever the central sends is dropped
+        if (event->receive.sdu_rx) {
+            os_mbuf_free_chain(event->receive.sdu_rx);
+        }
+        stream_recv_ready(event->receive.chan);
+        break;
+
+    case BLE_L2CAP_EVENT_COC_TX_UNSTALLED:
+        xSemaphoreTake(stream_lock, portMAX_DELAY);
+        stream_stalled = false;
+        xSemaphoreGive(stream_lock);
+        break;
+
+    default:
+        break;
+    }
+    return 0;
+}
+
+/**
+ * @brief Listen for the stream channel on L2CAP_COC_PSM
+ * @return 0 on success, a NimBLE error code otherwise
+ */
+static int stream_init(void)
+{
+    int rc = os_mempool_init(&stream_mempool, L2CAP_COC_BUF_COUNT, L2CAP_COC_MTU, stream_mem, "l2cap_stream");
+    if (rc == 0) {
+        rc = os_mbuf_pool_init(&stream_mbuf_pool, &stream_mempool, L2CAP_COC_MTU, L2CAP_COC_BUF_COUNT);
+    }
+    if (rc == 0) {
+        rc = ble_l2cap_create_server(L2CAP_COC_PSM, L2CAP_COC_MTU, stream_event_cb, NULL);
+    }
+    return rc;
+}
+#endif
+
+static void gatt_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg)
+{
+    if (ctxt->op == BLE_GATT_REGISTER_OP_SVC &&
+        ble_uuid_cmp(ctxt->svc.svc_def->uuid, BLE_UUID16_DECLARE(GATTS_SERVICE_UUID)) == 0) {
+        ESP_LOGI(TAG, "Service start successfully, service_handle %d", ctxt->svc.handle);
+        ble_common_service_started();
+    }
+}
+
+esp_err_t ble_port_init(void)
+{
+    esp_err_t ret = nimble_port_init();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "%s init nimble failed: %s", __func__, esp_err_to_name(ret));
+        return ret;
+    }
+
+    // LE Secure Connections with bonding; no display or keyboard, pairs with Just Works
+    ble_hs_cfg.sync_cb = on_sync;
+    ble_hs_cfg.reset_cb = on_reset;
+    ble_hs_cfg.gatts_register_cb = gatt_register_cb;
+    ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
+    ble_hs_cfg.sm_io_cap = BLE_HS_IO_NO_INPUT_OUTPUT;
+    ble_hs_cfg.sm_bonding = 1;
+    ble_hs_cfg.sm_mitm = 0;
+    ble_hs_cfg.sm_sc = 1;
+    ble_hs_cfg.sm_our_key_dist = BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
+    ble_hs_cfg.sm_their_key_dist = BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
+
+    ble_svc_gap_init();
+    ble_svc_gatt_init();
+    int rc = ble_gatts_count_cfg(gatt_services);
+    if (rc == 0) {
+        rc = ble_gatts_add_svcs(gatt_services);
+    }
+    if (rc == 0) {
+        rc = ble_svc_gap_device_name_set(DEVICE_NAME);
+    }
+    if (rc == 0) {
+        rc = ble_att_set_preferred_mtu(LOCAL_MTU);
+    }
+    if (rc != 0) {
+        ESP_LOGE(TAG, "GATT server setup failed, rc %d", rc);
+        return ESP_FAIL;
+    }
+
+    stream_lock = xSemaphoreCreateMutexStatic(&stream_lock_buffer);
+#if CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM
+    rc = stream_init();
+    if (rc != 0) {
+        // GATT keeps working without the stream channel
+        ESP_LOGE(TAG, "L2CAP stream channel setup failed, rc %d", rc);
+    }
+#endif
+
+    // Bond keys persist in NVS, see CONFIG_BT_NIMBLE_NVS_PERSIST
+    ble_store_config_init();
+
+    ble_npl_event_init(&pairing_window_event, pairing_window_event_cb, NULL);
+    ble_npl_event_init(&restart_adv_event, restart_adv_event_cb, NULL);
+
+    // Advertising starts from on_sync once the host and controller are in step
+    nimble_port_freertos_init(host_task);
+    return ESP_OK;
+}
+
+esp_err_t ble_port_notify(ble_attr_t attr, const uint8_t *value, size_t len)
+{
+    uint16_t handle = attr == BLE_ATTR_ZONE ? zone_handle : ota_control_handle;
+    bool subscribed = attr == BLE_ATTR_ZONE ? notifications_enabled : ota_notifications_enabled;
+    uint16_t conn = conn_handle;
+
+    if (!atomic_load(&connection_established) || !subscribed || conn == BLE_HS_CONN_HANDLE_NONE) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(value, len);
+    if (!om) {
+        return ESP_ERR_NO_MEM;
+    }
+    // Consumes the mbuf, also on failure
+    int rc = ble_gatts_notify_custom(conn, handle, om);
+    if (rc == BLE_HS_ENOMEM) {
+        return ESP_ERR_NO_MEM;
+    }
+    return rc == 0 ? ESP_OK : ESP_FAIL;
+}
+
+size_t ble_port_payload_max(void)
+{
+    return ble_att_mtu(conn_handle) - 3;
+}
+
+esp_err_t ble_port_stream_send(const uint8_t *data, size_t len)
+{
+#if CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM
+    esp_err_t ret = ESP_OK;
+
+    xSemaphoreTake(stream_lock, portMAX_DELAY);
+    if (!stream_chan) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else if (len > stream_sdu_max) {
+        ret = ESP_ERR_INVALID_SIZE;
+    } else if (stream_stalled) {
+        ret = ESP_ERR_NO_MEM;
+    } else {
+        struct os_mbuf *sdu = os_mbuf_get_pkthdr(&stream_mbuf_pool, 0);
+        if (!sdu || os_mbuf_append(sdu, data, len) != 0) {
+            if (sdu) {
+                os_mbuf_free_chain(sdu);
+            }
+            ret = ESP_ERR_NO_MEM;
+        } else {
+            int rc = ble_l2cap_send(stream_chan, sdu);
+            if (rc == BLE_HS_ESTALLED) {
+                // Taken, but the central ran out of credits; hold the next SDU until it hands out more
+                stream_stalled = true;
+            } else if (rc == BLE_HS_EBUSY || rc == BLE_HS_EBADDATA) {
+                // Refused before the channel took the buffer
+                os_mbuf_free_chain(sdu);
+                ret = rc == BLE_HS_EBUSY ? ESP_ERR_NO_MEM : ESP_ERR_INVALID_SIZE;
+            } else if (rc != 0) {
+                ret = ESP_FAIL;
+            }
+        }
+    }
+    xSemaphoreGive(stream_lock);
+    return ret;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+size_t ble_port_stream_mtu(void)
+{
+    size_t mtu = 0;
+    if (stream_lock) {
+        xSemaphoreTake(stream_lock, portMAX_DELAY);
+        mtu = stream_chan ? stream_sdu_max : 0;
+        xSemaphoreGive(stream_lock);
+    }
+    return mtu;
+}
+
+esp_err_t ble_port_service_changed(void)
+{
+    // Also kept in the bond store for bonded centrals that are not connected
+    ble_svc_gatt_changed(0x0001, 0xFFFF);
+    return ESP_OK;
+}
+
+void ble_port_set_conn_interval(uint16_t min_int, uint16_t max_int)
+{
+    struct ble_gap_upd_params params = {
+        .itvl_min = min_int,
+        .itvl_max = max_int,
+        .latency = 0,
+        .supervision_timeout = CONN_SUPERVISION_TIMEOUT,
+    };
+    ble_gap_update_params(conn_handle, &params);
+}
+
+esp_err_t ble_port_set_phy(ble_phy_t phy)
+{
+#if CONFIG_BT_NIMBLE_50_FEATURE_SUPPORT
+    uint8_t mask;
+    switch (phy) {
+        case BLE_PHY_2M:    mask = BLE_GAP_LE_PHY_2M_MASK; break;
+        case BLE_PHY_CODED: mask = BLE_GAP_LE_PHY_CODED_MASK; break;
+        default:            mask = BLE_GAP_LE_PHY_1M_MASK; break;
+    }
+    int rc = ble_gap_set_prefered_le_phy(conn_handle, mask, mask,
+                                         phy == BLE_PHY_CODED ? BLE_GAP_LE_PHY_CODED_S8 : BLE_GAP_LE_PHY_CODED_ANY);
+    if (rc == BLE_HS_ENOTCONN) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return rc == 0 ? ESP_OK : ESP_FAIL;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t ble_port_read_rssi(void)
+{
+    int8_t rssi;
+
+    if (ble_gap_conn_rssi(conn_handle, &rssi) != 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // NimBLE answers from the controller right away, report it like the Bluedroid event
+    ble_common_rssi(rssi);
+    return ESP_OK;
+}
+
+uint16_t ble_port_conn_handle(void)
+{
+    // NimBLE uses the controller's handles
+    return conn_handle;
+}
+
+bool ble_is_connected(void)
+{
+    return atomic_load(&connection_established);
+}
+
+void ble_open_pairing_window(void)
+{
+    // A second request while one is queued is dropped by the queue
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &pairing_window_event);
+}
+
+esp_err_t ble_restart_advertising(void)
+{
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &restart_adv_event);
+    return ESP_OK;
+}
+
+/**
+ * @brief The stack only checks encryption on the calibration characteristic; this also requires the keys to be bonded
+ * @param conn Connection handle of the access
+ * @return true if the link is encrypted with bonded keys
+ */
+static bool link_bonded(uint16_t conn)
+{
+    struct ble_gap_conn_desc desc;
+
+    return ble_gap_conn_find(conn, &desc) == 0 && desc.sec_state.encrypted && desc.sec_state.bonded;
+}
+
+static int gatt_access_cb(uint16_t conn, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    static uint8_t stats_blob[STATS_BLOB_LEN];
+    static int64_t stats_snapshot_us = 0;
+    static uint8_t zone_stats_blob[WIRE_ZONE_STATS_LEN];
+    static int64_t zone_stats_snapshot_us = 0;
+    static uint8_t write_buf[OTA_DATA_MAX_LEN];
+    uint16_t len = 0;
+
+    switch (ctxt->op) {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+        stats_inc(STATS_GATT_READS);
+        if (attr_handle == calibration_handle) {
+            if (!link_bonded(conn)) {
+                return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
+            }
+            uint8_t value = ble_common_calibration_read();
+            return os_mbuf_append(ctxt->om, &value, sizeof(value)) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+        }
+        if (attr_handle == stats_handle) {
+            // The stack slices long reads itself, keep one snapshot for all chunks of a read
+            int64_t now = esp_timer_get_time();
+            if (now - stats_snapshot_us > STATS_SNAPSHOT_MS * 1000) {
+                stats_serialize(stats_blob, sizeof(stats_blob));
+            }
+            stats_snapshot_us = now;
+            return os_mbuf_append(ctxt->om, stats_blob, sizeof(stats_blob)) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+        }
+        if (attr_handle == config_handle) {
+            uint8_t config[CHAR_VALUE_MAX_LEN];
+            len = ble_common_config_read(config, sizeof(config));
+            return os_mbuf_append(ctxt->om, config, len) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+        }
+        if (attr_handle == rules_handle) {
+            static uint8_t rules_blob[BLE_RULES_MAX_LEN];
+            len = ble_common_rules_read(rules_blob, sizeof(rules_blob));
+            return os_mbuf_append(ctxt->om, rules_blob, len) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+        }
+        if (attr_handle == zone_stats_handle) {
+            // Same snapshot window as the statistics, the frame spans two chunks at the default MTU
+            int64_t now = esp_timer_get_time();
+            if (now - zone_stats_snapshot_us > STATS_SNAPSHOT_MS * 1000) {
+                zone_stats_serialize(zone_stats_blob, sizeof(zone_stats_blob));
+            }
+            zone_stats_snapshot_us = now;
+            return os_mbuf_append(ctxt->om, zone_stats_blob, sizeof(zone_stats_blob)) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+        }
+        // Default value for other reads
+        uint8_t zero = 0x00;
+        return os_mbuf_append(ctxt->om, &zero, sizeof(zero)) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+        stats_inc(STATS_GATT_WRITES);
+        if (OS_MBUF_PKTLEN(ctxt->om) > sizeof(write_buf) ||
+            ble_hs_mbuf_to_flat(ctxt->om, write_buf, sizeof(write_buf), &len) != 0) {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+
+        // Image chunks arrive back to back, keep this path free of logging
+        if (attr_handle == ota_data_handle) {
+            ota_data(write_buf, len);
+            return 0;
+        }
+
+        ESP_LOGI(TAG, "GATT write request, handle = %d, value len = %d", attr_handle, len);
+        if (attr_handle == ota_control_handle) {
+            ble_common_ota_control(write_buf, len);
+            return 0;
+        }
+        if (attr_handle == rules_handle) {
+            if (len > BLE_RULES_MAX_LEN) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            return ble_common_rules_write(write_buf, len) ? 0 : BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+        }
+        if (len > CHAR_VALUE_MAX_LEN) {
+            ESP_LOGE(TAG, "Write length %d exceeds maximum %d", len, CHAR_VALUE_MAX_LEN);
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+        if (attr_handle == calibration_handle) {
+            if (!link_bonded(conn)) {
+                return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
+            }
+            ble_common_calibration_write(write_buf, len);
+        } else if (attr_handle == zone_handle) {
+            ble_common_zone_write(write_buf, len);
+        } else if (attr_handle == config_handle) {
+            ble_common_config_write(write_buf, len);
+        } else if (attr_handle == zone_stats_handle) {
+            ble_common_zone_stats_write(write_buf, len);
+        }
+        return 0;
+
+    default:
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+static int gap_event_cb(struct ble_gap_event *event, void *arg)
+{
+    struct ble_gap_conn_desc desc;
+
+    switch (event->type) {
+    case BLE_GAP_EVENT_CONNECT:
+        if (event->connect.status != 0) {
+            ESP_LOGW(TAG, "Connection failed, status %d", event->connect.status);
+            start_advertising();
+            break;
+        }
+        if (ble_gap_conn_find(event->connect.conn_handle, &desc) != 0) {
+            break;
+        }
+        ESP_LOGI(TAG, "Connected, conn_handle %u, remote %02x:%02x:%02x:%02x:%02x:%02x",
+                 event->connect.conn_handle,
+                 desc.peer_ota_addr.val[5], desc.peer_ota_addr.val[4], desc.peer_ota_addr.val[3],
+                 desc.peer_ota_addr.val[2], desc.peer_ota_addr.val[1], desc.peer_ota_addr.val[0]);
+        adv_mode = ADV_MODE_ALLOW_LIST;
+        // Directed advertising aims at the identity, the controller resolves the central's current address against it
+        last_central_addr = desc.peer_id_addr;
+        last_central_bonded = is_bonded(&desc.peer_id_addr);
+        if (last_central_bonded) {
+            // Re-encrypt from the stored keys right away instead of waiting for the first protected access
+            ble_gap_security_initiate(event->connect.conn_handle);
+        }
+        conn_handle = event->connect.conn_handle;
+        atomic_store(&connection_established, true);
+        ble_common_connected();
+        break;
+
+    case BLE_GAP_EVENT_DISCONNECT:
+        ESP_LOGI(TAG, "Disconnected, reason 0x%03x", event->disconnect.reason);
+        atomic_store(&connection_established, false);
+        notifications_enabled = false;
+        ota_notifications_enabled = false;
+        conn_handle = BLE_HS_CONN_HANDLE_NONE;
+        // NimBLE reports controller reasons offset into its own error space
+        ble_common_disconnected(event->disconnect.reason >= BLE_HS_ERR_HCI_BASE ?
+                                event->disconnect.reason - BLE_HS_ERR_HCI_BASE : 0xFF);
+        adv_mode = (DIRECTED_ADV_ENABLE && last_central_bonded) ? ADV_MODE_DIRECTED : ADV_MODE_ALLOW_LIST;
+        if (start_advertising() != 0) {
+            // The health monitor retries once its advertising timeout expires
+            ESP_LOGE(TAG, "Restart advertising failed");
+        }
+        break;
+
+    case BLE_GAP_EVENT_ADV_COMPLETE:
+        // Only a bounded mode runs out; a connection also ends advertising but is handled above
+        if (event->adv_complete.reason == BLE_HS_ETIMEOUT) {
+            ESP_LOGI(TAG, "%s ended, advertising to bonded centrals", adv_mode == ADV_MODE_DIRECTED ? "Directed burst" : "Pairing window");
+            adv_mode = ADV_MODE_ALLOW_LIST;
+            start_advertising();
+        }
+        break;
+
+    case BLE_GAP_EVENT_CONN_UPDATE:
+        if (ble_gap_conn_find(event->conn_update.conn_handle, &desc) == 0) {
+            ESP_LOGI(TAG, "Connection params update, status %d, conn_int %d, latency %d, timeout %d",
+                     event->conn_update.status, desc.conn_itvl, desc.conn_latency, desc.supervision_timeout);
+        }
+        break;
+
+    case BLE_GAP_EVENT_ENC_CHANGE:
+        if (event->enc_change.status != 0) {
+            ESP_LOGW(TAG, "Authentication failed, status %d", event->enc_change.status);
+            ble_common_encrypted(false);
+            break;
+        }
+        if (ble_gap_conn_find(event->enc_change.conn_handle, &desc) == 0) {
+            ESP_LOGI(TAG, "Link encrypted, bonded %d, key size %d", desc.sec_state.bonded, desc.sec_state.key_size);
+            if (!last_central_bonded && desc.sec_state.bonded) {
+                // New bond, let it through the allow list from now on
+                last_central_bonded = true;
+                last_central_addr = desc.peer_id_addr;
+                update_accept_list();
+            }
+        }
+        ble_common_encrypted(true);
+        break;
+
+    case BLE_GAP_EVENT_REPEAT_PAIRING:
+        // The central lost its keys; forget ours and let it pair again
+        if (ble_gap_conn_find(event->repeat_pairing.conn_handle, &desc) == 0) {
+            ble_store_util_delete_peer(&desc.peer_id_addr);
+        }
+        return BLE_GAP_REPEAT_PAIRING_RETRY;
+
+    case BLE_GAP_EVENT_SUBSCRIBE:
+        if (event->subscribe.attr_handle == zone_handle) {
+            ESP_LOGI(TAG, "Notifications %s", event->subscribe.cur_notify ? "enabled" : "disabled");
+            notifications_enabled = event->subscribe.cur_notify;
+        } else if (event->subscribe.attr_handle == ota_control_handle) {
+            ota_notifications_enabled = event->subscribe.cur_notify;
+        }
+        break;
+
+#if CONFIG_BT_NIMBLE_50_FEATURE_SUPPORT
+    case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+        if (event->phy_updated.status != 0) {
+            ESP_LOGW(TAG, "PHY update failed, status %d", event->phy_updated.status);
+            break;
+        }
+        ble_common_phy_updated(event->phy_updated.tx_phy, event->phy_updated.rx_phy);
+        break;
+#endif
+
+    case BLE_GAP_EVENT_MTU:
+        ESP_LOGI(TAG, "MTU %d", event->mtu.value);
+        break;
+
+    default:
+        break;
+    }
+    return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ *
+ * Shared between ble_common.c and the host stack backend
+ *
+ * The backend owns the stack: advertising, security, the attribute table
+ * and the connection. It reports what happens through the ble_common_*
+ * hooks, which keep the statistics, OTA and application side identical for
+ * both stacks.
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "ble.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// BLE characteristic value constraints
+#define GATTS_SERVICE_UUID   0x00FF
+#define GATTS_CHAR_UUID      0xFF01
+#define GATTS_CALIBRATION_CHAR_UUID  0xFF02
+#define GATTS_STATS_CHAR_UUID        0xFF03
+#define GATTS_OTA_CONTROL_CHAR_UUID  0xFF04
+#define GATTS_OTA_DATA_CHAR_UUID     0xFF05
+#define GATTS_CONFIG_CHAR_UUID       0xFF06
+#define GATTS_RULES_CHAR_UUID        0xFF07
+#define GATTS_ZONE_STATS_CHAR_UUID   0xFF08
+#define OTA_DATA_MAX_LEN     512    // Largest ATT write the data characteristic accepts
+#define DEVICE_NAME          "BLE_Encoder"   // Sent in the scan response
+#define SHORT_ID_LEN         2      // Advertised as 0x00FF service data: the last two bytes of the BT MAC
+#define CHAR_VALUE_MAX_LEN   20
+#define ADV_DATA_MAX_LEN     31
+#define LOCAL_MTU            500
+#define BLE_PORT_CONN_HANDLE_NONE 0xFFFF
+#define GATT_DB_VERSION      4      // Bump with any change to the attribute table, bonded centrals are then told to rediscover
+
+// BLE Security
+#define SECURITY_KEY_SIZE    16     // Maximum encryption key size in bytes
+
+// Reconnection
+#define DIRECTED_ADV_ENABLE  true   // Open with a high duty directed advertising burst toward the last bonded central
+#define DIRECTED_ADV_BURST_MS 1000  // Burst length, kept under the 1.28 s controller limit
+#define PAIRING_WINDOW_MS    60000  // Accept any central for this long after a button press while disconnected
+#define ADV_INTERVAL         0x20   // 20 ms, in 0.625 ms units
+
+// Connection Parameters, in 1.25 ms units
+#define CONN_INT_MIN         0x10   // 20 ms
+#define CONN_INT_MAX         0x20   // 40 ms
+#define OTA_CONN_INT_MIN     0x06   // 7.5 ms, shortest allowed, for firmware transfers
+#define OTA_CONN_INT_MAX     0x0C   // 15 ms
+#define CONN_SUPERVISION_TIMEOUT 400  // 4 s, in 10 ms units
+
+// PHY Policy
+#define PHY_LONG_RANGE       false  // Keep links on Coded PHY (S8) for gateways far away, needs BLE 5 on both ends
+#define STREAM_PAYLOAD_1M    244    // Fills one 251 byte data length extended PDU
+#define STREAM_PAYLOAD_2M    497    // Full 500 byte MTU, airtime is short enough to span PDUs
+#define STREAM_PAYLOAD_CODED 64     // Each PDU takes up to 8x the airtime, keep retransmissions cheap
+
+// Adaptive TX power, see ble_common.c
+#define TX_POWER_ADAPTIVE    true   // Step the connection TX power with the link margin
+#define TX_POWER_ADV_DBM     9      // Advertising and initial connection power, carried in the advertising data
+#define TX_POWER_POLL_MS     2000   // Connection RSSI sampling period
+#define TX_POWER_MARGIN_HIGH (-60)  // Step down while the estimated RSSI at the central stays above this, dBm
+#define TX_POWER_MARGIN_LOW  (-75)  // Step up below this, dBm
+#define TX_POWER_HOLD_POLLS  3      // Samples between two step downs, so the average can follow
+
+// LE credit based L2CAP channel for bulk streaming, see ble.h
+#define L2CAP_COC_PSM        0x0080 // First dynamic LE PSM
+#define L2CAP_COC_MTU        512    // Largest SDU in either direction
+#define L2CAP_COC_BUF_COUNT  6      // SDU buffers shared by receive and transmit
+
+typedef enum {
+    BLE_ATTR_ZONE,          ///< Zone value, 0xFF01
+    BLE_ATTR_OTA_CONTROL,   ///< OTA control value, 0xFF04
+} ble_attr_t;
+
+// Values match the HCI PHY codes used by both stacks
+typedef enum {
+    BLE_PHY_NONE  = 0,      ///< Not connected
+    BLE_PHY_1M    = 1,
+    BLE_PHY_2M    = 2,
+    BLE_PHY_CODED = 3,      ///< Long range, S8 coding
+} ble_phy_t;
+
+/**
+ * @brief Start the controller and host, register the service and queue the first advertisement
+ * @return ESP_OK on success
+ */
+esp_err_t ble_port_init(void);
+
+/**
+ * @brief Notify a characteristic on the current connection
+ * @param attr Characteristic to notify
+ * @param value Value to send
+ * @param len Length of value, at most ble_port_payload_max()
+ * @return ESP_OK if queued, ESP_ERR_INVALID_STATE if not connected or not subscribed,
+ *         ESP_ERR_NO_MEM while the stack is congested
+ */
+esp_err_t ble_port_notify(ble_attr_t attr, const uint8_t *value, size_t len);
+
+/**
+ * @brief Largest notification payload on the current connection
+ * @return Negotiated ATT MTU minus the 3 byte header
+ */
+size_t ble_port_payload_max(void);
+
+/**
+ * @brief Send one SDU on the L2CAP stream channel
+ *
+ * The channel has credit based flow control; while the central has no
+ * credits left, or the previous SDU is still going out, the SDU is refused.
+ *
+ * @param data SDU bytes
+ * @param len SDU length, at most ble_port_stream_mtu()
+ * @return ESP_OK if queued, ESP_ERR_INVALID_STATE if no channel is open, ESP_ERR_INVALID_SIZE
+ *         if len exceeds the channel MTU, ESP_ERR_NO_MEM while out of credits or buffers,
+ *         ESP_ERR_NOT_SUPPORTED if the stack has no LE channels
+ */
+esp_err_t ble_port_stream_send(const uint8_t *data, size_t len);
+
+/**
+ * @brief Largest SDU the open stream channel takes
+ * @return The smaller of both ends' SDU sizes, 0 if no channel is open
+ */
+size_t ble_port_stream_mtu(void);
+
+/**
+ * @brief Indicate Service Changed over the whole handle range to the encrypted central
+ *
+ * Stacks that track bonds also queue the indication for bonded centrals
+ * that are not connected.
+ *
+ * @return ESP_OK once the indication is queued for at least one central
+ */
+esp_err_t ble_port_service_changed(void);
+
+/**
+ * @brief Ask the central for a connection interval range
+ * @param min_int Minimum interval in 1.25 ms units
+ * @param max_int Maximum interval in 1.25 ms units
+ */
+void ble_port_set_conn_interval(uint16_t min_int, uint16_t max_int);
+
+/**
+ * @brief Ask the controller to move the current link to a PHY, for both directions
+ * @param phy PHY to use
+ * @return ESP_OK if the request was sent, ESP_ERR_NOT_SUPPORTED without BLE 5 support in the build
+ */
+esp_err_t ble_port_set_phy(ble_phy_t phy);
+
+/**
+ * @brief Read the RSSI of the current link; the result arrives through ble_common_rssi()
+ * @return ESP_OK if the read was started, ESP_ERR_INVALID_STATE if not connected
+ */
+esp_err_t ble_port_read_rssi(void);
+
+/**
+ * @brief Controller handle of the current connection, which selects its TX power setting
+ * @return The HCI connection handle, BLE_PORT_CONN_HANDLE_NONE if not connected
+ */
+uint16_t ble_port_conn_handle(void);
+
+/**
+ * @brief Short ID that tells encoders apart in the advertisement
+ * @param id Output, SHORT_ID_LEN bytes in address order
+ */
+void ble_common_short_id(uint8_t *id);
+
+/**
+ * @brief The service is registered and started
+ */
+void ble_common_service_started(void);
+
+/**
+ * @brief The controller confirmed an advertising start
+ */
+void ble_common_advertising_started(void);
+
+/**
+ * @brief A central connected
+ */
+void ble_common_connected(void);
+
+/**
+ * @brief The link was encrypted, or encryption failed
+ * @param success true if the link is now encrypted
+ */
+void ble_common_encrypted(bool success);
+
+/**
+ * @brief The controller reported the PHY of the link
+ * @param tx_phy Transmit PHY
+ * @param rx_phy Receive PHY
+ */
+void ble_common_phy_updated(ble_phy_t tx_phy, ble_phy_t rx_phy);
+
+/**
+ * @brief A connection RSSI read completed
+ * @param rssi Received signal strength of the central, dBm
+ */
+void ble_common_rssi(int8_t rssi);
+
+/**
+ * @brief The central opened or closed the L2CAP stream channel
+ * @param open true once the channel is connected
+ * @param mtu Largest SDU the channel takes, 0 when closed
+ */
+void ble_common_stream_changed(bool open, size_t mtu);
+
+/**
+ * @brief The central disconnected; the backend restarts advertising afterwards
+ * @param reason HCI disconnect reason
+ */
+void ble_common_disconnected(uint8_t reason);
+
+/**
+ * @brief Handle a write to the zone characteristic
+ * @param data Written bytes
+ * @param len Written length
+ */
+void ble_common_zone_write(const uint8_t *data, size_t len);
+
+/**
+ * @brief Handle a write to the calibration characteristic
+ * @param data Written bytes
+ * @param len Written length
+ */
+void ble_common_calibration_write(const uint8_t *data, size_t len);
+
+/**
+ * @brief Value for a read of the calibration characteristic
+ * @return 0x01 in calibration mode, 0x00 otherwise
+ */
+uint8_t ble_common_calibration_read(void);
+
+/**
+ * @brief Handle a write to the configuration characteristic
+ * @param data Written bytes
+ * @param len Written length
+ */
+void ble_common_config_write(const uint8_t *data, size_t len);
+
+/**
+ * @brief Value for a read of the configuration characteristic
+ * @param value Receives the value
+ * @param max_len Size of value
+ * @return Length of the value
+ */
+size_t ble_common_config_read(uint8_t *value, size_t max_len);
+
+/**
+ * @brief Handle a write to the rules characteristic
+ * @param data Written program
+ * @param len Written length, up to BLE_RULES_MAX_LEN
+ * @return false if the application rejected the program
+ */
+bool ble_common_rules_write(const uint8_t *data, size_t len);
+
+/**
+ * @brief Value for a read of the rules characteristic
+ * @param value Receives the program
+ * @param max_len Size of value
+ * @return Length of the program
+ */
+size_t ble_common_rules_read(uint8_t *value, size_t max_len);
+
+/**
+ * @brief Handle a write to the zone statistics characteristic, which clears them
+ * @param data Written bytes, ignored
+ * @param len Written length
+ */
+void ble_common_zone_stats_write(const uint8_t *data, size_t len);
+
+/**
+ * @brief Handle a write to the OTA control characteristic
+ * @param data Written bytes
+ * @param len Written length
+ */
+void ble_common_ota_control(const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,182 @@
+/*
+ *
+ * Capture sessions: encoder samples streamed in batches over the L2CAP channel
+ *
+ */
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "ble.h"
+#include "stats.h"
+#include "wire.h"
+#include "capture.h"
+
+#define TAG "CAPTURE"
+
+#define CAPTURE_SAMPLES_MAX  ((CAPTURE_FRAME_MAX_LEN - WIRE_CAPTURE_HEADER_LEN) / WIRE_CAPTURE_SAMPLE_LEN)
+
+static const position_source_t *capture_source = NULL;
+static esp_timer_handle_t sample_timer = NULL;
+static TaskHandle_t capture_task_handle = NULL;
+static StaticTask_t capture_task_buffer;
+static StackType_t capture_task_stack[CAPTURE_TASK_STACK_SIZE];
+
+// The timer fills one batch while the task sends the other
+static portMUX_TYPE batch_lock = portMUX_INITIALIZER_UNLOCKED;
+static wire_capture_sample_t batches[2][CAPTURE_SAMPLES_MAX];
+static uint8_t batch_count[2];
+static uint8_t fill = 0;
+static uint8_t batch_limit = 0;         // Samples per frame on the open channel, 0 while no session runs
+static encoder_event_t last_sample;     // Only touched by the timer
+static uint8_t frame[CAPTURE_FRAME_MAX_LEN];
+
+static void capture_sample_cb(void *arg)
+{
+    encoder_event_t snapshot;
+    if (position_source_read_snapshot(capture_source, &snapshot) != ESP_OK) {
+        return;
+    }
+    if (snapshot.timestamp == last_sample.timestamp && snapshot.state.position == last_sample.state.position) {
+        return;
+    }
+    last_sample = snapshot;
+
+    wire_capture_sample_t sample = {
+        .timestamp = snapshot.timestamp,
+        .position = snapshot.state.position,
+        .interval = snapshot.interval,
+    };
+    bool full = false;
+
+    portENTER_CRITICAL(&batch_lock);
+    uint8_t n = batch_count[fill];
+    if (batch_limit) {
+        if (n < batch_limit) {
+            batches[fill][n++] = sample;
+            batch_count[fill] = n;
+        } else {
+            // The task has not taken the full batch yet, fold the step into its last sample
+            batches[fill][n - 1] = sample;
+        }
+        full = n >= batch_limit;
+    }
+    portEXIT_CRITICAL(&batch_lock);
+
+    if (full) {
+        xTaskNotifyGive(capture_task_handle);
+    }
+}
+
+/**
+ * @brief Send a frame, waiting a few ticks for credits
+ * @param len Frame length
+ * @return true if the channel took it
+ */
+static bool send_frame(size_t len)
+{
+    for (int i = 0; i <= CAPTURE_SEND_RETRIES; i++) {
+        esp_err_t ret = ble_stream_send(frame, len);
+        if (ret == ESP_OK) {
+            return true;
+        }
+        if (ret != ESP_ERR_NO_MEM) {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+    return false;
+}
+
+/**
+ * @brief Start or stop the sampling timer to follow the stream channel
+ * @param limit Samples per frame the channel takes, 0 if it is closed
+ */
+static void follow_channel(uint8_t limit)
+{
+    if (limit && !batch_limit) {
+        portENTER_CRITICAL(&batch_lock);
+        batch_count[0] = batch_count[1] = 0;
+        batch_limit = limit;
+        portEXIT_CRITICAL(&batch_lock);
+        // Forces the current state into the first frame
+        memset(&last_sample, 0xFF, sizeof(last_sample));
+        esp_timer_start_periodic(sample_timer, CAPTURE_SAMPLE_PERIOD_US);
+        ESP_LOGI(TAG, "Session started, %u samples per frame", limit);
+    } else if (!limit && batch_limit) {
+        esp_timer_stop(sample_timer);
+        portENTER_CRITICAL(&batch_lock);
+        batch_limit = 0;
+        portEXIT_CRITICAL(&batch_lock);
+        ESP_LOGI(TAG, "Session ended");
+    }
+}
+
+static void capture_task(void *arg)
+{
+    uint16_t sequence = 0;
+
+    for (;;) {
+        size_t mtu = ble_stream_mtu();
+        size_t limit = mtu > WIRE_CAPTURE_HEADER_LEN ? (mtu - WIRE_CAPTURE_HEADER_LEN) / WIRE_CAPTURE_SAMPLE_LEN : 0;
+        if (limit > CAPTURE_SAMPLES_MAX) {
+            limit = CAPTURE_SAMPLES_MAX;
+        }
+        if (!batch_limit && limit) {
+            sequence = 0;
+        }
+        follow_channel((uint8_t)limit);
+        if (!limit) {
+            vTaskDelay(pdMS_TO_TICKS(CAPTURE_IDLE_POLL_MS));
+            continue;
+        }
+
+        // Woken early by a full batch
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CAPTURE_FLUSH_MS));
+
+        portENTER_CRITICAL(&batch_lock);
+        uint8_t sending = fill;
+        uint8_t count = batch_count[sending];
+        fill ^= 1;
+        batch_count[fill] = 0;
+        portEXIT_CRITICAL(&batch_lock);
+        if (!count) {
+            continue;
+        }
+
+        wire_capture_header_t header = { .count = count, .sequence = sequence++ };
+        position_source_get_timestamp_hz(capture_source, &header.timestamp_hz);
+        size_t len = wire_pack_capture_header(frame, &header);
+        for (int i = 0; i < count; i++) {
+            len += wire_pack_capture_sample(&frame[len], &batches[sending][i]);
+        }
+
+        if (send_frame(len)) {
+            stats_inc(STATS_CAPTURE_FRAMES);
+        } else {
+            stats_inc(STATS_CAPTURE_DROPPED);
+        }
+    }
+}
+
+esp_err_t capture_init(const position_source_t *source)
+{
+    if (!source) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    capture_source = source;
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = capture_sample_cb,
+        .name = "capture"
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &sample_timer);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    capture_task_handle = xTaskCreateStatic(capture_task, "capture", CAPTURE_TASK_STACK_SIZE, NULL,
+                                            CAPTURE_TASK_PRIORITY, capture_task_stack, &capture_task_buffer);
+    return capture_task_handle ? ESP_OK : ESP_ERR_NO_MEM;
+}
@@ -0,0 +1,41 @@
+/*
+ *
+ * Capture sessions: encoder samples streamed in batches over the L2CAP channel
+ *
+ * While a central holds the stream channel open (see ble.h), a periodic
+ * timer reads the position snapshot, which takes no lock, and records each
+ * new step. A full batch, or a partial one after CAPTURE_FLUSH_MS, goes out
+ * as one SDU: a capture_header frame followed by its capture_sample
+ * records, as laid out in main/wire.json.
+ *
+ * Steps closer together than CAPTURE_SAMPLE_PERIOD_US are merged into the
+ * last one; the position is always exact.
+ *
+ */
+#pragma once
+
+#include "esp_err.h"
+#include "position_source.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAPTURE_FRAME_MAX_LEN     512    // Largest SDU the stream channel takes
+#define CAPTURE_SAMPLE_PERIOD_US  1000   // Snapshot reads while a session is open
+#define CAPTURE_FLUSH_MS          100    // Longest a sample waits for its frame to fill
+#define CAPTURE_IDLE_POLL_MS      250    // Checks for a newly opened channel
+#define CAPTURE_SEND_RETRIES      20     // Ticks to wait for credits before a frame is dropped
+#define CAPTURE_TASK_STACK_SIZE   3072
+#define CAPTURE_TASK_PRIORITY     1      // Same as the encoder loop
+
+/**
+ * @brief Start the capture task; sessions then follow the stream channel by themselves
+ * @param source Position source to sample, must stay valid
+ * @return ESP_OK on success
+ */
+esp_err_t capture_init(const position_source_t *source);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,155 @@
+/*
+ *
+ * Deep sleep with the encoder position kept by the ULP coprocessor or LP core
+ *
+ */
+#include <inttypes.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "deep_sleep.h"
+
+#if CONFIG_ENCODER_DEEP_SLEEP
+#include "driver/rtc_io.h"
+#include "esp_sleep.h"
+#include "soc/soc_caps.h"
+#if CONFIG_ULP_COPROC_TYPE_LP_CORE
+#include "ulp_lp_core.h"
+#else
+#include "ulp_riscv.h"
+#endif
+#include "ulp_encoder.h"
+#include "ulp/ulp_encoder_shared.h"
+
+#define TAG "SLEEP"
+
+extern const uint8_t ulp_encoder_bin_start[] asm("_binary_ulp_encoder_bin_start");
+extern const uint8_t ulp_encoder_bin_end[] asm("_binary_ulp_encoder_bin_end");
+
+// The program's encoder_state, in the RTC / LP memory both cores can reach
+#define shared ((ulp_encoder_shared_t *)&ulp_encoder_state)
+
+/**
+ * @brief Hand an encoder pin to the RTC / LP IO mux as a pulled up input
+ * @param pin GPIO number
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the coprocessor cannot read the pin
+ */
+static esp_err_t configure_pin(gpio_num_t pin)
+{
+    if (!rtc_gpio_is_valid_gpio(pin)) {
+        ESP_LOGE(TAG, "GPIO %d cannot be read in deep sleep", pin);
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = rtc_gpio_init(pin);
+    if (ret == ESP_OK) {
+        ret = rtc_gpio_set_direction(pin, RTC_GPIO_MODE_INPUT_ONLY);
+    }
+    if (ret == ESP_OK) {
+        ret = rtc_gpio_pulldown_dis(pin);
+    }
+    if (ret == ESP_OK) {
+        ret = rtc_gpio_pullup_en(pin);
+    }
+    return ret;
+}
+
+esp_err_t deep_sleep_enter(const deep_sleep_config_t *config)
+{
+    if (!config) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = configure_pin(config->pin_a);
+    if (ret == ESP_OK) {
+        ret = configure_pin(config->pin_b);
+    }
+    if (ret != ESP_OK) {
+        rtc_gpio_deinit(config->pin_a);
+        return ret;
+    }
+
+    // Loading clears the program's variables, so seed them afterwards
+#if CONFIG_ULP_COPROC_TYPE_LP_CORE
+    ret = ulp_lp_core_load_binary(ulp_encoder_bin_start, ulp_encoder_bin_end - ulp_encoder_bin_start);
+#else
+    ret = ulp_riscv_load_binary(ulp_encoder_bin_start, ulp_encoder_bin_end - ulp_encoder_bin_start);
+#endif
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Loading the coprocessor program failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    uint8_t ab = (rtc_gpio_get_level(config->pin_a) << 1) | rtc_gpio_get_level(config->pin_b);
+    quadrature_init(&shared->decoder, ab, config->resolution, 0);
+    shared->position = config->position;
+    shared->wake_min = config->wake_min;
+    shared->wake_max = config->wake_max;
+    shared->pin_a = config->pin_a;
+    shared->pin_b = config->pin_b;
+    shared->flip = config->flip;
+    shared->samples = 0;
+    shared->woke = 0;
+
+#if CONFIG_ULP_COPROC_TYPE_LP_CORE
+    ulp_lp_core_cfg_t cfg = {
+        .wakeup_source = ULP_LP_CORE_WAKEUP_SOURCE_LP_TIMER,
+        .lp_timer_sleep_duration_us = CONFIG_ENCODER_ULP_SAMPLE_PERIOD_US,
+    };
+    ret = ulp_lp_core_run(&cfg);
+#else
+    ret = ulp_set_wakeup_period(0, CONFIG_ENCODER_ULP_SAMPLE_PERIOD_US);
+    if (ret == ESP_OK) {
+        ret = ulp_riscv_run();
+    }
+#endif
+    if (ret == ESP_OK) {
+        ret = esp_sleep_enable_ulp_wakeup();
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Starting the coprocessor failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+#if SOC_PM_SUPPORT_RTC_PERIPH_PD
+    // Keeps the pull-ups on the encoder pins powered
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+#endif
+    ESP_LOGI(TAG, "Deep sleep at position %" PRId32 ", waking outside [%" PRId32 ", %" PRId32 "]",
+             config->position, config->wake_min, config->wake_max);
+    esp_deep_sleep_start();
+    return ESP_FAIL;
+}
+
+bool deep_sleep_resume(int32_t *position)
+{
+    if (!position || esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_ULP) {
+        return false;
+    }
+
+#if CONFIG_ULP_COPROC_TYPE_LP_CORE
+    ulp_lp_core_stop();
+#else
+    ulp_riscv_timer_stop();
+    ulp_riscv_halt();
+#endif
+    rtc_gpio_deinit(shared->pin_a);
+    rtc_gpio_deinit(shared->pin_b);
+
+    *position = shared->position;
+    ESP_LOGI(TAG, "Woken by the coprocessor at position %" PRId32 " after %" PRIu32 " samples, %" PRIu32 " illegal transitions",
+             shared->position, shared->samples, shared->decoder.illegal);
+    return true;
+}
+
+#else
+
+esp_err_t deep_sleep_enter(const deep_sleep_config_t *config)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+bool deep_sleep_resume(int32_t *position)
+{
+    return false;
+}
+
+#endif
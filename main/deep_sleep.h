@@ -0,0 +1,64 @@
+/*
+ *
+ * Deep sleep with the encoder position kept by the ULP coprocessor or LP core
+ *
+ * The main core and radio power down while the coprocessor samples the A/B
+ * pins and runs the same quadrature decoder as the driver. It wakes the
+ * main core once the position leaves a given range, i.e. on a zone change;
+ * the boot that follows picks the position up with deep_sleep_resume().
+ *
+ * Built with CONFIG_ENCODER_DEEP_SLEEP, which needs a ULP RISC-V or LP core
+ * (ESP32-S2/S3/C6/P4). Without it both calls report that nothing happened.
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "quadrature.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief What the coprocessor tracks while the main core sleeps
+ */
+typedef struct {
+    gpio_num_t pin_a;       ///< A signal, must be an RTC / LP IO
+    gpio_num_t pin_b;       ///< B signal, must be an RTC / LP IO
+    int32_t position;       ///< Position to count on from
+    int32_t wake_min;       ///< Wake once the position drops below this
+    int32_t wake_max;       ///< Wake once the position rises above this
+    quadrature_resolution_t resolution; ///< As encoder_set_resolution()
+    bool flip;              ///< As encoder_flip_direction()
+} deep_sleep_config_t;
+
+/**
+ * @brief Start the coprocessor on the encoder pins and enter deep sleep
+ *
+ * The encoder driver must be uninitialized first, the pins are handed to
+ * the RTC / LP IO mux. Does not return on success.
+ *
+ * @param config What to track
+ * @return ESP_ERR_INVALID_ARG if a pin cannot be read in deep sleep,
+ *         ESP_ERR_NOT_SUPPORTED without CONFIG_ENCODER_DEEP_SLEEP, or the coprocessor error
+ */
+esp_err_t deep_sleep_enter(const deep_sleep_config_t *config);
+
+/**
+ * @brief Take the position back from the coprocessor after a wake from deep sleep
+ *
+ * Stops the coprocessor and returns the pins to the GPIO matrix. Call
+ * before encoder_init().
+ *
+ * @param position Receives the counted position
+ * @return true if this boot is a wake by the coprocessor
+ */
+bool deep_sleep_resume(int32_t *position);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,116 @@
+/*
+ *
+ * Hardware edge timestamps for the encoder A/B inputs
+ *
+ */
+#include <string.h>
+#include "soc/soc_caps.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "edge_capture.h"
+
+#define TAG "EDGE_CAPTURE"
+
+#if SOC_MCPWM_SUPPORTED
+static bool IRAM_ATTR capture_isr(mcpwm_cap_channel_handle_t channel, const mcpwm_capture_event_data_t *edata, void *user_data)
+{
+    edge_capture_t *capture = (edge_capture_t *)user_data;
+    return capture->cb(edata->cap_value, capture->arg);
+}
+
+/**
+ * @brief Add a capture channel on both edges of a pin
+ * @param capture Capture instance with its timer created
+ * @param pin Input pin
+ * @param channel Receives the channel handle
+ * @return ESP_OK on success
+ */
+static esp_err_t add_channel(edge_capture_t *capture, gpio_num_t pin, mcpwm_cap_channel_handle_t *channel)
+{
+    mcpwm_capture_channel_config_t channel_conf = {
+        .gpio_num = pin,
+        .prescale = 1,
+        .flags.pos_edge = true,
+        .flags.neg_edge = true,
+    };
+    esp_err_t ret = mcpwm_new_capture_channel(capture->timer, &channel_conf, channel);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    mcpwm_capture_event_callbacks_t cbs = {
+        .on_cap = capture_isr,
+    };
+    ret = mcpwm_capture_channel_register_event_callbacks(*channel, &cbs, capture);
+    if (ret == ESP_OK) {
+        ret = mcpwm_capture_channel_enable(*channel);
+    }
+    return ret;
+}
+#endif
+
+esp_err_t edge_capture_enable(edge_capture_t *capture, gpio_num_t pin_a, gpio_num_t pin_b,
+                              edge_capture_cb_t cb, void *arg, uint32_t *resolution_hz)
+{
+    if (!capture || !cb || !resolution_hz) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+#if SOC_MCPWM_SUPPORTED
+    capture->cb = cb;
+    capture->arg = arg;
+
+    mcpwm_capture_timer_config_t timer_conf = {
+        .group_id = 0,
+        .clk_src = MCPWM_CAPTURE_CLK_SRC_DEFAULT,
+    };
+    esp_err_t ret = mcpwm_new_capture_timer(&timer_conf, &capture->timer);
+    if (ret == ESP_OK) {
+        ret = add_channel(capture, pin_a, &capture->channel_a);
+    }
+    if (ret == ESP_OK) {
+        ret = add_channel(capture, pin_b, &capture->channel_b);
+    }
+    if (ret == ESP_OK) {
+        ret = mcpwm_capture_timer_get_resolution(capture->timer, resolution_hz);
+    }
+    if (ret == ESP_OK) {
+        ret = mcpwm_capture_timer_enable(capture->timer);
+    }
+    if (ret == ESP_OK) {
+        ret = mcpwm_capture_timer_start(capture->timer);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Capture setup failed: %s", esp_err_to_name(ret));
+        edge_capture_disable(capture);
+    }
+    return ret;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t edge_capture_disable(edge_capture_t *capture)
+{
+    if (!capture) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+#if SOC_MCPWM_SUPPORTED
+    // Channels go first, the timer cannot be deleted while they hold it; each step is best effort
+    mcpwm_cap_channel_handle_t channels[] = {capture->channel_a, capture->channel_b};
+    for (int i = 0; i < 2; i++) {
+        if (channels[i]) {
+            mcpwm_capture_channel_disable(channels[i]);
+            mcpwm_del_capture_channel(channels[i]);
+        }
+    }
+    if (capture->timer) {
+        mcpwm_capture_timer_stop(capture->timer);
+        mcpwm_capture_timer_disable(capture->timer);
+        mcpwm_del_capture_timer(capture->timer);
+    }
+#endif
+    memset(capture, 0, sizeof(*capture));
+    return ESP_OK;
+}
@@ -0,0 +1,67 @@
+/*
+ *
+ * Hardware edge timestamps for the encoder A/B inputs
+ *
+ * Uses an MCPWM capture timer with one capture channel per pin, latching the
+ * timer on both edges. The latched value reaches the callback directly, so
+ * edge intervals carry no interrupt latency jitter.
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "driver/gpio.h"
+#include "driver/mcpwm_cap.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Called from the capture ISR on every edge of either pin
+ * @param timestamp Latched capture timer value
+ * @param arg User argument
+ * @return true if a higher priority task was woken
+ */
+typedef bool (*edge_capture_cb_t)(uint32_t timestamp, void *arg);
+
+/**
+ * @brief Capture timer and the channels on the A/B pins
+ */
+typedef struct {
+    mcpwm_cap_timer_handle_t timer;
+    mcpwm_cap_channel_handle_t channel_a;
+    mcpwm_cap_channel_handle_t channel_b;
+    edge_capture_cb_t cb;
+    void *arg;
+} edge_capture_t;
+
+/**
+ * @brief Start latching timestamps on both edges of two input pins
+ *
+ * The pins keep their GPIO input configuration, so gpio_get_level() still
+ * reads them from the callback.
+ *
+ * @param capture Capture instance, zero-initialized
+ * @param pin_a First input
+ * @param pin_b Second input
+ * @param cb Edge callback, must be in IRAM
+ * @param arg Argument for cb
+ * @param resolution_hz Receives the timestamp resolution
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if the chip has no MCPWM
+ */
+esp_err_t edge_capture_enable(edge_capture_t *capture, gpio_num_t pin_a, gpio_num_t pin_b,
+                              edge_capture_cb_t cb, void *arg, uint32_t *resolution_hz);
+
+/**
+ * @brief Stop capturing and delete the timer and channels
+ * @param capture Capture instance, may be unused
+ * @return ESP_OK on success
+ */
+esp_err_t edge_capture_disable(edge_capture_t *capture);
+
+#ifdef __cplusplus
+}
+#endif
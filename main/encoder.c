@@ -0,0 +1,535 @@
+/*
+ *
+ * Interrupt-driven incremental rotary encoder driver with signal quality monitoring
+ *
+ */
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "encoder.h"
+
+#define TAG "ENCODER"
+
+static inline uint8_t read_ab(const encoder_info_t *info)
+{
+    return (gpio_get_level(info->pin_a) << 1) | gpio_get_level(info->pin_b);
+}
+
+static inline uint32_t us_to_ticks(const encoder_info_t *info, uint32_t us)
+{
+    return (uint32_t)((uint64_t)us * info->timestamp_hz / 1000000);
+}
+
+/**
+ * @brief Set the timestamp rate and the idle time after which a 32-bit tick difference is ambiguous
+ * @param info Driver instance
+ * @param hz Timestamp ticks per second
+ */
+static void set_timestamp_hz(encoder_info_t *info, uint32_t hz)
+{
+    info->timestamp_hz = hz;
+    info->wrap_us = (int64_t)(((uint64_t)1 << 32) * 1000000 / hz);
+}
+
+/**
+ * @brief Publish a state change that is not a step, call with the lock held
+ * @param info Driver instance
+ */
+static void publish_state(encoder_info_t *info)
+{
+    encoder_event_t event = {
+        .state = info->state,
+        .timestamp = info->last_step_ticks,
+    };
+    position_snapshot_publish(&info->snapshot, &event);
+}
+
+/**
+ * @brief Decode one edge and queue an event if it completed a step
+ * @param info Driver instance
+ * @param now Timestamp of the edge
+ * @return true if a higher priority task was woken
+ */
+static bool IRAM_ATTR encoder_edge(encoder_info_t *info, uint32_t now)
+{
+    uint32_t start = esp_cpu_get_cycle_count();
+    uint8_t ab = read_ab(info);
+    encoder_event_t event;
+    bool send = false;
+    bool arm = false;
+
+    portENTER_CRITICAL_ISR(&info->lock);
+    info->isr_raw++;
+
+    // Every edge is decoded, skipping one would turn the next into an illegal double transition
+    int step = quadrature_update(&info->decoder, ab, now);
+    if (step) {
+        if (info->flip) {
+            step = -step;
+        }
+        info->state.position += step;
+        info->state.direction = step > 0 ? ENCODER_DIRECTION_CLOCKWISE : ENCODER_DIRECTION_COUNTER_CLOCKWISE;
+        event.state = info->state;
+        event.timestamp = now;
+        // After an idle longer than one counter wrap the tick difference is meaningless, report no interval
+        int64_t now_us = esp_timer_get_time();
+        bool timed = info->stepped && now_us - info->last_step_us < info->wrap_us;
+        event.interval = timed ? now - info->last_step_ticks : 0;
+        info->last_step_ticks = now;
+        info->last_step_us = now_us;
+        info->stepped = true;
+        position_snapshot_publish(&info->snapshot, &event);
+
+        // The gate only thins out queued events, a step it holds back is queued when it closes
+        if (!info->gate_ticks || now - info->last_event_ticks >= info->gate_ticks) {
+            info->last_event_ticks = now;
+            info->isr_accepted++;
+            info->gated = false;
+            send = info->queue != NULL;
+        } else {
+            info->gated = true;
+            info->gated_event = event;
+            arm = !info->gate_armed;
+            info->gate_armed = true;
+        }
+    }
+    portEXIT_CRITICAL_ISR(&info->lock);
+
+    BaseType_t task_woken = pdFALSE;
+    if (send) {
+        xQueueOverwriteFromISR(info->queue, &event, &task_woken);
+    }
+    if (arm) {
+        esp_timer_start_once(info->gate_timer, info->min_edge_interval_us);
+    }
+
+    // Only this handler writes the maximum, readers tolerate a stale value
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    if (cycles > info->isr_max_cycles) {
+        info->isr_max_cycles = cycles;
+    }
+    return task_woken == pdTRUE;
+}
+
+/**
+ * @brief Queue the last step the gate held back, runs once the gate interval has passed
+ * @param arg Driver instance
+ */
+static void gate_timer_cb(void *arg)
+{
+    encoder_info_t *info = (encoder_info_t *)arg;
+    encoder_event_t event;
+
+    portENTER_CRITICAL(&info->lock);
+    bool send = info->gated && info->queue != NULL;
+    if (send) {
+        event = info->gated_event;
+        info->isr_accepted++;
+    }
+    info->gated = false;
+    info->gate_armed = false;
+    portEXIT_CRITICAL(&info->lock);
+
+    if (send) {
+        xQueueOverwrite(info->queue, &event);
+    }
+}
+
+static void IRAM_ATTR encoder_isr(void *arg)
+{
+    BaseType_t task_woken = encoder_edge((encoder_info_t *)arg, esp_cpu_get_cycle_count()) ? pdTRUE : pdFALSE;
+    if (task_woken) {
+        portYIELD_FROM_ISR(task_woken);
+    }
+}
+
+static bool IRAM_ATTR encoder_capture_cb(uint32_t timestamp, void *arg)
+{
+    return encoder_edge((encoder_info_t *)arg, timestamp);
+}
+
+/**
+ * @brief Attach the GPIO interrupt to both pins
+ * @param info Driver instance
+ * @return ESP_OK on success
+ */
+static esp_err_t add_isr_handlers(encoder_info_t *info)
+{
+    esp_err_t ret = gpio_isr_handler_add(info->pin_a, encoder_isr, info);
+    if (ret == ESP_OK) {
+        ret = gpio_isr_handler_add(info->pin_b, encoder_isr, info);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to add ISR handlers: %s", esp_err_to_name(ret));
+        gpio_isr_handler_remove(info->pin_a);
+    }
+    return ret;
+}
+
+esp_err_t encoder_init(encoder_info_t *info, gpio_num_t pin_a, gpio_num_t pin_b)
+{
+    if (!info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(info, 0, sizeof(*info));
+    info->pin_a = pin_a;
+    info->pin_b = pin_b;
+    portMUX_INITIALIZE(&info->lock);
+
+    gpio_config_t io_conf = {
+        .pin_bit_mask = (1ULL << pin_a) | (1ULL << pin_b),
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_ANYEDGE
+    };
+    esp_err_t ret = gpio_config(&io_conf);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    const esp_timer_create_args_t gate_timer_args = {
+        .callback = gate_timer_cb,
+        .arg = info,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "encoder_gate",
+    };
+    ret = esp_timer_create(&gate_timer_args, &info->gate_timer);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    quadrature_init(&info->decoder, read_ab(info), QUADRATURE_X1, 0);
+    set_timestamp_hz(info, esp_rom_get_cpu_ticks_per_us() * 1000000);
+    position_quality_init(&info->quality);
+
+    ret = add_isr_handlers(info);
+    if (ret != ESP_OK) {
+        esp_timer_delete(info->gate_timer);
+        info->gate_timer = NULL;
+    }
+    return ret;
+}
+
+esp_err_t encoder_uninit(encoder_info_t *info)
+{
+    if (!info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    gpio_set_intr_type(info->pin_a, GPIO_INTR_DISABLE);
+    gpio_set_intr_type(info->pin_b, GPIO_INTR_DISABLE);
+    esp_err_t ret = gpio_isr_handler_remove(info->pin_a);
+    esp_err_t ret_b = gpio_isr_handler_remove(info->pin_b);
+    edge_capture_disable(&info->capture);
+    info->capturing = false;
+
+    input_filter_disable(info->filter_a);
+    input_filter_disable(info->filter_b);
+    info->filter_a = NULL;
+    info->filter_b = NULL;
+
+    // The interrupts are off, so no edge can arm the timer again before it is deleted
+    if (info->gate_timer) {
+        esp_timer_stop(info->gate_timer);
+        esp_timer_delete(info->gate_timer);
+        info->gate_timer = NULL;
+    }
+    return ret != ESP_OK ? ret : ret_b;
+}
+
+esp_err_t encoder_set_resolution(encoder_info_t *info, quadrature_resolution_t resolution)
+{
+    if (!info || (resolution != QUADRATURE_X1 && resolution != QUADRATURE_X2 && resolution != QUADRATURE_X4)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&info->lock);
+    info->state.position = info->state.position * resolution / info->decoder.resolution;
+    info->decoder.resolution = resolution;
+    info->decoder.sub = 0;
+    info->stepped = false;
+    info->isr_max_cycles = 0;
+    publish_state(info);
+    portEXIT_CRITICAL(&info->lock);
+    return ESP_OK;
+}
+
+esp_err_t encoder_flip_direction(encoder_info_t *info)
+{
+    if (!info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&info->lock);
+    info->flip = !info->flip;
+    portEXIT_CRITICAL(&info->lock);
+    return ESP_OK;
+}
+
+esp_err_t encoder_set_glitch_width(encoder_info_t *info, uint32_t width_us)
+{
+    if (!info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&info->lock);
+    info->glitch_width_us = width_us;
+    info->decoder.glitch_ticks = us_to_ticks(info, width_us);
+    portEXIT_CRITICAL(&info->lock);
+    return ESP_OK;
+}
+
+esp_err_t encoder_set_input_filter(encoder_info_t *info, uint32_t width_ns)
+{
+    if (!info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (info->filter_a || info->filter_b) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t ret = input_filter_enable(info->pin_a, width_ns, &info->filter_a);
+    if (ret == ESP_OK) {
+        ret = input_filter_enable(info->pin_b, width_ns, &info->filter_b);
+    }
+    if (ret != ESP_OK) {
+        // Filter both pins or neither, a one-sided filter skews the A/B timing
+        input_filter_disable(info->filter_a);
+        info->filter_a = NULL;
+    }
+    return ret;
+}
+
+esp_err_t encoder_set_min_edge_interval(encoder_info_t *info, uint32_t interval_us)
+{
+    if (!info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&info->lock);
+    info->min_edge_interval_us = interval_us;
+    info->gate_ticks = us_to_ticks(info, interval_us);
+    portEXIT_CRITICAL(&info->lock);
+    return ESP_OK;
+}
+
+esp_err_t encoder_enable_capture(encoder_info_t *info)
+{
+    if (!info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (info->capturing) {
+        return ESP_OK;
+    }
+
+    // One source of edges at a time, both would decode every edge twice
+    gpio_isr_handler_remove(info->pin_a);
+    gpio_isr_handler_remove(info->pin_b);
+    gpio_set_intr_type(info->pin_a, GPIO_INTR_DISABLE);
+    gpio_set_intr_type(info->pin_b, GPIO_INTR_DISABLE);
+
+    uint32_t hz = 0;
+    esp_err_t ret = edge_capture_enable(&info->capture, info->pin_a, info->pin_b, encoder_capture_cb, info, &hz);
+    if (ret != ESP_OK) {
+        gpio_set_intr_type(info->pin_a, GPIO_INTR_ANYEDGE);
+        gpio_set_intr_type(info->pin_b, GPIO_INTR_ANYEDGE);
+        add_isr_handlers(info);
+        return ret;
+    }
+
+    // Timestamps change units, so rescale everything kept in ticks
+    portENTER_CRITICAL(&info->lock);
+    info->capturing = true;
+    set_timestamp_hz(info, hz);
+    info->decoder.glitch_ticks = us_to_ticks(info, info->glitch_width_us);
+    info->gate_ticks = us_to_ticks(info, info->min_edge_interval_us);
+    info->decoder.last_edge_a = 0;
+    info->decoder.last_edge_b = 0;
+    info->last_event_ticks = 0;
+    info->stepped = false;
+    portEXIT_CRITICAL(&info->lock);
+    ESP_LOGI(TAG, "Edge capture at %" PRIu32 " Hz", hz);
+    return ESP_OK;
+}
+
+esp_err_t encoder_get_timestamp_hz(encoder_info_t *info, uint32_t *hz)
+{
+    if (!info || !hz) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&info->lock);
+    *hz = info->timestamp_hz;
+    portEXIT_CRITICAL(&info->lock);
+    return ESP_OK;
+}
+
+esp_err_t encoder_get_isr_counts(encoder_info_t *info, uint32_t *raw, uint32_t *accepted)
+{
+    if (!info || !raw || !accepted) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&info->lock);
+    *raw = info->isr_raw;
+    *accepted = info->isr_accepted;
+    portEXIT_CRITICAL(&info->lock);
+    return ESP_OK;
+}
+
+esp_err_t encoder_get_isr_max_cycles(encoder_info_t *info, uint32_t *cycles)
+{
+    if (!info || !cycles) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *cycles = info->isr_max_cycles;
+    return ESP_OK;
+}
+
+esp_err_t encoder_set_queue(encoder_info_t *info, QueueHandle_t queue)
+{
+    if (!info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&info->lock);
+    info->queue = queue;
+    portEXIT_CRITICAL(&info->lock);
+    return ESP_OK;
+}
+
+esp_err_t encoder_get_state(encoder_info_t *info, encoder_state_t *state)
+{
+    if (!info || !state) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    encoder_event_t event;
+    position_snapshot_read(&info->snapshot, &event);
+    *state = event.state;
+    return ESP_OK;
+}
+
+esp_err_t encoder_set_position(encoder_info_t *info, encoder_position_t position)
+{
+    if (!info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&info->lock);
+    info->state.position = position;
+    info->decoder.sub = 0;
+    publish_state(info);
+    portEXIT_CRITICAL(&info->lock);
+    return ESP_OK;
+}
+
+esp_err_t encoder_reset(encoder_info_t *info)
+{
+    if (!info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&info->lock);
+    info->state.position = 0;
+    info->state.direction = ENCODER_DIRECTION_NOT_SET;
+    info->decoder.sub = 0;
+    publish_state(info);
+    portEXIT_CRITICAL(&info->lock);
+    return ESP_OK;
+}
+
+bool encoder_check_quality(encoder_info_t *info, const encoder_quality_limits_t *limits, encoder_quality_t *quality)
+{
+    bool changed = false;
+
+    if (position_quality_due(&info->quality)) {
+        portENTER_CRITICAL(&info->lock);
+        uint32_t illegal = info->decoder.illegal;
+        uint32_t glitches = info->decoder.glitches;
+        uint32_t reversals = info->decoder.reversals;
+        portEXIT_CRITICAL(&info->lock);
+
+        changed = position_quality_roll(&info->quality, illegal, glitches, reversals, limits);
+    }
+
+    if (quality) {
+        *quality = info->quality.quality;
+    }
+    return changed;
+}
+
+static esp_err_t source_set_queue(void *ctx, QueueHandle_t queue)
+{
+    return encoder_set_queue(ctx, queue);
+}
+
+static esp_err_t source_get_timestamp_hz(void *ctx, uint32_t *hz)
+{
+    return encoder_get_timestamp_hz(ctx, hz);
+}
+
+static esp_err_t source_get_state(void *ctx, encoder_state_t *state)
+{
+    return encoder_get_state(ctx, state);
+}
+
+static esp_err_t source_set_position(void *ctx, encoder_position_t position)
+{
+    return encoder_set_position(ctx, position);
+}
+
+static esp_err_t source_reset(void *ctx)
+{
+    return encoder_reset(ctx);
+}
+
+static esp_err_t source_set_resolution(void *ctx, quadrature_resolution_t resolution)
+{
+    return encoder_set_resolution(ctx, resolution);
+}
+
+static bool source_check_quality(void *ctx, const encoder_quality_limits_t *limits, encoder_quality_t *quality)
+{
+    return encoder_check_quality(ctx, limits, quality);
+}
+
+static esp_err_t source_uninit(void *ctx)
+{
+    return encoder_uninit(ctx);
+}
+
+static const position_source_ops_t source_ops = {
+    .set_queue = source_set_queue,
+    .get_timestamp_hz = source_get_timestamp_hz,
+    .get_state = source_get_state,
+    .set_position = source_set_position,
+    .reset = source_reset,
+    .set_resolution = source_set_resolution,
+    .check_quality = source_check_quality,
+    .uninit = source_uninit,
+};
+
+esp_err_t encoder_get_position_source(encoder_info_t *info, position_source_t *source)
+{
+    if (!info || !source) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *source = (position_source_t){
+        .name = "quadrature",
+        .ops = &source_ops,
+        .ctx = info,
+        .snapshot = &info->snapshot,
+    };
+    return ESP_OK;
+}
@@ -0,0 +1,247 @@
+/*
+ *
+ * Interrupt-driven incremental rotary encoder driver with signal quality monitoring
+ *
+ * Replaces the esp32-rotary-encoder component so that the decode path is
+ * visible to the application: every edge goes through the quadrature core,
+ * which counts illegal transitions, glitches and direction reversals.
+ *
+ * Event timestamps count at encoder_get_timestamp_hz(). With edge capture
+ * they are latched by hardware, otherwise they are CPU cycles read at the
+ * start of the ISR.
+ *
+ * The edge path is IRAM-safe: the handlers are in IRAM, and the decoder,
+ * snapshot and queue helpers they use are inlined or IRAM-resident, so
+ * edges are decoded while the flash cache is off for an NVS or OTA write.
+ * This needs the GPIO ISR service installed with ESP_INTR_FLAG_IRAM,
+ * CONFIG_GPIO_CTRL_FUNC_IN_IRAM, CONFIG_ESP_TIMER_IN_IRAM (the default)
+ * for the gate timer, and the instance and its queue in internal RAM
+ * (static storage is).
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "edge_capture.h"
+#include "input_filter.h"
+#include "position_source.h"
+#include "quadrature.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Driver instance, treat as opaque
+ */
+typedef struct {
+    gpio_num_t pin_a;
+    gpio_num_t pin_b;
+    QueueHandle_t queue;
+    bool flip;
+    encoder_state_t state;
+    quadrature_t decoder;
+    portMUX_TYPE lock;
+    seqlock_t snapshot;         ///< Last step, readable without the lock
+
+    gpio_glitch_filter_handle_t filter_a;
+    gpio_glitch_filter_handle_t filter_b;
+    edge_capture_t capture;
+    bool capturing;
+    uint32_t timestamp_hz;
+    uint32_t glitch_width_us;
+    uint32_t min_edge_interval_us;
+    uint32_t last_step_ticks;
+    int64_t last_step_us;       ///< esp_timer time of the last step, to spot idles longer than a tick wrap
+    int64_t wrap_us;            ///< Time the 32-bit timestamp takes to wrap
+    bool stepped;
+    uint32_t gate_ticks;
+    uint32_t last_event_ticks;
+    esp_timer_handle_t gate_timer;  ///< Delivers the last step held back by the gate
+    bool gate_armed;
+    bool gated;                 ///< A step was held back and not queued since
+    encoder_event_t gated_event;
+    uint32_t isr_raw;
+    uint32_t isr_accepted;
+    uint32_t isr_max_cycles;
+
+    position_quality_window_t quality;
+} encoder_info_t;
+
+/**
+ * @brief Configure the A/B GPIOs and start decoding on every edge
+ *
+ * The GPIO ISR service must already be installed, with ESP_INTR_FLAG_IRAM
+ * to keep decoding during flash writes. The A/B state at init is taken as
+ * the detent (rest) state.
+ *
+ * @param info Driver instance
+ * @param pin_a GPIO for the A signal
+ * @param pin_b GPIO for the B signal
+ * @return ESP_OK on success
+ */
+esp_err_t encoder_init(encoder_info_t *info, gpio_num_t pin_a, gpio_num_t pin_b);
+
+/**
+ * @brief Release the GPIO interrupt handlers and any input filters
+ * @param info Driver instance
+ * @return ESP_OK on success
+ */
+esp_err_t encoder_uninit(encoder_info_t *info);
+
+/**
+ * @brief Set the steps counted per detent cycle
+ *
+ * The position is rescaled to the new resolution, so it keeps pointing at
+ * the same shaft angle, and the decode cost maximum is restarted.
+ *
+ * @param info Driver instance
+ * @param resolution x1 (the default), x2 or x4
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for any other resolution
+ */
+esp_err_t encoder_set_resolution(encoder_info_t *info, quadrature_resolution_t resolution);
+
+/**
+ * @brief Reverse the clockwise/counterclockwise sense
+ * @param info Driver instance
+ * @return ESP_OK on success
+ */
+esp_err_t encoder_flip_direction(encoder_info_t *info);
+
+/**
+ * @brief Set the minimum spacing of edges on one pin; closer edges are counted as glitches
+ * @param info Driver instance
+ * @param width_us Minimum pulse width in microseconds, 0 disables glitch counting
+ * @return ESP_OK on success
+ */
+esp_err_t encoder_set_glitch_width(encoder_info_t *info, uint32_t width_us);
+
+/**
+ * @brief Enable the hardware glitch filter on both A/B inputs
+ * @param info Driver instance
+ * @param width_ns Pulses shorter than this are removed before they raise an interrupt
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if the chip has no glitch filter
+ */
+esp_err_t encoder_set_input_filter(encoder_info_t *info, uint32_t width_ns);
+
+/**
+ * @brief Queue step events no sooner than a minimum interval after the last queued one
+ *
+ * Every edge is still sampled and decoded, so the position stays exact;
+ * only the queue traffic and the task wakeups it causes are limited. The
+ * last step held back by the gate is queued once the interval has passed,
+ * so the queue always ends up at the current position.
+ *
+ * @param info Driver instance
+ * @param interval_us Minimum interval in microseconds, 0 queues every step
+ * @return ESP_OK on success
+ */
+esp_err_t encoder_set_min_edge_interval(encoder_info_t *info, uint32_t interval_us);
+
+/**
+ * @brief Timestamp edges in hardware instead of reading the CPU cycle counter in the GPIO ISR
+ *
+ * Moves A/B edge detection from the GPIO interrupt to MCPWM capture
+ * channels. Decoding, the glitch width and the edge interval gate work as
+ * before, on the latched timestamps.
+ *
+ * @param info Driver instance
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if the chip has no MCPWM;
+ *         the GPIO interrupt stays in use on failure
+ */
+esp_err_t encoder_enable_capture(encoder_info_t *info);
+
+/**
+ * @brief Get the rate of the event timestamps
+ * @param info Driver instance
+ * @param hz Receives the timestamp ticks per second
+ * @return ESP_OK on success
+ */
+esp_err_t encoder_get_timestamp_hz(encoder_info_t *info, uint32_t *hz);
+
+/**
+ * @brief Get the interrupt count and the number of steps queued through the software gate
+ * @param info Driver instance
+ * @param raw Receives the number of interrupts taken, all of them decoded
+ * @param accepted Receives the number of step events queued
+ * @return ESP_OK on success
+ */
+esp_err_t encoder_get_isr_counts(encoder_info_t *info, uint32_t *raw, uint32_t *accepted);
+
+/**
+ * @brief Get the most CPU cycles one edge has taken to decode and queue
+ *
+ * Covers the handler body, not interrupt entry and exit. Restarted by
+ * encoder_set_resolution() so each resolution can be measured on its own.
+ *
+ * @param info Driver instance
+ * @param cycles Receives the maximum, 0 before the first edge
+ * @return ESP_OK on success
+ */
+esp_err_t encoder_get_isr_max_cycles(encoder_info_t *info, uint32_t *cycles);
+
+/**
+ * @brief Set the queue that receives an event on every step
+ * @param info Driver instance
+ * @param queue Queue of encoder_event_t with a length of one; it is overwritten, never blocked on
+ * @return ESP_OK on success
+ */
+esp_err_t encoder_set_queue(encoder_info_t *info, QueueHandle_t queue);
+
+/**
+ * @brief Get the current position and direction
+ *
+ * Reads the snapshot published by the ISR, so it takes no lock and leaves
+ * interrupts enabled; safe to call from any task on either core.
+ *
+ * @param info Driver instance
+ * @param state Receives the state
+ * @return ESP_OK on success
+ */
+esp_err_t encoder_get_state(encoder_info_t *info, encoder_state_t *state);
+
+/**
+ * @brief Set the position, e.g. to zero it or to restore it after a restart
+ * @param info Driver instance
+ * @param position New position
+ * @return ESP_OK on success
+ */
+esp_err_t encoder_set_position(encoder_info_t *info, encoder_position_t position);
+
+/**
+ * @brief Zero the position and direction
+ * @param info Driver instance
+ * @return ESP_OK on success
+ */
+esp_err_t encoder_reset(encoder_info_t *info);
+
+/**
+ * @brief Roll the one second quality window and evaluate it against limits
+ *
+ * Call periodically from task context. The signal becomes degraded as soon
+ * as a window exceeds any limit, and recovers after a window within all limits.
+ *
+ * @param info Driver instance
+ * @param limits Per-second limits
+ * @param quality Receives the current quality, may be NULL
+ * @return true if the degraded flag changed
+ */
+bool encoder_check_quality(encoder_info_t *info, const encoder_quality_limits_t *limits, encoder_quality_t *quality);
+
+/**
+ * @brief Expose an initialized driver through the position source interface
+ * @param info Driver instance, must outlive the source
+ * @param source Receives the position source
+ * @return ESP_OK on success
+ */
+esp_err_t encoder_get_position_source(encoder_info_t *info, position_source_t *source);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,184 @@
+/*
+ *
+ * Health monitor: task watchdog, stall detection and recovery bookkeeping
+ *
+ */
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_task_wdt.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "stats.h"
+#include "health.h"
+
+#define TAG "HEALTH"
+
+#define HEALTH_NVS_NAMESPACE       "health"
+#define HEALTH_EVENT_STALL_US      (500 * 1000)    // Position may differ from the last event for this long
+#define HEALTH_ADV_RESTART_US      (2000 * 1000)   // Advertising must start this long after being requested
+#define HEALTH_RTC_MAGIC           0x48454C54      // "HELT"
+
+// Survives software, watchdog and panic resets but not power loss
+static RTC_NOINIT_ATTR uint32_t rtc_magic;
+static RTC_NOINIT_ATTR int32_t rtc_position;
+
+static portMUX_TYPE health_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool preserved_valid = false;
+static int32_t preserved_position = 0;
+
+static volatile esp_err_t encoder_error = ESP_OK;
+static int32_t last_event_position = 0;
+static int64_t stall_since_us = 0;
+static bool stalled = false;
+
+static bool adv_expected = false;
+static int64_t adv_requested_us = 0;
+
+esp_err_t health_init(uint32_t timeout_ms)
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+    if (rtc_magic == HEALTH_RTC_MAGIC &&
+        (reason == ESP_RST_TASK_WDT || reason == ESP_RST_INT_WDT ||
+         reason == ESP_RST_WDT || reason == ESP_RST_PANIC)) {
+        preserved_valid = true;
+        preserved_position = rtc_position;
+        ESP_LOGW(TAG, "Recovered from reset reason %d, preserved position %" PRId32, reason, preserved_position);
+    }
+    rtc_magic = HEALTH_RTC_MAGIC;
+    rtc_position = preserved_valid ? preserved_position : 0;
+    last_event_position = rtc_position;
+
+    esp_err_t ret = esp_task_wdt_add(NULL);
+    if (ret == ESP_ERR_INVALID_STATE) {
+        // Watchdog not started by the startup code, bring it up ourselves
+        esp_task_wdt_config_t wdt_config = {
+            .timeout_ms = timeout_ms,
+            .idle_core_mask = 0,
+            .trigger_panic = true,
+        };
+        ret = esp_task_wdt_init(&wdt_config);
+        if (ret == ESP_OK) {
+            ret = esp_task_wdt_add(NULL);
+        }
+    }
+    return ret;
+}
+
+void health_feed(int32_t position)
+{
+    esp_task_wdt_reset();
+    rtc_position = position;
+}
+
+bool health_get_preserved_position(int32_t *position)
+{
+    if (preserved_valid && position) {
+        *position = preserved_position;
+    }
+    return preserved_valid;
+}
+
+void health_report_encoder_error(esp_err_t err)
+{
+    ESP_LOGE(TAG, "Encoder driver error: %s", esp_err_to_name(err));
+    encoder_error = err;
+}
+
+void health_note_encoder_event(int32_t position)
+{
+    last_event_position = position;
+    stall_since_us = 0;
+}
+
+void health_note_encoder_poll(int32_t position)
+{
+    if (position == last_event_position) {
+        stall_since_us = 0;
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (!stall_since_us) {
+        stall_since_us = now;
+    } else if (now - stall_since_us > HEALTH_EVENT_STALL_US) {
+        stalled = true;
+        stall_since_us = 0;
+    }
+}
+
+void health_expect_advertising(void)
+{
+    portENTER_CRITICAL(&health_lock);
+    adv_expected = true;
+    adv_requested_us = esp_timer_get_time();
+    portEXIT_CRITICAL(&health_lock);
+}
+
+void health_note_advertising_started(void)
+{
+    portENTER_CRITICAL(&health_lock);
+    adv_expected = false;
+    portEXIT_CRITICAL(&health_lock);
+}
+
+void health_note_connected(void)
+{
+    portENTER_CRITICAL(&health_lock);
+    adv_expected = false;
+    portEXIT_CRITICAL(&health_lock);
+}
+
+health_recovery_t health_check(void)
+{
+    if (encoder_error != ESP_OK) {
+        encoder_error = ESP_OK;
+        return HEALTH_RECOVERY_ENCODER_ERROR;
+    }
+
+    if (stalled) {
+        stalled = false;
+        return HEALTH_RECOVERY_EVENT_STALL;
+    }
+
+    bool adv_stalled = false;
+    portENTER_CRITICAL(&health_lock);
+    if (adv_expected && esp_timer_get_time() - adv_requested_us > HEALTH_ADV_RESTART_US) {
+        // Re-arm so a failed restart is retried after another timeout
+        adv_requested_us = esp_timer_get_time();
+        adv_stalled = true;
+    }
+    portEXIT_CRITICAL(&health_lock);
+
+    return adv_stalled ? HEALTH_RECOVERY_ADVERTISING : HEALTH_RECOVERY_NONE;
+}
+
+void health_record_recovery(health_recovery_t reason, int32_t position)
+{
+    stats_inc(STATS_RECOVERIES);
+    last_event_position = position;
+    rtc_position = position;
+
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(HEALTH_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(ret));
+        return;
+    }
+
+    uint32_t count = 0;
+    nvs_get_u32(handle, "count", &count);
+    nvs_set_u32(handle, "count", count + 1);
+    nvs_set_u8(handle, "reason", (uint8_t)reason);
+    nvs_set_i32(handle, "position", position);
+    ret = nvs_commit(handle);
+    nvs_close(handle);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to record recovery: %s", esp_err_to_name(ret));
+    } else {
+        ESP_LOGW(TAG, "Recovery %d recorded (total %" PRIu32 "), position %" PRId32, reason, count + 1, position);
+    }
+}
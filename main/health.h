@@ -0,0 +1,101 @@
+/*
+ *
+ * Health monitor: task watchdog, stall detection and recovery bookkeeping
+ *
+ * The main loop feeds the monitor every iteration and asks it which
+ * subsystem, if any, needs to be restarted. The monitor itself never
+ * touches the encoder or the BLE stack; the application performs the
+ * restart and reports it back with health_record_recovery().
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    HEALTH_RECOVERY_NONE = 0,
+    HEALTH_RECOVERY_ENCODER_ERROR,   ///< An encoder driver call failed
+    HEALTH_RECOVERY_EVENT_STALL,     ///< Position moved but no events were delivered
+    HEALTH_RECOVERY_ADVERTISING,     ///< Advertising did not resume while disconnected
+    HEALTH_RECOVERY_WATCHDOG,        ///< Booted after a watchdog or panic reset
+} health_recovery_t;
+
+/**
+ * @brief Subscribe the calling task to the task watchdog
+ * @param timeout_ms Watchdog timeout used if the watchdog is not already running
+ * @return ESP_OK on success
+ */
+esp_err_t health_init(uint32_t timeout_ms);
+
+/**
+ * @brief Feed the task watchdog and preserve the position across resets
+ * @param position Current encoder position
+ */
+void health_feed(int32_t position);
+
+/**
+ * @brief Get the position preserved before an abnormal reset
+ * @param position Receives the preserved position
+ * @return true if the last reset was a watchdog or panic reset and a position was preserved
+ */
+bool health_get_preserved_position(int32_t *position);
+
+/**
+ * @brief Report a failed encoder driver call
+ * @param err Error returned by the driver
+ */
+void health_report_encoder_error(esp_err_t err);
+
+/**
+ * @brief Note an event delivered by the encoder queue
+ * @param position Position carried by the event
+ */
+void health_note_encoder_event(int32_t position);
+
+/**
+ * @brief Note a polled encoder position
+ * @param position Position read from the driver
+ */
+void health_note_encoder_poll(int32_t position);
+
+/**
+ * @brief Note that advertising has been requested and should start soon
+ */
+void health_expect_advertising(void);
+
+/**
+ * @brief Note that advertising started successfully
+ */
+void health_note_advertising_started(void);
+
+/**
+ * @brief Note that a central connected, so advertising is no longer expected
+ */
+void health_note_connected(void);
+
+/**
+ * @brief Check for a subsystem that needs to be restarted
+ *
+ * The returned condition is cleared; if the restart does not fix it, it is
+ * detected again after its timeout.
+ *
+ * @return Recovery needed, HEALTH_RECOVERY_NONE if everything is healthy
+ */
+health_recovery_t health_check(void);
+
+/**
+ * @brief Persist a recovery to NVS together with the position preserved across it
+ * @param reason Recovery that was performed
+ * @param position Encoder position after recovery
+ */
+void health_record_recovery(health_recovery_t reason, int32_t position);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,66 @@
+/*
+ *
+ * Hardware glitch filters for GPIO inputs
+ *
+ */
+#include <inttypes.h>
+#include "soc/soc_caps.h"
+#include "esp_log.h"
+#include "input_filter.h"
+
+#define TAG "INPUT_FILTER"
+
+esp_err_t input_filter_enable(gpio_num_t gpio, uint32_t width_ns, gpio_glitch_filter_handle_t *filter)
+{
+    if (!filter || width_ns == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ESP_ERR_NOT_SUPPORTED;
+#if SOC_GPIO_FLEX_GLITCH_FILTER_NUM > 0
+    gpio_flex_glitch_filter_config_t flex_conf = {
+        .clk_src = GLITCH_FILTER_CLK_SRC_DEFAULT,
+        .gpio_num = gpio,
+        .window_width_ns = width_ns,
+        .window_thres_ns = width_ns,
+    };
+    ret = gpio_new_flex_glitch_filter(&flex_conf, filter);
+    if (ret != ESP_OK) {
+        // All flex filters may be taken, fall back to the pin filter below
+        ESP_LOGW(TAG, "No flex filter for GPIO %d: %s", gpio, esp_err_to_name(ret));
+    }
+#endif
+#if SOC_GPIO_SUPPORT_PIN_GLITCH_FILTER
+    if (ret != ESP_OK) {
+        gpio_pin_glitch_filter_config_t pin_conf = {
+            .clk_src = GLITCH_FILTER_CLK_SRC_DEFAULT,
+            .gpio_num = gpio,
+        };
+        ret = gpio_new_pin_glitch_filter(&pin_conf, filter);
+        if (ret == ESP_OK) {
+            ESP_LOGI(TAG, "GPIO %d uses the fixed-width pin filter, %" PRIu32 " ns not applied", gpio, width_ns);
+        }
+    }
+#endif
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = gpio_glitch_filter_enable(*filter);
+    if (ret != ESP_OK) {
+        gpio_del_glitch_filter(*filter);
+        *filter = NULL;
+    }
+    return ret;
+}
+
+esp_err_t input_filter_disable(gpio_glitch_filter_handle_t filter)
+{
+    if (!filter) {
+        return ESP_OK;
+    }
+
+    // Deleting requires the filter to be disabled first
+    gpio_glitch_filter_disable(filter);
+    return gpio_del_glitch_filter(filter);
+}
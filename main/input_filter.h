@@ -0,0 +1,40 @@
+/*
+ *
+ * Hardware glitch filters for GPIO inputs
+ *
+ * Picks the best filter the chip provides: a flex filter with a
+ * configurable width where available, otherwise the fixed-width pin filter
+ * (two IO_MUX clock cycles). Filtered pulses never reach the GPIO matrix,
+ * so they neither raise interrupts nor show up in gpio_get_level().
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "driver/gpio.h"
+#include "driver/gpio_filter.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Create and enable a glitch filter on an input pin
+ * @param gpio Input pin to filter
+ * @param width_ns Pulses shorter than this are removed; ignored by the fixed-width pin filter
+ * @param filter Receives the filter handle
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if the chip has no glitch filter
+ */
+esp_err_t input_filter_enable(gpio_num_t gpio, uint32_t width_ns, gpio_glitch_filter_handle_t *filter);
+
+/**
+ * @brief Disable and delete a filter created by input_filter_enable()
+ * @param filter Filter handle, may be NULL
+ * @return ESP_OK on success
+ */
+esp_err_t input_filter_disable(gpio_glitch_filter_handle_t filter);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,284 @@
+/*
+ *
+ * RGB status LED driven by the LEDC PWM peripheral
+ *
+ */
+#include <stdbool.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "driver/ledc.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "led.h"
+
+#define TAG "LED"
+
+#define LED_SPEED_MODE       LEDC_LOW_SPEED_MODE
+#define LED_TIMER            LEDC_TIMER_0
+#define LED_DUTY_RESOLUTION  LEDC_TIMER_10_BIT
+#define LED_DUTY_MAX         ((1U << 10) - 1)
+#define LED_PWM_FREQ_HZ      5000
+#define LED_NUM_CHANNELS     3
+#define LED_FADE_MARGIN_MS   20     // Pattern fades end this long before the next step, which would otherwise wait for them
+#define LED_RETRY_US         1000   // Pattern step retry while a caller holds the lock
+
+static const ledc_channel_t led_channels[LED_NUM_CHANNELS] = {
+    LEDC_CHANNEL_0, LEDC_CHANNEL_1, LEDC_CHANNEL_2
+};
+static const led_rgb_t LED_OFF = {0, 0, 0};
+
+static SemaphoreHandle_t led_lock = NULL;
+static StaticSemaphore_t led_lock_buffer;
+static esp_timer_handle_t pattern_timer = NULL;
+
+// Requested pattern
+static led_pattern_t base_pattern = LED_PATTERN_SOLID;
+static led_rgb_t base_color = {0, 0, 0};
+static uint32_t base_period_ms = 0;
+static uint8_t led_brightness = 255;
+static bool phase_on = false;
+
+// Flash overlay
+static led_rgb_t flash_color = {0, 0, 0};
+static uint8_t flash_remaining = 0;
+static uint32_t flash_period_ms = 0;
+
+// Duty currently programmed into each channel
+static uint32_t channel_duty[LED_NUM_CHANNELS] = { 0 };
+static volatile uint32_t write_count = 0;
+
+static bool rgb_equal(led_rgb_t a, led_rgb_t b)
+{
+    return a.red == b.red && a.green == b.green && a.blue == b.blue;
+}
+
+/**
+ * @brief Program channel duties for a color, skipping channels that already match
+ * @param color Color to output
+ * @param fade_ms Hardware fade duration, 0 to switch immediately
+ */
+static void apply_color_locked(led_rgb_t color, uint32_t fade_ms)
+{
+    const uint8_t levels[LED_NUM_CHANNELS] = { color.red, color.green, color.blue };
+
+    for (int i = 0; i < LED_NUM_CHANNELS; i++) {
+        uint32_t duty = (uint32_t)levels[i] * led_brightness * LED_DUTY_MAX / (255U * 255U);
+        if (duty == channel_duty[i]) {
+            continue;
+        }
+
+        esp_err_t ret;
+        if (fade_ms) {
+            ret = ledc_set_fade_time_and_start(LED_SPEED_MODE, led_channels[i], duty, fade_ms, LEDC_FADE_NO_WAIT);
+        } else {
+            ret = ledc_set_duty_and_update(LED_SPEED_MODE, led_channels[i], duty, 0);
+        }
+        write_count++;
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to set duty on channel %d: %s", i, esp_err_to_name(ret));
+            continue;
+        }
+        channel_duty[i] = duty;
+    }
+}
+
+/**
+ * @brief Advance the flash overlay or base pattern by one phase and schedule the next
+ */
+static void run_step_locked(void)
+{
+    uint32_t next_ms;
+
+    if (flash_remaining) {
+        phase_on = !phase_on;
+        apply_color_locked(phase_on ? flash_color : LED_OFF, 0);
+        if (!phase_on) {
+            flash_remaining--;
+            if (!flash_remaining) {
+                // Restart the base pattern from its off phase after the last flash
+                phase_on = false;
+            }
+        }
+        next_ms = flash_period_ms / 2;
+    } else {
+        switch (base_pattern) {
+            case LED_PATTERN_BLINK:
+                phase_on = !phase_on;
+                apply_color_locked(phase_on ? base_color : LED_OFF, 0);
+                break;
+            case LED_PATTERN_PULSE:
+                phase_on = !phase_on;
+                // LEDC holds a channel until its fade ends, so finish it before the next step comes
+                apply_color_locked(phase_on ? base_color : LED_OFF,
+                                   base_period_ms / 2 > LED_FADE_MARGIN_MS ? base_period_ms / 2 - LED_FADE_MARGIN_MS : 0);
+                break;
+            case LED_PATTERN_SOLID:
+            default:
+                apply_color_locked(base_color, 0);
+                return;
+        }
+        next_ms = base_period_ms / 2;
+    }
+
+    esp_timer_start_once(pattern_timer, (uint64_t)next_ms * 1000);
+}
+
+/**
+ * @brief Step the pattern from the shared esp_timer task, which must not block
+ */
+static void pattern_timer_cb(void *arg)
+{
+    // A caller holding the lock may be waiting on the fade engine; try again shortly instead of stalling other timers
+    if (xSemaphoreTake(led_lock, 0) != pdTRUE) {
+        esp_timer_start_once(pattern_timer, LED_RETRY_US);
+        return;
+    }
+    // A caller may have restarted the schedule since this callback was due
+    if (!esp_timer_is_active(pattern_timer)) {
+        run_step_locked();
+    }
+    xSemaphoreGive(led_lock);
+}
+
+esp_err_t led_init(gpio_num_t red_gpio, gpio_num_t green_gpio, gpio_num_t blue_gpio)
+{
+    const gpio_num_t gpios[LED_NUM_CHANNELS] = { red_gpio, green_gpio, blue_gpio };
+
+    ledc_timer_config_t timer_conf = {
+        .speed_mode = LED_SPEED_MODE,
+        .duty_resolution = LED_DUTY_RESOLUTION,
+        .timer_num = LED_TIMER,
+        .freq_hz = LED_PWM_FREQ_HZ,
+        .clk_cfg = LEDC_AUTO_CLK
+    };
+    esp_err_t ret = ledc_timer_config(&timer_conf);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    for (int i = 0; i < LED_NUM_CHANNELS; i++) {
+        ledc_channel_config_t channel_conf = {
+            .gpio_num = gpios[i],
+            .speed_mode = LED_SPEED_MODE,
+            .channel = led_channels[i],
+            .intr_type = LEDC_INTR_DISABLE,
+            .timer_sel = LED_TIMER,
+            .duty = 0,
+            .hpoint = 0
+        };
+        ret = ledc_channel_config(&channel_conf);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        channel_duty[i] = 0;
+    }
+
+    ret = ledc_fade_func_install(0);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    led_lock = xSemaphoreCreateMutexStatic(&led_lock_buffer);
+    if (!led_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = pattern_timer_cb,
+        .name = "led_pattern"
+    };
+    return esp_timer_create(&timer_args, &pattern_timer);
+}
+
+esp_err_t led_set_color(led_rgb_t color, uint32_t fade_ms)
+{
+    if (!led_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(led_lock, portMAX_DELAY);
+    base_pattern = LED_PATTERN_SOLID;
+    base_color = color;
+    base_period_ms = 0;
+    if (!flash_remaining) {
+        esp_timer_stop(pattern_timer);
+        apply_color_locked(color, fade_ms);
+    }
+    xSemaphoreGive(led_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t led_set_pattern(led_pattern_t pattern, led_rgb_t color, uint32_t period_ms)
+{
+    if (!led_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (pattern == LED_PATTERN_SOLID) {
+        return led_set_color(color, 0);
+    }
+    if (period_ms < 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(led_lock, portMAX_DELAY);
+    if (base_pattern == pattern && rgb_equal(base_color, color) && base_period_ms == period_ms) {
+        xSemaphoreGive(led_lock);
+        return ESP_OK;
+    }
+
+    base_pattern = pattern;
+    base_color = color;
+    base_period_ms = period_ms;
+    if (!flash_remaining) {
+        esp_timer_stop(pattern_timer);
+        phase_on = false;
+        run_step_locked();
+    }
+    xSemaphoreGive(led_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t led_flash(led_rgb_t color, uint8_t count, uint32_t period_ms)
+{
+    if (!led_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (count == 0 || period_ms < 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(led_lock, portMAX_DELAY);
+    esp_timer_stop(pattern_timer);
+    flash_color = color;
+    flash_remaining = count;
+    flash_period_ms = period_ms;
+    phase_on = false;
+    run_step_locked();
+    xSemaphoreGive(led_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t led_set_brightness(uint8_t brightness)
+{
+    if (!led_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(led_lock, portMAX_DELAY);
+    led_brightness = brightness;
+    if (!flash_remaining && (base_pattern == LED_PATTERN_SOLID || phase_on)) {
+        apply_color_locked(base_color, 0);
+    }
+    xSemaphoreGive(led_lock);
+
+    return ESP_OK;
+}
+
+uint32_t led_get_write_count(void)
+{
+    return write_count;
+}
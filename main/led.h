@@ -0,0 +1,95 @@
+/*
+ *
+ * RGB status LED driven by the LEDC PWM peripheral
+ *
+ * The LED module owns the output state: it caches the duty programmed into
+ * each channel and only writes the peripheral when that duty changes.
+ * Animated patterns are stepped from an esp_timer, so callers only need to
+ * call in when the desired pattern changes. The step never blocks the
+ * esp_timer task: it only tries the lock, and pattern fades end before the
+ * next step so LEDC has no fade to wait for.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "driver/gpio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief RGB color, one 8-bit intensity per channel
+ */
+typedef struct {
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+} led_rgb_t;
+
+/**
+ * @brief Animation applied to a color
+ */
+typedef enum {
+    LED_PATTERN_SOLID,   ///< Steady color
+    LED_PATTERN_BLINK,   ///< Hard on/off, half a period each
+    LED_PATTERN_PULSE,   ///< Hardware fade up and down, each within half a period
+} led_pattern_t;
+
+/**
+ * @brief Configure the LEDC timer, channels and fade engine for an RGB LED
+ * @param red_gpio GPIO driving the red element (active high)
+ * @param green_gpio GPIO driving the green element (active high)
+ * @param blue_gpio GPIO driving the blue element (active high)
+ * @return ESP_OK on success
+ */
+esp_err_t led_init(gpio_num_t red_gpio, gpio_num_t green_gpio, gpio_num_t blue_gpio);
+
+/**
+ * @brief Show a steady color, cancelling any pattern in progress
+ * @param color Target color
+ * @param fade_ms Hardware fade duration, 0 to switch immediately
+ * @return ESP_OK on success
+ */
+esp_err_t led_set_color(led_rgb_t color, uint32_t fade_ms);
+
+/**
+ * @brief Run a pattern from the LED timer
+ *
+ * Requesting the pattern that is already running is a no-op. If a flash is
+ * in progress the new pattern takes over once the flash completes.
+ *
+ * @param pattern Pattern to run
+ * @param color Color of the pattern's on phase
+ * @param period_ms Length of one on/off cycle, ignored for LED_PATTERN_SOLID
+ * @return ESP_OK on success
+ */
+esp_err_t led_set_pattern(led_pattern_t pattern, led_rgb_t color, uint32_t period_ms);
+
+/**
+ * @brief Briefly flash a color over the current pattern, then resume it
+ * @param color Flash color
+ * @param count Number of flashes
+ * @param period_ms Length of one on/off cycle
+ * @return ESP_OK on success
+ */
+esp_err_t led_flash(led_rgb_t color, uint8_t count, uint32_t period_ms);
+
+/**
+ * @brief Set global brightness applied on top of every color
+ * @param brightness 0 (off) to 255 (full)
+ * @return ESP_OK on success
+ */
+esp_err_t led_set_brightness(uint8_t brightness);
+
+/**
+ * @brief Number of channel duty writes issued to the LEDC peripheral since init
+ * @return Write count
+ */
+uint32_t led_get_write_count(void);
+
+#ifdef __cplusplus
+}
+#endif
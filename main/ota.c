@@ -0,0 +1,312 @@
+/*
+ *
+ * Firmware update streamed over BLE into the inactive OTA partition
+ *
+ */
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/stream_buffer.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "ota.h"
+#include "ota_image.h"
+
+#define TAG "OTA"
+
+#define OTA_TASK_STACK_SIZE  4096
+#define OTA_TASK_PRIORITY    2      // Above the encoder loop, flash writes are mostly spent waiting
+#define OTA_CHUNK_SIZE       1024   // Bytes moved from the stream buffer to flash per write
+#define OTA_POLL_MS          20
+#define OTA_RESTART_DELAY_MS 500    // Lets the END reply go out before restarting
+
+typedef struct {
+    uint8_t cmd;
+    uint32_t size;
+    uint8_t hash[OTA_HASH_LEN];
+} ota_request_t;
+
+static ota_notify_cb_t notify_cb = NULL;
+
+static StaticQueue_t request_queue_buffer;
+static uint8_t request_queue_storage[2 * sizeof(ota_request_t)];
+static QueueHandle_t request_queue = NULL;
+
+static StaticStreamBuffer_t stream_buffer;
+static uint8_t stream_storage[OTA_WINDOW_BYTES + 1];
+static StreamBufferHandle_t stream = NULL;
+
+static StaticTask_t ota_task_buffer;
+static StackType_t ota_task_stack[OTA_TASK_STACK_SIZE];
+
+static atomic_bool receiving = false;
+static atomic_bool overflow = false;
+
+// Transfer state, owned by the OTA task except for the window accounting done in ota_data()
+static const esp_partition_t *partition = NULL;
+static esp_ota_handle_t ota_handle = 0;
+static ota_image_t image;
+static uint8_t chunk[OTA_CHUNK_SIZE];
+
+static int flash_begin(void *ctx, uint32_t size)
+{
+    esp_err_t ret = esp_ota_begin(partition, size, &ota_handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+static int flash_write(void *ctx, const uint8_t *data, size_t len)
+{
+    return esp_ota_write(ota_handle, data, len);
+}
+
+static int flash_end(void *ctx)
+{
+    esp_err_t ret = esp_ota_end(ota_handle);
+    ota_handle = 0;
+    if (ret == ESP_OK) {
+        ret = esp_ota_set_boot_partition(partition);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Image rejected: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+static void flash_abort(void *ctx)
+{
+    esp_ota_abort(ota_handle);
+    ota_handle = 0;
+}
+
+static const ota_flash_t flash_hooks = {
+    .begin = flash_begin,
+    .write = flash_write,
+    .end = flash_end,
+    .abort = flash_abort,
+};
+
+static void reply(uint8_t msg, uint8_t status)
+{
+    const wire_ota_reply_t fields = { .message = msg, .status = status };
+    uint8_t buf[WIRE_OTA_REPLY_LEN];
+    notify_cb(buf, wire_pack_ota_reply(buf, &fields));
+}
+
+static void send_ack(uint32_t written)
+{
+    const wire_ota_ack_t fields = { .written = written };
+    uint8_t buf[WIRE_OTA_ACK_LEN];
+    notify_cb(buf, wire_pack_ota_ack(buf, &fields));
+}
+
+/**
+ * @brief Drop the transfer and tell the sender why
+ * @param status Reason
+ */
+static void fail(ota_status_t status)
+{
+    atomic_store(&receiving, false);
+    ota_image_fail(&image);
+    xStreamBufferReset(stream);
+    ESP_LOGW(TAG, "Transfer aborted at %" PRIu32 "/%" PRIu32 " bytes, status %d", image.written, image.size, status);
+    reply(OTA_CMD_ABORT, status);
+}
+
+static void begin(const ota_request_t *req)
+{
+    if (atomic_load(&receiving)) {
+        reply(OTA_CMD_BEGIN, OTA_STATUS_BUSY);
+        return;
+    }
+
+    partition = esp_ota_get_next_update_partition(NULL);
+    if (!partition) {
+        reply(OTA_CMD_BEGIN, OTA_STATUS_FLASH_ERROR);
+        return;
+    }
+    ota_status_t status = ota_image_begin(&image, req->size, req->hash, partition->size);
+    if (status != OTA_STATUS_OK) {
+        reply(OTA_CMD_BEGIN, status);
+        return;
+    }
+
+    xStreamBufferReset(stream);
+    atomic_store(&overflow, false);
+    atomic_store(&receiving, true);
+
+    ESP_LOGI(TAG, "Receiving %" PRIu32 " bytes into partition %s", image.size, partition->label);
+    reply(OTA_CMD_BEGIN, OTA_STATUS_OK);
+}
+
+/**
+ * @brief Move buffered image data to flash
+ * @param wait Ticks to wait for data
+ * @return false if the transfer failed
+ */
+static bool drain(TickType_t wait)
+{
+    size_t n;
+    while ((n = xStreamBufferReceive(stream, chunk, sizeof(chunk), wait)) > 0) {
+        wait = 0;
+        ota_status_t status = ota_image_write(&image, chunk, n);
+        if (status != OTA_STATUS_OK) {
+            fail(status);
+            return false;
+        }
+        uint32_t written;
+        if (ota_image_take_ack(&image, &written)) {
+            send_ack(written);
+        }
+    }
+    if (atomic_load(&overflow)) {
+        fail(OTA_STATUS_OVERFLOW);
+        return false;
+    }
+    return true;
+}
+
+static void end(void)
+{
+    if (!atomic_load(&receiving)) {
+        reply(OTA_CMD_END, OTA_STATUS_INVALID);
+        return;
+    }
+    // Data written before END is already in the buffer
+    if (!drain(0)) {
+        return;
+    }
+    ota_status_t status = ota_image_end(&image);
+    if (status == OTA_STATUS_SIZE_MISMATCH || status == OTA_STATUS_HASH_MISMATCH) {
+        fail(status);
+        return;
+    }
+    atomic_store(&receiving, false);
+    if (status != OTA_STATUS_OK) {
+        reply(OTA_CMD_END, status);
+        return;
+    }
+
+    ESP_LOGI(TAG, "Update verified, restarting into %s", partition->label);
+    reply(OTA_CMD_END, OTA_STATUS_OK);
+    vTaskDelay(pdMS_TO_TICKS(OTA_RESTART_DELAY_MS));
+    esp_restart();
+}
+
+static void ota_task(void *arg)
+{
+    ota_request_t req;
+
+    for (;;) {
+        if (atomic_load(&receiving)) {
+            drain(pdMS_TO_TICKS(OTA_POLL_MS));
+        }
+        if (xQueueReceive(request_queue, &req, atomic_load(&receiving) ? 0 : portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        switch (req.cmd) {
+            case OTA_CMD_BEGIN:
+                begin(&req);
+                break;
+            case OTA_CMD_END:
+                end();
+                break;
+            case OTA_CMD_ABORT:
+                if (atomic_load(&receiving)) {
+                    fail(OTA_STATUS_ABORTED);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+esp_err_t ota_init(ota_notify_cb_t notify)
+{
+    if (!notify) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    notify_cb = notify;
+    ota_image_init(&image, &flash_hooks);
+
+    request_queue = xQueueCreateStatic(2, sizeof(ota_request_t), request_queue_storage, &request_queue_buffer);
+    stream = xStreamBufferCreateStatic(sizeof(stream_storage) - 1, 1, stream_storage, &stream_buffer);
+    if (!request_queue || !stream) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    TaskHandle_t task = xTaskCreateStatic(ota_task, "ota", OTA_TASK_STACK_SIZE, NULL, OTA_TASK_PRIORITY,
+                                          ota_task_stack, &ota_task_buffer);
+    return task ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void ota_control(const uint8_t *data, size_t len)
+{
+    ota_request_t req = { 0 };
+
+    if (!data || len == 0) {
+        return;
+    }
+    req.cmd = data[0];
+    if (req.cmd == OTA_CMD_BEGIN) {
+        wire_ota_begin_t begin_req;
+        if (!wire_unpack_ota_begin(data, len, &begin_req)) {
+            reply(OTA_CMD_BEGIN, OTA_STATUS_INVALID);
+            return;
+        }
+        req.size = begin_req.size;
+        memcpy(req.hash, begin_req.sha256, OTA_HASH_LEN);
+    } else if (req.cmd != OTA_CMD_END && req.cmd != OTA_CMD_ABORT) {
+        reply(req.cmd, OTA_STATUS_INVALID);
+        return;
+    }
+
+    if (xQueueSend(request_queue, &req, 0) != pdTRUE) {
+        reply(req.cmd, OTA_STATUS_BUSY);
+    }
+}
+
+void ota_data(const uint8_t *data, size_t len)
+{
+    if (!atomic_load(&receiving) || atomic_load(&overflow)) {
+        return;
+    }
+    // Never block the BT task; a sender that ignores the window loses the transfer. The buffer
+    // holds a whole window, so a send within the window always fits
+    if (!ota_image_receive(&image, len) || xStreamBufferSend(stream, data, len, 0) != len) {
+        atomic_store(&overflow, true);
+    }
+}
+
+void ota_abort(void)
+{
+    if (atomic_load(&receiving)) {
+        const uint8_t abort_cmd = OTA_CMD_ABORT;
+        ota_control(&abort_cmd, 1);
+    }
+}
+
+bool ota_in_progress(void)
+{
+    return atomic_load(&receiving);
+}
+
+esp_err_t ota_confirm_running_image(void)
+{
+    esp_ota_img_states_t state;
+    const esp_partition_t *running = esp_ota_get_running_partition();
+
+    if (esp_ota_get_state_partition(running, &state) != ESP_OK || state != ESP_OTA_IMG_PENDING_VERIFY) {
+        return ESP_OK;
+    }
+    ESP_LOGI(TAG, "Confirming new image in %s", running->label);
+    return esp_ota_mark_app_valid_cancel_rollback();
+}
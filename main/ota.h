@@ -0,0 +1,89 @@
+/*
+ *
+ * Firmware update streamed over BLE into the inactive OTA partition
+ *
+ * The GATT callback only copies chunks into a stream buffer. A dedicated
+ * task erases, writes and hashes the image, so neither the BT stack nor the
+ * encoder loop waits on flash. The sender keeps at most OTA_WINDOW_BYTES
+ * unacknowledged and the device acknowledges every OTA_ACK_STEP bytes
+ * written, which is what bounds the buffer.
+ *
+ * Control messages (written to the control characteristic):
+ *
+ *   0x01 BEGIN   u32 image size, 32 byte SHA-256 of the image
+ *   0x02 END     verify the hash, select the new partition and restart
+ *   0x03 ABORT   discard the transfer
+ *
+ * Replies (notified on the control characteristic):
+ *
+ *   0x01 status  BEGIN result, data may be sent once this is OK
+ *   0x02 status  END result, the device restarts after an OK
+ *   0x03 status  transfer aborted, by request or on an error
+ *   0x10 u32     acknowledgement, bytes written to flash so far
+ *
+ * Image data is written without response to the data characteristic, in
+ * order, in chunks of up to the negotiated MTU minus 3.
+ *
+ * The message codes, statuses and layouts come from main/wire.json.
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "ota_image.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Called from the OTA task to send a reply on the control characteristic
+ * @param msg Reply bytes
+ * @param len Reply length
+ */
+typedef void (*ota_notify_cb_t)(const uint8_t *msg, size_t len);
+
+/**
+ * @brief Create the OTA task and its buffers
+ * @param notify Reply callback
+ * @return ESP_OK on success
+ */
+esp_err_t ota_init(ota_notify_cb_t notify);
+
+/**
+ * @brief Handle a write to the control characteristic, from the GATT callback
+ * @param data Written bytes
+ * @param len Written length
+ */
+void ota_control(const uint8_t *data, size_t len);
+
+/**
+ * @brief Handle a write to the data characteristic, from the GATT callback
+ * @param data Image chunk
+ * @param len Chunk length
+ */
+void ota_data(const uint8_t *data, size_t len);
+
+/**
+ * @brief Discard any running transfer, e.g. on disconnect
+ */
+void ota_abort(void);
+
+/**
+ * @brief Check whether a transfer is being received
+ * @return true between a successful BEGIN and the end or abort of the transfer
+ */
+bool ota_in_progress(void);
+
+/**
+ * @brief Mark the running image as good so the bootloader does not roll it back
+ * @return ESP_OK on success or if the image was already confirmed
+ */
+esp_err_t ota_confirm_running_image(void);
+
+#ifdef __cplusplus
+}
+#endif
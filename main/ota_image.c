@@ -0,0 +1,101 @@
+/*
+ *
+ * OTA image transfer: window, size and hash checks in front of a flash hook
+ *
+ */
+#include <string.h>
+#include "ota_image.h"
+
+void ota_image_init(ota_image_t *img, const ota_flash_t *flash)
+{
+    memset(img, 0, sizeof(*img));
+    img->flash = *flash;
+}
+
+ota_status_t ota_image_begin(ota_image_t *img, uint32_t size, const uint8_t *hash, uint32_t capacity)
+{
+    if (size == 0 || size > capacity) {
+        return OTA_STATUS_SIZE_MISMATCH;
+    }
+    // Erases only as much of the partition as the image needs
+    if (img->flash.begin(img->flash.ctx, size) != 0) {
+        return OTA_STATUS_FLASH_ERROR;
+    }
+
+    mbedtls_sha256_init(&img->sha);
+    mbedtls_sha256_starts(&img->sha, 0);
+    memcpy(img->hash, hash, OTA_HASH_LEN);
+    img->size = size;
+    img->written = 0;
+    atomic_store(&img->received, 0);
+    atomic_store(&img->acked, 0);
+    img->active = true;
+    return OTA_STATUS_OK;
+}
+
+bool ota_image_receive(ota_image_t *img, size_t len)
+{
+    // The sender keeps sent + len - acked within the window, and the device never acks less than it has told it
+    uint32_t received = atomic_load(&img->received) + (uint32_t)len;
+    atomic_store(&img->received, received);
+    return received - atomic_load(&img->acked) <= OTA_WINDOW_BYTES;
+}
+
+ota_status_t ota_image_write(ota_image_t *img, const uint8_t *data, size_t len)
+{
+    if (len > img->size - img->written) {
+        ota_image_fail(img);
+        return OTA_STATUS_SIZE_MISMATCH;
+    }
+    if (img->flash.write(img->flash.ctx, data, len) != 0) {
+        ota_image_fail(img);
+        return OTA_STATUS_FLASH_ERROR;
+    }
+    mbedtls_sha256_update(&img->sha, data, len);
+    img->written += len;
+    return OTA_STATUS_OK;
+}
+
+bool ota_image_take_ack(ota_image_t *img, uint32_t *written)
+{
+    uint32_t acked = atomic_load(&img->acked);
+    if (img->written == acked || (img->written - acked < OTA_ACK_STEP && img->written != img->size)) {
+        return false;
+    }
+    atomic_store(&img->acked, img->written);
+    *written = img->written;
+    return true;
+}
+
+ota_status_t ota_image_end(ota_image_t *img)
+{
+    if (img->written != img->size) {
+        ota_image_fail(img);
+        return OTA_STATUS_SIZE_MISMATCH;
+    }
+
+    uint8_t hash[OTA_HASH_LEN];
+    mbedtls_sha256_finish(&img->sha, hash);
+    if (memcmp(hash, img->hash, OTA_HASH_LEN) != 0) {
+        ota_image_fail(img);
+        return OTA_STATUS_HASH_MISMATCH;
+    }
+
+    img->active = false;
+    mbedtls_sha256_free(&img->sha);
+    // The end hook also validates the image header and segments, and releases the partition either way
+    if (img->flash.end(img->flash.ctx) != 0) {
+        return OTA_STATUS_FLASH_ERROR;
+    }
+    return OTA_STATUS_OK;
+}
+
+void ota_image_fail(ota_image_t *img)
+{
+    if (!img->active) {
+        return;
+    }
+    img->active = false;
+    mbedtls_sha256_free(&img->sha);
+    img->flash.abort(img->flash.ctx);
+}
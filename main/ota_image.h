@@ -0,0 +1,119 @@
+/*
+ *
+ * OTA image transfer: window, size and hash checks in front of a flash hook
+ *
+ * Kept free of ESP-IDF so the checks can be exercised on a host against a
+ * file-backed partition, see tools/ota_host_test.c. ota.c supplies flash
+ * hooks for the esp_ota_* API and moves the bytes between the BT and OTA
+ * tasks.
+ *
+ * The receiving side calls ota_image_receive() for every chunk before it
+ * hands it over, which enforces the sender window. The writing side calls
+ * ota_image_write() in order, ota_image_take_ack() after each write and
+ * ota_image_end() once the sender ends the transfer. Any failure aborts
+ * the partition and ends the transfer; the returned status is the reason.
+ *
+ */
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mbedtls/sha256.h"
+#include "wire.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OTA_WINDOW_BYTES  8192  ///< Unacknowledged bytes the sender may have in flight
+#define OTA_ACK_STEP      2048  ///< Bytes written between acknowledgements
+#define OTA_HASH_LEN      sizeof(((wire_ota_begin_t *)0)->sha256)
+
+/**
+ * @brief Flash hooks, each returns 0 on success
+ */
+typedef struct {
+    int (*begin)(void *ctx, uint32_t size);                     ///< Make room for an image of size bytes
+    int (*write)(void *ctx, const uint8_t *data, size_t len);   ///< Append image bytes
+    int (*end)(void *ctx);                                      ///< Validate the complete image and select it for boot
+    void (*abort)(void *ctx);                                   ///< Discard a partial image
+    void *ctx;
+} ota_flash_t;
+
+/**
+ * @brief Transfer state
+ */
+typedef struct {
+    ota_flash_t flash;
+    bool active;                    ///< Between a successful begin and the end or failure
+    uint32_t size;                  ///< Announced image size
+    uint32_t written;               ///< Bytes passed to the flash hook
+    atomic_uint received;           ///< Bytes accepted from the sender, receiving side only
+    atomic_uint acked;              ///< Bytes acknowledged to the sender, writing side only
+    uint8_t hash[OTA_HASH_LEN];     ///< Announced SHA-256
+    mbedtls_sha256_context sha;
+} ota_image_t;
+
+/**
+ * @brief Attach the transfer state to a flash target
+ * @param img Transfer
+ * @param flash Flash hooks, copied
+ */
+void ota_image_init(ota_image_t *img, const ota_flash_t *flash);
+
+/**
+ * @brief Start a transfer
+ * @param img Transfer, not active
+ * @param size Announced image size
+ * @param hash Announced SHA-256, OTA_HASH_LEN bytes
+ * @param capacity Size of the target partition
+ * @return OTA_STATUS_OK, OTA_STATUS_SIZE_MISMATCH if the image is empty or does not fit,
+ *         OTA_STATUS_FLASH_ERROR if the begin hook fails
+ */
+ota_status_t ota_image_begin(ota_image_t *img, uint32_t size, const uint8_t *hash, uint32_t capacity);
+
+/**
+ * @brief Account for a chunk from the sender before it is handed to the writing side
+ * @param img Active transfer
+ * @param len Chunk length
+ * @return false if the chunk exceeds the window, the writing side then fails with OTA_STATUS_OVERFLOW
+ */
+bool ota_image_receive(ota_image_t *img, size_t len);
+
+/**
+ * @brief Hash and write the next image bytes
+ * @param img Active transfer
+ * @param data Image bytes, in order
+ * @param len Length of data
+ * @return OTA_STATUS_OK, OTA_STATUS_SIZE_MISMATCH past the announced size,
+ *         OTA_STATUS_FLASH_ERROR if the write hook fails
+ */
+ota_status_t ota_image_write(ota_image_t *img, const uint8_t *data, size_t len);
+
+/**
+ * @brief Check whether an acknowledgement is due and record it as sent
+ * @param img Active transfer
+ * @param written Receives the byte count to acknowledge
+ * @return true every OTA_ACK_STEP bytes and once the whole image is written
+ */
+bool ota_image_take_ack(ota_image_t *img, uint32_t *written);
+
+/**
+ * @brief Verify the complete image and select it through the end hook
+ * @param img Active transfer
+ * @return OTA_STATUS_OK, OTA_STATUS_SIZE_MISMATCH if bytes are missing,
+ *         OTA_STATUS_HASH_MISMATCH, or OTA_STATUS_FLASH_ERROR if the end hook rejects the image
+ */
+ota_status_t ota_image_end(ota_image_t *img);
+
+/**
+ * @brief End the transfer and discard the partial image, e.g. on abort or overflow
+ * @param img Transfer; does nothing if it is not active
+ */
+void ota_image_fail(ota_image_t *img);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,374 @@
+/*
+ *
+ * Quadrature encoder counted by the PCNT peripheral
+ *
+ */
+#include <string.h>
+#include "soc/soc_caps.h"
+#include "esp_log.h"
+#include "pcnt_encoder.h"
+
+#define TAG "PCNT_ENCODER"
+
+#define PCNT_LIMIT  30000   // Hardware count range; crossings are accumulated in software
+
+#if SOC_PCNT_SUPPORTED
+/**
+ * @brief Convert a count of x4 edges into steps, rounding to the nearest step
+ *
+ * The count at init sits in the middle of step zero, so contact bounce at
+ * a detent has to cover half a step before the position moves.
+ *
+ * @param enc Backend instance
+ * @param count Edges from init
+ * @return Steps from init
+ */
+static int32_t count_to_steps(const pcnt_encoder_t *enc, int count)
+{
+    int32_t scaled = (int32_t)count * enc->resolution + 2;
+    return scaled >= 0 ? scaled / 4 : -((3 - scaled) / 4);
+}
+
+/**
+ * @brief Read the hardware count, in the configured direction
+ * @param enc Backend instance
+ * @param count Receives the count
+ * @return ESP_OK on success
+ */
+static esp_err_t read_count(pcnt_encoder_t *enc, int *count)
+{
+    esp_err_t ret = pcnt_unit_get_count(enc->unit, count);
+    if (ret == ESP_OK && enc->flip) {
+        *count = -*count;
+    }
+    return ret;
+}
+
+/**
+ * @brief Publish a state change that is not a step, call with the lock held
+ * @param enc Backend instance
+ */
+static void publish_state(pcnt_encoder_t *enc)
+{
+    encoder_event_t event = {
+        .state = enc->state,
+        .timestamp = enc->last_step_us,
+    };
+    position_snapshot_publish(&enc->snapshot, &event);
+}
+
+static void poll_cb(void *arg)
+{
+    pcnt_encoder_t *enc = (pcnt_encoder_t *)arg;
+    int count;
+    if (read_count(enc, &count) != ESP_OK) {
+        return;
+    }
+
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    encoder_event_t event;
+    bool send = false;
+
+    portENTER_CRITICAL(&enc->lock);
+    enc->count = count;
+    int32_t position = enc->offset + count_to_steps(enc, count);
+    if (position != enc->state.position) {
+        int step = position > enc->state.position ? 1 : -1;
+        if (enc->last_step && step != enc->last_step) {
+            enc->reversals++;
+        }
+        enc->last_step = step;
+        enc->state.position = position;
+        enc->state.direction = step > 0 ? ENCODER_DIRECTION_CLOCKWISE : ENCODER_DIRECTION_COUNTER_CLOCKWISE;
+        event.state = enc->state;
+        event.timestamp = now;
+        event.interval = enc->stepped ? now - enc->last_step_us : 0;
+        enc->last_step_us = now;
+        enc->stepped = true;
+        position_snapshot_publish(&enc->snapshot, &event);
+        send = enc->queue != NULL;
+    }
+    portEXIT_CRITICAL(&enc->lock);
+
+    if (send) {
+        xQueueOverwrite(enc->queue, &event);
+    }
+}
+
+/**
+ * @brief Create the unit and its two channels, decoding x4
+ * @param enc Backend instance
+ * @param config Pins and options
+ * @return ESP_OK on success
+ */
+static esp_err_t create_unit(pcnt_encoder_t *enc, const pcnt_encoder_config_t *config)
+{
+    pcnt_unit_config_t unit_conf = {
+        .low_limit = -PCNT_LIMIT,
+        .high_limit = PCNT_LIMIT,
+        .flags.accum_count = true,
+    };
+    esp_err_t ret = pcnt_new_unit(&unit_conf, &enc->unit);
+    if (ret == ESP_OK && config->glitch_ns) {
+        pcnt_glitch_filter_config_t filter_conf = {
+            .max_glitch_ns = config->glitch_ns,
+        };
+        ret = pcnt_unit_set_glitch_filter(enc->unit, &filter_conf);
+    }
+
+    // Each channel counts the edges of one signal, in the direction given by the level of the other
+    pcnt_chan_config_t chan_a_conf = {
+        .edge_gpio_num = config->pin_a,
+        .level_gpio_num = config->pin_b,
+    };
+    pcnt_chan_config_t chan_b_conf = {
+        .edge_gpio_num = config->pin_b,
+        .level_gpio_num = config->pin_a,
+    };
+    if (ret == ESP_OK) {
+        ret = pcnt_new_channel(enc->unit, &chan_a_conf, &enc->channel_a);
+    }
+    if (ret == ESP_OK) {
+        ret = pcnt_new_channel(enc->unit, &chan_b_conf, &enc->channel_b);
+    }
+    if (ret == ESP_OK) {
+        ret = pcnt_channel_set_edge_action(enc->channel_a, PCNT_CHANNEL_EDGE_ACTION_DECREASE, PCNT_CHANNEL_EDGE_ACTION_INCREASE);
+    }
+    if (ret == ESP_OK) {
+        ret = pcnt_channel_set_level_action(enc->channel_a, PCNT_CHANNEL_LEVEL_ACTION_KEEP, PCNT_CHANNEL_LEVEL_ACTION_INVERSE);
+    }
+    if (ret == ESP_OK) {
+        ret = pcnt_channel_set_edge_action(enc->channel_b, PCNT_CHANNEL_EDGE_ACTION_INCREASE, PCNT_CHANNEL_EDGE_ACTION_DECREASE);
+    }
+    if (ret == ESP_OK) {
+        ret = pcnt_channel_set_level_action(enc->channel_b, PCNT_CHANNEL_LEVEL_ACTION_KEEP, PCNT_CHANNEL_LEVEL_ACTION_INVERSE);
+    }
+
+    // Watch points on the limits let the driver carry the count across them
+    if (ret == ESP_OK) {
+        ret = pcnt_unit_add_watch_point(enc->unit, PCNT_LIMIT);
+    }
+    if (ret == ESP_OK) {
+        ret = pcnt_unit_add_watch_point(enc->unit, -PCNT_LIMIT);
+    }
+    if (ret == ESP_OK) {
+        gpio_set_pull_mode(config->pin_a, GPIO_PULLUP_ONLY);
+        gpio_set_pull_mode(config->pin_b, GPIO_PULLUP_ONLY);
+        ret = pcnt_unit_enable(enc->unit);
+    }
+    if (ret == ESP_OK) {
+        ret = pcnt_unit_clear_count(enc->unit);
+    }
+    if (ret == ESP_OK) {
+        ret = pcnt_unit_start(enc->unit);
+    }
+    return ret;
+}
+#endif
+
+esp_err_t pcnt_encoder_init(pcnt_encoder_t *enc, const pcnt_encoder_config_t *config)
+{
+    if (!enc || !config) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+#if SOC_PCNT_SUPPORTED
+    memset(enc, 0, sizeof(*enc));
+    portMUX_INITIALIZE(&enc->lock);
+    enc->resolution = config->resolution;
+    enc->flip = config->flip;
+    position_quality_init(&enc->quality);
+
+    esp_err_t ret = create_unit(enc, config);
+    if (ret == ESP_OK) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = poll_cb,
+            .arg = enc,
+            .name = "pcnt_encoder"
+        };
+        ret = esp_timer_create(&timer_args, &enc->timer);
+    }
+    if (ret == ESP_OK) {
+        ret = esp_timer_start_periodic(enc->timer, PCNT_ENCODER_POLL_US);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "PCNT setup failed: %s", esp_err_to_name(ret));
+        pcnt_encoder_uninit(enc);
+    }
+    return ret;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t pcnt_encoder_uninit(pcnt_encoder_t *enc)
+{
+    if (!enc) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+#if SOC_PCNT_SUPPORTED
+    // Each step is best effort, init may have stopped half way
+    if (enc->timer) {
+        esp_timer_stop(enc->timer);
+        esp_timer_delete(enc->timer);
+    }
+    if (enc->unit) {
+        pcnt_unit_stop(enc->unit);
+        pcnt_unit_disable(enc->unit);
+        pcnt_unit_remove_watch_point(enc->unit, PCNT_LIMIT);
+        pcnt_unit_remove_watch_point(enc->unit, -PCNT_LIMIT);
+    }
+    if (enc->channel_a) {
+        pcnt_del_channel(enc->channel_a);
+    }
+    if (enc->channel_b) {
+        pcnt_del_channel(enc->channel_b);
+    }
+    if (enc->unit) {
+        pcnt_del_unit(enc->unit);
+    }
+    enc->timer = NULL;
+    enc->unit = NULL;
+    enc->channel_a = NULL;
+    enc->channel_b = NULL;
+#endif
+    return ESP_OK;
+}
+
+#if SOC_PCNT_SUPPORTED
+static esp_err_t source_set_queue(void *ctx, QueueHandle_t queue)
+{
+    pcnt_encoder_t *enc = (pcnt_encoder_t *)ctx;
+    portENTER_CRITICAL(&enc->lock);
+    enc->queue = queue;
+    portEXIT_CRITICAL(&enc->lock);
+    return ESP_OK;
+}
+
+static esp_err_t source_get_timestamp_hz(void *ctx, uint32_t *hz)
+{
+    if (!hz) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *hz = 1000000;
+    return ESP_OK;
+}
+
+static esp_err_t source_get_state(void *ctx, encoder_state_t *state)
+{
+    pcnt_encoder_t *enc = (pcnt_encoder_t *)ctx;
+    if (!state) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    encoder_event_t event;
+    position_snapshot_read(&enc->snapshot, &event);
+    *state = event.state;
+    return ESP_OK;
+}
+
+static esp_err_t source_set_position(void *ctx, encoder_position_t position)
+{
+    pcnt_encoder_t *enc = (pcnt_encoder_t *)ctx;
+    int count;
+    esp_err_t ret = read_count(enc, &count);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    portENTER_CRITICAL(&enc->lock);
+    enc->count = count;
+    enc->offset = position - count_to_steps(enc, count);
+    enc->state.position = position;
+    publish_state(enc);
+    portEXIT_CRITICAL(&enc->lock);
+    return ESP_OK;
+}
+
+static esp_err_t source_reset(void *ctx)
+{
+    pcnt_encoder_t *enc = (pcnt_encoder_t *)ctx;
+    esp_err_t ret = source_set_position(ctx, 0);
+    if (ret == ESP_OK) {
+        portENTER_CRITICAL(&enc->lock);
+        enc->state.direction = ENCODER_DIRECTION_NOT_SET;
+        enc->last_step = 0;
+        publish_state(enc);
+        portEXIT_CRITICAL(&enc->lock);
+    }
+    return ret;
+}
+
+static esp_err_t source_set_resolution(void *ctx, quadrature_resolution_t resolution)
+{
+    pcnt_encoder_t *enc = (pcnt_encoder_t *)ctx;
+    if (resolution != QUADRATURE_X1 && resolution != QUADRATURE_X2 && resolution != QUADRATURE_X4) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // The hardware always counts x4, only the scaling changes
+    portENTER_CRITICAL(&enc->lock);
+    enc->state.position = enc->state.position * resolution / enc->resolution;
+    enc->resolution = resolution;
+    enc->offset = enc->state.position - count_to_steps(enc, enc->count);
+    enc->stepped = false;
+    publish_state(enc);
+    portEXIT_CRITICAL(&enc->lock);
+    return ESP_OK;
+}
+
+static bool source_check_quality(void *ctx, const encoder_quality_limits_t *limits, encoder_quality_t *quality)
+{
+    pcnt_encoder_t *enc = (pcnt_encoder_t *)ctx;
+    bool changed = false;
+
+    if (position_quality_due(&enc->quality)) {
+        portENTER_CRITICAL(&enc->lock);
+        uint32_t reversals = enc->reversals;
+        portEXIT_CRITICAL(&enc->lock);
+
+        changed = position_quality_roll(&enc->quality, 0, 0, reversals, limits);
+    }
+
+    if (quality) {
+        *quality = enc->quality.quality;
+    }
+    return changed;
+}
+
+static esp_err_t source_uninit(void *ctx)
+{
+    return pcnt_encoder_uninit(ctx);
+}
+
+static const position_source_ops_t source_ops = {
+    .set_queue = source_set_queue,
+    .get_timestamp_hz = source_get_timestamp_hz,
+    .get_state = source_get_state,
+    .set_position = source_set_position,
+    .reset = source_reset,
+    .set_resolution = source_set_resolution,
+    .check_quality = source_check_quality,
+    .uninit = source_uninit,
+};
+#endif
+
+esp_err_t pcnt_encoder_get_position_source(pcnt_encoder_t *enc, position_source_t *source)
+{
+    if (!enc || !source) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+#if SOC_PCNT_SUPPORTED
+    *source = (position_source_t){
+        .name = "pcnt",
+        .ops = &source_ops,
+        .ctx = enc,
+        .snapshot = &enc->snapshot,
+    };
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
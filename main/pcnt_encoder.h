@@ -0,0 +1,95 @@
+/*
+ *
+ * Quadrature encoder counted by the PCNT peripheral
+ *
+ * Both channels of one unit decode A/B at x4 in hardware, so edges cost no
+ * CPU time and no interrupts however fast the shaft turns. A periodic timer
+ * reads the count and delivers an event when the position changed.
+ *
+ * PCNT does not report illegal transitions, and its glitch filter drops
+ * short pulses without counting them, so only direction reversals feed the
+ * signal quality. Needs a chip with PCNT (ESP32, S2, S3, C6, H2, P4).
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+#include "driver/pulse_cnt.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "position_source.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PCNT_ENCODER_POLL_US   1000   // Count sampling period, bounds the event latency
+
+/**
+ * @brief Pins and counting options
+ */
+typedef struct {
+    gpio_num_t pin_a;
+    gpio_num_t pin_b;
+    quadrature_resolution_t resolution;  ///< Steps per detent cycle
+    uint32_t glitch_ns;                  ///< Pulses shorter than this are not counted, 0 disables
+    bool flip;                           ///< Reverse the clockwise/counterclockwise sense
+} pcnt_encoder_config_t;
+
+/**
+ * @brief Backend instance, treat as opaque
+ */
+typedef struct {
+    pcnt_unit_handle_t unit;
+    pcnt_channel_handle_t channel_a;
+    pcnt_channel_handle_t channel_b;
+    esp_timer_handle_t timer;
+    QueueHandle_t queue;
+    portMUX_TYPE lock;
+    seqlock_t snapshot;         ///< Last step, readable without the lock
+
+    quadrature_resolution_t resolution;
+    bool flip;
+    int count;                  ///< Last hardware count, edges from init
+    int32_t offset;             ///< Position at a count of zero
+    encoder_state_t state;
+    int last_step;
+    uint32_t reversals;
+    uint32_t last_step_us;
+    bool stepped;
+    position_quality_window_t quality;
+} pcnt_encoder_t;
+
+/**
+ * @brief Configure the PCNT unit on the A/B pins and start counting
+ *
+ * The A/B state at init is taken as a detent, in the middle of position zero.
+ *
+ * @param enc Backend instance
+ * @param config Pins and options
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if the chip has no PCNT
+ */
+esp_err_t pcnt_encoder_init(pcnt_encoder_t *enc, const pcnt_encoder_config_t *config);
+
+/**
+ * @brief Stop counting and release the unit and timer
+ * @param enc Backend instance
+ * @return ESP_OK on success
+ */
+esp_err_t pcnt_encoder_uninit(pcnt_encoder_t *enc);
+
+/**
+ * @brief Expose an initialized backend through the position source interface
+ * @param enc Backend instance, must outlive the source
+ * @param source Receives the position source
+ * @return ESP_OK on success
+ */
+esp_err_t pcnt_encoder_get_position_source(pcnt_encoder_t *enc, position_source_t *source);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,44 @@
+/*
+ *
+ * Position source: signal quality windows shared by the backends
+ *
+ */
+#include "esp_timer.h"
+#include "position_source.h"
+
+#define QUALITY_WINDOW_US  (1000 * 1000)
+
+void position_quality_init(position_quality_window_t *window)
+{
+    *window = (position_quality_window_t){
+        .start_us = esp_timer_get_time(),
+    };
+}
+
+bool position_quality_due(const position_quality_window_t *window)
+{
+    return esp_timer_get_time() - window->start_us >= QUALITY_WINDOW_US;
+}
+
+bool position_quality_roll(position_quality_window_t *window, uint32_t illegal, uint32_t glitches, uint32_t reversals,
+                           const encoder_quality_limits_t *limits)
+{
+    encoder_quality_t *q = &window->quality;
+    q->illegal = illegal;
+    q->glitches = glitches;
+    q->reversals = reversals;
+    q->illegal_per_s = illegal - window->illegal;
+    q->glitches_per_s = glitches - window->glitches;
+    q->reversals_per_s = reversals - window->reversals;
+    window->illegal = illegal;
+    window->glitches = glitches;
+    window->reversals = reversals;
+    window->start_us = esp_timer_get_time();
+
+    bool degraded = q->illegal_per_s > limits->illegal_per_s ||
+                    q->glitches_per_s > limits->glitches_per_s ||
+                    q->reversals_per_s > limits->reversals_per_s;
+    bool changed = degraded != q->degraded;
+    q->degraded = degraded;
+    return changed;
+}
@@ -0,0 +1,284 @@
+/*
+ *
+ * Position source: the interface between a position sensor backend and the application
+ *
+ * The zone logic, statistics and BLE layers only see encoder states, events
+ * and signal quality. A backend fills in position_source_ops_t and hands out
+ * a position_source_t; the backends in this tree are:
+ *
+ *   encoder.c       A/B quadrature on GPIO interrupts, see encoder_get_position_source()
+ *   pcnt_encoder.c  A/B quadrature counted by the PCNT peripheral
+ *   abs_encoder.c   magnetic absolute angle sensor, unwrapped over multiple turns
+ *
+ * Every backend delivers an event to the queue when the position changes,
+ * so the health monitor's event stall check applies to all of them.
+ *
+ * Every backend also publishes the last step through a sequence lock
+ * (seqlock.h) from its decode path. position_source_read_snapshot() and
+ * get_state read it without taking the backend lock or masking interrupts,
+ * so any number of tasks on either core can poll the position.
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_err.h"
+#include "quadrature.h"
+#include "seqlock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int32_t encoder_position_t;
+
+typedef enum {
+    ENCODER_DIRECTION_NOT_SET = 0,
+    ENCODER_DIRECTION_CLOCKWISE,
+    ENCODER_DIRECTION_COUNTER_CLOCKWISE,
+} encoder_direction_t;
+
+/**
+ * @brief Position and direction of the last step
+ */
+typedef struct {
+    encoder_position_t position;
+    encoder_direction_t direction;
+} encoder_state_t;
+
+/**
+ * @brief Event delivered to the queue on every step
+ *
+ * Timestamps count at the source's timestamp rate and wrap, so only
+ * differences are meaningful.
+ */
+typedef struct {
+    encoder_state_t state;
+    uint32_t timestamp;     ///< Edge or sample that completed the step
+    uint32_t interval;      ///< Time since the previous step, 0 for the first one or after an idle longer than a timestamp wrap
+} encoder_event_t;
+
+_Static_assert(sizeof(encoder_event_t) % 4 == 0 && sizeof(encoder_event_t) <= SEQLOCK_MAX_WORDS * 4,
+               "encoder_event_t must fit the snapshot sequence lock");
+
+/**
+ * @brief Per-second rates above which the signal is considered degraded
+ */
+typedef struct {
+    uint32_t illegal_per_s;
+    uint32_t glitches_per_s;
+    uint32_t reversals_per_s;
+} encoder_quality_limits_t;
+
+/**
+ * @brief Signal quality totals and the rates over the last one second window
+ *
+ * What counts as illegal or a glitch depends on the backend; see its header.
+ */
+typedef struct {
+    uint32_t illegal;
+    uint32_t glitches;
+    uint32_t reversals;
+    uint32_t illegal_per_s;
+    uint32_t glitches_per_s;
+    uint32_t reversals_per_s;
+    bool degraded;
+} encoder_quality_t;
+
+/**
+ * @brief Operations a backend implements, ctx is its instance
+ */
+typedef struct {
+    esp_err_t (*set_queue)(void *ctx, QueueHandle_t queue);
+    esp_err_t (*get_timestamp_hz)(void *ctx, uint32_t *hz);
+    esp_err_t (*get_state)(void *ctx, encoder_state_t *state);
+    esp_err_t (*set_position)(void *ctx, encoder_position_t position);
+    esp_err_t (*reset)(void *ctx);
+    esp_err_t (*set_resolution)(void *ctx, quadrature_resolution_t resolution);
+    bool (*check_quality)(void *ctx, const encoder_quality_limits_t *limits, encoder_quality_t *quality);
+    esp_err_t (*uninit)(void *ctx);
+} position_source_ops_t;
+
+/**
+ * @brief A backend instance behind the common operations
+ */
+typedef struct {
+    const char *name;
+    const position_source_ops_t *ops;
+    void *ctx;
+    seqlock_t *snapshot;        ///< Last step, published by the backend
+} position_source_t;
+
+/**
+ * @brief Publish the last step, call with the backend lock held so writers are serialized
+ *
+ * Changes that are not a step (set_position, reset, set_resolution) publish
+ * the new state with the previous timestamp and an interval of 0.
+ *
+ * @param snapshot Backend's sequence lock
+ * @param event Step to publish
+ */
+static inline __attribute__((always_inline)) void position_snapshot_publish(seqlock_t *snapshot, const encoder_event_t *event)
+{
+    seqlock_write(snapshot, event, sizeof(*event));
+}
+
+/**
+ * @brief Read the last published step from a backend's sequence lock
+ * @param snapshot Backend's sequence lock
+ * @param event Receives the step
+ */
+static inline void position_snapshot_read(seqlock_t *snapshot, encoder_event_t *event)
+{
+    seqlock_read(snapshot, event, sizeof(*event));
+}
+
+/**
+ * @brief Read the last step without locking, callable from any task on any core
+ * @param source Position source
+ * @param event Receives the position, direction and timestamp of the last step
+ * @return ESP_OK on success
+ */
+static inline esp_err_t position_source_read_snapshot(const position_source_t *source, encoder_event_t *event)
+{
+    if (!source || !source->snapshot || !event) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    position_snapshot_read(source->snapshot, event);
+    return ESP_OK;
+}
+
+/**
+ * @brief Set the queue that receives an event on every step
+ * @param source Position source
+ * @param queue Queue of encoder_event_t with a length of one; it is overwritten, never blocked on
+ * @return ESP_OK on success
+ */
+static inline esp_err_t position_source_set_queue(const position_source_t *source, QueueHandle_t queue)
+{
+    return source && source->ops ? source->ops->set_queue(source->ctx, queue) : ESP_ERR_INVALID_ARG;
+}
+
+/**
+ * @brief Get the rate event timestamps count at
+ * @param source Position source
+ * @param hz Receives the timestamp ticks per second
+ * @return ESP_OK on success
+ */
+static inline esp_err_t position_source_get_timestamp_hz(const position_source_t *source, uint32_t *hz)
+{
+    return source && source->ops ? source->ops->get_timestamp_hz(source->ctx, hz) : ESP_ERR_INVALID_ARG;
+}
+
+/**
+ * @brief Get the current position and direction, lock-free like position_source_read_snapshot()
+ * @param source Position source
+ * @param state Receives the state
+ * @return ESP_OK on success
+ */
+static inline esp_err_t position_source_get_state(const position_source_t *source, encoder_state_t *state)
+{
+    return source && source->ops ? source->ops->get_state(source->ctx, state) : ESP_ERR_INVALID_ARG;
+}
+
+/**
+ * @brief Set the position, e.g. to restore it after a restart
+ * @param source Position source
+ * @param position New position
+ * @return ESP_OK on success
+ */
+static inline esp_err_t position_source_set_position(const position_source_t *source, encoder_position_t position)
+{
+    return source && source->ops ? source->ops->set_position(source->ctx, position) : ESP_ERR_INVALID_ARG;
+}
+
+/**
+ * @brief Zero the position and direction
+ * @param source Position source
+ * @return ESP_OK on success
+ */
+static inline esp_err_t position_source_reset(const position_source_t *source)
+{
+    return source && source->ops ? source->ops->reset(source->ctx) : ESP_ERR_INVALID_ARG;
+}
+
+/**
+ * @brief Set the steps per detent and rescale the position to it
+ * @param source Position source
+ * @param resolution x1, x2 or x4
+ * @return ESP_OK on success
+ */
+static inline esp_err_t position_source_set_resolution(const position_source_t *source, quadrature_resolution_t resolution)
+{
+    return source && source->ops ? source->ops->set_resolution(source->ctx, resolution) : ESP_ERR_INVALID_ARG;
+}
+
+/**
+ * @brief Roll the one second quality window and evaluate it against limits
+ * @param source Position source
+ * @param limits Per-second limits
+ * @param quality Receives the current quality, may be NULL
+ * @return true if the degraded flag changed
+ */
+static inline bool position_source_check_quality(const position_source_t *source, const encoder_quality_limits_t *limits,
+                                                 encoder_quality_t *quality)
+{
+    return source && source->ops ? source->ops->check_quality(source->ctx, limits, quality) : false;
+}
+
+/**
+ * @brief Stop the backend and release its peripherals
+ * @param source Position source
+ * @return ESP_OK on success
+ */
+static inline esp_err_t position_source_uninit(const position_source_t *source)
+{
+    return source && source->ops ? source->ops->uninit(source->ctx) : ESP_ERR_INVALID_ARG;
+}
+
+/**
+ * @brief One second signal quality window, shared by the backends
+ */
+typedef struct {
+    encoder_quality_t quality;
+    int64_t start_us;
+    uint32_t illegal;           ///< Totals at the start of the window
+    uint32_t glitches;
+    uint32_t reversals;
+} position_quality_window_t;
+
+/**
+ * @brief Start the first window
+ * @param window Window to start
+ */
+void position_quality_init(position_quality_window_t *window);
+
+/**
+ * @brief Check whether the current window has run its second
+ * @param window Window
+ * @return true if position_quality_roll() should be called
+ */
+bool position_quality_due(const position_quality_window_t *window);
+
+/**
+ * @brief Close the window with the current totals and start the next one
+ *
+ * The signal becomes degraded as soon as a window exceeds any limit, and
+ * recovers after a window within all limits.
+ *
+ * @param window Window
+ * @param illegal Total illegal transitions or rejected samples
+ * @param glitches Total glitches
+ * @param reversals Total direction reversals
+ * @param limits Per-second limits
+ * @return true if the degraded flag changed
+ */
+bool position_quality_roll(position_quality_window_t *window, uint32_t illegal, uint32_t glitches, uint32_t reversals,
+                           const encoder_quality_limits_t *limits);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,153 @@
+/*
+ *
+ * Quadrature decoder core with signal quality accounting
+ *
+ * Pure logic with no hardware access, so it can run inside the GPIO ISR and
+ * be exercised on a host. Every A/B edge is classified through a 16-entry
+ * transition table. At x1 and x2 a step is emitted when the signals settle
+ * back into a rest state, which rejects bounce around a detent; x4 emits a
+ * step on every legal edge for the full resolution of the encoder.
+ *
+ * The encoder ISR runs while flash is being written, when the cache is off.
+ * On the device the table is placed in DRAM and the update is always
+ * inlined into the IRAM handler, so nothing here is fetched from flash.
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#define QUADRATURE_DRAM  DRAM_ATTR
+#else
+#define QUADRATURE_DRAM
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QUADRATURE_ILLEGAL  2
+
+/**
+ * @brief Steps counted per detent cycle of four edges
+ */
+typedef enum {
+    QUADRATURE_X1 = 1,          ///< At the detent state
+    QUADRATURE_X2 = 2,          ///< At the detent and the opposite state
+    QUADRATURE_X4 = 4,          ///< On every legal edge
+} quadrature_resolution_t;
+
+/**
+ * @brief Decoder state and quality counters
+ */
+typedef struct {
+    uint8_t ab;                 ///< Last sampled state, A in bit 1 and B in bit 0
+    uint8_t detent;             ///< State the encoder rests in at a detent
+    uint8_t resolution;         ///< Steps per detent cycle, a quadrature_resolution_t
+    int8_t sub;                 ///< Edges accumulated since the last rest state
+    int8_t last_step;           ///< Direction of the last emitted step
+    uint32_t glitch_ticks;      ///< Edges on one pin closer than this are glitches
+    uint32_t last_edge_a;       ///< Tick of the last edge on A
+    uint32_t last_edge_b;       ///< Tick of the last edge on B
+
+    uint32_t edges;             ///< Edges processed
+    uint32_t illegal;           ///< Transitions where both pins changed, i.e. a missed edge
+    uint32_t glitches;          ///< Edges closer than glitch_ticks to the previous one on the same pin
+    uint32_t reversals;         ///< Steps in the opposite direction to the previous step
+} quadrature_t;
+
+/**
+ * @brief Edge direction by (previous state << 2 | new state), Gray sequence 00 -> 01 -> 11 -> 10 is forward
+ */
+static const int8_t QUADRATURE_DRAM quadrature_table[16] = {
+    0, 1, -1, QUADRATURE_ILLEGAL,
+    -1, 0, QUADRATURE_ILLEGAL, 1,
+    1, QUADRATURE_ILLEGAL, 0, -1,
+    QUADRATURE_ILLEGAL, -1, 1, 0,
+};
+
+/**
+ * @brief Reset the decoder
+ * @param q Decoder
+ * @param ab Current A/B state, taken as the detent state
+ * @param resolution Steps per detent cycle
+ * @param glitch_ticks Minimum spacing of edges on one pin, 0 disables glitch counting
+ */
+static inline void quadrature_init(quadrature_t *q, uint8_t ab, quadrature_resolution_t resolution, uint32_t glitch_ticks)
+{
+    *q = (quadrature_t){
+        .ab = ab & 3,
+        .detent = ab & 3,
+        .resolution = resolution,
+        .glitch_ticks = glitch_ticks,
+    };
+}
+
+/**
+ * @brief Feed one sampled A/B state
+ * @param q Decoder
+ * @param ab New A/B state, A in bit 1 and B in bit 0
+ * @param now_ticks Free-running timestamp, only differences are used
+ * @return Step emitted: +1, -1 or 0
+ */
+static inline __attribute__((always_inline)) int quadrature_update(quadrature_t *q, uint8_t ab, uint32_t now_ticks)
+{
+    ab &= 3;
+    uint8_t changed = q->ab ^ ab;
+    if (!changed) {
+        return 0;
+    }
+
+    q->edges++;
+    if (changed & 2) {
+        if (q->glitch_ticks && now_ticks - q->last_edge_a < q->glitch_ticks) {
+            q->glitches++;
+        }
+        q->last_edge_a = now_ticks;
+    }
+    if (changed & 1) {
+        if (q->glitch_ticks && now_ticks - q->last_edge_b < q->glitch_ticks) {
+            q->glitches++;
+        }
+        q->last_edge_b = now_ticks;
+    }
+
+    int8_t dir = quadrature_table[(q->ab << 2) | ab];
+    q->ab = ab;
+    if (dir == QUADRATURE_ILLEGAL) {
+        // The direction of the missed edges is unknown; at x1 and x2 the edges seen still decide the step
+        q->illegal++;
+        if (q->resolution == QUADRATURE_X4) {
+            return 0;
+        }
+        dir = 0;
+    }
+
+    int step = dir;
+    if (q->resolution != QUADRATURE_X4) {
+        q->sub += dir;
+        bool at_rest = ab == q->detent || (q->resolution == QUADRATURE_X2 && ab == (q->detent ^ 3));
+        if (!at_rest) {
+            return 0;
+        }
+
+        // Between rest states a clean step moves 4 edges (2 at x2); accept a majority
+        int threshold = q->resolution == QUADRATURE_X2 ? 1 : 2;
+        step = q->sub >= threshold ? 1 : (q->sub <= -threshold ? -1 : 0);
+        q->sub = 0;
+    }
+    if (step) {
+        if (q->last_step && step != q->last_step) {
+            q->reversals++;
+        }
+        q->last_step = step;
+    }
+    return step;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,270 @@
+/*
+ *
+ * Rules engine: compound alert conditions as compact bytecode
+ *
+ */
+#include <string.h>
+#include "wire.h"
+#include "rules.h"
+
+typedef struct {
+    uint8_t operands;   // Operand bytes after the opcode
+    uint8_t pops;
+    uint8_t pushes;
+} op_shape_t;
+
+/**
+ * @brief Look up the operand length and stack effect of an opcode
+ * @param op Opcode
+ * @param shape Receives its shape
+ * @return false for an unknown opcode
+ */
+static bool op_shape(uint8_t op, op_shape_t *shape)
+{
+    switch (op) {
+    case RULE_OP_PUSH8:       *shape = (op_shape_t){ 1, 0, 1 }; return true;
+    case RULE_OP_PUSH16:      *shape = (op_shape_t){ 2, 0, 1 }; return true;
+    case RULE_OP_PUSH32:      *shape = (op_shape_t){ 4, 0, 1 }; return true;
+    case RULE_OP_ZONE:
+    case RULE_OP_POSITION:
+    case RULE_OP_ZONE_MS:
+    case RULE_OP_CALIB_MS:
+    case RULE_OP_CALIBRATING: *shape = (op_shape_t){ 0, 0, 1 }; return true;
+    case RULE_OP_DELTA:       *shape = (op_shape_t){ 1, 0, 1 }; return true;
+    case RULE_OP_NEG:
+    case RULE_OP_ABS:
+    case RULE_OP_NOT:         *shape = (op_shape_t){ 0, 1, 1 }; return true;
+    case RULE_OP_ADD:
+    case RULE_OP_SUB:
+    case RULE_OP_EQ:
+    case RULE_OP_NE:
+    case RULE_OP_LT:
+    case RULE_OP_LE:
+    case RULE_OP_GT:
+    case RULE_OP_GE:
+    case RULE_OP_AND:
+    case RULE_OP_OR:          *shape = (op_shape_t){ 0, 2, 1 }; return true;
+    case RULE_OP_HELD:        *shape = (op_shape_t){ 3, 1, 1 }; return true;
+    case RULE_OP_ALERT:       *shape = (op_shape_t){ 1, 1, 0 }; return true;
+    default:                  return false;
+    }
+}
+
+bool rules_verify(const uint8_t *program, size_t len)
+{
+    if (len == 0) {
+        return true;
+    }
+
+    wire_rules_header_t header;
+    if (len > RULES_PROGRAM_MAX || !wire_unpack_rules_header(program, len, &header) ||
+        header.version != RULES_VERSION || header.rules == 0 || header.rules > RULES_MAX ||
+        header.timers > RULES_TIMERS_MAX) {
+        return false;
+    }
+
+    size_t pc = WIRE_RULES_HEADER_LEN;
+    int depth = 0;
+    unsigned rules = 0;
+    while (pc < len) {
+        op_shape_t shape;
+        if (!op_shape(program[pc], &shape) || pc + 1 + shape.operands > len || depth < shape.pops) {
+            return false;
+        }
+        const uint8_t *arg = &program[pc + 1];
+        depth += shape.pushes - shape.pops;
+        if (depth > RULES_STACK_MAX) {
+            return false;
+        }
+
+        switch (program[pc]) {
+        case RULE_OP_DELTA:
+            if (arg[0] == 0 || arg[0] >= RULES_HISTORY_LEN) {
+                return false;
+            }
+            break;
+        case RULE_OP_HELD:
+            if (arg[0] >= header.timers) {
+                return false;
+            }
+            break;
+        case RULE_OP_ALERT:
+            // A rule is one expression, nothing may be left under its result
+            if (depth != 0) {
+                return false;
+            }
+            rules++;
+            break;
+        default:
+            break;
+        }
+        pc += 1 + shape.operands;
+    }
+
+    // Every op but alert pushes, so an empty stack means the code ends with one
+    return depth == 0 && rules == header.rules;
+}
+
+bool rules_load(rules_t *rules, const uint8_t *program, size_t len)
+{
+    memset(rules, 0, sizeof(*rules));
+    if (!rules_verify(program, len)) {
+        return false;
+    }
+    if (len) {
+        memcpy(rules->program, program, len);
+    }
+    rules->len = len;
+    return true;
+}
+
+/**
+ * @brief Track the zone entry time and append the position history
+ * @param rules Engine
+ * @param in Current inputs
+ */
+static void update_inputs(rules_t *rules, const rules_input_t *in)
+{
+    if (!rules->started) {
+        rules->started = true;
+        rules->zone = in->zone;
+        rules->zone_since_ms = in->now_ms;
+        rules->history[0] = in->position;
+        rules->history_head = 0;
+        rules->history_fill = 1;
+        rules->history_ms = in->now_ms;
+        return;
+    }
+
+    if (in->zone != rules->zone) {
+        rules->zone = in->zone;
+        rules->zone_since_ms = in->now_ms;
+    }
+
+    // One entry per elapsed tick; ticks missed by a late call repeat the current position
+    uint32_t ticks = (in->now_ms - rules->history_ms) / RULES_TICK_MS;
+    rules->history_ms += ticks * RULES_TICK_MS;
+    if (ticks > RULES_HISTORY_LEN) {
+        ticks = RULES_HISTORY_LEN;
+    }
+    while (ticks--) {
+        rules->history_head = (rules->history_head + 1) % RULES_HISTORY_LEN;
+        rules->history[rules->history_head] = in->position;
+        if (rules->history_fill < RULES_HISTORY_LEN) {
+            rules->history_fill++;
+        }
+    }
+}
+
+/**
+ * @brief Position some ticks back, or the oldest one kept
+ * @param rules Engine
+ * @param ticks Ticks back, below RULES_HISTORY_LEN
+ * @return Position then
+ */
+static int32_t history_at(const rules_t *rules, uint8_t ticks)
+{
+    if (ticks >= rules->history_fill) {
+        ticks = rules->history_fill - 1;
+    }
+    return rules->history[(rules->history_head + RULES_HISTORY_LEN - ticks) % RULES_HISTORY_LEN];
+}
+
+/**
+ * @brief Evaluate a held opcode
+ * @param rules Engine
+ * @param timer Timer slot
+ * @param ticks Duration the condition has to hold
+ * @param cond Condition
+ * @param now_ms Current time
+ * @return true once cond has been true for the whole duration
+ */
+static bool held(rules_t *rules, uint8_t timer, uint16_t ticks, bool cond, uint32_t now_ms)
+{
+    if (!cond) {
+        rules->timer_running[timer] = false;
+        return false;
+    }
+    if (!rules->timer_running[timer]) {
+        rules->timer_running[timer] = true;
+        rules->timer_start_ms[timer] = now_ms;
+    }
+    return now_ms - rules->timer_start_ms[timer] >= (uint32_t)ticks * RULES_TICK_MS;
+}
+
+static int32_t saturate(int64_t v)
+{
+    return v > INT32_MAX ? INT32_MAX : v < INT32_MIN ? INT32_MIN : (int32_t)v;
+}
+
+int rules_evaluate(rules_t *rules, const rules_input_t *in, rules_alert_cb_t alert_cb, void *ctx)
+{
+    if (!rules->len) {
+        return 0;
+    }
+    update_inputs(rules, in);
+
+    int32_t stack[RULES_STACK_MAX];
+    int sp = 0;
+    uint8_t rule = 0;
+    int fired = 0;
+    size_t pc = WIRE_RULES_HEADER_LEN;
+    // Verified on load, so no bounds or stack checks here
+    while (pc < rules->len) {
+        uint8_t op = rules->program[pc];
+        const uint8_t *arg = &rules->program[pc + 1];
+        op_shape_t shape;
+        op_shape(op, &shape);
+        pc += 1 + shape.operands;
+
+        int64_t a = 0;
+        int64_t b = 0;
+        if (shape.pops == 2) {
+            b = stack[--sp];
+            a = stack[--sp];
+        } else if (shape.pops == 1) {
+            a = stack[--sp];
+        }
+
+        int64_t v = 0;
+        switch (op) {
+        case RULE_OP_PUSH8:       v = (int8_t)arg[0]; break;
+        case RULE_OP_PUSH16:      v = (int16_t)wire_get_u16(arg); break;
+        case RULE_OP_PUSH32:      v = (int32_t)wire_get_u32(arg); break;
+        case RULE_OP_ZONE:        v = rules->zone; break;
+        case RULE_OP_POSITION:    v = in->position; break;
+        case RULE_OP_ZONE_MS:     v = (uint32_t)(in->now_ms - rules->zone_since_ms); break;
+        case RULE_OP_CALIB_MS:    v = in->calibrated ? (uint32_t)(in->now_ms - in->calibrated_ms) : INT32_MAX; break;
+        case RULE_OP_CALIBRATING: v = in->calibrating; break;
+        case RULE_OP_DELTA:       v = (int64_t)in->position - history_at(rules, arg[0]); break;
+        case RULE_OP_ADD:         v = a + b; break;
+        case RULE_OP_SUB:         v = a - b; break;
+        case RULE_OP_NEG:         v = -a; break;
+        case RULE_OP_ABS:         v = a < 0 ? -a : a; break;
+        case RULE_OP_EQ:          v = a == b; break;
+        case RULE_OP_NE:          v = a != b; break;
+        case RULE_OP_LT:          v = a < b; break;
+        case RULE_OP_LE:          v = a <= b; break;
+        case RULE_OP_GT:          v = a > b; break;
+        case RULE_OP_GE:          v = a >= b; break;
+        case RULE_OP_AND:         v = a && b; break;
+        case RULE_OP_OR:          v = a || b; break;
+        case RULE_OP_NOT:         v = !a; break;
+        case RULE_OP_HELD:        v = held(rules, arg[0], wire_get_u16(&arg[1]), a != 0, in->now_ms); break;
+        case RULE_OP_ALERT:
+            if (a && !rules->matched[rule]) {
+                fired++;
+                if (alert_cb) {
+                    alert_cb(rule, arg[0], ctx);
+                }
+            }
+            rules->matched[rule] = a != 0;
+            rule++;
+            continue;
+        default:
+            break;
+        }
+        stack[sp++] = saturate(v);
+    }
+    return fired;
+}
@@ -0,0 +1,117 @@
+/*
+ *
+ * Rules engine: compound alert conditions as compact bytecode
+ *
+ * A rules program is compiled on the host (tools/rules_compile.py), written
+ * to the rules characteristic and checked by rules_verify() before it is
+ * installed. It is a rules_header frame followed by one expression per
+ * rule in postfix form, each ending in an alert opcode; the opcodes are the
+ * rule_op values in main/wire.json. There are no jumps, so evaluating a
+ * program touches every byte once and its stack depth is known up front.
+ *
+ * rules_evaluate() runs from the encoder loop for every step event, and once
+ * per loop pass for conditions that change with time alone. An alert fires
+ * when its condition becomes true and re-arms once it is false again. Held
+ * conditions ("YELLOW for 30 s") keep their start time in a timer slot, and
+ * position changes over a window are taken from a history of the position
+ * sampled every RULES_TICK_MS. Nothing is allocated: the program, its timers
+ * and the history live in rules_t.
+ *
+ * Plain C with no ESP-IDF dependency, so tools/rules_model.c can run
+ * programs against a recorded trace on a host.
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RULES_VERSION      1      // Bytecode version in the program header
+#define RULES_PROGRAM_MAX  244    // Bytes, one ATT write at a 247 byte MTU
+#define RULES_MAX          16     // Alert opcodes in one program
+#define RULES_TIMERS_MAX   16     // Timer slots for held opcodes
+#define RULES_STACK_MAX    8      // Evaluation stack depth
+#define RULES_TICK_MS      100    // Position history period, also the unit of held durations
+#define RULES_HISTORY_LEN  64     // History entries, so delta windows reach (RULES_HISTORY_LEN - 1) ticks
+
+/**
+ * @brief Inputs of one evaluation
+ */
+typedef struct {
+    uint32_t now_ms;             ///< Monotonic time, wraps
+    int32_t position;            ///< Position in detents
+    uint8_t zone;                ///< Zone as its frame code, WIRE_FRAME_ZONE_*
+    bool calibrating;            ///< Calibration mode active
+    bool calibrated;             ///< A zero point was set since boot
+    uint32_t calibrated_ms;      ///< Time of the last zero set, when calibrated
+} rules_input_t;
+
+/**
+ * @brief Called for each alert that fires
+ * @param rule Index of the rule in the program
+ * @param code Alert code given by the program
+ * @param ctx Context passed to rules_evaluate()
+ */
+typedef void (*rules_alert_cb_t)(uint8_t rule, uint8_t code, void *ctx);
+
+/**
+ * @brief Installed program and its evaluation state
+ */
+typedef struct {
+    uint8_t program[RULES_PROGRAM_MAX];
+    size_t len;                              ///< 0 while no program is installed
+    bool started;                            ///< Zone and history seeded by the first evaluation
+    bool matched[RULES_MAX];                 ///< Last result of each rule, alerts fire on its rising edge
+    bool timer_running[RULES_TIMERS_MAX];
+    uint32_t timer_start_ms[RULES_TIMERS_MAX];
+    uint8_t zone;
+    uint32_t zone_since_ms;
+    int32_t history[RULES_HISTORY_LEN];      ///< Position at each tick, newest at history_head
+    uint8_t history_head;
+    uint8_t history_fill;                    ///< Valid entries, up to RULES_HISTORY_LEN
+    uint32_t history_ms;                     ///< Time of the newest entry
+} rules_t;
+
+/**
+ * @brief Check a program without installing it
+ *
+ * Checks the header, every opcode and operand, the stack depth, the timer
+ * indices and that the code is a sequence of complete rules. An empty
+ * program is valid and clears the rules.
+ *
+ * @param program Program bytes
+ * @param len Program length
+ * @return true if the program can be installed
+ */
+bool rules_verify(const uint8_t *program, size_t len);
+
+/**
+ * @brief Install a program and reset the evaluation state
+ * @param rules Engine
+ * @param program Program bytes, copied
+ * @param len Program length, 0 clears the rules
+ * @return false, leaving the engine empty, if the program fails rules_verify()
+ */
+bool rules_load(rules_t *rules, const uint8_t *program, size_t len);
+
+/**
+ * @brief Evaluate every rule once
+ *
+ * Runs in time linear in the program length and uses a fixed stack.
+ *
+ * @param rules Engine
+ * @param in Current inputs
+ * @param alert_cb Called for each alert that fires
+ * @param ctx Passed to alert_cb
+ * @return Number of alerts that fired
+ */
+int rules_evaluate(rules_t *rules, const rules_input_t *in, rules_alert_cb_t alert_cb, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
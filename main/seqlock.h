@@ -0,0 +1,84 @@
+/*
+ *
+ * Sequence lock for publishing small records to readers that never block
+ *
+ * The writer bumps the sequence to odd, stores the record and bumps it back
+ * to even; a reader retries until it sees the same even sequence before and
+ * after copying. Readers take no lock and leave interrupts enabled, so any
+ * task on any core can read, and a reader is never waited on by the writer.
+ *
+ * Writers must be serialized by the caller (the backends publish from within
+ * their own critical section). Always inlined, so publishing from an IRAM
+ * handler never calls into flash. Kept free of ESP-IDF so it can be
+ * exercised on a host, see tools/seqlock_stress.c.
+ *
+ */
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SEQLOCK_MAX_WORDS  8    // Largest record, in 32-bit words
+
+typedef struct {
+    atomic_uint_least32_t seq;
+    atomic_uint_least32_t words[SEQLOCK_MAX_WORDS];
+} seqlock_t;
+
+/**
+ * @brief Publish a record
+ * @param lock Sequence lock
+ * @param data Record, a multiple of 4 bytes and at most SEQLOCK_MAX_WORDS words
+ * @param len Size of the record
+ */
+static inline __attribute__((always_inline)) void seqlock_write(seqlock_t *lock, const void *data, size_t len)
+{
+    uint32_t seq = atomic_load_explicit(&lock->seq, memory_order_relaxed);
+    atomic_store_explicit(&lock->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    for (size_t i = 0; i < len / 4; i++) {
+        uint32_t word;
+        memcpy(&word, (const uint8_t *)data + i * 4, sizeof(word));
+        atomic_store_explicit(&lock->words[i], word, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&lock->seq, seq + 2, memory_order_release);
+}
+
+/**
+ * @brief Copy out the last published record
+ * @param lock Sequence lock
+ * @param data Receives the record
+ * @param len Size of the record, as published
+ * @return Number of attempts that overlapped a write and were retried
+ */
+static inline __attribute__((always_inline)) uint32_t seqlock_read(seqlock_t *lock, void *data, size_t len)
+{
+    uint32_t retries = 0;
+
+    for (;;) {
+        uint32_t begin = atomic_load_explicit(&lock->seq, memory_order_acquire);
+        if (!(begin & 1)) {
+            for (size_t i = 0; i < len / 4; i++) {
+                uint32_t word = atomic_load_explicit(&lock->words[i], memory_order_relaxed);
+                memcpy((uint8_t *)data + i * 4, &word, sizeof(word));
+            }
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&lock->seq, memory_order_relaxed) == begin) {
+                return retries;
+            }
+        }
+        retries++;
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,99 @@
+/*
+ *
+ * Runtime statistics: event counters and fixed-bucket latency histograms
+ *
+ */
+#include <stdatomic.h>
+#include "esp_timer.h"
+#include "led.h"
+#include "stats.h"
+
+_Static_assert(sizeof(((wire_stats_t *)0)->loop_time_us) == STATS_HIST_BUCKETS * sizeof(uint32_t),
+               "histogram fields in main/wire.json must have STATS_HIST_BUCKETS buckets");
+
+// Upper bucket bounds in microseconds, the last bucket collects everything above
+static const uint32_t hist_bounds_us[STATS_HIST_MAX][STATS_HIST_BUCKETS - 1] = {
+    [STATS_HIST_NOTIFY_LATENCY] = WIRE_STATS_NOTIFY_LATENCY_US_BOUNDS,
+    [STATS_HIST_LOOP_TIME] = WIRE_STATS_LOOP_TIME_US_BOUNDS,
+    [STATS_HIST_ENCRYPT_LATENCY] = WIRE_STATS_ENCRYPT_LATENCY_US_BOUNDS,
+};
+
+static atomic_uint_least32_t counters[STATS_COUNTER_MAX];
+static atomic_uint_least32_t disconnect_reasons[STATS_DISCONNECT_MAX];
+static atomic_uint_least32_t histograms[STATS_HIST_MAX][STATS_HIST_BUCKETS];
+
+void stats_inc(stats_counter_t counter)
+{
+    if (counter < STATS_COUNTER_MAX) {
+        atomic_fetch_add_explicit(&counters[counter], 1, memory_order_relaxed);
+    }
+}
+
+void stats_set(stats_counter_t counter, uint32_t value)
+{
+    if (counter < STATS_COUNTER_MAX) {
+        atomic_store_explicit(&counters[counter], value, memory_order_relaxed);
+    }
+}
+
+void stats_record_disconnect(uint8_t reason)
+{
+    stats_disconnect_t bucket;
+    switch (reason) {
+        case 0x08: bucket = STATS_DISCONNECT_TIMEOUT; break;
+        case 0x13: bucket = STATS_DISCONNECT_REMOTE; break;
+        case 0x16: bucket = STATS_DISCONNECT_LOCAL; break;
+        case 0x3E: bucket = STATS_DISCONNECT_FAILED; break;
+        default:   bucket = STATS_DISCONNECT_OTHER; break;
+    }
+    stats_inc(STATS_DISCONNECTS);
+    atomic_fetch_add_explicit(&disconnect_reasons[bucket], 1, memory_order_relaxed);
+}
+
+void stats_record(stats_hist_t hist, uint32_t value_us)
+{
+    if (hist >= STATS_HIST_MAX) {
+        return;
+    }
+
+    int bucket = 0;
+    while (bucket < STATS_HIST_BUCKETS - 1 && value_us > hist_bounds_us[hist][bucket]) {
+        bucket++;
+    }
+    atomic_fetch_add_explicit(&histograms[hist][bucket], 1, memory_order_relaxed);
+}
+
+size_t stats_serialize(uint8_t *buf, size_t len)
+{
+    if (!buf || len < STATS_BLOB_LEN) {
+        return 0;
+    }
+
+    atomic_store_explicit(&counters[STATS_LED_WRITES], led_get_write_count(), memory_order_relaxed);
+
+    wire_stats_t frame = {
+        .version = WIRE_STATS_VERSION,
+        .counter_count = STATS_COUNTER_MAX,
+        .disconnect_count = STATS_DISCONNECT_MAX,
+        .bucket_count = STATS_HIST_BUCKETS,
+        .uptime_s = (uint32_t)(esp_timer_get_time() / 1000000),
+    };
+    for (int i = 0; i < STATS_COUNTER_MAX; i++) {
+        frame.counters[i] = atomic_load_explicit(&counters[i], memory_order_relaxed);
+    }
+    for (int i = 0; i < STATS_DISCONNECT_MAX; i++) {
+        frame.disconnect_reasons[i] = atomic_load_explicit(&disconnect_reasons[i], memory_order_relaxed);
+    }
+    uint32_t *buckets[STATS_HIST_MAX] = {
+        [STATS_HIST_NOTIFY_LATENCY] = frame.notify_latency_us,
+        [STATS_HIST_LOOP_TIME] = frame.loop_time_us,
+        [STATS_HIST_ENCRYPT_LATENCY] = frame.encrypt_latency_us,
+    };
+    for (int h = 0; h < STATS_HIST_MAX; h++) {
+        for (int i = 0; i < STATS_HIST_BUCKETS; i++) {
+            buckets[h][i] = atomic_load_explicit(&histograms[h][i], memory_order_relaxed);
+        }
+    }
+
+    return wire_pack_stats(buf, &frame);
+}
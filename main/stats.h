@@ -0,0 +1,68 @@
+/*
+ *
+ * Runtime statistics: event counters and fixed-bucket latency histograms
+ *
+ * All updates are relaxed atomic increments, so they are safe from any task
+ * and cheap enough for the hot paths. The whole block is exported as one
+ * stats frame (main/wire.json) for the statistics characteristic; the
+ * counter and disconnect reason enums are generated from the same schema.
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "wire.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STATS_HIST_BUCKETS   8
+
+typedef enum {
+    STATS_HIST_NOTIFY_LATENCY,       ///< Encoder event to zone notification, microseconds
+    STATS_HIST_LOOP_TIME,            ///< Main loop body, microseconds
+    STATS_HIST_ENCRYPT_LATENCY,      ///< Connection to encrypted link, microseconds
+    STATS_HIST_MAX
+} stats_hist_t;
+
+#define STATS_BLOB_LEN  WIRE_STATS_LEN
+
+/**
+ * @brief Increment a counter
+ * @param counter Counter to increment
+ */
+void stats_inc(stats_counter_t counter);
+
+/**
+ * @brief Overwrite a counter with a value sampled from another module
+ * @param counter Counter to set
+ * @param value New value
+ */
+void stats_set(stats_counter_t counter, uint32_t value);
+
+/**
+ * @brief Count a disconnect and bucket its HCI reason code
+ * @param reason HCI disconnect reason
+ */
+void stats_record_disconnect(uint8_t reason);
+
+/**
+ * @brief Add a sample to a histogram
+ * @param hist Histogram to update
+ * @param value_us Sample in microseconds
+ */
+void stats_record(stats_hist_t hist, uint32_t value_us);
+
+/**
+ * @brief Serialize all statistics as a stats frame
+ * @param buf Output buffer
+ * @param len Size of buf, at least STATS_BLOB_LEN
+ * @return Number of bytes written, 0 if buf is too small
+ */
+size_t stats_serialize(uint8_t *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
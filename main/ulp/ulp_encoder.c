@@ -0,0 +1,36 @@
+/*
+ *
+ * Coprocessor program: samples the encoder A/B pins while the main core is
+ * in deep sleep and wakes it when the position leaves the current zone
+ *
+ * Started by the LP / RTC timer every CONFIG_ENCODER_ULP_SAMPLE_PERIOD_US,
+ * takes one sample and halts until the next period.
+ *
+ */
+#include <stdint.h>
+#include "sdkconfig.h"
+#if CONFIG_ULP_COPROC_TYPE_LP_CORE
+#include "ulp_lp_core_utils.h"
+#include "ulp_lp_core_gpio.h"
+#define read_pin(pin)  ulp_lp_core_gpio_get_level(pin)
+#define wake_main()    ulp_lp_core_wakeup_main_processor()
+#else
+#include "ulp_riscv_utils.h"
+#include "ulp_riscv_gpio.h"
+#define read_pin(pin)  ulp_riscv_gpio_get_level(pin)
+#define wake_main()    ulp_riscv_wakeup_main_processor()
+#endif
+#include "ulp_encoder_shared.h"
+
+// Reached from the main core as ulp_encoder_state, see deep_sleep.c
+ulp_encoder_shared_t encoder_state;
+
+int main(void)
+{
+    uint8_t ab = (read_pin(encoder_state.pin_a) << 1) | read_pin(encoder_state.pin_b);
+
+    if (ulp_encoder_sample(&encoder_state, ab)) {
+        wake_main();
+    }
+    return 0;
+}
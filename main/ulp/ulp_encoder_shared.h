@@ -0,0 +1,64 @@
+/*
+ *
+ * State shared between the coprocessor encoder program and the main core
+ *
+ * The sampling step is plain C with no hardware access: the ULP / LP core
+ * program (ulp_encoder.c) runs it on every timer wakeup, and
+ * tools/ulp_model.c replays A/B traces through it on a host. Both cores are
+ * 32-bit little-endian, so the struct has the same layout on either side.
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../quadrature.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Coprocessor state, lives in RTC / LP memory across deep sleep
+ */
+typedef struct {
+    quadrature_t decoder;   ///< Decoder state, carried across coprocessor wakeups
+    int32_t position;       ///< Encoder position, seeded by the main core before it sleeps
+    int32_t wake_min;       ///< Wake the main core once the position drops below this
+    int32_t wake_max;       ///< Wake the main core once the position rises above this
+    uint32_t pin_a;         ///< RTC / LP IO sampled for A
+    uint32_t pin_b;         ///< RTC / LP IO sampled for B
+    uint32_t flip;          ///< Reverse the step direction, as encoder_flip_direction()
+    uint32_t samples;       ///< Samples taken since the main core went to sleep
+    uint32_t woke;          ///< Set once the main core has been woken
+} ulp_encoder_shared_t;
+
+/**
+ * @brief Decode one A/B sample and check the zone thresholds
+ * @param s Shared state
+ * @param ab Sampled A/B state, A in bit 1 and B in bit 0
+ * @return true if the main core should be woken now
+ */
+static inline bool ulp_encoder_sample(ulp_encoder_shared_t *s, uint8_t ab)
+{
+    // No timer on the coprocessor, glitch counting stays off
+    int step = quadrature_update(&s->decoder, ab, 0);
+    if (s->flip) {
+        step = -step;
+    }
+    s->position += step;
+    s->samples++;
+
+    if (!step || s->woke) {
+        return false;
+    }
+    if (s->position < s->wake_min || s->position > s->wake_max) {
+        s->woke = 1;
+        return true;
+    }
+    return false;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,673 @@
+/*
+ *
+ * Wire protocol, generated by tools/wire_gen.py from main/wire.json, do not edit
+ *
+ * Frames on the zone characteristic, the statistics, rules and zone
+ * statistics characteristics, the OTA control characteristic and the L2CAP
+ * stream channel. Multi-byte fields are little-endian. Regenerate
+ * main/wire.h and wire.py with tools/wire_gen.py after any change.
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline void wire_put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static inline void wire_put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static inline uint16_t wire_get_u16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t wire_get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// First byte of every zone characteristic notification and stream channel SDU
+typedef enum {
+    WIRE_FRAME_ZONE_RED = 0x01,           ///< Position entered the red zone, strap loose
+    WIRE_FRAME_ZONE_GREEN = 0x02,         ///< Position entered the green zone, strap tight
+    WIRE_FRAME_ZONE_YELLOW = 0x03,        ///< Position entered the yellow zone
+    WIRE_FRAME_ZERO_SET = 0x04,           ///< Zero point set by the button in calibration mode
+    WIRE_FRAME_SIGNAL_DEGRADED = 0x05,    ///< Encoder signal quality crossed a limit
+    WIRE_FRAME_SIGNAL_RECOVERED = 0x06,   ///< Encoder signal back within the limits
+    WIRE_FRAME_CAPTURE_SAMPLES = 0x20,    ///< Batch of capture samples, stream channel only
+    WIRE_FRAME_RULE_ALERT = 0x30,         ///< A rule of the loaded rules program matched
+    WIRE_FRAME_BENCH = 0x7F,              ///< Throughput benchmark request and packets
+} wire_frame_t;
+
+// Messages on the OTA control characteristic
+typedef enum {
+    OTA_CMD_BEGIN = 0x01,   ///< Start a transfer, replied with its status
+    OTA_CMD_END = 0x02,     ///< Verify and switch to the new image, replied with its status
+    OTA_CMD_ABORT = 0x03,   ///< Discard the transfer, also the reply to a transfer that failed
+    OTA_MSG_ACK = 0x10,     ///< Bytes written to flash so far
+} ota_message_t;
+
+// Status in an OTA reply
+typedef enum {
+    OTA_STATUS_OK = 0x00,
+    OTA_STATUS_BUSY = 0x01,            ///< BEGIN while a transfer is running
+    OTA_STATUS_INVALID = 0x02,         ///< Malformed message or no transfer running
+    OTA_STATUS_FLASH_ERROR = 0x03,     ///< Partition could not be opened, written or selected
+    OTA_STATUS_SIZE_MISMATCH = 0x04,   ///< More or fewer bytes than announced
+    OTA_STATUS_HASH_MISMATCH = 0x05,   ///< SHA-256 of the received image differs
+    OTA_STATUS_OVERFLOW = 0x06,        ///< Sender exceeded the window
+    OTA_STATUS_ABORTED = 0x07,         ///< Aborted by the sender or a disconnect
+} ota_status_t;
+
+// Rules program opcodes, operands follow the opcode little-endian
+typedef enum {
+    RULE_OP_PUSH8 = 0x01,         ///< Push an i8 operand
+    RULE_OP_PUSH16 = 0x02,        ///< Push an i16 operand
+    RULE_OP_PUSH32 = 0x03,        ///< Push an i32 operand
+    RULE_OP_ZONE = 0x10,          ///< Push the zone as its frame code
+    RULE_OP_POSITION = 0x11,      ///< Push the position in detents
+    RULE_OP_ZONE_MS = 0x12,       ///< Push the time in the current zone in ms
+    RULE_OP_CALIB_MS = 0x13,      ///< Push the time since the last zero set in ms, INT32_MAX before one
+    RULE_OP_CALIBRATING = 0x14,   ///< Push 1 in calibration mode, else 0
+    RULE_OP_DELTA = 0x15,         ///< Push the position change over a u8 operand of history ticks
+    RULE_OP_ADD = 0x20,
+    RULE_OP_SUB = 0x21,
+    RULE_OP_NEG = 0x22,
+    RULE_OP_ABS = 0x23,
+    RULE_OP_EQ = 0x30,
+    RULE_OP_NE = 0x31,
+    RULE_OP_LT = 0x32,
+    RULE_OP_LE = 0x33,
+    RULE_OP_GT = 0x34,
+    RULE_OP_GE = 0x35,
+    RULE_OP_AND = 0x38,
+    RULE_OP_OR = 0x39,
+    RULE_OP_NOT = 0x3A,
+    RULE_OP_HELD = 0x40,          ///< Pop a condition, push 1 once it held for a u16 operand of ticks, u8 timer index first
+    RULE_OP_ALERT = 0x50,         ///< Pop a condition and end the rule, alert with a u8 operand code when it becomes true
+} rule_op_t;
+
+// Where a benchmark sends its packets
+typedef enum {
+    WIRE_BENCH_TRANSPORT_GATT = 0x00,    ///< Notifications on the zone characteristic
+    WIRE_BENCH_TRANSPORT_L2CAP = 0x01,   ///< SDUs on the L2CAP stream channel
+} wire_bench_transport_t;
+
+// Counters in the statistics frame
+typedef enum {
+    STATS_ENCODER_EVENTS = 0x00,           ///< Events received from the encoder queue
+    STATS_QUEUE_OVERFLOWS = 0x01,          ///< Events that skipped positions, i.e. steps lost to a full queue
+    STATS_ZONE_TRANSITIONS = 0x02,         ///< Zone changes seen by the zone logic
+    STATS_NOTIFY_SENT = 0x03,              ///< Notifications accepted by the stack
+    STATS_NOTIFY_FAILED = 0x04,            ///< Notifications rejected by the stack
+    STATS_NOTIFY_SUPPRESSED = 0x05,        ///< Notifications dropped because no client was subscribed
+    STATS_GATT_READS = 0x06,               ///< Read requests handled by the application
+    STATS_GATT_WRITES = 0x07,              ///< Write requests handled by the application
+    STATS_CONNECTIONS = 0x08,              ///< Centrals connected
+    STATS_DISCONNECTS = 0x09,              ///< Centrals disconnected, see disconnect reasons
+    STATS_LED_WRITES = 0x0A,               ///< LEDC duty writes, sampled from the LED module
+    STATS_RECOVERIES = 0x0B,               ///< In-place subsystem restarts by the health monitor
+    STATS_SIGNAL_ILLEGAL = 0x0C,           ///< Illegal A/B transitions, sampled from the encoder driver
+    STATS_SIGNAL_GLITCHES = 0x0D,          ///< A/B pulses shorter than the glitch width, sampled from the encoder driver
+    STATS_SIGNAL_REVERSALS = 0x0E,         ///< Step direction reversals, sampled from the encoder driver
+    STATS_SIGNAL_DEGRADED = 0x0F,          ///< 1 while the encoder signal is flagged as degraded
+    STATS_ENCODER_ISR_RAW = 0x10,          ///< Encoder interrupts taken, after any hardware glitch filter
+    STATS_ENCODER_ISR_ACCEPTED = 0x11,     ///< Step events queued through the minimum edge interval gate
+    STATS_AUTH_COMPLETE = 0x12,            ///< Links encrypted, by pairing or from stored bond keys
+    STATS_AUTH_FAILED = 0x13,              ///< Pairing or re-encryption failures
+    STATS_BLE_HEAP_BYTES = 0x14,           ///< Heap taken by bringing up the BT controller and host stack
+    STATS_BOOT_TO_ADV_MS = 0x15,           ///< Time from boot to the first advertisement, milliseconds
+    STATS_BENCH_BYTES_PER_S = 0x16,        ///< Notification payload throughput of the last benchmark run
+    STATS_PHY = 0x17,                      ///< Transmit PHY of the link: 1 = 1M, 2 = 2M, 3 = Coded, 0 when disconnected
+    STATS_PHY_UPDATES = 0x18,              ///< PHY changes reported by the controller
+    STATS_RSSI = 0x19,                     ///< Averaged connection RSSI in dBm, two's complement, 0 when disconnected
+    STATS_TX_POWER_DBM = 0x1A,             ///< Connection TX power in dBm, two's complement
+    STATS_TX_POWER_STEPS_DOWN = 0x1B,      ///< TX power reductions made by the power control loop
+    STATS_TX_POWER_STEPS_UP = 0x1C,        ///< TX power increases made by the power control loop
+    STATS_ENCODER_RESOLUTION = 0x1D,       ///< Steps per detent cycle: 1, 2 or 4
+    STATS_ENCODER_ISR_MAX_CYCLES = 0x1E,   ///< Most CPU cycles one edge took to decode, since the last resolution change
+    STATS_ENCODER_MAX_EDGE_RATE = 0x1F,    ///< Edges per second the decode path sustains at that cost, before interrupt overhead
+    STATS_CAPTURE_FRAMES = 0x20,           ///< Capture frames sent on the L2CAP stream channel
+    STATS_CAPTURE_DROPPED = 0x21,          ///< Capture frames dropped while the central had no credits
+    STATS_RULE_ALERTS = 0x22,              ///< Alerts fired by the rules program
+    STATS_COUNTER_MAX
+} stats_counter_t;
+
+// Disconnect reason buckets in the statistics frame, by HCI reason code
+typedef enum {
+    STATS_DISCONNECT_TIMEOUT = 0x00,   ///< 0x08 supervision timeout
+    STATS_DISCONNECT_REMOTE = 0x01,    ///< 0x13 remote user terminated
+    STATS_DISCONNECT_LOCAL = 0x02,     ///< 0x16 terminated by local host
+    STATS_DISCONNECT_FAILED = 0x03,    ///< 0x3E failed to be established
+    STATS_DISCONNECT_OTHER = 0x04,     ///< Any other reason
+    STATS_DISCONNECT_MAX
+} stats_disconnect_t;
+
+// bench_request: Written to the zone characteristic to start a benchmark
+#define WIRE_BENCH_REQUEST_LEN  5
+#define WIRE_BENCH_REQUEST_MIN_LEN  3   // Optional fields left out
+
+typedef struct {
+    uint16_t count;       ///< Packets to send
+    uint8_t phy;          ///< HCI PHY code to run on, 0 for the streaming PHY
+    uint8_t transport;    ///< See bench_transport
+} wire_bench_request_t;
+
+/**
+ * @brief Pack one bench_request frame
+ * @param buf Receives WIRE_BENCH_REQUEST_LEN bytes
+ * @param v Fields
+ * @return WIRE_BENCH_REQUEST_LEN
+ */
+static inline size_t wire_pack_bench_request(uint8_t *buf, const wire_bench_request_t *v)
+{
+    buf[0] = WIRE_FRAME_BENCH;
+    wire_put_u16(&buf[1], v->count);
+    buf[3] = v->phy;
+    buf[4] = v->transport;
+    return WIRE_BENCH_REQUEST_LEN;
+}
+
+/**
+ * @brief Unpack one bench_request frame; optional fields left out read as 0
+ * @param buf Received bytes
+ * @param len Received length
+ * @param v Receives the fields
+ * @return true if buf holds a bench_request frame
+ */
+static inline bool wire_unpack_bench_request(const uint8_t *buf, size_t len, wire_bench_request_t *v)
+{
+    if (len < WIRE_BENCH_REQUEST_MIN_LEN || len > WIRE_BENCH_REQUEST_LEN || buf[0] != WIRE_FRAME_BENCH) {
+        return false;
+    }
+    memset(v, 0, sizeof(*v));
+    v->count = wire_get_u16(&buf[1]);
+    if (len >= 4) {
+        v->phy = buf[3];
+    }
+    if (len >= 5) {
+        v->transport = buf[4];
+    }
+    return true;
+}
+
+// bench_packet: One benchmark packet, padding to the payload size of the link follows
+#define WIRE_BENCH_PACKET_LEN  3
+
+typedef struct {
+    uint16_t sequence;    ///< Packet number from 0
+} wire_bench_packet_t;
+
+/**
+ * @brief Pack one bench_packet frame, the caller appends what follows
+ * @param buf Receives WIRE_BENCH_PACKET_LEN bytes
+ * @param v Fields
+ * @return WIRE_BENCH_PACKET_LEN
+ */
+static inline size_t wire_pack_bench_packet(uint8_t *buf, const wire_bench_packet_t *v)
+{
+    buf[0] = WIRE_FRAME_BENCH;
+    wire_put_u16(&buf[1], v->sequence);
+    return WIRE_BENCH_PACKET_LEN;
+}
+
+/**
+ * @brief Unpack one bench_packet frame
+ * @param buf Received bytes
+ * @param len Received length
+ * @param v Receives the fields
+ * @return true if buf holds a bench_packet frame
+ */
+static inline bool wire_unpack_bench_packet(const uint8_t *buf, size_t len, wire_bench_packet_t *v)
+{
+    if (len < WIRE_BENCH_PACKET_LEN || buf[0] != WIRE_FRAME_BENCH) {
+        return false;
+    }
+    v->sequence = wire_get_u16(&buf[1]);
+    return true;
+}
+
+// capture_header: Start of a capture frame, followed by count capture_sample records
+#define WIRE_CAPTURE_HEADER_LEN  8
+
+typedef struct {
+    uint8_t count;            ///< Samples in the frame
+    uint16_t sequence;        ///< Frame number, wraps; a gap means frames were dropped
+    uint32_t timestamp_hz;    ///< Rate of the sample timestamps
+} wire_capture_header_t;
+
+/**
+ * @brief Pack one capture_header frame, the caller appends what follows
+ * @param buf Receives WIRE_CAPTURE_HEADER_LEN bytes
+ * @param v Fields
+ * @return WIRE_CAPTURE_HEADER_LEN
+ */
+static inline size_t wire_pack_capture_header(uint8_t *buf, const wire_capture_header_t *v)
+{
+    buf[0] = WIRE_FRAME_CAPTURE_SAMPLES;
+    buf[1] = v->count;
+    wire_put_u16(&buf[2], v->sequence);
+    wire_put_u32(&buf[4], v->timestamp_hz);
+    return WIRE_CAPTURE_HEADER_LEN;
+}
+
+/**
+ * @brief Unpack one capture_header frame
+ * @param buf Received bytes
+ * @param len Received length
+ * @param v Receives the fields
+ * @return true if buf holds a capture_header frame
+ */
+static inline bool wire_unpack_capture_header(const uint8_t *buf, size_t len, wire_capture_header_t *v)
+{
+    if (len < WIRE_CAPTURE_HEADER_LEN || buf[0] != WIRE_FRAME_CAPTURE_SAMPLES) {
+        return false;
+    }
+    v->count = buf[1];
+    v->sequence = wire_get_u16(&buf[2]);
+    v->timestamp_hz = wire_get_u32(&buf[4]);
+    return true;
+}
+
+// capture_sample: One encoder step in a capture frame
+#define WIRE_CAPTURE_SAMPLE_LEN  12
+
+typedef struct {
+    uint32_t timestamp;    ///< Time of the step
+    int32_t position;      ///< Position after the step
+    uint32_t interval;     ///< Time since the previous step
+} wire_capture_sample_t;
+
+/**
+ * @brief Pack one capture_sample frame
+ * @param buf Receives WIRE_CAPTURE_SAMPLE_LEN bytes
+ * @param v Fields
+ * @return WIRE_CAPTURE_SAMPLE_LEN
+ */
+static inline size_t wire_pack_capture_sample(uint8_t *buf, const wire_capture_sample_t *v)
+{
+    wire_put_u32(&buf[0], v->timestamp);
+    wire_put_u32(&buf[4], (uint32_t)v->position);
+    wire_put_u32(&buf[8], v->interval);
+    return WIRE_CAPTURE_SAMPLE_LEN;
+}
+
+/**
+ * @brief Unpack one capture_sample frame
+ * @param buf Received bytes
+ * @param len Received length
+ * @param v Receives the fields
+ * @return true if buf holds a capture_sample frame
+ */
+static inline bool wire_unpack_capture_sample(const uint8_t *buf, size_t len, wire_capture_sample_t *v)
+{
+    if (len < WIRE_CAPTURE_SAMPLE_LEN) {
+        return false;
+    }
+    v->timestamp = wire_get_u32(&buf[0]);
+    v->position = (int32_t)wire_get_u32(&buf[4]);
+    v->interval = wire_get_u32(&buf[8]);
+    return true;
+}
+
+// rules_header: Start of a rules program written to the rules characteristic, followed by the code
+#define WIRE_RULES_HEADER_LEN  3
+
+typedef struct {
+    uint8_t version;    ///< Bytecode version, see RULES_VERSION
+    uint8_t rules;      ///< Number of alert opcodes in the code
+    uint8_t timers;     ///< Timer slots used by held opcodes
+} wire_rules_header_t;
+
+/**
+ * @brief Pack one rules_header frame, the caller appends what follows
+ * @param buf Receives WIRE_RULES_HEADER_LEN bytes
+ * @param v Fields
+ * @return WIRE_RULES_HEADER_LEN
+ */
+static inline size_t wire_pack_rules_header(uint8_t *buf, const wire_rules_header_t *v)
+{
+    buf[0] = v->version;
+    buf[1] = v->rules;
+    buf[2] = v->timers;
+    return WIRE_RULES_HEADER_LEN;
+}
+
+/**
+ * @brief Unpack one rules_header frame
+ * @param buf Received bytes
+ * @param len Received length
+ * @param v Receives the fields
+ * @return true if buf holds a rules_header frame
+ */
+static inline bool wire_unpack_rules_header(const uint8_t *buf, size_t len, wire_rules_header_t *v)
+{
+    if (len < WIRE_RULES_HEADER_LEN) {
+        return false;
+    }
+    v->version = buf[0];
+    v->rules = buf[1];
+    v->timers = buf[2];
+    return true;
+}
+
+// rule_alert: Notified on the zone characteristic when a rule matches
+#define WIRE_RULE_ALERT_LEN  3
+
+typedef struct {
+    uint8_t rule;    ///< Index of the rule in the program
+    uint8_t code;    ///< Alert code given by the program
+} wire_rule_alert_t;
+
+/**
+ * @brief Pack one rule_alert frame
+ * @param buf Receives WIRE_RULE_ALERT_LEN bytes
+ * @param v Fields
+ * @return WIRE_RULE_ALERT_LEN
+ */
+static inline size_t wire_pack_rule_alert(uint8_t *buf, const wire_rule_alert_t *v)
+{
+    buf[0] = WIRE_FRAME_RULE_ALERT;
+    buf[1] = v->rule;
+    buf[2] = v->code;
+    return WIRE_RULE_ALERT_LEN;
+}
+
+/**
+ * @brief Unpack one rule_alert frame
+ * @param buf Received bytes
+ * @param len Received length
+ * @param v Receives the fields
+ * @return true if buf holds a rule_alert frame
+ */
+static inline bool wire_unpack_rule_alert(const uint8_t *buf, size_t len, wire_rule_alert_t *v)
+{
+    if (len < WIRE_RULE_ALERT_LEN || len > WIRE_RULE_ALERT_LEN || buf[0] != WIRE_FRAME_RULE_ALERT) {
+        return false;
+    }
+    v->rule = buf[1];
+    v->code = buf[2];
+    return true;
+}
+
+// zone_stats: Read from the zone statistics characteristic, totals since power-on or the last clear
+#define WIRE_ZONE_STATS_LEN  37
+
+typedef struct {
+    uint32_t covered_s;         ///< Seconds the totals cover, deep sleep included
+    uint32_t red_dwell_s;       ///< Seconds spent in the red zone
+    uint32_t green_dwell_s;     ///< Seconds spent in the green zone
+    uint32_t yellow_dwell_s;    ///< Seconds spent in the yellow zone
+    uint32_t red_entries;       ///< Transitions into the red zone
+    uint32_t green_entries;     ///< Transitions into the green zone
+    uint32_t yellow_entries;    ///< Transitions into the yellow zone
+    int32_t min_position;       ///< Lowest position in detents
+    int32_t max_position;       ///< Highest position in detents
+    uint8_t zone;               ///< Current zone as its frame code, 0 before the first update
+} wire_zone_stats_t;
+
+/**
+ * @brief Pack one zone_stats frame
+ * @param buf Receives WIRE_ZONE_STATS_LEN bytes
+ * @param v Fields
+ * @return WIRE_ZONE_STATS_LEN
+ */
+static inline size_t wire_pack_zone_stats(uint8_t *buf, const wire_zone_stats_t *v)
+{
+    wire_put_u32(&buf[0], v->covered_s);
+    wire_put_u32(&buf[4], v->red_dwell_s);
+    wire_put_u32(&buf[8], v->green_dwell_s);
+    wire_put_u32(&buf[12], v->yellow_dwell_s);
+    wire_put_u32(&buf[16], v->red_entries);
+    wire_put_u32(&buf[20], v->green_entries);
+    wire_put_u32(&buf[24], v->yellow_entries);
+    wire_put_u32(&buf[28], (uint32_t)v->min_position);
+    wire_put_u32(&buf[32], (uint32_t)v->max_position);
+    buf[36] = v->zone;
+    return WIRE_ZONE_STATS_LEN;
+}
+
+/**
+ * @brief Unpack one zone_stats frame
+ * @param buf Received bytes
+ * @param len Received length
+ * @param v Receives the fields
+ * @return true if buf holds a zone_stats frame
+ */
+static inline bool wire_unpack_zone_stats(const uint8_t *buf, size_t len, wire_zone_stats_t *v)
+{
+    if (len < WIRE_ZONE_STATS_LEN || len > WIRE_ZONE_STATS_LEN) {
+        return false;
+    }
+    v->covered_s = wire_get_u32(&buf[0]);
+    v->red_dwell_s = wire_get_u32(&buf[4]);
+    v->green_dwell_s = wire_get_u32(&buf[8]);
+    v->yellow_dwell_s = wire_get_u32(&buf[12]);
+    v->red_entries = wire_get_u32(&buf[16]);
+    v->green_entries = wire_get_u32(&buf[20]);
+    v->yellow_entries = wire_get_u32(&buf[24]);
+    v->min_position = (int32_t)wire_get_u32(&buf[28]);
+    v->max_position = (int32_t)wire_get_u32(&buf[32]);
+    v->zone = buf[36];
+    return true;
+}
+
+// ota_begin: Written to the OTA control characteristic to start a transfer
+#define WIRE_OTA_BEGIN_LEN  37
+
+typedef struct {
+    uint32_t size;         ///< Image size in bytes
+    uint8_t sha256[32];    ///< SHA-256 of the image
+} wire_ota_begin_t;
+
+/**
+ * @brief Pack one ota_begin frame
+ * @param buf Receives WIRE_OTA_BEGIN_LEN bytes
+ * @param v Fields
+ * @return WIRE_OTA_BEGIN_LEN
+ */
+static inline size_t wire_pack_ota_begin(uint8_t *buf, const wire_ota_begin_t *v)
+{
+    buf[0] = OTA_CMD_BEGIN;
+    wire_put_u32(&buf[1], v->size);
+    memcpy(&buf[5], v->sha256, 32);
+    return WIRE_OTA_BEGIN_LEN;
+}
+
+/**
+ * @brief Unpack one ota_begin frame
+ * @param buf Received bytes
+ * @param len Received length
+ * @param v Receives the fields
+ * @return true if buf holds a ota_begin frame
+ */
+static inline bool wire_unpack_ota_begin(const uint8_t *buf, size_t len, wire_ota_begin_t *v)
+{
+    if (len < WIRE_OTA_BEGIN_LEN || len > WIRE_OTA_BEGIN_LEN || buf[0] != OTA_CMD_BEGIN) {
+        return false;
+    }
+    v->size = wire_get_u32(&buf[1]);
+    memcpy(v->sha256, &buf[5], 32);
+    return true;
+}
+
+// ota_reply: Notified on the OTA control characteristic in answer to a command
+#define WIRE_OTA_REPLY_LEN  2
+
+typedef struct {
+    uint8_t message;    ///< Command answered, see ota_message
+    uint8_t status;     ///< See ota_status
+} wire_ota_reply_t;
+
+/**
+ * @brief Pack one ota_reply frame
+ * @param buf Receives WIRE_OTA_REPLY_LEN bytes
+ * @param v Fields
+ * @return WIRE_OTA_REPLY_LEN
+ */
+static inline size_t wire_pack_ota_reply(uint8_t *buf, const wire_ota_reply_t *v)
+{
+    buf[0] = v->message;
+    buf[1] = v->status;
+    return WIRE_OTA_REPLY_LEN;
+}
+
+/**
+ * @brief Unpack one ota_reply frame
+ * @param buf Received bytes
+ * @param len Received length
+ * @param v Receives the fields
+ * @return true if buf holds a ota_reply frame
+ */
+static inline bool wire_unpack_ota_reply(const uint8_t *buf, size_t len, wire_ota_reply_t *v)
+{
+    if (len < WIRE_OTA_REPLY_LEN || len > WIRE_OTA_REPLY_LEN) {
+        return false;
+    }
+    v->message = buf[0];
+    v->status = buf[1];
+    return true;
+}
+
+// ota_ack: Notified on the OTA control characteristic as image data reaches flash
+#define WIRE_OTA_ACK_LEN  5
+
+typedef struct {
+    uint32_t written;    ///< Bytes written so far
+} wire_ota_ack_t;
+
+/**
+ * @brief Pack one ota_ack frame
+ * @param buf Receives WIRE_OTA_ACK_LEN bytes
+ * @param v Fields
+ * @return WIRE_OTA_ACK_LEN
+ */
+static inline size_t wire_pack_ota_ack(uint8_t *buf, const wire_ota_ack_t *v)
+{
+    buf[0] = OTA_MSG_ACK;
+    wire_put_u32(&buf[1], v->written);
+    return WIRE_OTA_ACK_LEN;
+}
+
+/**
+ * @brief Unpack one ota_ack frame
+ * @param buf Received bytes
+ * @param len Received length
+ * @param v Receives the fields
+ * @return true if buf holds a ota_ack frame
+ */
+static inline bool wire_unpack_ota_ack(const uint8_t *buf, size_t len, wire_ota_ack_t *v)
+{
+    if (len < WIRE_OTA_ACK_LEN || len > WIRE_OTA_ACK_LEN || buf[0] != OTA_MSG_ACK) {
+        return false;
+    }
+    v->written = wire_get_u32(&buf[1]);
+    return true;
+}
+
+// stats: Read from the statistics characteristic. Counters are totals since boot unless their doc says they are sampled; histogram buckets count samples up to each bound, the last one everything above
+#define WIRE_STATS_LEN  264
+#define WIRE_STATS_VERSION  2
+#define WIRE_STATS_NOTIFY_LATENCY_US_BOUNDS  { 1000, 2000, 5000, 10000, 20000, 50000, 100000 }
+#define WIRE_STATS_LOOP_TIME_US_BOUNDS  { 50, 100, 250, 500, 1000, 2500, 5000 }
+#define WIRE_STATS_ENCRYPT_LATENCY_US_BOUNDS  { 20000, 50000, 100000, 200000, 500000, 1000000, 2000000 }
+
+typedef struct {
+    uint8_t version;                                      ///< Layout version, WIRE_STATS_VERSION; it changes with any field
+    uint8_t counter_count;                                ///< Number of counters, STATS_COUNTER_MAX
+    uint8_t disconnect_count;                             ///< Number of disconnect reason buckets, STATS_DISCONNECT_MAX
+    uint8_t bucket_count;                                 ///< Buckets per histogram
+    uint32_t uptime_s;                                    ///< Seconds since boot
+    uint32_t counters[STATS_COUNTER_MAX];                 ///< In stats_counter order
+    uint32_t disconnect_reasons[STATS_DISCONNECT_MAX];    ///< In stats_disconnect order
+    uint32_t notify_latency_us[8];                        ///< Encoder event to zone notification
+    uint32_t loop_time_us[8];                             ///< Encoder loop body
+    uint32_t encrypt_latency_us[8];                       ///< Connection to encrypted link
+} wire_stats_t;
+
+/**
+ * @brief Pack one stats frame
+ * @param buf Receives WIRE_STATS_LEN bytes
+ * @param v Fields
+ * @return WIRE_STATS_LEN
+ */
+static inline size_t wire_pack_stats(uint8_t *buf, const wire_stats_t *v)
+{
+    buf[0] = v->version;
+    buf[1] = v->counter_count;
+    buf[2] = v->disconnect_count;
+    buf[3] = v->bucket_count;
+    wire_put_u32(&buf[4], v->uptime_s);
+    for (size_t i = 0; i < STATS_COUNTER_MAX; i++) {
+        wire_put_u32(&buf[8 + 4 * i], v->counters[i]);
+    }
+    for (size_t i = 0; i < STATS_DISCONNECT_MAX; i++) {
+        wire_put_u32(&buf[148 + 4 * i], v->disconnect_reasons[i]);
+    }
+    for (size_t i = 0; i < 8; i++) {
+        wire_put_u32(&buf[168 + 4 * i], v->notify_latency_us[i]);
+    }
+    for (size_t i = 0; i < 8; i++) {
+        wire_put_u32(&buf[200 + 4 * i], v->loop_time_us[i]);
+    }
+    for (size_t i = 0; i < 8; i++) {
+        wire_put_u32(&buf[232 + 4 * i], v->encrypt_latency_us[i]);
+    }
+    return WIRE_STATS_LEN;
+}
+
+/**
+ * @brief Unpack one stats frame
+ * @param buf Received bytes
+ * @param len Received length
+ * @param v Receives the fields
+ * @return true if buf holds a stats frame
+ */
+static inline bool wire_unpack_stats(const uint8_t *buf, size_t len, wire_stats_t *v)
+{
+    if (len < WIRE_STATS_LEN || len > WIRE_STATS_LEN) {
+        return false;
+    }
+    v->version = buf[0];
+    v->counter_count = buf[1];
+    v->disconnect_count = buf[2];
+    v->bucket_count = buf[3];
+    v->uptime_s = wire_get_u32(&buf[4]);
+    for (size_t i = 0; i < STATS_COUNTER_MAX; i++) {
+        v->counters[i] = wire_get_u32(&buf[8 + 4 * i]);
+    }
+    for (size_t i = 0; i < STATS_DISCONNECT_MAX; i++) {
+        v->disconnect_reasons[i] = wire_get_u32(&buf[148 + 4 * i]);
+    }
+    for (size_t i = 0; i < 8; i++) {
+        v->notify_latency_us[i] = wire_get_u32(&buf[168 + 4 * i]);
+    }
+    for (size_t i = 0; i < 8; i++) {
+        v->loop_time_us[i] = wire_get_u32(&buf[200 + 4 * i]);
+    }
+    for (size_t i = 0; i < 8; i++) {
+        v->encrypt_latency_us[i] = wire_get_u32(&buf[232 + 4 * i]);
+    }
+    return true;
+}
+
+#ifdef __cplusplus
+}
+#endif
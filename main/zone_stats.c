@@ -0,0 +1,121 @@
+/*
+ *
+ * Zone statistics: dwell time, transitions and position range per zone
+ *
+ */
+#include <inttypes.h>
+#include <string.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "wire.h"
+#include "zone_stats.h"
+
+#define TAG "ZONE_STATS"
+
+#define ZONE_STATS_RTC_MAGIC  0x5A535431      // "ZST1", change with the layout of zone_stats_rtc_t
+#define ZONE_COUNT            3               // Zones are the frame codes 1 to 3
+
+_Static_assert(WIRE_FRAME_ZONE_RED == 1 && WIRE_FRAME_ZONE_GREEN == 2 && WIRE_FRAME_ZONE_YELLOW == 3,
+               "Zone frame codes index the totals");
+
+typedef struct {
+    uint32_t magic;
+    uint8_t zone;                   // 0 until the first update after a clear
+    int64_t last_us;                // System time of the last update
+    uint64_t covered_us;
+    uint64_t dwell_us[ZONE_COUNT];
+    uint32_t entries[ZONE_COUNT];
+    int32_t min_position;
+    int32_t max_position;
+} zone_stats_rtc_t;
+
+// Survives deep sleep and software, watchdog and panic resets but not power loss
+static RTC_NOINIT_ATTR zone_stats_rtc_t totals;
+static portMUX_TYPE totals_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int64_t system_time_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void zone_stats_init(void)
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+    if (totals.magic == ZONE_STATS_RTC_MAGIC && reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT) {
+        ESP_LOGI(TAG, "Kept totals over %" PRIu32 " s across reset reason %d",
+                 (uint32_t)(totals.covered_us / 1000000), reason);
+        return;
+    }
+    zone_stats_clear();
+}
+
+void zone_stats_update(uint8_t zone, int32_t position)
+{
+    if (zone < 1 || zone > ZONE_COUNT) {
+        return;
+    }
+    int64_t now = system_time_us();
+
+    portENTER_CRITICAL(&totals_lock);
+    if (!totals.zone) {
+        totals.zone = zone;
+        totals.min_position = position;
+        totals.max_position = position;
+    } else {
+        // A clock that went back across a reset credits nothing and is picked up from here
+        if (now > totals.last_us) {
+            totals.covered_us += now - totals.last_us;
+            totals.dwell_us[totals.zone - 1] += now - totals.last_us;
+        }
+        if (zone != totals.zone) {
+            totals.zone = zone;
+            totals.entries[zone - 1]++;
+        }
+        if (position < totals.min_position) {
+            totals.min_position = position;
+        }
+        if (position > totals.max_position) {
+            totals.max_position = position;
+        }
+    }
+    totals.last_us = now;
+    portEXIT_CRITICAL(&totals_lock);
+}
+
+void zone_stats_clear(void)
+{
+    portENTER_CRITICAL(&totals_lock);
+    memset(&totals, 0, sizeof(totals));
+    totals.magic = ZONE_STATS_RTC_MAGIC;
+    portEXIT_CRITICAL(&totals_lock);
+}
+
+size_t zone_stats_serialize(uint8_t *buf, size_t len)
+{
+    if (!buf || len < WIRE_ZONE_STATS_LEN) {
+        return 0;
+    }
+
+    portENTER_CRITICAL(&totals_lock);
+    zone_stats_rtc_t snapshot = totals;
+    portEXIT_CRITICAL(&totals_lock);
+
+    const wire_zone_stats_t frame = {
+        .covered_s = (uint32_t)(snapshot.covered_us / 1000000),
+        .red_dwell_s = (uint32_t)(snapshot.dwell_us[WIRE_FRAME_ZONE_RED - 1] / 1000000),
+        .green_dwell_s = (uint32_t)(snapshot.dwell_us[WIRE_FRAME_ZONE_GREEN - 1] / 1000000),
+        .yellow_dwell_s = (uint32_t)(snapshot.dwell_us[WIRE_FRAME_ZONE_YELLOW - 1] / 1000000),
+        .red_entries = snapshot.entries[WIRE_FRAME_ZONE_RED - 1],
+        .green_entries = snapshot.entries[WIRE_FRAME_ZONE_GREEN - 1],
+        .yellow_entries = snapshot.entries[WIRE_FRAME_ZONE_YELLOW - 1],
+        .min_position = snapshot.min_position,
+        .max_position = snapshot.max_position,
+        .zone = snapshot.zone,
+    };
+    return wire_pack_zone_stats(buf, &frame);
+}
@@ -0,0 +1,55 @@
+/*
+ *
+ * Zone statistics: dwell time, transitions and position range per zone
+ *
+ * The encoder loop reports the zone and position every iteration, and the
+ * totals are updated incrementally: the time since the last update goes to
+ * the zone the position was in, a change of zone counts as an entry into
+ * the new one, and the position widens the min/max range. A central reads
+ * them as one zone_stats frame (main/wire.json), so a gateway can connect
+ * on a schedule instead of counting zone notifications all day.
+ *
+ * The totals live in RTC memory and survive deep sleep, software, watchdog
+ * and panic resets; power loss or a brownout clears them. Time comes from
+ * the system clock, which keeps running in deep sleep, so time asleep is
+ * credited to the zone the device slept in; the coprocessor wakes it when
+ * the position leaves that zone.
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Keep or clear the totals depending on the reset reason, call once at boot
+ */
+void zone_stats_init(void);
+
+/**
+ * @brief Account for the time since the last update and record the current zone and position
+ * @param zone Zone as its frame code, WIRE_FRAME_ZONE_*
+ * @param position Position in detents
+ */
+void zone_stats_update(uint8_t zone, int32_t position);
+
+/**
+ * @brief Clear the totals; the next update starts them again
+ */
+void zone_stats_clear(void);
+
+/**
+ * @brief Pack the totals as one consistent zone_stats frame
+ * @param buf Output buffer
+ * @param len Size of buf, at least WIRE_ZONE_STATS_LEN
+ * @return Bytes written, or 0 if buf is too small
+ */
+size_t zone_stats_serialize(uint8_t *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
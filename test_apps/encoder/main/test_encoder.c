@@ -0,0 +1,272 @@
+/*
+ *
+ * On-target tests of the GPIO interrupt encoder driver
+ *
+ * The A/B pins are switched to input and output, so the driver's interrupt
+ * sees the levels the test sets. A general purpose timer interrupt, which
+ * like the encoder ISR stays enabled while the flash cache is off, steps
+ * them through the quadrature sequence at a fixed edge rate. Meanwhile a
+ * task writes and commits NVS in a loop, so many edges arrive while flash
+ * is being written. Every edge has to raise an interrupt and be decoded.
+ *
+ * With the edge interval gate on, a burst of steps has to end with an event
+ * at the final position, or the health monitor's stall check (main/health.c,
+ * fed here the way the encoder loop feeds it) would restart the driver.
+ *
+ * Nothing else may drive TEST_PIN_A and TEST_PIN_B while the test runs;
+ * disconnect the encoder or pick two free pins.
+ *
+ */
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "driver/gptimer.h"
+#include "esp_attr.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "unity.h"
+#include "encoder.h"
+#include "health.h"
+#include "stats.h"
+
+#define TEST_PIN_A          GPIO_NUM_8      // ROT_ENC_A_GPIO in main/app_main.c
+#define TEST_PIN_B          GPIO_NUM_9      // ROT_ENC_B_GPIO
+#define EDGE_PERIOD_US      50              // 20000 edges/s, far beyond a hand-turned encoder
+#define EDGE_COUNT          40000           // Two seconds of edges
+#define HAMMER_BLOB_LEN     1024
+#define HAMMER_TASK_STACK   4096
+#define GATE_US             5000            // Gate interval, 100 edges at the test rate
+#define BURST_EDGES         37              // Ends inside the gate, so the last steps are held back
+#define LOOP_PERIOD_MS      10              // TASK_DELAY_MS in main/app_main.c
+#define IDLE_MS             1500            // Well past the 500 ms stall limit
+
+// Gray sequence, forward in quadrature_table; read by the generator while the cache is off
+static const uint8_t DRAM_ATTR gray[4] = {0, 1, 3, 2};
+
+static encoder_info_t encoder;
+static gptimer_handle_t edge_timer;
+static volatile uint32_t edges_left;
+static volatile int edge_dir;
+static uint8_t gray_index;
+
+static volatile bool hammering;
+static volatile bool hammer_done;
+static volatile uint32_t commits;
+static esp_err_t hammer_err;
+static uint8_t blob[HAMMER_BLOB_LEN];
+
+// health.c counts recoveries in the statistics, which are not part of this test
+void stats_inc(stats_counter_t counter)
+{
+    (void)counter;
+}
+
+static bool IRAM_ATTR edge_timer_cb(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *arg)
+{
+    if (!edges_left) {
+        return false;
+    }
+    // One pin changes per step, setting the other to its current level raises no edge
+    gray_index = (gray_index + edge_dir) & 3;
+    gpio_set_level(TEST_PIN_A, gray[gray_index] >> 1);
+    gpio_set_level(TEST_PIN_B, gray[gray_index] & 1);
+    edges_left--;
+    return false;
+}
+
+/**
+ * @brief Write and commit a blob until told to stop; failures end the loop and are left in hammer_err
+ */
+static void hammer_task(void *arg)
+{
+    nvs_handle_t handle;
+    hammer_err = nvs_open("enc_test", NVS_READWRITE, &handle);
+    while (hammer_err == ESP_OK && hammering) {
+        // New content every time, NVS skips writing an unchanged blob
+        memset(blob, (uint8_t)commits, sizeof(blob));
+        hammer_err = nvs_set_blob(handle, "hammer", blob, sizeof(blob));
+        if (hammer_err == ESP_OK) {
+            hammer_err = nvs_commit(handle);
+        }
+        commits++;
+        // Let the idle task feed the watchdog
+        vTaskDelay(1);
+    }
+    if (hammer_err == ESP_OK) {
+        nvs_erase_key(handle, "hammer");
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+    hammer_done = true;
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Generate edges and wait until the last one has been decoded
+ * @param count Edges to generate
+ * @param dir 1 forward, -1 backward
+ */
+static void run_edges(uint32_t count, int dir)
+{
+    edge_dir = dir;
+    edges_left = count;
+    while (edges_left) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    vTaskDelay(pdMS_TO_TICKS(10));
+}
+
+static void setup_encoder(void)
+{
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        TEST_ASSERT_EQUAL(ESP_OK, nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, ret);
+
+    // Drive both pins high before they become outputs, the driver then takes 11 as the detent
+    TEST_ASSERT_EQUAL(ESP_OK, gpio_install_isr_service(ESP_INTR_FLAG_IRAM));
+    TEST_ASSERT_EQUAL(ESP_OK, encoder_init(&encoder, TEST_PIN_A, TEST_PIN_B));
+    TEST_ASSERT_EQUAL(ESP_OK, gpio_set_level(TEST_PIN_A, 1));
+    TEST_ASSERT_EQUAL(ESP_OK, gpio_set_level(TEST_PIN_B, 1));
+    TEST_ASSERT_EQUAL(ESP_OK, gpio_set_direction(TEST_PIN_A, GPIO_MODE_INPUT_OUTPUT));
+    TEST_ASSERT_EQUAL(ESP_OK, gpio_set_direction(TEST_PIN_B, GPIO_MODE_INPUT_OUTPUT));
+    gray_index = 2;
+    // A step per edge, so the position counts edges one for one
+    TEST_ASSERT_EQUAL(ESP_OK, encoder_set_resolution(&encoder, QUADRATURE_X4));
+    TEST_ASSERT_EQUAL(ESP_OK, encoder_reset(&encoder));
+
+    const gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000000,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, gptimer_new_timer(&timer_config, &edge_timer));
+    const gptimer_event_callbacks_t cbs = {
+        .on_alarm = edge_timer_cb,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, gptimer_register_event_callbacks(edge_timer, &cbs, NULL));
+    const gptimer_alarm_config_t alarm_config = {
+        .alarm_count = EDGE_PERIOD_US,
+        .reload_count = 0,
+        .flags.auto_reload_on_alarm = true,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, gptimer_set_alarm_action(edge_timer, &alarm_config));
+    TEST_ASSERT_EQUAL(ESP_OK, gptimer_enable(edge_timer));
+    TEST_ASSERT_EQUAL(ESP_OK, gptimer_start(edge_timer));
+}
+
+static void teardown_encoder(void)
+{
+    gptimer_stop(edge_timer);
+    gptimer_disable(edge_timer);
+    gptimer_del_timer(edge_timer);
+    encoder_uninit(&encoder);
+    gpio_reset_pin(TEST_PIN_A);
+    gpio_reset_pin(TEST_PIN_B);
+    gpio_uninstall_isr_service();
+    nvs_flash_deinit();
+}
+
+static void expect_counts(uint32_t edges, encoder_position_t position)
+{
+    uint32_t raw = 0;
+    uint32_t accepted = 0;
+    encoder_state_t state;
+    TEST_ASSERT_EQUAL(ESP_OK, encoder_get_isr_counts(&encoder, &raw, &accepted));
+    TEST_ASSERT_EQUAL(ESP_OK, encoder_get_state(&encoder, &state));
+    // An edge lost while the cache was off shows up as a missing interrupt and,
+    // once the next edge on the other pin arrives, as an illegal transition
+    TEST_ASSERT_EQUAL_UINT32(edges, raw);
+    TEST_ASSERT_EQUAL_UINT32(0, encoder.decoder.illegal);
+    TEST_ASSERT_EQUAL_INT32(position, state.position);
+}
+
+TEST_CASE("encoder decodes every edge at full rate", "[encoder]")
+{
+    setup_encoder();
+    run_edges(EDGE_COUNT, 1);
+    expect_counts(EDGE_COUNT, EDGE_COUNT);
+    run_edges(EDGE_COUNT, -1);
+    expect_counts(2 * EDGE_COUNT, 0);
+    teardown_encoder();
+}
+
+TEST_CASE("encoder decodes every edge while NVS is written", "[encoder][nvs]")
+{
+    setup_encoder();
+
+    commits = 0;
+    hammer_err = ESP_OK;
+    hammer_done = false;
+    hammering = true;
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(hammer_task, "nvs_hammer", HAMMER_TASK_STACK, NULL, 5, NULL));
+    // Writes have to be running before the edges start, and keep running in both directions
+    while (!commits && !hammer_done) {
+        vTaskDelay(1);
+    }
+    uint32_t commits_start = commits;
+    run_edges(EDGE_COUNT, 1);
+    uint32_t commits_forward = commits;
+    run_edges(EDGE_COUNT, -1);
+    uint32_t commits_total = commits;
+
+    hammering = false;
+    while (!hammer_done) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    printf("%" PRIu32 " NVS commits during %d edges\n", commits_total - commits_start, 2 * EDGE_COUNT);
+    TEST_ASSERT_EQUAL(ESP_OK, hammer_err);
+    TEST_ASSERT_GREATER_THAN_UINT32(commits_start, commits_forward);
+    TEST_ASSERT_GREATER_THAN_UINT32(commits_forward, commits_total);
+
+    expect_counts(2 * EDGE_COUNT, 0);
+    teardown_encoder();
+}
+
+TEST_CASE("encoder queues the last gated step after a burst", "[encoder][gate]")
+{
+    setup_encoder();
+    QueueHandle_t queue = xQueueCreate(1, sizeof(encoder_event_t));
+    TEST_ASSERT_NOT_NULL(queue);
+    TEST_ASSERT_EQUAL(ESP_OK, encoder_set_queue(&encoder, queue));
+    TEST_ASSERT_EQUAL(ESP_OK, encoder_set_min_edge_interval(&encoder, GATE_US));
+    health_note_encoder_event(0);
+
+    run_edges(BURST_EDGES, 1);
+
+    // The encoder loop: an event if there is one, otherwise a poll of the snapshot
+    encoder_event_t event = { 0 };
+    int32_t last_event = 0;
+    for (int ms = 0; ms < IDLE_MS; ms += LOOP_PERIOD_MS) {
+        if (xQueueReceive(queue, &event, 0) == pdTRUE) {
+            last_event = event.state.position;
+            health_note_encoder_event(last_event);
+        } else {
+            encoder_state_t state;
+            TEST_ASSERT_EQUAL(ESP_OK, encoder_get_state(&encoder, &state));
+            health_note_encoder_poll(state.position);
+        }
+        TEST_ASSERT_NOT_EQUAL(HEALTH_RECOVERY_EVENT_STALL, health_check());
+        vTaskDelay(pdMS_TO_TICKS(LOOP_PERIOD_MS));
+    }
+
+    uint32_t raw = 0;
+    uint32_t accepted = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, encoder_get_isr_counts(&encoder, &raw, &accepted));
+    // The first step went through, the rest of the burst only as the trailing event
+    TEST_ASSERT_EQUAL_UINT32(2, accepted);
+    TEST_ASSERT_EQUAL_INT32(BURST_EDGES, last_event);
+    expect_counts(BURST_EDGES, BURST_EDGES);
+
+    teardown_encoder();
+    vQueueDelete(queue);
+}
+
+void app_main(void)
+{
+    unity_run_menu();
+}
@@ -0,0 +1,54 @@
+#!/usr/bin/env python
+#
+# Absolute angle sensor check.
+#
+# Builds tools/abs_sensor_model.c and replays each case's samples through
+# the register reads and multi-turn unwrapping of main/abs_sensor.h. A
+# trace states the positions it has to produce ("expect position N",
+# "expect jumps N", "expect rejected", see tools/abs_sensor_model.c), so a
+# case fails if a turn is lost, a position rounds the wrong way or a
+# rejected sample moves the position.
+#
+#   $ python tools/abs_sensor_check.py
+#
+import sys
+
+from model_check import check
+
+# name, arguments (detents_per_turn [resolution]), samples with expectations
+CASES = [
+    ("unwraps forward over turns",
+     ["20"],
+     "0 90 180 270 360 expect position 20 450 540 630 720 810 expect position 45 expect jumps 0"),
+    ("unwraps backward across zero",
+     ["20"],
+     "0 -90 -180 -270 -360 expect position -20 -450 expect position -25"),
+    ("rounds to the nearest step",
+     ["20"],
+     "0 8.9 expect position 0 9.1 expect position 1 -8.9 expect position 0 -9.1 expect position -1"),
+    ("jitter around zero stays at zero",
+     ["20"],
+     "0 1 -1 2 -2 1 expect position 0"),
+    ("bus error keeps the position",
+     ["20"],
+     "0 90 e expect rejected expect position 5 180 expect position 10"),
+    ("missing magnet keeps the position",
+     ["20"],
+     "0 90 m expect rejected m expect position 5 180 expect position 10"),
+    ("first good sample is zero",
+     ["20"],
+     "e m 45 expect position 0 100 expect position 3"),
+    ("zero angle away from the magnet zero",
+     ["20"],
+     "350 10 expect position 1 330 expect position -1"),
+    ("move over a quarter turn is a jump",
+     ["20"],
+     "0 100 expect jumps 1 expect position 6"),
+    ("resolution scales the steps",
+     ["20", "4"],
+     "0 90 expect position 20 4.4 expect position 1"),
+]
+
+
+if __name__ == "__main__":
+    sys.exit(check("abs_sensor_model.c", CASES, libs=["-lm"]))
@@ -0,0 +1,166 @@
+/*
+ *
+ * Host model of the absolute angle sensor backend
+ *
+ * Runs the register reads and multi-turn unwrapping of main/abs_sensor.h
+ * against a simulated AS5600 register file and prints the positions the
+ * device would report. Each token on stdin is one sample: a shaft angle in
+ * degrees (any value, it wraps like the magnet does), "m" for a sample with
+ * the magnet missing, or "e" for a failed bus read. The first good sample
+ * is position zero.
+ *
+ * A trace can also state what it has to produce at that point, as
+ * "expect position N" for the position of the last accepted sample,
+ * "expect jumps N" or "expect rejected" for a rejected last sample. The run
+ * then fails if the state differs; tools/abs_sensor_check.py uses this.
+ *
+ *   $ cc -o abs_sensor_model tools/abs_sensor_model.c -lm
+ *   $ echo "0 90 180 270 360 450 e 540 m 500 350" | ./abs_sensor_model 20
+ *   $ echo "0 90 180 270 370 e expect rejected expect position 21" | ./abs_sensor_model 20
+ *
+ * Arguments: detents_per_turn [resolution]
+ * Exits 1 if an expectation fails.
+ *
+ */
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../main/abs_sensor.h"
+
+/**
+ * @brief Simulated sensor: the register file as the chip exposes it
+ */
+typedef struct {
+    uint8_t regs[256];
+    bool fail_next;
+} model_t;
+
+static int model_read(void *ctx, uint8_t reg, uint8_t *data, size_t len)
+{
+    model_t *m = (model_t *)ctx;
+    if (m->fail_next) {
+        m->fail_next = false;
+        return -1;
+    }
+    // The chip auto-increments the register address within a burst
+    for (size_t i = 0; i < len; i++) {
+        data[i] = m->regs[(uint8_t)(reg + i)];
+    }
+    return 0;
+}
+
+static void model_set_angle(model_t *m, double degrees)
+{
+    double turn = fmod(degrees / 360.0, 1.0);
+    if (turn < 0) {
+        turn += 1.0;
+    }
+    uint16_t raw = (uint16_t)(turn * ABS_SENSOR_COUNTS_PER_TURN) % ABS_SENSOR_COUNTS_PER_TURN;
+    m->regs[ABS_SENSOR_REG_STATUS] = ABS_SENSOR_STATUS_MD;
+    m->regs[ABS_SENSOR_REG_STATUS + 1] = raw >> 8;
+    m->regs[ABS_SENSOR_REG_STATUS + 2] = raw & 0xFF;
+}
+
+typedef struct {
+    int32_t position;           // Position of the last accepted sample
+    bool rejected;              // Last sample was rejected
+} state_t;
+
+/**
+ * @brief Check one "expect" statement against the state so far
+ * @param what Expected quantity: position, jumps or rejected
+ * @param value Expected value, unused for rejected
+ */
+static bool check_expect(const abs_sensor_t *sensor, const state_t *state, uint32_t samples,
+                         const char *what, int32_t value)
+{
+    if (strcmp(what, "position") == 0) {
+        if (state->position == value) {
+            return true;
+        }
+        printf("sample %" PRIu32 ": position %" PRId32 ", expected %" PRId32 "\n", samples, state->position, value);
+    } else if (strcmp(what, "jumps") == 0) {
+        if (sensor->jumps == (uint32_t)value) {
+            return true;
+        }
+        printf("sample %" PRIu32 ": %" PRIu32 " jumps, expected %" PRId32 "\n", samples, sensor->jumps, value);
+    } else if (strcmp(what, "rejected") == 0) {
+        if (state->rejected) {
+            return true;
+        }
+        printf("sample %" PRIu32 ": accepted, expected a rejection\n", samples);
+    } else {
+        printf("unknown expectation \"%s\"\n", what);
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s detents_per_turn [resolution] < samples\n", argv[0]);
+        return 2;
+    }
+    uint32_t steps_per_turn = atoi(argv[1]) * (argc > 2 ? atoi(argv[2]) : 1);
+    if (!steps_per_turn) {
+        fprintf(stderr, "detents_per_turn and resolution must be positive\n");
+        return 2;
+    }
+
+    model_t model = { 0 };
+    abs_sensor_t sensor;
+    abs_sensor_init(&sensor, model_read, &model);
+
+    bool zeroed = false;
+    int32_t zero_angle = 0;
+    uint32_t samples = 0;
+    state_t state = { 0 };
+    int failed = 0;
+    char token[32];
+
+    while (scanf("%31s", token) == 1) {
+        if (strcmp(token, "expect") == 0) {
+            char what[16];
+            int32_t value = 0;
+            if (scanf("%15s", what) != 1 || (strcmp(what, "rejected") != 0 && scanf("%" SCNd32, &value) != 1)) {
+                fprintf(stderr, "expect needs position N, jumps N or rejected\n");
+                return 2;
+            }
+            failed += !check_expect(&sensor, &state, samples, what, value);
+            continue;
+        }
+        samples++;
+        if (strcmp(token, "e") == 0) {
+            model.fail_next = true;
+        } else if (strcmp(token, "m") == 0) {
+            model.regs[ABS_SENSOR_REG_STATUS] = ABS_SENSOR_STATUS_ML;
+        } else {
+            model_set_angle(&model, atof(token));
+        }
+
+        int32_t angle;
+        abs_sensor_result_t result = abs_sensor_sample(&sensor, &angle);
+        state.rejected = result != ABS_SENSOR_OK;
+        if (result != ABS_SENSOR_OK) {
+            printf("sample %" PRIu32 ": rejected (%s)\n", samples, result == ABS_SENSOR_BUS_ERROR ? "bus error" : "no magnet");
+            continue;
+        }
+        if (!zeroed) {
+            zero_angle = angle;
+            zeroed = true;
+        }
+        state.position = abs_sensor_to_steps(angle - zero_angle, steps_per_turn);
+        printf("sample %" PRIu32 ": angle %" PRId32 ", turns %" PRId32 ", position %" PRId32 "\n",
+               samples, angle, sensor.turns, state.position);
+    }
+
+    printf("%" PRIu32 " samples, %" PRIu32 " bus errors, %" PRIu32 " magnet errors, %" PRIu32 " jumps\n",
+           samples, sensor.bus_errors, sensor.magnet_errors, sensor.jumps);
+    if (failed) {
+        printf("%d expectations failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
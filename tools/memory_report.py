@@ -0,0 +1,236 @@
+#!/usr/bin/env python
+#
+# Build-time memory report for the application component.
+#
+# Static RAM is taken from the linker map: every .data/.bss/.rtc input section
+# contributed by one of our object files is summed per source file. Stack depth
+# comes from the GCC call graph (-fcallgraph-info=su): the worst path from each
+# task entry point is walked through our own functions. Calls into ESP-IDF are
+# outside the graph and are listed so their stack can be added from the IDF docs.
+#
+# The BLE host stack (Bluedroid or NimBLE, whichever was built) and the
+# controller are reported per library with their flash and RAM, so two builds
+# can be compared side by side.
+#
+import argparse
+import collections
+import glob
+import os
+import re
+import sys
+
+# Functions that start a stack: task entry points and callbacks run on IDF tasks.
+# Only the entries of the BLE backend that was built are found.
+DEFAULT_ENTRIES = {
+    "encoder_loop_task": "encoder loop task",
+    "gatts_event_handler": "BT task (GATTS)",
+    "esp_gap_cb": "BT task (GAP)",
+    "gap_event_cb": "NimBLE host (GAP)",
+    "gatt_access_cb": "NimBLE host (GATT)",
+    "pattern_timer_cb": "esp_timer task",
+    "adv_mode_timer_cb": "esp_timer task (advertising)",
+    "ota_task": "OTA task",
+    "bench_task": "BLE benchmark task",
+    "sample_task": "absolute sensor task",
+    "poll_cb": "esp_timer task (PCNT)",
+    "capture_task": "capture task",
+    "capture_sample_cb": "esp_timer task (capture)",
+}
+
+# Host stack and controller libraries; NimBLE and Bluedroid both build into libbt
+DEFAULT_STACK_LIBS = ("bt", "btdm_app", "ble_app", "btbb")
+
+RAM_PREFIXES = {
+    "data": (".data", ".sdata", ".dram"),
+    "bss": (".bss", ".sbss", "COMMON"),
+    "rtc": (".rtc", ".rtc_noinit"),
+}
+
+FLASH_PREFIXES = {
+    "iram": (".iram", ".iram1"),
+    "code": (".text", ".literal", ".flash.text"),
+    "rodata": (".rodata", ".srodata", ".flash.rodata"),
+}
+
+MAP_ENTRY_RE = re.compile(r"^\s*(\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S+)$")
+OBJECT_RE = re.compile(r"lib(\w+)\.a\(([^)]+?)\.o(?:bj)?\)$")
+
+NODE_RE = re.compile(r'node: \{ title: "([^"]+)" label: "([^"]*)"')
+EDGE_RE = re.compile(r'edge: \{ sourcename: "([^"]+)" targetname: "([^"]+)"')
+STACK_RE = re.compile(r"\\n(\d+) bytes \(([^)]+)\)")
+
+
+def section_kind(name):
+    for kind, prefixes in RAM_PREFIXES.items():
+        if name.startswith(prefixes):
+            # RTC sections also start with .rtc.data/.rtc.bss, keep them together
+            return "rtc" if name.startswith(".rtc") else kind
+    return None
+
+
+def flash_kind(name):
+    for kind, prefixes in FLASH_PREFIXES.items():
+        if name.startswith(prefixes):
+            return kind
+    return None
+
+
+def map_entries(path):
+    """Yield (section, size, library, object) for every input section taken from a static library."""
+    pending = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.rstrip()
+            # Long section names are printed on their own line, values on the next
+            if re.match(r"^ \.\S+$", line):
+                pending = line.strip()
+                continue
+            m = MAP_ENTRY_RE.match(line)
+            if not m:
+                pending = None
+                continue
+            name = m.group(1) or pending
+            pending = None
+            obj = OBJECT_RE.search(m.group(4))
+            if name and obj:
+                yield name, int(m.group(3), 16), obj.group(1), obj.group(2)
+
+
+def parse_map(path, component):
+    """Sum RAM input sections per object file of one component."""
+    usage = collections.defaultdict(lambda: collections.Counter())
+    for name, size, lib, obj in map_entries(path):
+        kind = section_kind(name)
+        if lib == component and kind:
+            usage[obj][kind] += size
+    return usage
+
+
+def parse_libraries(path, libs):
+    """Sum RAM and flash input sections per library."""
+    usage = collections.defaultdict(lambda: collections.Counter())
+    for name, size, lib, obj in map_entries(path):
+        if lib not in libs:
+            continue
+        kind = section_kind(name) or flash_kind(name)
+        if kind:
+            usage[lib][kind] += size
+    return usage
+
+
+def parse_callgraph(directory):
+    """Load every .ci file under directory into (stack, edges, source) maps keyed by function title."""
+    stack = {}
+    edges = collections.defaultdict(set)
+    qualifier = {}
+    for path in glob.glob(os.path.join(directory, "**", "*.ci"), recursive=True):
+        with open(path) as f:
+            text = f.read()
+        for title, label in NODE_RE.findall(text):
+            m = STACK_RE.search(label)
+            if m:
+                stack[title] = (int(m.group(1)), m.group(2))
+        for src, dst in EDGE_RE.findall(text):
+            edges[src].add(dst)
+    # Static functions are titled "file:name", calls to them use the same title
+    for title in stack:
+        qualifier.setdefault(title.rsplit(":", 1)[-1], title)
+    return stack, edges, qualifier
+
+
+def worst_path(title, stack, edges, memo, active):
+    """Return (bytes, path, external calls, flags) of the deepest call chain from title."""
+    if title in memo:
+        return memo[title]
+    if title not in stack:
+        return 0, [], {title}, set()
+    if title in active:
+        return 0, [], set(), {"recursion"}
+
+    active.add(title)
+    own, kind = stack[title]
+    best = (0, [], set(), set())
+    externals = set()
+    flags = set() if kind == "static" else {kind}
+    for callee in edges.get(title, ()):
+        depth, path, ext, fl = worst_path(callee, stack, edges, memo, active)
+        externals |= ext
+        flags |= fl
+        if depth > best[0] or not best[1]:
+            best = (depth, path, ext, fl)
+    active.discard(title)
+
+    result = (own + best[0], [title.rsplit(":", 1)[-1]] + best[1], externals, flags)
+    memo[title] = result
+    return result
+
+
+def print_footprint(label, usage):
+    # IRAM code is loaded from flash and occupies RAM, so it counts for both
+    flash = usage["code"] + usage["rodata"] + usage["iram"] + usage["data"]
+    ram = usage["iram"] + usage["data"] + usage["bss"] + usage["rtc"]
+    print(f"  {label:<16}{usage['code']:>8}{usage['rodata']:>8}{usage['iram']:>8}"
+          f"{usage['data']:>8}{usage['bss']:>8}{flash:>8}{ram:>8}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--map", required=True, help="linker map file")
+    parser.add_argument("--objects", required=True, help="component build directory holding .ci files")
+    parser.add_argument("--component", default="main", help="component library name")
+    parser.add_argument("--stack-lib", action="append", metavar="LIB",
+                        help="BLE stack library without lib/.a, may be repeated (default: %s)" % ", ".join(DEFAULT_STACK_LIBS))
+    parser.add_argument("--entry", action="append", metavar="FUNC[=LABEL]",
+                        help="stack entry point, may be repeated (default: firmware tasks)")
+    args = parser.parse_args()
+
+    entries = DEFAULT_ENTRIES
+    if args.entry:
+        entries = dict(e.split("=", 1) if "=" in e else (e, e) for e in args.entry)
+
+    print("Static RAM by subsystem (bytes)")
+    print(f"  {'object':<24}{'data':>8}{'bss':>8}{'rtc':>8}{'total':>8}")
+    totals = collections.Counter()
+    if os.path.exists(args.map):
+        for obj, usage in sorted(parse_map(args.map, args.component).items()):
+            total = sum(usage.values())
+            totals.update(usage)
+            print(f"  {obj:<24}{usage['data']:>8}{usage['bss']:>8}{usage['rtc']:>8}{total:>8}")
+        print(f"  {'total':<24}{totals['data']:>8}{totals['bss']:>8}{totals['rtc']:>8}{sum(totals.values()):>8}")
+    else:
+        print(f"  map file {args.map} not found")
+
+    if os.path.exists(args.map):
+        print()
+        print("BLE stack footprint by library (bytes)")
+        print(f"  {'library':<16}{'code':>8}{'rodata':>8}{'iram':>8}{'data':>8}{'bss':>8}{'flash':>8}{'ram':>8}")
+        stack_totals = collections.Counter()
+        for lib, usage in sorted(parse_libraries(args.map, set(args.stack_lib or DEFAULT_STACK_LIBS)).items()):
+            stack_totals.update(usage)
+            print_footprint(f"lib{lib}.a", usage)
+        print_footprint("total", stack_totals)
+
+    print()
+    print("Worst-case stack depth in application code (bytes)")
+    stack, edges, qualifier = parse_callgraph(args.objects)
+    if not stack:
+        print("  no call graph found, build with -fcallgraph-info=su")
+        return 0
+
+    memo = {}
+    for func, label in entries.items():
+        title = qualifier.get(func)
+        if not title:
+            print(f"  {label:<24}{'-':>8}  ({func} not found)")
+            continue
+        depth, path, externals, flags = worst_path(title, stack, edges, memo, set())
+        note = f" [{', '.join(sorted(flags))}]" if flags else ""
+        print(f"  {label:<24}{depth:>8}  {' -> '.join(path)}{note}")
+        if externals:
+            print(f"  {'':<24}{'':>8}  + IDF calls: {', '.join(sorted(externals)[:8])}"
+                  f"{' ...' if len(externals) > 8 else ''}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,64 @@
+#
+# Runner shared by the host model checks (ulp_check.py, abs_sensor_check.py,
+# rules_check.py).
+#
+# A check builds one tools/*_model.c and runs each of its cases against it.
+# The expectations are part of the case input and the model compares them
+# itself, so a case passes when the model exits 0. Prints one line per case,
+# with the model's output under a failing one, and the check exits 1 if any
+# case fails. Set CC to pick the compiler, default cc.
+#
+import os
+import subprocess
+import tempfile
+
+TOOLS = os.path.dirname(os.path.abspath(__file__))
+
+
+class Model:
+    """A built model and a scratch directory for its input files."""
+
+    def __init__(self, path, tmp):
+        self.path = path
+        self.tmp = tmp
+
+    def run(self, args, stdin):
+        """Run the model with stdin, one input per line; return the exit status and output."""
+        stdin = "\n".join(line.strip() for line in stdin.strip().splitlines()) + "\n"
+        result = subprocess.run([self.path] + list(args), input=stdin, capture_output=True, text=True)
+        return result.returncode, result.stdout + result.stderr
+
+    def file(self, name, data):
+        """Write an input file for the model, return its path."""
+        path = os.path.join(self.tmp, name)
+        with open(path, "wb") as f:
+            f.write(data)
+        return path
+
+
+def check(source, cases, libs=()):
+    """Build tools/<source> and run the cases against it, return the exit status for the check.
+
+    A case is (name, args, stdin), which passes if the model exits 0, or (name, run) where run(model)
+    returns (ok, output) for a case that needs more than one plain run.
+    """
+    failures = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, os.path.splitext(source)[0])
+        cc = os.environ.get("CC", "cc")
+        subprocess.run([cc, "-o", path, os.path.join(TOOLS, source)] + list(libs), check=True)
+        model = Model(path, tmp)
+
+        for name, *case in cases:
+            if len(case) == 1:
+                ok, output = case[0](model)
+            else:
+                status, output = model.run(*case)
+                ok = status == 0
+            print(f"{name:44s} {'ok' if ok else 'FAIL'}")
+            if not ok:
+                print(output, end="")
+                failures += 1
+
+    print(f"{failures} failed")
+    return 1 if failures else 0
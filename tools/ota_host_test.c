@@ -0,0 +1,255 @@
+/*
+ *
+ * Host test of the OTA transfer checks
+ *
+ * Runs main/ota_image.c against a file-backed partition: the begin hook
+ * erases the file to 0xFF, writes land at the current offset, end selects
+ * it and abort discards it. A simulated sender streams an image in ATT
+ * sized chunks, either keeping to the window or ignoring it, and a
+ * simulated OTA task drains the buffered bytes to flash in the chunk size
+ * ota.c uses. Each case checks the status and what ended up in the
+ * partition.
+ *
+ *   $ cc -Itools/host -o ota_host_test tools/ota_host_test.c -lcrypto
+ *   $ ./ota_host_test
+ *
+ * Exits 1 if any case fails.
+ *
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/sha.h>
+#include "../main/ota_image.c"
+
+#define PARTITION_SIZE  (64 * 1024)
+#define ATT_CHUNK       244     // Data write at a 247 byte MTU
+#define FLASH_CHUNK     1024    // OTA_CHUNK_SIZE in ota.c
+
+typedef struct {
+    FILE *file;
+    uint32_t offset;
+    bool open;
+    bool selected;
+    bool aborted;
+    int begins;
+    long fail_write_at;         // Offset whose write fails, -1 for none
+} partition_t;
+
+static int part_begin(void *ctx, uint32_t size)
+{
+    partition_t *p = ctx;
+    p->begins++;
+    if (p->open) {
+        return -1;
+    }
+    rewind(p->file);
+    for (uint32_t i = 0; i < size; i++) {
+        fputc(0xFF, p->file);
+    }
+    p->offset = 0;
+    p->open = true;
+    return 0;
+}
+
+static int part_write(void *ctx, const uint8_t *data, size_t len)
+{
+    partition_t *p = ctx;
+    if (!p->open || (p->fail_write_at >= 0 && p->offset + len > (size_t)p->fail_write_at)) {
+        return -1;
+    }
+    fseek(p->file, p->offset, SEEK_SET);
+    if (fwrite(data, 1, len, p->file) != len) {
+        return -1;
+    }
+    p->offset += len;
+    return 0;
+}
+
+static int part_end(void *ctx)
+{
+    partition_t *p = ctx;
+    if (!p->open) {
+        return -1;
+    }
+    p->open = false;
+    p->selected = true;
+    return 0;
+}
+
+static void part_abort(void *ctx)
+{
+    partition_t *p = ctx;
+    p->open = false;
+    p->aborted = true;
+}
+
+/**
+ * @brief Check that the partition holds exactly the image
+ */
+static bool part_holds(partition_t *p, const uint8_t *image, uint32_t len)
+{
+    static uint8_t readback[PARTITION_SIZE];
+    fflush(p->file);
+    fseek(p->file, 0, SEEK_SET);
+    return p->offset == len && fread(readback, 1, len, p->file) == len && memcmp(readback, image, len) == 0;
+}
+
+typedef struct {
+    uint32_t announced;         // Size in BEGIN
+    uint32_t sent;              // Bytes actually streamed
+    bool corrupt;               // Flip a byte in flight
+    bool ignore_window;         // Send without waiting for acknowledgements
+} transfer_t;
+
+static uint8_t buffered[OTA_WINDOW_BYTES];
+static size_t buffered_len;
+
+/**
+ * @brief Write buffered bytes to flash the way the OTA task drains its stream buffer
+ * @param sender_acked Updated with the acknowledgements the sender would receive
+ */
+static ota_status_t drain(ota_image_t *img, uint32_t *sender_acked)
+{
+    size_t pos = 0;
+    while (pos < buffered_len) {
+        size_t n = buffered_len - pos < FLASH_CHUNK ? buffered_len - pos : FLASH_CHUNK;
+        ota_status_t status = ota_image_write(img, &buffered[pos], n);
+        if (status != OTA_STATUS_OK) {
+            return status;
+        }
+        pos += n;
+        uint32_t written;
+        if (ota_image_take_ack(img, &written)) {
+            *sender_acked = written;
+        }
+    }
+    buffered_len = 0;
+    return OTA_STATUS_OK;
+}
+
+/**
+ * @brief Run one transfer through begin, the data path and end
+ * @return Status of the first step that failed, or of the end
+ */
+static ota_status_t run(ota_image_t *img, const uint8_t *image, const transfer_t *t)
+{
+    uint8_t hash[OTA_HASH_LEN];
+    SHA256(image, t->sent < t->announced ? t->sent : t->announced, hash);
+    ota_status_t status = ota_image_begin(img, t->announced, hash, PARTITION_SIZE);
+    if (status != OTA_STATUS_OK) {
+        return status;
+    }
+
+    buffered_len = 0;
+    uint32_t sent = 0;
+    uint32_t acked = 0;
+    while (sent < t->sent) {
+        uint32_t n = t->sent - sent < ATT_CHUNK ? t->sent - sent : ATT_CHUNK;
+        if (!t->ignore_window && sent + n - acked > OTA_WINDOW_BYTES) {
+            // The sender waits for an acknowledgement, the OTA task catches up meanwhile
+            status = drain(img, &acked);
+            if (status != OTA_STATUS_OK) {
+                return status;
+            }
+            continue;
+        }
+        if (!ota_image_receive(img, n)) {
+            ota_image_fail(img);
+            return OTA_STATUS_OVERFLOW;
+        }
+        if (buffered_len + n > sizeof(buffered)) {
+            // The window has to keep the sender within the buffer, ota.c relies on it
+            printf("  accepted %" PRIu32 " bytes the stream buffer cannot hold\n", n);
+            ota_image_fail(img);
+            return OTA_STATUS_INVALID;
+        }
+        memcpy(&buffered[buffered_len], &image[sent], n);
+        if (t->corrupt && sent == 0) {
+            buffered[buffered_len + n / 2] ^= 0x01;
+        }
+        buffered_len += n;
+        sent += n;
+    }
+
+    status = drain(img, &acked);
+    if (status != OTA_STATUS_OK) {
+        return status;
+    }
+    return ota_image_end(img);
+}
+
+static int failures;
+
+static void expect(const char *name, bool ok)
+{
+    printf("%-40s %s\n", name, ok ? "ok" : "FAIL");
+    if (!ok) {
+        failures++;
+    }
+}
+
+int main(void)
+{
+    static uint8_t image[PARTITION_SIZE + ATT_CHUNK];
+    srand(1);
+    for (size_t i = 0; i < sizeof(image); i++) {
+        image[i] = (uint8_t)rand();
+    }
+
+    partition_t part;
+    ota_image_t img;
+    const ota_flash_t hooks = {
+        .begin = part_begin,
+        .write = part_write,
+        .end = part_end,
+        .abort = part_abort,
+        .ctx = &part,
+    };
+
+    const struct {
+        const char *name;
+        transfer_t transfer;
+        long fail_write_at;
+        ota_status_t status;
+    } cases[] = {
+        { "image within the window",       { 40000, 40000, false, false }, -1, OTA_STATUS_OK },
+        { "image filling the partition",   { PARTITION_SIZE, PARTITION_SIZE, false, false }, -1, OTA_STATUS_OK },
+        { "one window without acks",       { OTA_WINDOW_BYTES, OTA_WINDOW_BYTES, false, true }, -1, OTA_STATUS_OK },
+        { "empty image",                   { 0, 0, false, false }, -1, OTA_STATUS_SIZE_MISMATCH },
+        { "image larger than partition",   { PARTITION_SIZE + 1, PARTITION_SIZE + 1, false, false }, -1, OTA_STATUS_SIZE_MISMATCH },
+        { "more bytes than announced",     { 20000, 20100, false, false }, -1, OTA_STATUS_SIZE_MISMATCH },
+        { "fewer bytes than announced",    { 20100, 20000, false, false }, -1, OTA_STATUS_SIZE_MISMATCH },
+        { "byte corrupted in flight",      { 20000, 20000, true, false }, -1, OTA_STATUS_HASH_MISMATCH },
+        { "sender ignoring the window",    { 40000, 40000, false, true }, -1, OTA_STATUS_OVERFLOW },
+        { "flash write failing",           { 20000, 20000, false, false }, 5000, OTA_STATUS_FLASH_ERROR },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        part = (partition_t){ .file = tmpfile(), .fail_write_at = cases[i].fail_write_at };
+        if (!part.file) {
+            perror("tmpfile");
+            return 2;
+        }
+        ota_image_init(&img, &hooks);
+        const transfer_t *t = &cases[i].transfer;
+        ota_status_t status = run(&img, image, t);
+
+        bool ok = status == cases[i].status && !img.active && !part.open;
+        if (cases[i].status == OTA_STATUS_OK) {
+            ok = ok && part.selected && !part.aborted && part_holds(&part, image, t->announced);
+        } else if (part.begins) {
+            // Anything that got a partition must give it back and never select it
+            ok = ok && part.aborted && !part.selected;
+        }
+        if (status != cases[i].status) {
+            printf("  status %d, expected %d\n", status, cases[i].status);
+        }
+        expect(cases[i].name, ok);
+        fclose(part.file);
+    }
+
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+/*
+ *
+ * Host check of the quadrature decoder core
+ *
+ * Runs main/quadrature.h, the decoder the GPIO ISR, the coprocessor and
+ * the models share. The transition table is checked against the Gray
+ * sequence, built here independently: one changed pin steps forward or
+ * backward, both pins changing is illegal. Then edge sequences go through
+ * quadrature_update() at x1, x2 and x4: clean turns, the rest states of
+ * each resolution, a switch between them, bounce at a rest state, a missed
+ * edge, a reversal and pulses shorter than the glitch width. Each case
+ * checks the steps emitted and the quality counters.
+ *
+ *   $ cc -o quadrature_check tools/quadrature_check.c
+ *   $ ./quadrature_check
+ *
+ * Exits 1 if any case fails.
+ *
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include "../main/quadrature.h"
+
+#define TICK  100       // Edge spacing in the sequences, well above the glitch width
+
+static const uint8_t gray[4] = {0, 1, 3, 2};   // Forward order of the A/B states
+
+static int failures;
+
+static void expect(const char *name, bool ok)
+{
+    printf("%-44s %s\n", name, ok ? "ok" : "FAIL");
+    if (!ok) {
+        failures++;
+    }
+}
+
+/**
+ * @brief Position of an A/B state in the Gray sequence
+ */
+static int gray_index(uint8_t ab)
+{
+    for (int i = 0; i < 4; i++) {
+        if (gray[i] == ab) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool check_table(void)
+{
+    bool ok = true;
+    for (uint8_t from = 0; from < 4; from++) {
+        for (uint8_t to = 0; to < 4; to++) {
+            int expected;
+            if (from == to) {
+                expected = 0;
+            } else if ((from ^ to) == 3) {
+                expected = QUADRATURE_ILLEGAL;
+            } else {
+                expected = (gray_index(from) + 1) % 4 == gray_index(to) ? 1 : -1;
+            }
+            if (quadrature_table[(from << 2) | to] != expected) {
+                printf("  %u%u -> %u%u is %d, expected %d\n", from >> 1, from & 1, to >> 1, to & 1,
+                       quadrature_table[(from << 2) | to], expected);
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+typedef struct {
+    int steps;          // Sum of the emitted steps
+    int emitted;        // Number of non-zero steps
+} result_t;
+
+/**
+ * @brief Feed a sequence of A/B states, one every TICK unless ticks are given
+ * @param q Decoder, already initialized
+ * @param states A/B states
+ * @param ticks Timestamp of each state, NULL for TICK spacing
+ * @param n Number of states
+ */
+static result_t feed(quadrature_t *q, const uint8_t *states, const uint32_t *ticks, int n)
+{
+    result_t r = {0};
+    for (int i = 0; i < n; i++) {
+        int step = quadrature_update(q, states[i], ticks ? ticks[i] : (uint32_t)(i + 1) * TICK);
+        r.steps += step;
+        r.emitted += step != 0;
+    }
+    return r;
+}
+
+/**
+ * @brief Feed whole turns from the detent, forward or backward
+ * @param q Decoder at its detent state
+ * @param edges Number of edges, negative for backward
+ */
+static result_t turn(quadrature_t *q, int edges)
+{
+    uint8_t states[64];
+    int n = edges < 0 ? -edges : edges;
+    int dir = edges < 0 ? -1 : 1;
+    int index = gray_index(q->ab);
+    for (int i = 0; i < n; i++) {
+        index = (index + dir + 4) % 4;
+        states[i] = gray[index];
+    }
+    return feed(q, states, NULL, n);
+}
+
+static bool counters(const quadrature_t *q, uint32_t illegal, uint32_t glitches, uint32_t reversals)
+{
+    bool ok = q->illegal == illegal && q->glitches == glitches && q->reversals == reversals;
+    if (!ok) {
+        printf("  illegal %u glitches %u reversals %u, expected %u %u %u\n",
+               (unsigned)q->illegal, (unsigned)q->glitches, (unsigned)q->reversals,
+               (unsigned)illegal, (unsigned)glitches, (unsigned)reversals);
+    }
+    return ok;
+}
+
+int main(void)
+{
+    quadrature_t q;
+    result_t r;
+
+    expect("table follows the Gray sequence", check_table());
+
+    // Every rest state can be the detent, the decoder takes whatever it starts in
+    bool ok = true;
+    for (uint8_t detent = 0; detent < 4; detent++) {
+        const quadrature_resolution_t modes[] = {QUADRATURE_X1, QUADRATURE_X2, QUADRATURE_X4};
+        for (int m = 0; m < 3; m++) {
+            quadrature_init(&q, detent, modes[m], 0);
+            r = turn(&q, 32);
+            ok = ok && r.steps == 8 * (int)modes[m] && r.emitted == 8 * (int)modes[m] && q.ab == detent;
+            r = turn(&q, -32);
+            ok = ok && r.steps == -8 * (int)modes[m] && counters(&q, 0, 0, 1);
+        }
+    }
+    expect("x1, x2, x4 count 1, 2, 4 steps per cycle", ok);
+
+    // x1 steps only on arriving back at the detent
+    quadrature_init(&q, 0, QUADRATURE_X1, 0);
+    r = turn(&q, 3);
+    ok = r.emitted == 0;
+    r = turn(&q, 1);
+    expect("x1 steps on reaching the detent", ok && r.steps == 1 && r.emitted == 1);
+
+    // x2 rests at the detent and at the opposite state, and nowhere else
+    quadrature_init(&q, 1, QUADRATURE_X2, 0);
+    r = feed(&q, (const uint8_t[]){3, 2, 0, 1}, NULL, 4);
+    ok = r.emitted == 2 && q.sub == 0;
+    quadrature_init(&q, 1, QUADRATURE_X2, 0);
+    r = feed(&q, (const uint8_t[]){3}, NULL, 1);
+    ok = ok && r.emitted == 0;
+    r = feed(&q, (const uint8_t[]){2}, NULL, 1);
+    expect("x2 steps at the detent and opposite state", ok && r.steps == 1 && r.emitted == 1);
+
+    // Bounce at the opposite state nets nothing at x2 either
+    quadrature_init(&q, 0, QUADRATURE_X2, 0);
+    turn(&q, 2);
+    r = feed(&q, (const uint8_t[]){2, 3, 2, 3}, NULL, 4);
+    expect("x2 ignores bounce at the opposite state", r.emitted == 0 && q.ab == 3 && counters(&q, 0, 0, 0));
+
+    // The decoder switches resolution between steps, as encoder_set_resolution() does
+    quadrature_init(&q, 0, QUADRATURE_X1, 0);
+    turn(&q, 4);
+    q.resolution = QUADRATURE_X4;
+    q.sub = 0;
+    r = turn(&q, 4);
+    ok = r.steps == 4;
+    q.resolution = QUADRATURE_X2;
+    q.sub = 0;
+    r = turn(&q, 4);
+    expect("resolution switch applies from the next edge", ok && r.steps == 2);
+
+    // Bounce: leave the detent and fall back, at x1 nothing is counted
+    quadrature_init(&q, 0, QUADRATURE_X1, 0);
+    r = feed(&q, (const uint8_t[]){1, 0, 1, 0, 1, 0}, NULL, 6);
+    expect("x1 ignores bounce at the detent", r.emitted == 0 && q.sub == 0 && counters(&q, 0, 0, 0));
+
+    // Bounce on one pin at x4 moves back and forth, ending where it started
+    quadrature_init(&q, 0, QUADRATURE_X4, 0);
+    r = feed(&q, (const uint8_t[]){1, 0, 1, 0}, NULL, 4);
+    expect("x4 bounce nets zero, counts reversals", r.steps == 0 && r.emitted == 4 && counters(&q, 0, 0, 3));
+
+    // Both pins change at once: an edge was missed
+    quadrature_init(&q, 0, QUADRATURE_X4, 0);
+    r = feed(&q, (const uint8_t[]){3, 2, 0}, NULL, 3);
+    expect("x4 counts a double transition as illegal", r.steps == 2 && r.emitted == 2 && counters(&q, 1, 0, 0));
+
+    // A cycle with one edge missed still has a majority of forward edges
+    quadrature_init(&q, 0, QUADRATURE_X1, 0);
+    r = feed(&q, (const uint8_t[]){1, 3, 0}, NULL, 3);
+    expect("x1 keeps a step with one edge missed", r.steps == 1 && counters(&q, 1, 0, 0));
+
+    // Two double transitions back to the detent show no direction at all
+    quadrature_init(&q, 0, QUADRATURE_X1, 0);
+    r = feed(&q, (const uint8_t[]){3, 0}, NULL, 2);
+    expect("x1 emits nothing without a majority", r.emitted == 0 && q.sub == 0 && counters(&q, 2, 0, 0));
+
+    // Pulses on A shorter than the glitch width, the B edge between them is spaced normally
+    quadrature_init(&q, 0, QUADRATURE_X4, 50);
+    r = feed(&q, (const uint8_t[]){1, 3, 1, 3}, (const uint32_t[]){100, 200, 210, 220}, 4);
+    expect("edges closer than the glitch width count", r.steps == 2 && counters(&q, 0, 2, 2));
+
+    // Glitch counting is off at width 0
+    quadrature_init(&q, 0, QUADRATURE_X4, 0);
+    feed(&q, (const uint8_t[]){1, 3, 1, 3}, (const uint32_t[]){100, 200, 201, 202}, 4);
+    expect("glitch width 0 counts no glitches", counters(&q, 0, 0, 2));
+
+    // The timestamps wrap, only differences count
+    quadrature_init(&q, 0, QUADRATURE_X4, 50);
+    q.last_edge_a = UINT32_MAX - 10;
+    feed(&q, (const uint8_t[]){2}, (const uint32_t[]){20}, 1);
+    expect("glitch check across a timestamp wrap", counters(&q, 0, 1, 0));
+
+    // Unchanged samples are not edges
+    quadrature_init(&q, 2, QUADRATURE_X4, 0);
+    r = feed(&q, (const uint8_t[]){2, 2, 2}, NULL, 3);
+    expect("repeated state is not an edge", r.emitted == 0 && q.edges == 0);
+
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}
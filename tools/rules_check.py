@@ -0,0 +1,139 @@
+#!/usr/bin/env python
+#
+# Rules engine check.
+#
+# Builds tools/rules_model.c with main/rules.c, compiles each case's rules
+# with tools/rules_compile.py and replays its trace through the model. A
+# trace ends with the alerts it must raise ("expect ms code", see
+# tools/rules_model.c), so a case fails if an alert is missing, extra, late
+# or early. A last case checks that the engine rejects a truncated program.
+#
+#   $ python tools/rules_check.py
+#
+import sys
+
+from model_check import check
+from rules_compile import compile_rules
+
+# name, rules, trace with expectations
+CASES = [
+    ("held zone, re-armed after leaving it",
+     "alert 1 when zone == YELLOW for 30s",
+     """
+     0 0 G
+     1000 8 Y
+     40000 8 Y
+     45000 0 G
+     50000 8 Y
+     90000 8 Y
+     expect 31000 1
+     expect 80000 1
+     """),
+    ("held zone, interrupted too early",
+     "alert 1 when zone == YELLOW for 30s",
+     """
+     0 0 G
+     1000 8 Y
+     20000 0 G
+     25000 8 Y
+     50000 8 Y
+     expect none
+     """),
+    ("position change over a window",
+     "alert 2 when abs(delta(1s)) > 20",
+     """
+     0 0 G
+     2500 25 G
+     5000 -30 G
+     6000 -30 G
+     expect 2500 2
+     expect 5000 2
+     """),
+    ("slow drift stays within the window",
+     "alert 2 when abs(delta(1s)) > 20",
+     """
+     0 0 G
+     1000 10 G
+     2000 20 G
+     3000 30 G
+     4000 40 G
+     5000 40 G
+     expect none
+     """),
+    ("red soon after calibration",
+     "alert 3 when zone == RED and since_calibration < 5s",
+     """
+     0 12 R
+     500 0 G
+     1000 0 G z
+     3000 12 R
+     4000 0 G
+     5000 12 R
+     8000 12 R
+     expect 3000 3
+     expect 5000 3
+     """),
+    ("calibration mode outside green",
+     "alert 4 when calibrating and not (zone == GREEN)",
+     """
+     0 0 G c
+     1000 8 Y c
+     2000 8 Y
+     3000 8 Y c
+     4000 0 G c
+     expect 1000 4
+     expect 3000 4
+     """),
+    ("zone entered and left within one loop pass",
+     "alert 6 when zone == RED",
+     """
+     0 0 G
+     1010 12 R
+     1030 0 G
+     2000 0 G
+     expect 1010 6
+     """),
+    ("rules fire in program order",
+     """
+     alert 5 when position > 10
+     alert 6 when zone == RED
+     alert 7 when zone_time > 2s and zone == RED
+     """,
+     """
+     0 0 G
+     1000 12 R
+     4000 12 R
+     expect 1000 5
+     expect 1000 6
+     expect 3050 7
+     """),
+]
+
+
+
+def replay(rules, trace):
+    """Case that runs a trace through the compiled rules."""
+    def run(model):
+        status, output = model.run([model.file("program.bin", compile_rules(rules))], trace)
+        return status == 0, output
+    return run
+
+
+def rejected(program):
+    """Case that passes if the engine refuses to load the program."""
+    def run(model):
+        status, output = model.run([model.file("program.bin", program)], "0 0 G")
+        return status == 1 and "rejected" in output, output
+    return run
+
+
+def main():
+    cases = [(name, replay(rules, trace)) for name, rules, trace in CASES]
+    # The verifier has to refuse a program whose last rule is cut off
+    program = compile_rules("alert 1 when zone == YELLOW for 30s")
+    cases.append(("truncated program is rejected", rejected(program[:-1])))
+    return check("rules_model.c", cases)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,330 @@
+#!/usr/bin/env python
+#
+# Rules compiler.
+#
+# Compiles alert rules into the bytecode run by main/rules.c. One rule per
+# line, '#' starts a comment:
+#
+#   alert 1 when zone == YELLOW for 30s
+#   alert 2 when abs(delta(1s)) > 20
+#   alert 3 when zone == RED and since_calibration < 5s
+#
+# Inputs: zone (compare with RED, GREEN, YELLOW), position (detents),
+# zone_time and since_calibration (durations), calibrating (0 or 1), and
+# delta(window), the position change over a window of up to 6.3 s.
+# Durations are written 500ms, 30s or 2min. 'cond for 30s' is true once
+# cond has held for 30 s; it binds tighter than 'and' and 'or'. Operators:
+# + - == != < <= > >= and or not abs() and parentheses.
+#
+# The alert code is sent to the central in a rule_alert frame when the rule
+# becomes true, and again only after it was false in between.
+#
+#   $ python tools/rules_compile.py alerts.rules -o alerts.bin
+#   $ python tools/rules_compile.py alerts.rules --list
+#   $ python device_example.py --rules alerts.bin
+#
+import argparse
+import os
+import re
+import struct
+import sys
+
+ROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+sys.path.insert(0, ROOT)
+
+import wire  # noqa: E402
+from wire import RuleOp  # noqa: E402
+
+
+def read_limits():
+    """Take RULES_* limits from main/rules.h, so they have one source."""
+    with open(os.path.join(ROOT, "main", "rules.h")) as f:
+        return {m.group(1): int(m.group(2))
+                for m in re.finditer(r"^#define\s+RULES_(\w+)\s+(\d+)", f.read(), re.M)}
+
+
+LIMITS = read_limits()
+
+CONSTANTS = {
+    "RED": wire.Frame.ZONE_RED,
+    "GREEN": wire.Frame.ZONE_GREEN,
+    "YELLOW": wire.Frame.ZONE_YELLOW,
+    "true": 1,
+    "false": 0,
+}
+INPUTS = {
+    "zone": RuleOp.ZONE,
+    "position": RuleOp.POSITION,
+    "zone_time": RuleOp.ZONE_MS,
+    "since_calibration": RuleOp.CALIB_MS,
+    "calibrating": RuleOp.CALIBRATING,
+}
+COMPARISONS = {
+    "==": RuleOp.EQ, "!=": RuleOp.NE, "<": RuleOp.LT,
+    "<=": RuleOp.LE, ">": RuleOp.GT, ">=": RuleOp.GE,
+}
+UNITS = {"ms": 1, "s": 1000, "min": 60000}
+OPERANDS = {
+    RuleOp.PUSH8: "<b", RuleOp.PUSH16: "<h", RuleOp.PUSH32: "<i",
+    RuleOp.DELTA: "<B", RuleOp.HELD: "<BH", RuleOp.ALERT: "<B",
+}
+# (pops, pushes) where it is not (0, 1)
+STACK = {
+    RuleOp.NEG: (1, 1), RuleOp.ABS: (1, 1), RuleOp.NOT: (1, 1), RuleOp.HELD: (1, 1),
+    RuleOp.ALERT: (1, 0),
+    **{op: (2, 1) for op in (RuleOp.ADD, RuleOp.SUB, RuleOp.AND, RuleOp.OR, *COMPARISONS.values())},
+}
+
+TOKEN = re.compile(r"\s*(?:(?P<duration>\d+)(?P<unit>ms|s|min)\b|(?P<number>0x[0-9a-fA-F]+|\d+)"
+                   r"|(?P<name>[A-Za-z_]\w*)|(?P<op>==|!=|<=|>=|[<>+\-()]))")
+
+
+class RuleError(Exception):
+    pass
+
+
+class Duration(int):
+    """Milliseconds, kept apart from plain numbers so windows can be checked."""
+
+
+def tokenize(text):
+    tokens = []
+    pos = 0
+    text = text.rstrip()
+    while pos < len(text):
+        m = TOKEN.match(text, pos)
+        if not m or m.end() == pos:
+            raise RuleError(f"unexpected {text[pos:].strip()[:10]!r}")
+        pos = m.end()
+        if m.group("duration"):
+            tokens.append(Duration(int(m.group("duration")) * UNITS[m.group("unit")]))
+        elif m.group("number"):
+            tokens.append(int(m.group("number"), 0))
+        else:
+            tokens.append(m.group("name") or m.group("op"))
+    return tokens
+
+
+class Parser:
+    """Recursive descent, emitting postfix code as it goes."""
+
+    def __init__(self, tokens, program):
+        self.tokens = tokens
+        self.program = program
+
+    def peek(self):
+        return self.tokens[0] if self.tokens else None
+
+    def take(self, expected=None):
+        if not self.tokens:
+            raise RuleError(f"expected {expected or 'more'} at end of rule")
+        token = self.tokens.pop(0)
+        if expected is not None and token != expected:
+            raise RuleError(f"expected {expected!r}, got {token!r}")
+        return token
+
+    def duration(self):
+        token = self.take()
+        if not isinstance(token, Duration):
+            raise RuleError(f"expected a duration like 30s, got {token!r}")
+        return token
+
+    def ticks(self, ms, limit, what):
+        ticks = -(-ms // LIMITS["TICK_MS"])
+        if not 1 <= ticks <= limit:
+            raise RuleError(f"{what} must be between {LIMITS['TICK_MS']} ms and {limit * LIMITS['TICK_MS']} ms")
+        return ticks
+
+    def expression(self):
+        self.conjunction()
+        while self.peek() == "or":
+            self.take()
+            self.conjunction()
+            self.program.emit(RuleOp.OR)
+
+    def conjunction(self):
+        self.negation()
+        while self.peek() == "and":
+            self.take()
+            self.negation()
+            self.program.emit(RuleOp.AND)
+
+    def negation(self):
+        if self.peek() == "not":
+            self.take()
+            self.negation()
+            self.program.emit(RuleOp.NOT)
+            return
+        self.comparison()
+        if self.peek() == "for":
+            self.take()
+            ticks = self.ticks(self.duration(), 0xFFFF, "a 'for' duration")
+            self.program.emit(RuleOp.HELD, self.program.new_timer(), ticks)
+
+    def comparison(self):
+        self.sum()
+        if self.peek() in COMPARISONS:
+            op = COMPARISONS[self.take()]
+            self.sum()
+            self.program.emit(op)
+
+    def sum(self):
+        self.unary()
+        while self.peek() in ("+", "-"):
+            op = RuleOp.ADD if self.take() == "+" else RuleOp.SUB
+            self.unary()
+            self.program.emit(op)
+
+    def unary(self):
+        if self.peek() == "-":
+            self.take()
+            self.unary()
+            self.program.emit(RuleOp.NEG)
+            return
+        self.primary()
+
+    def primary(self):
+        token = self.take()
+        if isinstance(token, int):
+            self.program.push(token)
+        elif token == "(":
+            self.expression()
+            self.take(")")
+        elif token == "abs":
+            self.take("(")
+            self.expression()
+            self.take(")")
+            self.program.emit(RuleOp.ABS)
+        elif token == "delta":
+            self.take("(")
+            ticks = self.ticks(self.duration(), LIMITS["HISTORY_LEN"] - 1, "a delta window")
+            self.take(")")
+            self.program.emit(RuleOp.DELTA, ticks)
+        elif token in INPUTS:
+            self.program.emit(INPUTS[token])
+        elif token in CONSTANTS:
+            self.program.push(CONSTANTS[token])
+        else:
+            raise RuleError(f"unknown name {token!r}")
+
+
+class Program:
+    def __init__(self):
+        self.code = bytearray()
+        self.rules = 0
+        self.timers = 0
+        self.depth = 0
+
+    def emit(self, op, *operands):
+        pops, pushes = STACK.get(op, (0, 1))
+        self.depth += pushes - pops
+        if self.depth > LIMITS["STACK_MAX"]:
+            raise RuleError(f"expression nests deeper than {LIMITS['STACK_MAX']}")
+        self.code.append(op)
+        if op in OPERANDS:
+            self.code += struct.pack(OPERANDS[op], *operands)
+
+    def push(self, value):
+        if -0x80 <= value < 0x80:
+            self.emit(RuleOp.PUSH8, value)
+        elif -0x8000 <= value < 0x8000:
+            self.emit(RuleOp.PUSH16, value)
+        elif -0x80000000 <= value < 0x80000000:
+            self.emit(RuleOp.PUSH32, value)
+        else:
+            raise RuleError(f"{value} does not fit 32 bits")
+
+    def new_timer(self):
+        if self.timers == LIMITS["TIMERS_MAX"]:
+            raise RuleError(f"more than {LIMITS['TIMERS_MAX']} 'for' conditions")
+        self.timers += 1
+        return self.timers - 1
+
+    def rule(self, text):
+        tokens = tokenize(text)
+        parser = Parser(tokens, self)
+        parser.take("alert")
+        code = parser.take()
+        if not isinstance(code, int) or isinstance(code, Duration) or not 0 <= code <= 0xFF:
+            raise RuleError(f"alert code must be 0-255, got {code!r}")
+        parser.take("when")
+        parser.expression()
+        if tokens:
+            raise RuleError(f"unexpected {tokens[0]!r}")
+        if self.rules == LIMITS["MAX"]:
+            raise RuleError(f"more than {LIMITS['MAX']} rules")
+        self.emit(RuleOp.ALERT, code)
+        self.rules += 1
+
+    def bytes(self):
+        if not self.rules:
+            return b""
+        program = wire.pack_rules_header(LIMITS["VERSION"], self.rules, self.timers) + bytes(self.code)
+        if len(program) > LIMITS["PROGRAM_MAX"]:
+            raise RuleError(f"program is {len(program)} bytes, the limit is {LIMITS['PROGRAM_MAX']}")
+        return program
+
+
+def compile_rules(text):
+    """Compile rules source to a program, empty when there are no rules."""
+    program = Program()
+    for number, line in enumerate(text.splitlines(), 1):
+        line = line.split("#", 1)[0]
+        if not line.strip():
+            continue
+        try:
+            program.rule(line)
+        except RuleError as e:
+            raise RuleError(f"line {number}: {e}") from None
+    try:
+        return program.bytes()
+    except RuleError as e:
+        raise RuleError(f"program: {e}") from None
+
+
+def disassemble(program):
+    """Yield one line per opcode of a compiled program."""
+    if not program:
+        return
+    header = wire.decode_rules_header(program)
+    yield f"version {header.version}, {header.rules} rules, {header.timers} timers"
+    pc = wire.RULES_HEADER.size
+    rule = 0
+    while pc < len(program):
+        op = RuleOp(program[pc])
+        fmt = OPERANDS.get(op)
+        operands = struct.unpack_from(fmt, program, pc + 1) if fmt else ()
+        size = 1 + (struct.calcsize(fmt) if fmt else 0)
+        yield f"{pc:4d}  {program[pc:pc + size].hex(' '):14s} {op.name.lower()} {' '.join(map(str, operands))}".rstrip()
+        if op == RuleOp.ALERT:
+            yield f"      rule {rule}"
+            rule += 1
+        pc += size
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compile encoder alert rules to bytecode")
+    parser.add_argument("source", help="Rules source file, - for stdin")
+    parser.add_argument("-o", "--out", help="Write the program here, default prints it as hex")
+    parser.add_argument("--list", action="store_true", help="Print the disassembly")
+    args = parser.parse_args()
+
+    text = sys.stdin.read() if args.source == "-" else open(args.source).read()
+    try:
+        program = compile_rules(text)
+    except RuleError as e:
+        sys.exit(f"{args.source}: {e}")
+
+    if args.list:
+        for line in disassemble(program):
+            print(line)
+    if args.out:
+        with open(args.out, "wb") as f:
+            f.write(program)
+        print(f"wrote {args.out}, {len(program)} bytes")
+    elif not args.list:
+        print(program.hex())
+
+
+if __name__ == "__main__":
+    main()
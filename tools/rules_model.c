@@ -0,0 +1,153 @@
+/*
+ *
+ * Host model of the rules engine
+ *
+ * Loads a compiled rules program (tools/rules_compile.py) into main/rules.c
+ * and replays a trace through it the way the encoder loop does: each trace
+ * line is evaluated like a step event, and the inputs are evaluated again
+ * every step_ms until the next line. A line is "ms position zone [flags]":
+ * the time the inputs change, the position in detents, R, G or Y for the
+ * zone, and optionally c while calibrating and z for a zero set at that
+ * time. The last line ends the run.
+ *
+ * A trace can also list the alerts it has to raise, in order, as lines
+ * "expect ms code", or "expect none" for a run without alerts. The run then
+ * fails if the alerts differ; tools/rules_check.py uses this.
+ *
+ *   $ cc -o rules_model tools/rules_model.c
+ *   $ printf '0 0 G\n1000 8 Y\n40000 8 Y\nexpect 31000 1\n' | ./rules_model alerts.bin
+ *
+ * Arguments: program [step_ms], default step 50
+ * Exits 1 if the program is rejected or the alerts differ from the expected ones.
+ *
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../main/rules.c"
+
+#define ALERTS_MAX  64     // Alerts kept for the comparison with the expected ones
+
+typedef struct {
+    uint32_t ms;
+    uint8_t code;
+} alert_t;
+
+typedef struct {
+    rules_input_t in;
+    alert_t seen[ALERTS_MAX];
+    int seen_count;         // Also counts alerts past ALERTS_MAX
+} run_t;
+
+static void print_alert(uint8_t rule, uint8_t code, void *ctx)
+{
+    run_t *run = ctx;
+    printf("%8" PRIu32 " ms  position %4" PRId32 "  rule %u  alert %u\n", run->in.now_ms, run->in.position, rule, code);
+    if (run->seen_count < ALERTS_MAX) {
+        run->seen[run->seen_count] = (alert_t){ run->in.now_ms, code };
+    }
+    run->seen_count++;
+}
+
+/**
+ * @brief Compare the alerts raised with the expected ones
+ * @return true if they match in time, code and order
+ */
+static bool check_alerts(const run_t *run, const alert_t *expected, int expected_count)
+{
+    bool ok = run->seen_count == expected_count;
+    int n = run->seen_count < expected_count ? run->seen_count : expected_count;
+    if (n > ALERTS_MAX) {
+        n = ALERTS_MAX;
+    }
+    for (int i = 0; i < n; i++) {
+        if (run->seen[i].ms != expected[i].ms || run->seen[i].code != expected[i].code) {
+            printf("alert %d: %" PRIu32 " ms code %u, expected %" PRIu32 " ms code %u\n",
+                   i + 1, run->seen[i].ms, run->seen[i].code, expected[i].ms, expected[i].code);
+            ok = false;
+        }
+    }
+    if (run->seen_count != expected_count) {
+        printf("%d alerts, expected %d\n", run->seen_count, expected_count);
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s program [step_ms] < trace\n", argv[0]);
+        return 2;
+    }
+    uint32_t step_ms = argc > 2 ? (uint32_t)atoi(argv[2]) : 50;
+    if (step_ms == 0) {
+        fprintf(stderr, "step_ms must be positive\n");
+        return 2;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        perror(argv[1]);
+        return 2;
+    }
+    uint8_t program[RULES_PROGRAM_MAX + 1];
+    size_t len = fread(program, 1, sizeof(program), f);
+    fclose(f);
+
+    static rules_t rules;
+    if (!rules_load(&rules, program, len)) {
+        fprintf(stderr, "%s: program rejected (%zu bytes)\n", argv[1], len);
+        return 1;
+    }
+
+    static run_t run = { .in = { .zone = WIRE_FRAME_ZONE_GREEN } };
+    rules_input_t *in = &run.in;
+    alert_t expected[ALERTS_MAX];
+    int expected_count = 0;
+    bool expecting = false;
+    bool started = false;
+    char line[128];
+    while (fgets(line, sizeof(line), stdin)) {
+        if (strncmp(line, "expect", 6) == 0) {
+            uint32_t ms;
+            unsigned code;
+            expecting = true;
+            if (sscanf(line + 6, "%" SCNu32 " %u", &ms, &code) == 2 && expected_count < ALERTS_MAX) {
+                expected[expected_count++] = (alert_t){ ms, (uint8_t)code };
+            }
+            continue;
+        }
+
+        uint32_t ms;
+        int32_t position;
+        char zone;
+        char flags[8] = "";
+        if (sscanf(line, "%" SCNu32 " %" SCNd32 " %c %7s", &ms, &position, &zone, flags) < 3) {
+            continue;
+        }
+
+        // Hold the previous inputs up to this line, one loop iteration per step
+        while (started && in->now_ms + step_ms < ms) {
+            in->now_ms += step_ms;
+            rules_evaluate(&rules, in, print_alert, &run);
+        }
+
+        in->now_ms = ms;
+        in->position = position;
+        in->zone = zone == 'R' ? WIRE_FRAME_ZONE_RED : zone == 'Y' ? WIRE_FRAME_ZONE_YELLOW : WIRE_FRAME_ZONE_GREEN;
+        in->calibrating = strchr(flags, 'c') != NULL;
+        if (strchr(flags, 'z')) {
+            in->calibrated = true;
+            in->calibrated_ms = ms;
+        }
+        rules_evaluate(&rules, in, print_alert, &run);
+        started = true;
+    }
+
+    printf("%d alerts, %zu byte program\n", run.seen_count, len);
+    if (expecting && !check_alerts(&run, expected, expected_count)) {
+        return 1;
+    }
+    return 0;
+}
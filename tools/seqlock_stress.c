@@ -0,0 +1,148 @@
+/*
+ *
+ * Host stress run of the position snapshot sequence lock
+ *
+ * Runs main/seqlock.h with writer threads publishing records, serialized by
+ * a mutex the way the backends serialize them with their spinlock, while
+ * reader threads copy records out without locking. Every word of a record
+ * is derived from the same counter, so a reader that got a mix of two
+ * writes (a torn read) sees words that disagree. Also checks that each
+ * reader sees the counter only move forward.
+ *
+ *   $ cc -O2 -pthread -o seqlock_stress tools/seqlock_stress.c
+ *   $ ./seqlock_stress 8 2 5
+ *
+ * Arguments: [readers [writers [seconds]]], defaults 4 1 2
+ * Exits 1 if any torn or out-of-order read was seen.
+ *
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../main/seqlock.h"
+
+#define RECORD_WORDS  SEQLOCK_MAX_WORDS
+
+typedef struct {
+    uint32_t words[RECORD_WORDS];
+} record_t;
+
+static seqlock_t lock;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t counter;            // Under writer_mutex
+static atomic_bool stop;
+
+typedef struct {
+    pthread_t thread;
+    uint64_t reads;
+    uint64_t retries;
+    uint64_t torn;
+    uint64_t backwards;
+} reader_t;
+
+static void make_record(record_t *r, uint32_t n)
+{
+    r->words[0] = n;
+    for (uint32_t i = 1; i < RECORD_WORDS; i++) {
+        r->words[i] = (n * 2654435761u) ^ (i * 0x9E3779B9u);
+    }
+}
+
+static bool record_ok(const record_t *r, uint32_t *n)
+{
+    // Word 0 is the counter, every other word must match it
+    *n = r->words[0];
+    record_t expect;
+    make_record(&expect, *n);
+    for (uint32_t i = 1; i < RECORD_WORDS; i++) {
+        if (r->words[i] != expect.words[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void *writer_main(void *arg)
+{
+    (void)arg;
+    record_t r;
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        pthread_mutex_lock(&writer_mutex);
+        make_record(&r, ++counter);
+        seqlock_write(&lock, &r, sizeof(r));
+        pthread_mutex_unlock(&writer_mutex);
+    }
+    return NULL;
+}
+
+static void *reader_main(void *arg)
+{
+    reader_t *rd = (reader_t *)arg;
+    record_t r;
+    uint32_t last = 0;
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        rd->retries += seqlock_read(&lock, &r, sizeof(r));
+        rd->reads++;
+        uint32_t n;
+        if (!record_ok(&r, &n)) {
+            rd->torn++;
+        } else if (n < last) {
+            rd->backwards++;
+        } else {
+            last = n;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int readers = argc > 1 ? atoi(argv[1]) : 4;
+    int writers = argc > 2 ? atoi(argv[2]) : 1;
+    int seconds = argc > 3 ? atoi(argv[3]) : 2;
+    if (readers < 1 || writers < 1 || seconds < 1) {
+        fprintf(stderr, "usage: %s [readers [writers [seconds]]]\n", argv[0]);
+        return 2;
+    }
+
+    record_t initial;
+    make_record(&initial, 0);
+    seqlock_write(&lock, &initial, sizeof(initial));
+
+    reader_t *rd = calloc(readers, sizeof(*rd));
+    pthread_t *wr = calloc(writers, sizeof(*wr));
+    if (!rd || !wr) {
+        return 2;
+    }
+    for (int i = 0; i < readers; i++) {
+        pthread_create(&rd[i].thread, NULL, reader_main, &rd[i]);
+    }
+    for (int i = 0; i < writers; i++) {
+        pthread_create(&wr[i], NULL, writer_main, NULL);
+    }
+
+    struct timespec duration = { .tv_sec = seconds };
+    nanosleep(&duration, NULL);
+    atomic_store(&stop, true);
+
+    for (int i = 0; i < writers; i++) {
+        pthread_join(wr[i], NULL);
+    }
+    uint64_t reads = 0, retries = 0, torn = 0, backwards = 0;
+    for (int i = 0; i < readers; i++) {
+        pthread_join(rd[i].thread, NULL);
+        reads += rd[i].reads;
+        retries += rd[i].retries;
+        torn += rd[i].torn;
+        backwards += rd[i].backwards;
+    }
+
+    printf("%" PRIu32 " writes, %" PRIu64 " reads, %" PRIu64 " retries, %" PRIu64 " torn, %" PRIu64 " out of order\n",
+           counter, reads, retries, torn, backwards);
+    free(rd);
+    free(wr);
+    return torn || backwards ? 1 : 0;
+}
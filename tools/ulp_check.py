@@ -0,0 +1,57 @@
+#!/usr/bin/env python
+#
+# Coprocessor encoder program check.
+#
+# Builds tools/ulp_model.c and replays each case's A/B trace through the
+# sampling step the ULP / LP core runs in deep sleep. A trace states the
+# positions and wakes it has to produce ("expect position N", "expect wake
+# S", "expect asleep", see tools/ulp_model.c), so a case fails if the
+# coprocessor would count wrong, wake the main core too early, too late, or
+# not at all.
+#
+#   $ python tools/ulp_check.py
+#
+import sys
+
+from model_check import check
+
+# name, arguments (wake_min wake_max [start_position [resolution [flip]]]), trace with expectations
+CASES = [
+    ("wakes above the zone",
+     ["-5", "5"],
+     "0 1320 1320 1320 1320 1320 expect position 5 expect asleep 1320 expect wake 24"),
+    ("wakes below the zone",
+     ["-5", "5"],
+     "0 2310 2310 2310 2310 2310 expect asleep 2310 expect position -6 expect wake 24"),
+    ("stays asleep within the zone",
+     ["-5", "5"],
+     "0 1320 1320 1320 2310 2310 2310 expect position 0 expect asleep"),
+    ("wakes only once",
+     ["-5", "5"],
+     "0 1320 1320 1320 1320 1320 1320 2310 2310 1320 1320 expect position 6 expect wake 24"),
+    ("starts from the seeded position",
+     ["-5", "5", "4"],
+     "0 1320 expect position 5 expect asleep 1320 expect wake 8"),
+    ("flipped direction",
+     ["-5", "5", "0", "1", "1"],
+     "0 1320 1320 1320 1320 1320 1320 expect position -6 expect wake 24"),
+    ("x2 counts at the opposite state",
+     ["-5", "5", "0", "2"],
+     "0 1320 1320 13 expect position 5 expect asleep 20 expect wake 12"),
+    ("x4 counts every edge",
+     ["-5", "5", "0", "4"],
+     "0 13201 expect position 5 expect asleep 3 expect wake 6"),
+    ("detent other than 00",
+     ["-5", "5"],
+     "3 2013 2013 expect position 2"),
+    ("bounce at the detent",
+     ["-5", "5"],
+     "0 101010 202020 expect position 0 expect asleep"),
+    ("cycle with a missed edge",
+     ["-5", "5"],
+     "0 130 expect position 1"),
+]
+
+
+if __name__ == "__main__":
+    sys.exit(check("ulp_model.c", CASES))
@@ -0,0 +1,121 @@
+/*
+ *
+ * Host model of the coprocessor encoder program
+ *
+ * Replays an A/B trace through the same sampling step the ULP / LP core runs
+ * in deep sleep (main/ulp/ulp_encoder_shared.h) and prints where it would
+ * wake the main core. Each digit 0-3 on stdin is one sample, A in bit 1 and
+ * B in bit 0; anything else is skipped. The first sample is the detent.
+ *
+ * A trace can also state what it has to produce at that point, as
+ * "expect position N", "expect wake S" for a wake at sample S, or "expect
+ * asleep". The run then fails if the state differs; tools/ulp_check.py uses
+ * this.
+ *
+ *   $ cc -o ulp_model tools/ulp_model.c
+ *   $ echo "0 1320 1320 1320 1320 1320 1320" | ./ulp_model -5 5
+ *   $ echo "0 1320 1320 expect position 2 expect asleep" | ./ulp_model -5 5
+ *
+ * Arguments: wake_min wake_max [start_position [resolution [flip]]]
+ * Exits 1 if an expectation fails.
+ *
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../main/ulp/ulp_encoder_shared.h"
+
+/**
+ * @brief Check one "expect" statement against the state so far
+ * @param what Expected quantity: position, wake or asleep
+ * @param value Expected value, unused for asleep
+ * @param wake_sample Sample that woke the main core, 0 if none
+ */
+static bool check_expect(const ulp_encoder_shared_t *s, const char *what, int32_t value, uint32_t wake_sample)
+{
+    if (strcmp(what, "position") == 0) {
+        if (s->position == value) {
+            return true;
+        }
+        printf("sample %" PRIu32 ": position %" PRId32 ", expected %" PRId32 "\n", s->samples, s->position, value);
+    } else if (strcmp(what, "wake") == 0) {
+        if (s->woke && wake_sample == (uint32_t)value) {
+            return true;
+        }
+        printf("sample %" PRIu32 ": %s, expected a wake at sample %" PRId32 "\n",
+               s->samples, s->woke ? "woke at another sample" : "still asleep", value);
+    } else if (strcmp(what, "asleep") == 0) {
+        if (!s->woke) {
+            return true;
+        }
+        printf("sample %" PRIu32 ": woke at sample %" PRIu32 ", expected to stay asleep\n", s->samples, wake_sample);
+    } else {
+        printf("unknown expectation \"%s\"\n", what);
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s wake_min wake_max [start_position [resolution [flip]]] < trace\n", argv[0]);
+        return 2;
+    }
+
+    ulp_encoder_shared_t s = {
+        .wake_min = atoi(argv[1]),
+        .wake_max = atoi(argv[2]),
+        .position = argc > 3 ? atoi(argv[3]) : 0,
+        .flip = argc > 5 ? atoi(argv[5]) != 0 : 0,
+    };
+    quadrature_resolution_t resolution = argc > 4 ? atoi(argv[4]) : QUADRATURE_X1;
+    if (resolution != QUADRATURE_X1 && resolution != QUADRATURE_X2 && resolution != QUADRATURE_X4) {
+        fprintf(stderr, "resolution must be 1, 2 or 4\n");
+        return 2;
+    }
+    bool started = false;
+    uint32_t wake_sample = 0;
+    int failed = 0;
+    char token[32];
+
+    while (scanf("%31s", token) == 1) {
+        if (strcmp(token, "expect") == 0) {
+            char what[16];
+            int32_t value = 0;
+            if (scanf("%15s", what) != 1 || (strcmp(what, "asleep") != 0 && scanf("%" SCNd32, &value) != 1)) {
+                fprintf(stderr, "expect needs position N, wake S or asleep\n");
+                return 2;
+            }
+            failed += !check_expect(&s, what, value, wake_sample);
+            continue;
+        }
+        for (const char *c = token; *c; c++) {
+            if (*c < '0' || *c > '3') {
+                continue;
+            }
+            uint8_t ab = *c - '0';
+            if (!started) {
+                // The main core seeds the decoder with the pins as they are at sleep entry
+                quadrature_init(&s.decoder, ab, resolution, 0);
+                started = true;
+                continue;
+            }
+            int32_t before = s.position;
+            if (ulp_encoder_sample(&s, ab)) {
+                wake_sample = s.samples;
+                printf("wake at sample %" PRIu32 ", position %" PRId32 "\n", s.samples, s.position);
+            } else if (s.position != before) {
+                printf("sample %" PRIu32 ": position %" PRId32 "\n", s.samples, s.position);
+            }
+        }
+    }
+
+    printf("%" PRIu32 " samples, position %" PRId32 ", %" PRIu32 " illegal transitions, %s\n",
+           s.samples, s.position, s.decoder.illegal, s.woke ? "woke the main core" : "stayed asleep");
+    if (failed) {
+        printf("%d expectations failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,465 @@
+#!/usr/bin/env python
+#
+# Wire protocol generator.
+#
+# Reads the frame and command schema in main/wire.json and writes both ends
+# of the protocol from it: main/wire.h with fixed-size, little-endian C
+# packers and unpackers (static inline, no heap), and wire.py with struct
+# based encoders and decoders for device_example.py. Frames marked "batch"
+# also get a NumPy structured dtype, so a run of records decodes straight
+# from a memoryview without a Python loop per record.
+#
+# Besides scalars and u8[N] byte strings, a field can be an array of a
+# scalar type, sized by a number or by an enum with a "c_count" member
+# (u32[stats_counter] has one element per counter). Array fields may carry
+# "bounds", the upper bucket bounds of a histogram, and a frame may carry a
+# layout "version"; both are emitted as constants on each side.
+#
+# Both outputs are checked in. The build runs this with --check and fails if
+# either is stale.
+#
+#   $ python tools/wire_gen.py          # regenerate
+#   $ python tools/wire_gen.py --check  # exit 1 if an output is out of date
+#
+import argparse
+import json
+import os
+import sys
+import textwrap
+
+ROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+SCHEMA = os.path.join(ROOT, "main", "wire.json")
+C_OUT = os.path.join(ROOT, "main", "wire.h")
+PY_OUT = os.path.join(ROOT, "wire.py")
+
+# type: (size, C type, struct code, NumPy code)
+SCALARS = {
+    "u8": (1, "uint8_t", "B", "u1"),
+    "i8": (1, "int8_t", "b", "i1"),
+    "u16": (2, "uint16_t", "H", "<u2"),
+    "i16": (2, "int16_t", "h", "<i2"),
+    "u32": (4, "uint32_t", "I", "<u4"),
+    "i32": (4, "int32_t", "i", "<i4"),
+}
+
+
+class Field:
+    def __init__(self, spec, enums):
+        self.name = spec["name"]
+        self.doc = spec.get("doc", "")
+        self.optional = spec.get("optional", False)
+        self.bounds = spec.get("bounds")
+        self.array = 0          # Length of a u8[N] byte string
+        self.count = 0          # Length of a scalar array, 0 for a scalar
+        kind = spec["type"]
+        base, _, length = kind.partition("[")
+        if length and not length.endswith("]"):
+            raise SystemExit(f"{SCHEMA}: field {self.name} has unknown type {kind}")
+        length = length[:-1]
+        if base == "u8" and length.isdigit():
+            self.array = int(length)
+            self.size = self.array
+            self.struct = f"{self.array}s"
+            self.numpy = f"V{self.array}"
+            self.kind = "bytes"
+        elif base in SCALARS and length:
+            if length.isdigit():
+                self.count, self.c_count = int(length), length
+            elif length in enums and enums[length].c_count:
+                self.count, self.c_count = len(enums[length].values), enums[length].c_count
+            else:
+                raise SystemExit(f"{SCHEMA}: field {self.name} is sized by {length}, not a number or a counted enum")
+            size, _, code, numpy = SCALARS[base]
+            self.size = size * self.count
+            self.struct = f"{self.count}{code}"
+            self.numpy = (numpy, (self.count,))
+            self.kind = base
+        elif kind in SCALARS:
+            self.size, _, self.struct, self.numpy = SCALARS[kind]
+            self.kind = kind
+        else:
+            raise SystemExit(f"{SCHEMA}: field {self.name} has unknown type {kind}")
+        if self.bounds is not None and len(self.bounds) != self.count - 1:
+            raise SystemExit(f"{SCHEMA}: field {self.name} needs one bound less than it has buckets")
+
+    @property
+    def c_decl(self):
+        if self.array:
+            return f"uint8_t {self.name}[{self.array}];"
+        if self.count:
+            return f"{SCALARS[self.kind][1]} {self.name}[{self.c_count}];"
+        return f"{SCALARS[self.kind][1]} {self.name};"
+
+    @property
+    def values(self):
+        """Number of values the field packs to in a struct format."""
+        return self.count or 1
+
+
+class Enum:
+    def __init__(self, name, spec):
+        self.name = name
+        self.doc = spec.get("doc", "")
+        self.c_type = spec.get("c_type", f"wire_{name}_t")
+        self.c_prefix = spec.get("c_prefix", f"WIRE_{name.upper()}_")
+        self.py_name = "".join(part.capitalize() for part in name.split("_"))
+        self.values = [(key, v["value"], v.get("doc", "")) for key, v in spec["values"].items()]
+        self.signed = [key for key, v in spec["values"].items() if v.get("signed")]
+        # Enums that size arrays end in a count member and number their values from 0
+        self.c_count = spec.get("c_count")
+        if self.c_count and [v for _, v, _ in self.values] != list(range(len(self.values))):
+            raise SystemExit(f"{SCHEMA}: enum {name} has a c_count, its values must run from 0 without gaps")
+
+    def c_name(self, key):
+        return self.c_prefix + key.upper()
+
+
+class Frame:
+    def __init__(self, name, spec, enums):
+        self.name = name
+        self.doc = spec.get("doc", "")
+        self.open = spec.get("open", False)
+        self.batch = spec.get("batch", False)
+        self.version = spec.get("version")
+        self.fields = [Field(f, enums) for f in spec["fields"]]
+        if self.batch and any(f.count for f in self.fields):
+            raise SystemExit(f"{SCHEMA}: batch frame {name} cannot hold arrays")
+        self.tag = None
+        if "tag" in spec:
+            enum_name, key = spec["tag"].split(".")
+            self.tag = (enums[enum_name], key)
+        offset = 1 if self.tag else 0
+        self.offsets = []
+        self.min_len = None
+        for f in self.fields:
+            if f.optional and self.min_len is None:
+                self.min_len = offset
+            elif not f.optional and self.min_len is not None:
+                raise SystemExit(f"{SCHEMA}: {name}.{f.name} follows an optional field")
+            self.offsets.append(offset)
+            offset += f.size
+        self.size = offset
+        self.py_name = "".join(part.capitalize() for part in name.split("_"))
+
+    @property
+    def macro(self):
+        return f"WIRE_{self.name.upper()}"
+
+    @property
+    def struct_format(self):
+        return "<" + ("B" if self.tag else "") + "".join(f.struct for f in self.fields)
+
+
+def load(path):
+    with open(path) as f:
+        schema = json.load(f)
+    enums = {name: Enum(name, spec) for name, spec in schema["enums"].items()}
+    frames = [Frame(name, spec, enums) for name, spec in schema["frames"].items()]
+    return schema.get("doc", ""), list(enums.values()), frames
+
+
+def put(field, buf, off, src):
+    """C statement writing one field at buf[off]."""
+    if field.count:
+        size = SCALARS[field.kind][0]
+        element = Field({"name": field.name, "type": field.kind}, {})
+        return (f"for (size_t i = 0; i < {field.c_count}; i++) {{\n"
+                f"        {put(element, buf, f'{off} + {size} * i' if size > 1 else f'{off} + i', f'{src}[i]')}\n"
+                f"    }}")
+    if field.array:
+        return f"memcpy(&{buf}[{off}], {src}, {field.array});"
+    cast = f"(uint{field.size * 8}_t)" if field.kind.startswith("i") else ""
+    if field.size == 1:
+        return f"{buf}[{off}] = {cast}{src};"
+    return f"wire_put_u{field.size * 8}(&{buf}[{off}], {cast}{src});"
+
+
+def get(field, buf, off, dst):
+    """C statement reading one field from buf[off]."""
+    if field.count:
+        size = SCALARS[field.kind][0]
+        element = Field({"name": field.name, "type": field.kind}, {})
+        return (f"for (size_t i = 0; i < {field.c_count}; i++) {{\n"
+                f"        {get(element, buf, f'{off} + {size} * i' if size > 1 else f'{off} + i', f'{dst}[i]')}\n"
+                f"    }}")
+    if field.array:
+        return f"memcpy({dst}, &{buf}[{off}], {field.array});"
+    cast = f"({SCALARS[field.kind][1]})" if field.kind.startswith("i") else ""
+    if field.size == 1:
+        return f"{dst} = {cast}{buf}[{off}];"
+    return f"{dst} = {cast}wire_get_u{field.size * 8}(&{buf}[{off}]);"
+
+
+def generate_c(doc, enums, frames):
+    out = []
+    w = out.append
+    w("/*")
+    w(" *")
+    w(" * Wire protocol, generated by tools/wire_gen.py from main/wire.json, do not edit")
+    w(" *")
+    for line in textwrap.wrap(doc, 72):
+        w(f" * {line}")
+    w(" *")
+    w(" */")
+    w("#pragma once")
+    w("")
+    w("#include <stdbool.h>")
+    w("#include <stddef.h>")
+    w("#include <stdint.h>")
+    w("#include <string.h>")
+    w("")
+    w("#ifdef __cplusplus")
+    w('extern "C" {')
+    w("#endif")
+    w("")
+    w("static inline void wire_put_u16(uint8_t *p, uint16_t v)")
+    w("{")
+    w("    p[0] = v & 0xFF;")
+    w("    p[1] = v >> 8;")
+    w("}")
+    w("")
+    w("static inline void wire_put_u32(uint8_t *p, uint32_t v)")
+    w("{")
+    w("    p[0] = v & 0xFF;")
+    w("    p[1] = (v >> 8) & 0xFF;")
+    w("    p[2] = (v >> 16) & 0xFF;")
+    w("    p[3] = v >> 24;")
+    w("}")
+    w("")
+    w("static inline uint16_t wire_get_u16(const uint8_t *p)")
+    w("{")
+    w("    return p[0] | (p[1] << 8);")
+    w("}")
+    w("")
+    w("static inline uint32_t wire_get_u32(const uint8_t *p)")
+    w("{")
+    w("    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);")
+    w("}")
+
+    for e in enums:
+        w("")
+        w(f"// {e.doc}")
+        w("typedef enum {")
+        width = max(len(e.c_name(k)) for k, _, _ in e.values) + 4
+        for key, value, vdoc in e.values:
+            line = f"    {e.c_name(key)} = 0x{value:02X},"
+            if vdoc:
+                line = f"{line:<{width + 11}}///< {vdoc}"
+            w(line)
+        if e.c_count:
+            w(f"    {e.c_count}")
+        w(f"}} {e.c_type};")
+
+    for fr in frames:
+        w("")
+        w(f"// {fr.name}: {fr.doc}")
+        w(f"#define {fr.macro}_LEN  {fr.size}")
+        if fr.min_len is not None:
+            w(f"#define {fr.macro}_MIN_LEN  {fr.min_len}   // Optional fields left out")
+        if fr.version is not None:
+            w(f"#define {fr.macro}_VERSION  {fr.version}")
+        for f in fr.fields:
+            if f.bounds is not None:
+                w(f"#define {fr.macro}_{f.name.upper()}_BOUNDS  {{ {', '.join(str(b) for b in f.bounds)} }}")
+        w("")
+        w("typedef struct {")
+        width = max(len(f.c_decl) for f in fr.fields) + 4
+        for f in fr.fields:
+            line = f"    {f.c_decl}"
+            if f.doc:
+                line = f"{line:<{width + 4}}///< {f.doc}"
+            w(line)
+        w(f"}} wire_{fr.name}_t;")
+
+        tag_enum, tag_key = fr.tag if fr.tag else (None, None)
+        w("")
+        w("/**")
+        w(f" * @brief Pack one {fr.name} frame" + (", the caller appends what follows" if fr.open else ""))
+        w(f" * @param buf Receives {fr.macro}_LEN bytes")
+        w(" * @param v Fields")
+        w(f" * @return {fr.macro}_LEN")
+        w(" */")
+        w(f"static inline size_t wire_pack_{fr.name}(uint8_t *buf, const wire_{fr.name}_t *v)")
+        w("{")
+        if fr.tag:
+            w(f"    buf[0] = {tag_enum.c_name(tag_key)};")
+        for f, off in zip(fr.fields, fr.offsets):
+            w(f"    {put(f, 'buf', off, f'v->{f.name}')}")
+        w(f"    return {fr.macro}_LEN;")
+        w("}")
+        w("")
+        w("/**")
+        w(f" * @brief Unpack one {fr.name} frame" + ("; optional fields left out read as 0" if fr.min_len is not None else ""))
+        w(" * @param buf Received bytes")
+        w(" * @param len Received length")
+        w(" * @param v Receives the fields")
+        w(f" * @return true if buf holds a {fr.name} frame")
+        w(" */")
+        w(f"static inline bool wire_unpack_{fr.name}(const uint8_t *buf, size_t len, wire_{fr.name}_t *v)")
+        w("{")
+        min_len = f"{fr.macro}_MIN_LEN" if fr.min_len is not None else f"{fr.macro}_LEN"
+        checks = [f"len < {min_len}"]
+        if not fr.open and not fr.batch:
+            checks.append(f"len > {fr.macro}_LEN")
+        if fr.tag:
+            checks.append(f"buf[0] != {tag_enum.c_name(tag_key)}")
+        w(f"    if ({' || '.join(checks)}) {{")
+        w("        return false;")
+        w("    }")
+        if fr.min_len is not None:
+            w("    memset(v, 0, sizeof(*v));")
+        for f, off in zip(fr.fields, fr.offsets):
+            stmt = get(f, "buf", off, f"v->{f.name}")
+            if f.optional:
+                w(f"    if (len >= {off + f.size}) {{")
+                w(f"        {stmt}")
+                w("    }")
+            else:
+                w(f"    {stmt}")
+        w("    return true;")
+        w("}")
+
+    w("")
+    w("#ifdef __cplusplus")
+    w("}")
+    w("#endif")
+    return "\n".join(out) + "\n"
+
+
+def generate_py(doc, enums, frames):
+    out = []
+    w = out.append
+    w('"""Wire protocol, generated by tools/wire_gen.py from main/wire.json, do not edit.')
+    w("")
+    out.extend(textwrap.wrap(doc, 100))
+    w('"""')
+    w("import enum")
+    w("import struct")
+    w("from collections import namedtuple")
+    w("")
+    w("try:")
+    w("    import numpy as np")
+    w("except ImportError:  # Batch decoders fall back to struct.iter_unpack")
+    w("    np = None")
+    for e in enums:
+        w("")
+        w("")
+        w(f"class {e.py_name}(enum.IntEnum):")
+        w(f'    """{e.doc}"""')
+        for key, value, vdoc in e.values:
+            line = f"    {key.upper()} = 0x{value:02X}"
+            w(f"{line:<34}# {vdoc}" if vdoc else line)
+        if e.signed:
+            w("")
+            w("")
+            w(f"# {e.py_name} values that carry a two's complement number")
+            w(f"{e.name.upper()}_SIGNED = frozenset({{{', '.join(f'{e.py_name}.{k.upper()}' for k in e.signed)}}})")
+
+    for fr in frames:
+        names = [f.name for f in fr.fields]
+        const = fr.name.upper()
+        w("")
+        w("")
+        w(f"# {fr.name}: {fr.doc}")
+        w(f'{const} = struct.Struct("{fr.struct_format}")')
+        if fr.min_len is not None:
+            w(f"{const}_MIN_LEN = {fr.min_len}")
+        if fr.version is not None:
+            w(f"{const}_VERSION = {fr.version}")
+        for f in fr.fields:
+            if f.bounds is not None:
+                w(f"{const}_{f.name.upper()}_BOUNDS = ({', '.join(str(b) for b in f.bounds)})")
+        w(f'{fr.py_name} = namedtuple("{fr.py_name}", "{" ".join(names)}")')
+        if fr.batch:
+            dtype = ", ".join(f'("{f.name}", "{f.numpy[0]}", {f.numpy[1]})' if f.count else f'("{f.name}", "{f.numpy}")'
+                              for f in fr.fields)
+            w(f"{const}_DTYPE = np.dtype([{dtype}]) if np else None")
+        w("")
+        w("")
+        params = ", ".join(f"{f.name}=0" if f.optional else f.name for f in fr.fields)
+        values = ", ".join(([f"{fr.tag[0].py_name}.{fr.tag[1].upper()}"] if fr.tag else []) +
+                           [f"*{f.name}" if f.count else f.name for f in fr.fields])
+        w(f"def pack_{fr.name}({params}):")
+        w(f'    """Pack one {fr.name} frame' + (', the caller appends what follows."""' if fr.open else '."""'))
+        w(f"    return {const}.pack({values})")
+        w("")
+        w("")
+        w(f"def decode_{fr.name}(buf, offset=0):")
+        w(f'    """Decode one {fr.name} frame from any buffer without copying it; ValueError if it is not one."""')
+        if fr.min_len is not None:
+            w(f"    if len(buf) - offset < {const}_MIN_LEN:")
+            w(f'        raise ValueError("short {fr.name}")')
+            w(f"    if len(buf) - offset < {const}.size:")
+            w("        # Optional fields left out read as 0")
+            w(f"        buf = bytes(memoryview(buf)[offset:offset + {const}.size]).ljust({const}.size, b\"\\0\")")
+            w("        offset = 0")
+        else:
+            w(f"    if len(buf) - offset < {const}.size:")
+            w(f'        raise ValueError("short {fr.name}")')
+        if fr.tag:
+            tag = f"{fr.tag[0].py_name}.{fr.tag[1].upper()}"
+            w(f"    tag, *fields = {const}.unpack_from(buf, offset)")
+            w(f"    if tag != {tag}:")
+            w(f'        raise ValueError(f"not a {fr.name}: 0x{{tag:02x}}")')
+        if any(f.count for f in fr.fields):
+            # Arrays unpack into consecutive values, gather each back into a tuple
+            if not fr.tag:
+                w(f"    fields = {const}.unpack_from(buf, offset)")
+            parts = []
+            index = 0
+            for f in fr.fields:
+                parts.append(f"tuple(fields[{index}:{index + f.count}])" if f.count else f"fields[{index}]")
+                index += f.values
+            w(f"    return {fr.py_name}(")
+            for part in parts:
+                w(f"        {part},")
+            w("    )")
+        elif fr.tag:
+            w(f"    return {fr.py_name}(*fields)")
+        else:
+            w(f"    return {fr.py_name}._make({const}.unpack_from(buf, offset))")
+        if fr.batch:
+            w("")
+            w("")
+            w(f"def decode_{fr.name}_batch(buf, count, offset=0):")
+            w(f'    """Decode count consecutive {fr.name} records: a NumPy structured array viewing buf,')
+            w(f'    or a list of {fr.py_name} without NumPy."""')
+            w(f"    end = offset + count * {const}.size")
+            w("    if len(buf) < end:")
+            w(f'        raise ValueError("short {fr.name} batch")')
+            w("    if np:")
+            w(f"        return np.frombuffer(buf, {const}_DTYPE, count, offset)")
+            w(f"    return [{fr.py_name}._make(t) for t in {const}.iter_unpack(memoryview(buf)[offset:end])]")
+    return "\n".join(out) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate main/wire.h and wire.py from main/wire.json")
+    parser.add_argument("--check", action="store_true", help="only report outputs that are out of date")
+    args = parser.parse_args()
+
+    doc, enums, frames = load(SCHEMA)
+    outputs = {C_OUT: generate_c(doc, enums, frames), PY_OUT: generate_py(doc, enums, frames)}
+    stale = []
+    for path, text in outputs.items():
+        current = None
+        if os.path.exists(path):
+            with open(path) as f:
+                current = f.read()
+        if current == text:
+            continue
+        stale.append(os.path.relpath(path, ROOT))
+        if not args.check:
+            with open(path, "w") as f:
+                f.write(text)
+
+    if args.check and stale:
+        print(f"{', '.join(stale)} out of date with main/wire.json, run tools/wire_gen.py", file=sys.stderr)
+        return 1
+    for path in stale:
+        print(f"wrote {path}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
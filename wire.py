@@ -0,0 +1,371 @@
+"""Wire protocol, generated by tools/wire_gen.py from main/wire.json, do not edit.
+
+Frames on the zone characteristic, the statistics, rules and zone statistics characteristics, the
+OTA control characteristic and the L2CAP stream channel. Multi-byte fields are little-endian.
+Regenerate main/wire.h and wire.py with tools/wire_gen.py after any change.
+"""
+import enum
+import struct
+from collections import namedtuple
+
+try:
+    import numpy as np
+except ImportError:  # Batch decoders fall back to struct.iter_unpack
+    np = None
+
+
+class Frame(enum.IntEnum):
+    """First byte of every zone characteristic notification and stream channel SDU"""
+    ZONE_RED = 0x01               # Position entered the red zone, strap loose
+    ZONE_GREEN = 0x02             # Position entered the green zone, strap tight
+    ZONE_YELLOW = 0x03            # Position entered the yellow zone
+    ZERO_SET = 0x04               # Zero point set by the button in calibration mode
+    SIGNAL_DEGRADED = 0x05        # Encoder signal quality crossed a limit
+    SIGNAL_RECOVERED = 0x06       # Encoder signal back within the limits
+    CAPTURE_SAMPLES = 0x20        # Batch of capture samples, stream channel only
+    RULE_ALERT = 0x30             # A rule of the loaded rules program matched
+    BENCH = 0x7F                  # Throughput benchmark request and packets
+
+
+class OtaMessage(enum.IntEnum):
+    """Messages on the OTA control characteristic"""
+    CMD_BEGIN = 0x01              # Start a transfer, replied with its status
+    CMD_END = 0x02                # Verify and switch to the new image, replied with its status
+    CMD_ABORT = 0x03              # Discard the transfer, also the reply to a transfer that failed
+    MSG_ACK = 0x10                # Bytes written to flash so far
+
+
+class OtaStatus(enum.IntEnum):
+    """Status in an OTA reply"""
+    OK = 0x00
+    BUSY = 0x01                   # BEGIN while a transfer is running
+    INVALID = 0x02                # Malformed message or no transfer running
+    FLASH_ERROR = 0x03            # Partition could not be opened, written or selected
+    SIZE_MISMATCH = 0x04          # More or fewer bytes than announced
+    HASH_MISMATCH = 0x05          # SHA-256 of the received image differs
+    OVERFLOW = 0x06               # Sender exceeded the window
+    ABORTED = 0x07                # Aborted by the sender or a disconnect
+
+
+class RuleOp(enum.IntEnum):
+    """Rules program opcodes, operands follow the opcode little-endian"""
+    PUSH8 = 0x01                  # Push an i8 operand
+    PUSH16 = 0x02                 # Push an i16 operand
+    PUSH32 = 0x03                 # Push an i32 operand
+    ZONE = 0x10                   # Push the zone as its frame code
+    POSITION = 0x11               # Push the position in detents
+    ZONE_MS = 0x12                # Push the time in the current zone in ms
+    CALIB_MS = 0x13               # Push the time since the last zero set in ms, INT32_MAX before one
+    CALIBRATING = 0x14            # Push 1 in calibration mode, else 0
+    DELTA = 0x15                  # Push the position change over a u8 operand of history ticks
+    ADD = 0x20
+    SUB = 0x21
+    NEG = 0x22
+    ABS = 0x23
+    EQ = 0x30
+    NE = 0x31
+    LT = 0x32
+    LE = 0x33
+    GT = 0x34
+    GE = 0x35
+    AND = 0x38
+    OR = 0x39
+    NOT = 0x3A
+    HELD = 0x40                   # Pop a condition, push 1 once it held for a u16 operand of ticks, u8 timer index first
+    ALERT = 0x50                  # Pop a condition and end the rule, alert with a u8 operand code when it becomes true
+
+
+class BenchTransport(enum.IntEnum):
+    """Where a benchmark sends its packets"""
+    GATT = 0x00                   # Notifications on the zone characteristic
+    L2CAP = 0x01                  # SDUs on the L2CAP stream channel
+
+
+class StatsCounter(enum.IntEnum):
+    """Counters in the statistics frame"""
+    ENCODER_EVENTS = 0x00         # Events received from the encoder queue
+    QUEUE_OVERFLOWS = 0x01        # Events that skipped positions, i.e. steps lost to a full queue
+    ZONE_TRANSITIONS = 0x02       # Zone changes seen by the zone logic
+    NOTIFY_SENT = 0x03            # Notifications accepted by the stack
+    NOTIFY_FAILED = 0x04          # Notifications rejected by the stack
+    NOTIFY_SUPPRESSED = 0x05      # Notifications dropped because no client was subscribed
+    GATT_READS = 0x06             # Read requests handled by the application
+    GATT_WRITES = 0x07            # Write requests handled by the application
+    CONNECTIONS = 0x08            # Centrals connected
+    DISCONNECTS = 0x09            # Centrals disconnected, see disconnect reasons
+    LED_WRITES = 0x0A             # LEDC duty writes, sampled from the LED module
+    RECOVERIES = 0x0B             # In-place subsystem restarts by the health monitor
+    SIGNAL_ILLEGAL = 0x0C         # Illegal A/B transitions, sampled from the encoder driver
+    SIGNAL_GLITCHES = 0x0D        # A/B pulses shorter than the glitch width, sampled from the encoder driver
+    SIGNAL_REVERSALS = 0x0E       # Step direction reversals, sampled from the encoder driver
+    SIGNAL_DEGRADED = 0x0F        # 1 while the encoder signal is flagged as degraded
+    ENCODER_ISR_RAW = 0x10        # Encoder interrupts taken, after any hardware glitch filter
+    ENCODER_ISR_ACCEPTED = 0x11   # Step events queued through the minimum edge interval gate
+    AUTH_COMPLETE = 0x12          # Links encrypted, by pairing or from stored bond keys
+    AUTH_FAILED = 0x13            # Pairing or re-encryption failures
+    BLE_HEAP_BYTES = 0x14         # Heap taken by bringing up the BT controller and host stack
+    BOOT_TO_ADV_MS = 0x15         # Time from boot to the first advertisement, milliseconds
+    BENCH_BYTES_PER_S = 0x16      # Notification payload throughput of the last benchmark run
+    PHY = 0x17                    # Transmit PHY of the link: 1 = 1M, 2 = 2M, 3 = Coded, 0 when disconnected
+    PHY_UPDATES = 0x18            # PHY changes reported by the controller
+    RSSI = 0x19                   # Averaged connection RSSI in dBm, two's complement, 0 when disconnected
+    TX_POWER_DBM = 0x1A           # Connection TX power in dBm, two's complement
+    TX_POWER_STEPS_DOWN = 0x1B    # TX power reductions made by the power control loop
+    TX_POWER_STEPS_UP = 0x1C      # TX power increases made by the power control loop
+    ENCODER_RESOLUTION = 0x1D     # Steps per detent cycle: 1, 2 or 4
+    ENCODER_ISR_MAX_CYCLES = 0x1E # Most CPU cycles one edge took to decode, since the last resolution change
+    ENCODER_MAX_EDGE_RATE = 0x1F  # Edges per second the decode path sustains at that cost, before interrupt overhead
+    CAPTURE_FRAMES = 0x20         # Capture frames sent on the L2CAP stream channel
+    CAPTURE_DROPPED = 0x21        # Capture frames dropped while the central had no credits
+    RULE_ALERTS = 0x22            # Alerts fired by the rules program
+
+
+# StatsCounter values that carry a two's complement number
+STATS_COUNTER_SIGNED = frozenset({StatsCounter.RSSI, StatsCounter.TX_POWER_DBM})
+
+
+class StatsDisconnect(enum.IntEnum):
+    """Disconnect reason buckets in the statistics frame, by HCI reason code"""
+    TIMEOUT = 0x00                # 0x08 supervision timeout
+    REMOTE = 0x01                 # 0x13 remote user terminated
+    LOCAL = 0x02                  # 0x16 terminated by local host
+    FAILED = 0x03                 # 0x3E failed to be established
+    OTHER = 0x04                  # Any other reason
+
+
+# bench_request: Written to the zone characteristic to start a benchmark
+BENCH_REQUEST = struct.Struct("<BHBB")
+BENCH_REQUEST_MIN_LEN = 3
+BenchRequest = namedtuple("BenchRequest", "count phy transport")
+
+
+def pack_bench_request(count, phy=0, transport=0):
+    """Pack one bench_request frame."""
+    return BENCH_REQUEST.pack(Frame.BENCH, count, phy, transport)
+
+
+def decode_bench_request(buf, offset=0):
+    """Decode one bench_request frame from any buffer without copying it; ValueError if it is not one."""
+    if len(buf) - offset < BENCH_REQUEST_MIN_LEN:
+        raise ValueError("short bench_request")
+    if len(buf) - offset < BENCH_REQUEST.size:
+        # Optional fields left out read as 0
+        buf = bytes(memoryview(buf)[offset:offset + BENCH_REQUEST.size]).ljust(BENCH_REQUEST.size, b"\0")
+        offset = 0
+    tag, *fields = BENCH_REQUEST.unpack_from(buf, offset)
+    if tag != Frame.BENCH:
+        raise ValueError(f"not a bench_request: 0x{tag:02x}")
+    return BenchRequest(*fields)
+
+
+# bench_packet: One benchmark packet, padding to the payload size of the link follows
+BENCH_PACKET = struct.Struct("<BH")
+BenchPacket = namedtuple("BenchPacket", "sequence")
+
+
+def pack_bench_packet(sequence):
+    """Pack one bench_packet frame, the caller appends what follows."""
+    return BENCH_PACKET.pack(Frame.BENCH, sequence)
+
+
+def decode_bench_packet(buf, offset=0):
+    """Decode one bench_packet frame from any buffer without copying it; ValueError if it is not one."""
+    if len(buf) - offset < BENCH_PACKET.size:
+        raise ValueError("short bench_packet")
+    tag, *fields = BENCH_PACKET.unpack_from(buf, offset)
+    if tag != Frame.BENCH:
+        raise ValueError(f"not a bench_packet: 0x{tag:02x}")
+    return BenchPacket(*fields)
+
+
+# capture_header: Start of a capture frame, followed by count capture_sample records
+CAPTURE_HEADER = struct.Struct("<BBHI")
+CaptureHeader = namedtuple("CaptureHeader", "count sequence timestamp_hz")
+
+
+def pack_capture_header(count, sequence, timestamp_hz):
+    """Pack one capture_header frame, the caller appends what follows."""
+    return CAPTURE_HEADER.pack(Frame.CAPTURE_SAMPLES, count, sequence, timestamp_hz)
+
+
+def decode_capture_header(buf, offset=0):
+    """Decode one capture_header frame from any buffer without copying it; ValueError if it is not one."""
+    if len(buf) - offset < CAPTURE_HEADER.size:
+        raise ValueError("short capture_header")
+    tag, *fields = CAPTURE_HEADER.unpack_from(buf, offset)
+    if tag != Frame.CAPTURE_SAMPLES:
+        raise ValueError(f"not a capture_header: 0x{tag:02x}")
+    return CaptureHeader(*fields)
+
+
+# capture_sample: One encoder step in a capture frame
+CAPTURE_SAMPLE = struct.Struct("<IiI")
+CaptureSample = namedtuple("CaptureSample", "timestamp position interval")
+CAPTURE_SAMPLE_DTYPE = np.dtype([("timestamp", "<u4"), ("position", "<i4"), ("interval", "<u4")]) if np else None
+
+
+def pack_capture_sample(timestamp, position, interval):
+    """Pack one capture_sample frame."""
+    return CAPTURE_SAMPLE.pack(timestamp, position, interval)
+
+
+def decode_capture_sample(buf, offset=0):
+    """Decode one capture_sample frame from any buffer without copying it; ValueError if it is not one."""
+    if len(buf) - offset < CAPTURE_SAMPLE.size:
+        raise ValueError("short capture_sample")
+    return CaptureSample._make(CAPTURE_SAMPLE.unpack_from(buf, offset))
+
+
+def decode_capture_sample_batch(buf, count, offset=0):
+    """Decode count consecutive capture_sample records: a NumPy structured array viewing buf,
+    or a list of CaptureSample without NumPy."""
+    end = offset + count * CAPTURE_SAMPLE.size
+    if len(buf) < end:
+        raise ValueError("short capture_sample batch")
+    if np:
+        return np.frombuffer(buf, CAPTURE_SAMPLE_DTYPE, count, offset)
+    return [CaptureSample._make(t) for t in CAPTURE_SAMPLE.iter_unpack(memoryview(buf)[offset:end])]
+
+
+# rules_header: Start of a rules program written to the rules characteristic, followed by the code
+RULES_HEADER = struct.Struct("<BBB")
+RulesHeader = namedtuple("RulesHeader", "version rules timers")
+
+
+def pack_rules_header(version, rules, timers):
+    """Pack one rules_header frame, the caller appends what follows."""
+    return RULES_HEADER.pack(version, rules, timers)
+
+
+def decode_rules_header(buf, offset=0):
+    """Decode one rules_header frame from any buffer without copying it; ValueError if it is not one."""
+    if len(buf) - offset < RULES_HEADER.size:
+        raise ValueError("short rules_header")
+    return RulesHeader._make(RULES_HEADER.unpack_from(buf, offset))
+
+
+# rule_alert: Notified on the zone characteristic when a rule matches
+RULE_ALERT = struct.Struct("<BBB")
+RuleAlert = namedtuple("RuleAlert", "rule code")
+
+
+def pack_rule_alert(rule, code):
+    """Pack one rule_alert frame."""
+    return RULE_ALERT.pack(Frame.RULE_ALERT, rule, code)
+
+
+def decode_rule_alert(buf, offset=0):
+    """Decode one rule_alert frame from any buffer without copying it; ValueError if it is not one."""
+    if len(buf) - offset < RULE_ALERT.size:
+        raise ValueError("short rule_alert")
+    tag, *fields = RULE_ALERT.unpack_from(buf, offset)
+    if tag != Frame.RULE_ALERT:
+        raise ValueError(f"not a rule_alert: 0x{tag:02x}")
+    return RuleAlert(*fields)
+
+
+# zone_stats: Read from the zone statistics characteristic, totals since power-on or the last clear
+ZONE_STATS = struct.Struct("<IIIIIIIiiB")
+ZoneStats = namedtuple("ZoneStats", "covered_s red_dwell_s green_dwell_s yellow_dwell_s red_entries green_entries yellow_entries min_position max_position zone")
+
+
+def pack_zone_stats(covered_s, red_dwell_s, green_dwell_s, yellow_dwell_s, red_entries, green_entries, yellow_entries, min_position, max_position, zone):
+    """Pack one zone_stats frame."""
+    return ZONE_STATS.pack(covered_s, red_dwell_s, green_dwell_s, yellow_dwell_s, red_entries, green_entries, yellow_entries, min_position, max_position, zone)
+
+
+def decode_zone_stats(buf, offset=0):
+    """Decode one zone_stats frame from any buffer without copying it; ValueError if it is not one."""
+    if len(buf) - offset < ZONE_STATS.size:
+        raise ValueError("short zone_stats")
+    return ZoneStats._make(ZONE_STATS.unpack_from(buf, offset))
+
+
+# ota_begin: Written to the OTA control characteristic to start a transfer
+OTA_BEGIN = struct.Struct("<BI32s")
+OtaBegin = namedtuple("OtaBegin", "size sha256")
+
+
+def pack_ota_begin(size, sha256):
+    """Pack one ota_begin frame."""
+    return OTA_BEGIN.pack(OtaMessage.CMD_BEGIN, size, sha256)
+
+
+def decode_ota_begin(buf, offset=0):
+    """Decode one ota_begin frame from any buffer without copying it; ValueError if it is not one."""
+    if len(buf) - offset < OTA_BEGIN.size:
+        raise ValueError("short ota_begin")
+    tag, *fields = OTA_BEGIN.unpack_from(buf, offset)
+    if tag != OtaMessage.CMD_BEGIN:
+        raise ValueError(f"not a ota_begin: 0x{tag:02x}")
+    return OtaBegin(*fields)
+
+
+# ota_reply: Notified on the OTA control characteristic in answer to a command
+OTA_REPLY = struct.Struct("<BB")
+OtaReply = namedtuple("OtaReply", "message status")
+
+
+def pack_ota_reply(message, status):
+    """Pack one ota_reply frame."""
+    return OTA_REPLY.pack(message, status)
+
+
+def decode_ota_reply(buf, offset=0):
+    """Decode one ota_reply frame from any buffer without copying it; ValueError if it is not one."""
+    if len(buf) - offset < OTA_REPLY.size:
+        raise ValueError("short ota_reply")
+    return OtaReply._make(OTA_REPLY.unpack_from(buf, offset))
+
+
+# ota_ack: Notified on the OTA control characteristic as image data reaches flash
+OTA_ACK = struct.Struct("<BI")
+OtaAck = namedtuple("OtaAck", "written")
+
+
+def pack_ota_ack(written):
+    """Pack one ota_ack frame."""
+    return OTA_ACK.pack(OtaMessage.MSG_ACK, written)
+
+
+def decode_ota_ack(buf, offset=0):
+    """Decode one ota_ack frame from any buffer without copying it; ValueError if it is not one."""
+    if len(buf) - offset < OTA_ACK.size:
+        raise ValueError("short ota_ack")
+    tag, *fields = OTA_ACK.unpack_from(buf, offset)
+    if tag != OtaMessage.MSG_ACK:
+        raise ValueError(f"not a ota_ack: 0x{tag:02x}")
+    return OtaAck(*fields)
+
+
+# stats: Read from the statistics characteristic. Counters are totals since boot unless their doc says they are sampled; histogram buckets count samples up to each bound, the last one everything above
+STATS = struct.Struct("<BBBBI35I5I8I8I8I")
+STATS_VERSION = 2
+STATS_NOTIFY_LATENCY_US_BOUNDS = (1000, 2000, 5000, 10000, 20000, 50000, 100000)
+STATS_LOOP_TIME_US_BOUNDS = (50, 100, 250, 500, 1000, 2500, 5000)
+STATS_ENCRYPT_LATENCY_US_BOUNDS = (20000, 50000, 100000, 200000, 500000, 1000000, 2000000)
+Stats = namedtuple("Stats", "version counter_count disconnect_count bucket_count uptime_s counters disconnect_reasons notify_latency_us loop_time_us encrypt_latency_us")
+
+
+def pack_stats(version, counter_count, disconnect_count, bucket_count, uptime_s, counters, disconnect_reasons, notify_latency_us, loop_time_us, encrypt_latency_us):
+    """Pack one stats frame."""
+    return STATS.pack(version, counter_count, disconnect_count, bucket_count, uptime_s, *counters, *disconnect_reasons, *notify_latency_us, *loop_time_us, *encrypt_latency_us)
+
+
+def decode_stats(buf, offset=0):
+    """Decode one stats frame from any buffer without copying it; ValueError if it is not one."""
+    if len(buf) - offset < STATS.size:
+        raise ValueError("short stats")
+    fields = STATS.unpack_from(buf, offset)
+    return Stats(
+        fields[0],
+        fields[1],
+        fields[2],
+        fields[3],
+        fields[4],
+        tuple(fields[5:40]),
+        tuple(fields[40:45]),
+        tuple(fields[45:53]),
+        tuple(fields[53:61]),
+        tuple(fields[61:69]),
+    )